@@ -22,6 +22,7 @@
 #include <boost/program_options.hpp>
 #include <boost/iostreams/copy.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 #include <camoto/gamegraphics.hpp>
 #include <camoto/gamemaps.hpp>
 #include <camoto/util.hpp>
@@ -55,15 +56,6 @@ namespace stream = camoto::stream;
 #define __STRING(x) #x
 #endif
 
-/// Place to cache tiles when rendering a map to a .png file
-struct CachedTile {
-	unsigned int code;
-	gg::StdImageDataPtr data;
-	gg::StdImageDataPtr mask;
-	unsigned int width;
-	unsigned int height;
-};
-
 /// Open a tileset.
 /**
  * @param filename
@@ -166,6 +158,9 @@ finishTesting:
  * Convert the given map into a PNG file on disk, by rendering the map as it
  * would appear in the game.
  *
+ * @param renderer
+ *   Renderer to draw the map with.
+ *
  * @param map
  *   Map file to export.
  *
@@ -175,171 +170,39 @@ finishTesting:
  * @param destFile
  *   Filename of destination (including ".png")
  *
+ * @param threads
+ *   Number of threads to draw the map with.
+ *
  * @throw stream::error on error
  */
-void map2dToPng(gm::Map2DPtr map, const gm::TilesetCollectionPtr& allTilesets,
-	const std::string& destFile)
+void map2dToPng(gm::Map2DRenderer& renderer, gm::Map2DPtr map,
+	const gm::TilesetCollectionPtr& allTilesets, const std::string& destFile,
+	unsigned int threads)
 {
-	unsigned int outWidth, outHeight; // in pixels
-	unsigned int globalTileWidth, globalTileHeight;
-	map->getTileSize(&globalTileWidth, &globalTileHeight);
-	map->getMapSize(&outWidth, &outHeight);
-	outWidth *= globalTileWidth;
-	outHeight *= globalTileHeight;
-
-	png::image<png::index_pixel> png(outWidth, outHeight);
-
-	bool useMask;
-	gg::PaletteTablePtr srcPal;
-	for (gm::TilesetCollection::const_iterator
-		i = allTilesets->begin(); i != allTilesets->end(); i++
-	) {
-		if (i->second->getCaps() & gg::Tileset::HasPalette) {
-			srcPal = i->second->getPalette();
-			break;
-		}
-	}
-	if (!srcPal) {
-		srcPal = gg::createPalette_DefaultVGA();
-		// Force last colour to be transparent
-		srcPal->at(255).red = 255;
-		srcPal->at(255).green = 0;
-		srcPal->at(255).blue = 192;
-		srcPal->at(255).alpha = 0;
-	}
-	png::palette pal(srcPal->size());
+	gm::RenderedMap image;
+	renderer.render(map, allTilesets, &image, threads);
+
+	png::image<png::index_pixel> png(image.width, image.height);
+
+	png::palette pal(image.palette->size());
 	int j = 0;
 	png::tRNS transparency;
 	for (gg::PaletteTable::iterator
-		i = srcPal->begin(); i != srcPal->end(); i++, j++
+		i = image.palette->begin(); i != image.palette->end(); i++, j++
 	) {
 		pal[j] = png::color(i->red, i->green, i->blue);
 		if (i->alpha == 0) transparency.push_back(j);
 	}
-	useMask = srcPal->size() < 255; // only mask if enough room in the palette
-	if (useMask) {
-		// Increment any transparent indices because we're going to insert a new
-		// colour for transparency
-		for (png::tRNS::iterator i = transparency.begin(); i != transparency.end(); i++) {
-			(*i)++;
-		}
-		// Make first colour transparent
-		pal.insert(pal.begin(), png::color(255, 0, 192));
-		transparency.insert(transparency.begin(), 0);
-	}
 	png.set_palette(pal);
 	if (transparency.size() > 0) {
 		png.set_tRNS(transparency);
 	}
 
-	unsigned int layerCount = map->getLayerCount();
-	for (unsigned int layerIndex = 0; layerIndex < layerCount; layerIndex++) {
-		gm::Map2D::LayerPtr layer = map->getLayer(layerIndex);
-
-		// Figure out the layer size (in tiles) and the tile size
-		unsigned int layerWidth, layerHeight, tileWidth, tileHeight;
-		getLayerDims(map, layer, &layerWidth, &layerHeight, &tileWidth, &tileHeight);
-
-		// Prepare tileset
-		std::vector<CachedTile> cache;
-
-		// Run through all items in the layer and render them one by one
-		const gm::Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-		for (gm::Map2D::Layer::ItemPtrVector::const_iterator t = items->begin();
-			t != items->end(); t++
-		) {
-			CachedTile thisTile;
-			unsigned int tileCode = (*t)->code;
-
-			// Find the cached tile
-			bool found = false;
-			for (std::vector<CachedTile>::iterator ct = cache.begin();
-				ct != cache.end(); ct++
-			) {
-				if (ct->code == tileCode) {
-					thisTile = *ct;
-					found = true;
-					break;
-				}
-			}
-			if (!found) {
-				// Tile hasn't been cached yet, load it from the tileset
-				gg::ImagePtr img;
-				gm::Map2D::Layer::ImageType imgType;
-				try {
-					imgType = layer->imageFromCode(*t, allTilesets, &img);
-				} catch (const std::exception& e) {
-					std::cerr << "Error loading image: " << e.what() << std::endl;
-					imgType = gm::Map2D::Layer::Unknown;
-				}
-				switch (imgType) {
-					case gm::Map2D::Layer::Supplied:
-						assert(img);
-						thisTile.data = img->toStandard();
-						thisTile.mask = img->toStandardMask();
-						img->getDimensions(&thisTile.width, &thisTile.height);
-						thisTile.code = tileCode;
-						break;
-					case gm::Map2D::Layer::Blank:
-						thisTile.width = thisTile.height = 0;
-						break;
-					case gm::Map2D::Layer::Unknown:
-					case gm::Map2D::Layer::Digit0:
-					case gm::Map2D::Layer::Digit1:
-					case gm::Map2D::Layer::Digit2:
-					case gm::Map2D::Layer::Digit3:
-					case gm::Map2D::Layer::Digit4:
-					case gm::Map2D::Layer::Digit5:
-					case gm::Map2D::Layer::Digit6:
-					case gm::Map2D::Layer::Digit7:
-					case gm::Map2D::Layer::Digit8:
-					case gm::Map2D::Layer::Digit9:
-					case gm::Map2D::Layer::DigitA:
-					case gm::Map2D::Layer::DigitB:
-					case gm::Map2D::Layer::DigitC:
-					case gm::Map2D::Layer::DigitD:
-					case gm::Map2D::Layer::DigitE:
-					case gm::Map2D::Layer::DigitF:
-					case gm::Map2D::Layer::Interactive:
-						// Display nothing, but could be changed to a question mark
-						thisTile.width = thisTile.height = 0;
-						break;
-
-					// Avoid compiler warning about unhandled enum
-					case gm::Map2D::Layer::NumImageTypes:
-						assert(imgType != gm::Map2D::Layer::NumImageTypes);
-				}
-				cache.push_back(thisTile);
-			}
-
-			if (!thisTile.data) continue; // no image
-
-			// Draw tile onto png
-			unsigned int offX = (*t)->x * tileWidth;
-			unsigned int offY = (*t)->y * tileHeight;
-			for (unsigned int tY = 0; tY < thisTile.height; tY++) {
-				unsigned int pngY = offY+tY;
-				if (pngY >= outHeight) break; // don't write past image edge
-				for (unsigned int tX = 0; tX < thisTile.width; tX++) {
-					unsigned int pngX = offX+tX;
-					if (pngX >= outWidth) break; // don't write past image edge
-					//png[offY + tY][offX + tX] = png::index_pixel(((*t)->code % 16) + 1);
-					// Only write opaque pixels
-					if (((thisTile.mask[tY*thisTile.width+tX] & 0x01) == 0) ||
-						((!useMask) && (layerIndex == 0))
-					) {
-						png[pngY][pngX] =
-							// +1 to the colour to skip over transparent (#0)
-							png::index_pixel(thisTile.data[tY*thisTile.width+tX] + (useMask ? 1 : 0));
-					} else {
-						if (layerIndex == 0) {
-							assert(useMask); // just to be sure my logic is right!
-							png[pngY][pngX] = png::index_pixel(0);
-						} // else let higher layers see through to lower ones
-					}
-				}
-			}
-		} // else layer is empty
+	const uint8_t *pixel = image.pixels.empty() ? NULL : &image.pixels[0];
+	for (unsigned int y = 0; y < image.height; y++) {
+		for (unsigned int x = 0; x < image.width; x++) {
+			png[y][x] = png::index_pixel(*pixel++);
+		}
 	}
 
 	png.write(destFile);
@@ -379,6 +242,8 @@ int main(int iArgC, char *cArgV[])
 			"specify format of file passed with --graphics")
 		("script,s",
 			"format output suitable for script parsing")
+		("threads,j", po::value<unsigned int>(),
+			"number of threads to use with --render (default is one per CPU)")
 		("force,f",
 			"force open even if the map is not in the given format")
 		("list-types",
@@ -404,6 +269,10 @@ int main(int iArgC, char *cArgV[])
 	// Get the format handler for this file format
 	gm::ManagerPtr pManager(gm::getManager());
 
+	// Reused for every map rendered, so each tile image is only loaded once
+	gm::Map2DRenderer renderer;
+	unsigned int threads = boost::thread::hardware_concurrency();
+
 	bool bScript = false; // show output suitable for script parsing?
 	bool bForceOpen = false; // open anyway even if map not in given format?
 	int iRet = RET_OK;
@@ -455,6 +324,19 @@ int main(int iArgC, char *cArgV[])
 				(i->string_key.compare("script") == 0)
 			) {
 				bScript = true;
+			} else if (
+				(i->string_key.compare("j") == 0) ||
+				(i->string_key.compare("threads") == 0)
+			) {
+				// Convert with the option's own type, so bad values are reported.
+				// Negative numbers would otherwise wrap around.
+				if (i->value[0].find('-') != std::string::npos) {
+					throw po::invalid_option_value(i->value[0]);
+				}
+				boost::any value;
+				poOptions.find("threads", false).semantic()->parse(value, i->value,
+					true);
+				threads = boost::any_cast<unsigned int>(value);
 			} else if (
 				(i->string_key.compare("f") == 0) ||
 				(i->string_key.compare("force") == 0)
@@ -520,78 +402,42 @@ int main(int iArgC, char *cArgV[])
 		std::cout << "Opening " << strFilename << " as type "
 			<< (strType.empty() ? "<autodetect>" : strType) << std::endl;
 
-		stream::file_sptr psMap(new stream::file());
+		// The map is only read, so map it into memory for quicker access
+		stream::input_sptr psMap;
 		try {
-			psMap->open(strFilename.c_str());
+			psMap.reset(new gm::input_mmap(strFilename));
 		} catch (const stream::open_error& e) {
 			std::cerr << "Error opening " << strFilename << ": " << e.what()
 				<< std::endl;
 			return RET_SHOWSTOPPER;
 		}
 
+		// Read the file once for all the format checks
+		gm::Probe probe(psMap);
+
 		gm::MapTypePtr pMapType;
 		if (strType.empty()) {
 			// Need to autodetect the file format.
-			gm::MapTypePtr pTestType;
-			unsigned int i = 0;
-			while ((pTestType = pManager->getMapType(i++))) {
-				gm::MapType::Certainty cert = pTestType->isInstance(psMap);
-				switch (cert) {
-					case gm::MapType::DefinitelyNo:
-						// Don't print anything (TODO: Maybe unless verbose?)
-						break;
-					case gm::MapType::Unsure:
-						std::cout << "File could be a " << pTestType->getFriendlyName()
-							<< " [" << pTestType->getMapCode() << "]" << std::endl;
-						// If we haven't found a match already, use this one
-						if (!pMapType) pMapType = pTestType;
+			gm::DetectMatchVector matches = pManager->detect(psMap, strFilename);
+			for (gm::DetectMatchVector::const_iterator
+				i = matches.begin(); i != matches.end(); i++
+			) {
+				switch (i->certainty) {
+					case gm::MapType::DefinitelyYes:
+						std::cout << "File is definitely a ";
 						break;
 					case gm::MapType::PossiblyYes:
-						std::cout << "File is likely to be a " << pTestType->getFriendlyName()
-							<< " [" << pTestType->getMapCode() << "]" << std::endl;
-						// Take this one as it's better than an uncertain match
-						pMapType = pTestType;
+						std::cout << "File is likely to be a ";
+						break;
+					default:
+						std::cout << "File could be a ";
 						break;
-					case gm::MapType::DefinitelyYes:
-						std::cout << "File is definitely a " << pTestType->getFriendlyName()
-							<< " [" << pTestType->getMapCode() << "]" << std::endl;
-						pMapType = pTestType;
-						// Don't bother checking any other formats if we got a 100% match
-						goto finishTesting;
-				}
-				if (cert != gm::MapType::DefinitelyNo) {
-					// We got a possible match, see if it requires any suppdata
-					camoto::SuppFilenames suppList = pTestType->getRequiredSupps(psMap,
-						strFilename);
-					if (suppList.size() > 0) {
-						// It has suppdata, see if it's present
-						std::cout << "  * This format requires supplemental files..." << std::endl;
-						bool bSuppOK = true;
-						for (camoto::SuppFilenames::iterator
-							i = suppList.begin(); i != suppList.end(); i++
-						) {
-							try {
-								stream::file_sptr suppStream(new stream::file());
-								suppStream->open(i->second);
-							} catch (const stream::open_error&) {
-								bSuppOK = false;
-								std::cout << "  * Could not find/open " << i->second
-									<< ", map is probably not "
-									<< pTestType->getMapCode() << std::endl;
-								break;
-							}
-						}
-						if (bSuppOK) {
-							// All supp files opened ok
-							std::cout << "  * All supp files present, map is likely "
-								<< pTestType->getMapCode() << std::endl;
-							// Set this as the most likely format
-							pMapType = pTestType;
-						}
-					}
 				}
+				std::cout << i->type->getFriendlyName() << " ["
+					<< i->type->getMapCode() << "]: " << i->reason << std::endl;
 			}
-finishTesting:
+			// Take the most likely match
+			if (!matches.empty()) pMapType = matches[0].type;
 			if (!pMapType) {
 				std::cerr << "Unable to automatically determine the file type.  Use "
 					"the --type option to manually specify the file format." << std::endl;
@@ -610,7 +456,7 @@ finishTesting:
 		assert(pMapType != NULL);
 
 		// Check to see if the file is actually in this format
-		if (!pMapType->isInstance(psMap)) {
+		if (!pMapType->isInstance(probe)) {
 			if (bForceOpen) {
 				std::cerr << "Warning: " << strFilename << " is not a "
 					<< pMapType->getFriendlyName() << ", open forced." << std::endl;
@@ -927,22 +773,16 @@ finishTesting:
 					getLayerDims(map2d, layer, &layerWidth, &layerHeight, &tileWidth, &tileHeight);
 
 					const gm::Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-					gm::Map2D::Layer::ItemPtrVector::const_iterator t = items->begin();
-					unsigned int numItems = items->size();
-					if (t != items->end()) {
+					if (!items->empty()) {
 						for (unsigned int y = 0; y < layerHeight; y++) {
 							for (unsigned int x = 0; x < layerWidth; x++) {
-								for (unsigned int i = 0; i < numItems; i++) {
-									if (((*t)->x == x) && ((*t)->y == y)) break;
-									t++;
-									if (t == items->end()) t = items->begin();
-								}
-								if (((*t)->x != x) || ((*t)->y != y)) {
+								gm::Map2D::Layer::ItemPtr t = layer->getItemAt(x, y);
+								if (!t) {
 									// Grid position with no tile!
 									std::cout << "     ";
 								} else {
 									std::cout << std::hex << std::setw(4)
-										<< (unsigned int)(*t)->code << ' ';
+										<< (unsigned int)t->code << ' ';
 								}
 							}
 							std::cout << "\n";
@@ -970,7 +810,8 @@ finishTesting:
 					gm::TilesetCollectionPtr allTilesets(new gm::TilesetCollection);
 					/// @todo Load more than one tileset
 					(*allTilesets)[gm::BackgroundTileset1] = openTileset(strGraphics, strGraphicsType);
-					map2dToPng(map2d, allTilesets, i->value[0]);
+					map2dToPng(renderer, map2d, allTilesets, i->value[0],
+						threads);
 				}
 
 			// Ignore --type/-t
@@ -82,7 +82,13 @@ Additional information is available from the Camoto homepage
 #include <camoto/gamemaps/map.hpp>
 #include <camoto/gamemaps/maptype.hpp>
 #include <camoto/gamemaps/manager.hpp>
+#include <camoto/gamemaps/detect.hpp>
+#include <camoto/gamemaps/detect_cache.hpp>
 #include <camoto/gamemaps/map2d.hpp>
 #include <camoto/gamemaps/util.hpp>
+#include <camoto/gamemaps/input_mmap.hpp>
+#include <camoto/gamemaps/probe.hpp>
+#include <camoto/gamemaps/render.hpp>
+#include <camoto/gamemaps/tile_atlas.hpp>
 
 #endif // _CAMOTO_GAMEMAPS_HPP_
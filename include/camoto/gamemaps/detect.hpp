@@ -0,0 +1,210 @@
+/**
+ * @file  camoto/gamemaps/detect.hpp
+ * @brief Work out which format a map file is in.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_DETECT_HPP_
+#define _CAMOTO_GAMEMAPS_DETECT_HPP_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <camoto/stream.hpp>
+#include <camoto/gamemaps/manager.hpp>
+#include <camoto/gamemaps/maptype.hpp>
+#include <camoto/gamemaps/probe.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// A format that a file may be in, as returned by Detector::detect().
+struct DetectMatch
+{
+	/// Format the file may be in.
+	MapTypePtr type;
+
+	/// Result of MapType::isInstance().  Never DefinitelyNo.
+	MapType::Certainty certainty;
+
+	/// Does the filename extension match one of MapType::getFileExtensions()?
+	bool extensionMatch;
+
+	/// Does the format need supplemental files?
+	bool needsSupps;
+
+	/// If needsSupps is true, were all the supplemental files found?
+	bool suppsPresent;
+
+	/// Supplemental files the format needs, from MapType::getRequiredSupps().
+	SuppFilenames supps;
+
+	/// Explanation of why this format matched, suitable for display.
+	std::string reason;
+};
+
+/// Find the formats a file could be in.
+/**
+ * On creation, the DetectFilter from every format is collected into an
+ * index.  Each file is then only passed to the MapType::isInstance() of the
+ * formats whose filters it passes, which for most files is only one or two.
+ *
+ * Create one of these and reuse it for every file to be checked.
+ *
+ * @note Multithreading: detect() may be called from multiple threads at the
+ *   same time, provided each is checking a different stream.
+ */
+class DLL_EXPORT Detector
+{
+	public:
+		/// Build the index of formats to check.
+		/**
+		 * @param manager
+		 *   Manager supplying the formats.
+		 */
+		Detector(const ManagerPtr& manager);
+
+		/// Build the index of formats to check.
+		/**
+		 * @param types
+		 *   Formats to check, in order of preference.
+		 */
+		Detector(const MapTypeVector& types);
+
+		/// Work out which formats a file could be in.
+		/**
+		 * @param input
+		 *   Content of the file.
+		 *
+		 * @param filename
+		 *   Path of the file, used to check the filename extension and to find
+		 *   any supplemental files.  May be empty if the file has no name, in
+		 *   which case neither of these are checked.
+		 *
+		 * @return All possible formats, most likely first.  They are ranked
+		 *   first by certainty, then by whether any supplemental files are
+		 *   present, then by filename extension, then in the order they are
+		 *   listed by the Manager.  The list is empty if the format could not
+		 *   be identified.
+		 */
+		DetectMatchVector detect(stream::input_sptr input,
+			const std::string& filename) const;
+
+		/// Work out which formats a file could be in.
+		/**
+		 * This is the same as the other detect(), but for data already read
+		 * into a Probe.
+		 *
+		 * @param input
+		 *   Content of the file, passed to MapType::getRequiredSupps().
+		 *
+		 * @param probe
+		 *   Data read from input.
+		 *
+		 * @param filename
+		 *   Path of the file, as for the other detect().
+		 *
+		 * @return All possible formats, most likely first.
+		 */
+		DetectMatchVector detect(stream::input_sptr input, const Probe& probe,
+			const std::string& filename) const;
+
+		/// Work out which formats a file could be in, using multiple threads.
+		/**
+		 * The formats that pass the filters are checked on up to the given
+		 * number of threads at once.  The result does not depend on the number
+		 * of threads or on which finishes first.  No threads are started if
+		 * only one format passes the filters.
+		 *
+		 * Most checks take well under a microsecond, which is far less than it
+		 * takes to start a thread, so this is only worthwhile for formats with
+		 * unusually slow checks.
+		 *
+		 * @param input
+		 *   Content of the file, passed to MapType::getRequiredSupps().
+		 *
+		 * @param probe
+		 *   Data read from input.
+		 *
+		 * @param filename
+		 *   Path of the file, as for the other detect().
+		 *
+		 * @param threads
+		 *   Maximum number of formats to check at the same time, including the
+		 *   calling thread.  1 or 0 checks each format in turn.
+		 *
+		 * @param stopWhenCertain
+		 *   true to stop checking once a format returns
+		 *   MapType::DefinitelyYes.  Formats before it in the list are still
+		 *   checked and returned, as if checking each format in turn and
+		 *   stopping at the first certain match.  false to check every format.
+		 *
+		 * @return Possible formats, most likely first.
+		 *
+		 * @throw Any exception other than stream::error thrown by a format's
+		 *   check, once every thread has finished.
+		 */
+		DetectMatchVector detect(stream::input_sptr input, const Probe& probe,
+			const std::string& filename, unsigned int threads, bool stopWhenCertain)
+			const;
+
+		/// Fill in the rest of each match and sort them.
+		/**
+		 * detect() calls this once the formats have been checked.  It is
+		 * available separately so results saved from an earlier detect() can
+		 * be checked against the filename again, since that may have changed.
+		 *
+		 * @param matches
+		 *   Matches with DetectMatch::type and DetectMatch::certainty set.  If
+		 *   DetectMatch::supps is empty, MapType::getRequiredSupps() is called
+		 *   to fill it.  On return the other fields are set and the list is
+		 *   sorted with the most likely first.
+		 *
+		 * @param input
+		 *   Content of the file, passed to MapType::getRequiredSupps().
+		 *
+		 * @param filename
+		 *   Path of the file, as for detect().
+		 */
+		static void rank(DetectMatchVector *matches, stream::input_sptr input,
+			const std::string& filename);
+
+	protected:
+		/// Fill filters, bySize and byRange from types.
+		void buildIndex();
+
+		/// Formats from the Manager, in order.
+		MapTypeVector types;
+
+		/// DetectFilter for each entry in types.
+		std::vector<DetectFilter> filters;
+
+		/// Index into types of the formats that accept each exact file size.
+		std::map<stream::len, std::vector<unsigned int> > bySize;
+
+		/// Index into types of the formats that accept a range of file sizes.
+		std::vector<unsigned int> byRange;
+};
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_DETECT_HPP_
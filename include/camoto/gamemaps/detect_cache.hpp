@@ -0,0 +1,198 @@
+/**
+ * @file  camoto/gamemaps/detect_cache.hpp
+ * @brief On-disk cache of format detection results.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_DETECT_CACHE_HPP_
+#define _CAMOTO_GAMEMAPS_DETECT_CACHE_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <boost/thread/mutex.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/gamemaps/manager.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// Remember which format each file was in, across runs.
+/**
+ * Each result of Manager::detect() is saved in a small file in the cache
+ * folder.  It is named from a hash of the file content and its size, and
+ * also records the library version.  When the same content is checked
+ * again, even under a different name, the saved result is used and no
+ * format has to check the file.
+ *
+ * Since the key is the content itself, a file that changes simply gets a
+ * new key and its old entry is no longer used, so nothing ever needs to be
+ * cleared by hand.  Old entries are left in the folder.
+ *
+ * Hashing means reading the whole file, so for files on disk the hash is
+ * saved too, along with the file's size, device, inode, and its modification
+ * and status change times to the nanosecond.  As long as none of these have
+ * changed, the saved hash is used and the file is not read.  A file changed
+ * in the last few seconds is always read, since a file system that only
+ * keeps coarse times could let it change again without its times moving on.
+ * Where the system does not give times this precise, every file is read.
+ *
+ * Only the parts of the result that depend on the content are cached.  The
+ * filename extension and whether the supplemental files exist are checked
+ * again each time.  The supplemental filenames are kept too, and reused when
+ * the file is checked under the same name.
+ *
+ * @note Multithreading: detect() may be called from multiple threads at the
+ *   same time, provided each is checking a different stream.  Multiple
+ *   processes may share the same cache folder.
+ */
+class DLL_EXPORT DetectCache
+{
+	public:
+		/// Use a folder to cache detection results.
+		/**
+		 * @param manager
+		 *   Manager used to detect files not in the cache.
+		 *
+		 * @param path
+		 *   Folder to store the results in.  It is created if it does not
+		 *   exist.
+		 *
+		 * @throw stream::error
+		 *   The folder could not be created.
+		 */
+		DetectCache(const ManagerPtr& manager, const std::string& path);
+
+		/// Work out which format a file is in.
+		/**
+		 * This is the same as Manager::detect(), except the result is taken
+		 * from the cache if the same content has been checked before.
+		 *
+		 * If the cache cannot be read or written, the file is detected as
+		 * normal and no error is reported.
+		 *
+		 * @param input
+		 *   Content of the file.
+		 *
+		 * @param filename
+		 *   Path of the file, as for Manager::detect().
+		 *
+		 * @return Possible formats, most likely first.
+		 */
+		DetectMatchVector detect(stream::input_sptr input,
+			const std::string& filename);
+
+		/// Get the number of files found in the cache.
+		unsigned long getHits() const;
+
+		/// Get the number of files that had to be detected.
+		unsigned long getMisses() const;
+
+	protected:
+		ManagerPtr manager;        ///< Used for detecting on a cache miss
+		std::string path;          ///< Folder holding the cache entries
+		unsigned long hits;        ///< Number of results taken from the cache
+		unsigned long misses;      ///< Number of results not in the cache
+		mutable boost::mutex lock; ///< Protects hits and misses
+
+		/// Read a cache entry.
+		/**
+		 * @param entry
+		 *   Path of the cache file.
+		 *
+		 * @param key
+		 *   Expected first line of the file.
+		 *
+		 * @param filename
+		 *   Filename being checked, to decide whether any cached
+		 *   supplemental filenames apply.
+		 *
+		 * @param matches
+		 *   On return, the cached matches with DetectMatch::type,
+		 *   DetectMatch::certainty and possibly DetectMatch::supps set.
+		 *
+		 * @return true if the entry was read, false if it does not exist or
+		 *   does not match the key.
+		 */
+		bool load(const std::string& entry, const std::string& key,
+			const std::string& filename, DetectMatchVector *matches) const;
+
+		/// Write a cache entry.
+		/**
+		 * The entry is written to a temporary file and renamed, so readers
+		 * never see a partially written entry.
+		 *
+		 * @param entry
+		 *   Path of the cache file.
+		 *
+		 * @param key
+		 *   First line of the file.
+		 *
+		 * @param filename
+		 *   Filename the supplemental filenames were worked out from.
+		 *
+		 * @param matches
+		 *   Result to save.
+		 */
+		void save(const std::string& entry, const std::string& key,
+			const std::string& filename, const DetectMatchVector& matches) const;
+
+		/// Read the content hash last worked out for a file on disk.
+		/**
+		 * @param entry
+		 *   Path of the cache file for this filename.
+		 *
+		 * @param filename
+		 *   Full path of the file, which must match the one saved.
+		 *
+		 * @param stamp
+		 *   Current size, location and times of the file, as described above.
+		 *
+		 * @param hash
+		 *   On return, the saved hash.
+		 *
+		 * @return true if the hash was read and the file still has the same
+		 *   stamp, false if it must be hashed again.
+		 */
+		bool loadHash(const std::string& entry, const std::string& filename,
+			const std::string& stamp, uint64_t *hash) const;
+
+		/// Remember the content hash of a file on disk.
+		/**
+		 * @param entry
+		 *   Path of the cache file for this filename.
+		 *
+		 * @param filename
+		 *   Full path of the file.
+		 *
+		 * @param stamp
+		 *   Size, location and times of the file when it was hashed.
+		 *
+		 * @param hash
+		 *   Hash of the file content.
+		 */
+		void saveHash(const std::string& entry, const std::string& filename,
+			const std::string& stamp, uint64_t hash) const;
+};
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_DETECT_CACHE_HPP_
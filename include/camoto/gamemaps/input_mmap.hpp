@@ -0,0 +1,99 @@
+/**
+ * @file  camoto/gamemaps/input_mmap.hpp
+ * @brief Read-only stream backed by a memory-mapped file.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_INPUT_MMAP_HPP_
+#define _CAMOTO_GAMEMAPS_INPUT_MMAP_HPP_
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <camoto/stream.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// Read-only stream over the contents of a file held in memory.
+/**
+ * Where the platform supports it the file is memory-mapped, so reads are a
+ * simple copy out of the page cache and seeks cost nothing.  Elsewhere, or
+ * if the file cannot be mapped (e.g. it is a pipe), the whole file is read
+ * into memory when it is opened.
+ *
+ * Either way the entire file is available through data(), which lets bulk
+ * decoders work directly on the file contents without reading them into a
+ * buffer first.
+ *
+ * The file must not be modified while it is open.
+ */
+class DLL_EXPORT input_mmap: virtual public stream::input
+{
+	public:
+		/// Open a file.
+		/**
+		 * @param filename
+		 *   Path of the file to open.
+		 *
+		 * @throw stream::open_error
+		 *   The file could not be opened.
+		 */
+		input_mmap(const std::string& filename);
+
+		/// Unmap or free the file contents.
+		virtual ~input_mmap();
+
+		virtual stream::len try_read(uint8_t *buffer, stream::len len);
+		virtual void seekg(stream::delta off, stream::seek_from from);
+		virtual stream::pos tellg() const;
+		virtual stream::len size() const;
+
+		/// Get the entire contents of the file.
+		/**
+		 * @return Pointer to the first byte of the file, which remains valid
+		 *   until this stream is destroyed.  There are size() bytes available.
+		 *   The pointer may be NULL if the file is empty.
+		 */
+		const uint8_t *data() const;
+
+		/// Was the file memory-mapped, or read into memory?
+		/**
+		 * @return true if the file is mapped, false if it was read in.
+		 */
+		bool isMapped() const;
+
+	protected:
+		const uint8_t *content;      ///< File contents, mapped or in buffer
+		stream::len lenContent;      ///< Size of content, in bytes
+		stream::pos offset;          ///< Current read position
+		void *mapping;               ///< Address returned by mmap(), or NULL
+		std::vector<uint8_t> buffer; ///< File contents if not mapped
+};
+
+/// Shared pointer to an input_mmap.
+typedef boost::shared_ptr<input_mmap> input_mmap_sptr;
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_INPUT_MMAP_HPP_
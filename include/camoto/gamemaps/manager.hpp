@@ -21,6 +21,8 @@
 #ifndef _CAMOTO_GAMEMAPS_MANAGER_HPP_
 #define _CAMOTO_GAMEMAPS_MANAGER_HPP_
 
+#include <string>
+#include <vector>
 #include <boost/shared_ptr.hpp>
 #include <camoto/gamemaps/maptype.hpp>
 
@@ -31,6 +33,12 @@
 namespace camoto {
 namespace gamemaps {
 
+/// A format that a file may be in, see camoto/gamemaps/detect.hpp.
+struct DetectMatch;
+
+/// List of possible formats, most likely first.
+typedef std::vector<DetectMatch> DetectMatchVector;
+
 /// Top-level class to manage map types.
 /**
  * This class provides access to the different map file formats supported
@@ -69,6 +77,32 @@ class Manager
 		 */
 		virtual const MapTypePtr getMapTypeByCode(const std::string& strCode)
 			const = 0;
+
+		/// Work out which format a file is in.
+		/**
+		 * The formats that could accept the file are checked in turn, stopping
+		 * at the first one that is certain the file is in its format.  The
+		 * checks are done on the calling thread, as they usually take well
+		 * under a microsecond and starting a thread takes far longer.
+		 *
+		 * Use Detector instead to get every format the file could be in.
+		 *
+		 * @param input
+		 *   Content of the file.
+		 *
+		 * @param filename
+		 *   Path of the file, used to check the filename extension and to find
+		 *   any supplemental files.  May be empty.
+		 *
+		 * @return Possible formats, most likely first.  Empty if the format
+		 *   could not be identified.
+		 *
+		 * @note Multithreading: This function may be called from multiple
+		 *   threads at the same time, provided each is checking a different
+		 *   stream.
+		 */
+		virtual DetectMatchVector detect(stream::input_sptr input,
+			const std::string& filename) const = 0;
 };
 
 /// Shared pointer to a Manager.
@@ -131,10 +131,19 @@ class Map2D: public Map
 
 		/// Get access to the given layer.
 		/**
+		 * Some formats do not decode a layer until it is first requested, so
+		 * callers only interested in the map attributes should avoid calling
+		 * this function.  It is safe to call from multiple threads at once, and
+		 * each call for the same index returns the same layer.
+		 *
 		 * @param index
 		 *   Layer index.  Must be < getLayerCount().
 		 *
 		 * @return A shared pointer to the layer.
+		 *
+		 * @throw stream::error
+		 *   The layer was being decoded for the first time and its data turned
+		 *   out to be invalid.
 		 */
 		virtual LayerPtr getLayer(unsigned int index) = 0;
 
@@ -214,6 +223,8 @@ class Map2D::Layer
 		typedef std::vector<ItemPtr> ItemPtrVector;
 		/// Shared pointer to a vector of items.
 		typedef boost::shared_ptr<ItemPtrVector> ItemPtrVectorPtr;
+		/// Shared pointer to a vector of items that must not be changed.
+		typedef boost::shared_ptr<const ItemPtrVector> ConstItemPtrVectorPtr;
 
 		/// Capabilities this layer supports.
 		enum Caps {
@@ -322,6 +333,108 @@ class Map2D::Layer
 		 */
 		virtual ItemPtrVectorPtr getAllItems() = 0;
 
+		/// Get the item at the given location.
+		/**
+		 * This is much faster than searching through getAllItems() when looking
+		 * up many cells, e.g. when drawing the whole map.
+		 *
+		 * @param x
+		 *   X coordinate, in tiles.
+		 *
+		 * @param y
+		 *   Y coordinate, in tiles.
+		 *
+		 * @return The item at this location, or a null pointer if the cell is
+		 *   empty.  If more than one item shares the same location, the one
+		 *   appearing last in getAllItems() is returned as it is drawn on top.
+		 */
+		virtual ItemPtr getItemAt(unsigned int x, unsigned int y) = 0;
+
+		/// Get all items within a rectangular area.
+		/**
+		 * @param x
+		 *   Left edge of the area, in tiles.
+		 *
+		 * @param y
+		 *   Top edge of the area, in tiles.
+		 *
+		 * @param width
+		 *   Width of the area, in tiles.
+		 *
+		 * @param height
+		 *   Height of the area, in tiles.
+		 *
+		 * @return Vector of all items whose coordinates lie within the area, in
+		 *   the same relative order as getAllItems().
+		 */
+		virtual ItemPtrVectorPtr getItemsInRect(unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height) = 0;
+
+		/// Get all items visible within a rectangular area.
+		/**
+		 * This differs from the other getItemsInRect() in that items are drawn
+		 * at the size of their images, so a sprite located above or to the left
+		 * of the area may still extend into it.  This is what is needed to find
+		 * the items to draw in a viewport, or to find the item under the mouse
+		 * cursor.
+		 *
+		 * The size of each image is looked up once per tile code and cached, so
+		 * the image for an item must not depend on anything other than its code.
+		 * Items may have their code changed to any in getValidItemList() and
+		 * will still be found at their new size.
+		 *
+		 * @param x
+		 *   Left edge of the area, in tiles.
+		 *
+		 * @param y
+		 *   Top edge of the area, in tiles.
+		 *
+		 * @param width
+		 *   Width of the area, in tiles.
+		 *
+		 * @param height
+		 *   Height of the area, in tiles.
+		 *
+		 * @param tileset
+		 *   Tileset used to obtain the image dimensions, as passed to
+		 *   imageFromCode().
+		 *
+		 * @return Vector of all items that overlap the area, in the same relative
+		 *   order as getAllItems().  Items without an image are treated as being
+		 *   one tile in size.
+		 */
+		virtual ItemPtrVectorPtr getItemsInRect(unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height,
+			const TilesetCollectionPtr& tileset) = 0;
+
+		/// Add a new item to the layer.
+		/**
+		 * This appends the item to the vector returned by getAllItems() and
+		 * updates any lookup structures used by getItemAt().
+		 *
+		 * @param item
+		 *   New item to add.  Its coordinates must already be set.
+		 */
+		virtual void addItem(const ItemPtr& item) = 0;
+
+		/// Move an existing item to a new location.
+		/**
+		 * Items should be moved with this function rather than changing their
+		 * coordinates directly, so that getItemAt() can find them in their new
+		 * location without having to reindex the whole layer.
+		 *
+		 * @param item
+		 *   Item obtained from getAllItems().
+		 *
+		 * @param x
+		 *   New X coordinate, in tiles.
+		 *
+		 * @param y
+		 *   New Y coordinate, in tiles.
+		 */
+		virtual void moveItem(const ItemPtr& item, unsigned int x,
+			unsigned int y) = 0;
+
 		/// Convert a map code into an image.
 		/**
 		 * @param item
@@ -389,12 +502,34 @@ class Map2D::Layer
 		 * Items are copied (i.e. with the copy constructor) if they are to be
 		 * inserted into a layer.
 		 *
-		 * @return Vector of all items.
+		 * The list may be shared with every other map of the same format, so
+		 * neither it nor its items may be changed.  Use
+		 * getEditableValidItemList() to get a list that can be.
+		 *
+		 * @return Vector of all items, or a null pointer if the layer does not
+		 *   have a list.
+		 */
+		virtual ConstItemPtrVectorPtr getValidItemList() const = 0;
+
+		/// Get a list of possible items that belongs to this layer alone.
+		/**
+		 * The first call copies the list returned by getValidItemList(), after
+		 * which both functions return the copy.  Changes made to it do not
+		 * affect any other layer or map.
+		 *
+		 * @return Vector of all items, which may be changed.
 		 */
-		virtual const ItemPtrVectorPtr getValidItemList() const = 0;
+		virtual ItemPtrVectorPtr getEditableValidItemList() = 0;
 };
 
 /// Item within the layer (a tile)
+/**
+ * Almost all items in a map are plain tiles, so only the location and code
+ * are stored in the item itself.  The fields for the other types (player,
+ * text, movement and blocking) are kept in a separate block which is only
+ * allocated the first time one of them is modified, through player(),
+ * text(), movement() or blocking().
+ */
 class Map2D::Layer::Item
 {
 	public:
@@ -407,44 +542,16 @@ class Map2D::Layer::Item
 			Flags     = 0x0010, ///< Set if generalFlags field is valid
 		};
 
-		unsigned int type; ///< Which fields are valid?
-
-		// Default fields
-		unsigned int x;  ///< Item location in units of tiles
-		unsigned int y;  ///< Item location in units of tiles
-
-		// Since many maps use a code like this, we'll put it here to save each
-		// map format from having to derive its own almost identical class.
-		unsigned int code; ///< Format-specific tile code
-
-		/// Player type: 0 for main player, 1 for second player, etc.
-		unsigned int playerNumber;
-		/// Player type: true to face left, false to face right
-		bool playerFacingLeft;
-
-		/// Text type: index of font to use (0 reserved for VGA 8x8)
-		unsigned int textFont;
-		/// Text type: actual content of the text element
-		std::string textContent;
-
 		/// These flags control which movement fields are valid and able to be modified
 		enum MovementFlags {
 			DistanceLimit = 0x0001, ///< Set if dist* vars indicate movement limits
 			SpeedLimit    = 0x0002, ///< Set if speedX and speedY are valid
 		};
-		unsigned int movementFlags;       ///< One or more of MovementFlags
 
-		/// Set movementDist* to this value to indicate movement in the
+		/// Set MovementInfo::dist* to this value to indicate movement in the
 		/// specified direction, of an indeterminate nature.
 		const static unsigned int DistIndeterminate = (unsigned int)-1;
 
-		unsigned int movementDistLeft;    ///< How far left the item can go, in grid units
-		unsigned int movementDistRight;   ///< How far right the item can go, in grid units
-		unsigned int movementDistUp;      ///< How far up the item can go, in grid units
-		unsigned int movementDistDown;    ///< How far down the item can go, in grid units
-		unsigned int movementSpeedX;      ///< Horizontal speed, in milliseconds per pixel
-		unsigned int movementSpeedY;      ///< Vertical speed, in milliseconds per pixel
-
 		enum BlockingFlags {
 			BlockLeft     = 0x0001, ///< Prevent movement right, through the left edge
 			BlockRight    = 0x0002, ///< Prevent movement left, through the right edge
@@ -454,12 +561,123 @@ class Map2D::Layer::Item
 			Slant45       = 0x0020, ///< Slanted tile /, 45 degrees CCW from the horizontal
 			Slant135      = 0x0040, ///< Slanted tile \, 135 degrees CCW from the horizontal
 		};
-		unsigned int blockingFlags;       ///< One or more of MovementFlags
 
 		enum GeneralFlags {
 			Interactive   = 0x0001, ///< This tile hosts an interactive item
 		};
+
+		/// Fields used when type includes Player.
+		struct PlayerInfo {
+			/// Player type: 0 for main player, 1 for second player, etc.
+			unsigned int number;
+			/// Player type: true to face left, false to face right
+			bool facingLeft;
+		};
+
+		/// Fields used when type includes Text.
+		struct TextInfo {
+			/// Index of font to use (0 reserved for VGA 8x8)
+			unsigned int font;
+			/// Actual content of the text element
+			std::string content;
+		};
+
+		/// Fields used when type includes Movement.
+		struct MovementInfo {
+			unsigned int flags;     ///< One or more of MovementFlags
+			unsigned int distLeft;  ///< How far left the item can go, in grid units
+			unsigned int distRight; ///< How far right the item can go, in grid units
+			unsigned int distUp;    ///< How far up the item can go, in grid units
+			unsigned int distDown;  ///< How far down the item can go, in grid units
+			unsigned int speedX;    ///< Horizontal speed, in milliseconds per pixel
+			unsigned int speedY;    ///< Vertical speed, in milliseconds per pixel
+		};
+
+		/// Fields used when type includes Blocking.
+		struct BlockingInfo {
+			unsigned int flags; ///< One or more of BlockingFlags
+		};
+
+		/// Create a new item with all fields set to zero.
+		Item();
+
+		/// Copy an item, including any player/text/movement/blocking fields.
+		Item(const Item& other);
+
+		/// Destructor.
+		~Item();
+
+		/// Copy an item, including any player/text/movement/blocking fields.
+		Item& operator=(const Item& other);
+
+		/// Access the player fields, allocating them if necessary.
+		PlayerInfo& player();
+
+		/// Read the player fields.
+		/**
+		 * @return The player fields, or zeroed fields if they have never been
+		 *   set.  No memory is allocated.
+		 */
+		const PlayerInfo& player() const;
+
+		/// Access the text fields, allocating them if necessary.
+		TextInfo& text();
+
+		/// Read the text fields.
+		/**
+		 * @return The text fields, or empty fields if they have never been set.
+		 *   No memory is allocated.
+		 */
+		const TextInfo& text() const;
+
+		/// Access the movement fields, allocating them if necessary.
+		MovementInfo& movement();
+
+		/// Read the movement fields.
+		/**
+		 * @return The movement fields, or zeroed fields if they have never been
+		 *   set.  No memory is allocated.
+		 */
+		const MovementInfo& movement() const;
+
+		/// Access the blocking fields, allocating them if necessary.
+		BlockingInfo& blocking();
+
+		/// Read the blocking fields.
+		/**
+		 * @return The blocking fields, or zeroed fields if they have never been
+		 *   set.  No memory is allocated.
+		 */
+		const BlockingInfo& blocking() const;
+
+		unsigned int type; ///< Which fields are valid?
+
+		// Default fields
+		unsigned int x;  ///< Item location in units of tiles
+		unsigned int y;  ///< Item location in units of tiles
+
+		// Since many maps use a code like this, we'll put it here to save each
+		// map format from having to derive its own almost identical class.
+		unsigned int code; ///< Format-specific tile code
+
+		/// Flags used when type includes Flags.
+		/**
+		 * This is kept here rather than with the other fields as grid layers can
+		 * set it on any tile.
+		 */
 		GeneralFlags generalFlags;
+
+	protected:
+		struct Extra;
+
+		/// Player/text/movement/blocking fields, or NULL if never accessed.
+		Extra *extra;
+
+		/// Zeroed fields returned by the const accessors when extra is NULL.
+		static const Extra emptyExtra;
+
+		/// Get the extra fields, allocating them if needed.
+		Extra& getExtra();
 };
 
 /// Value to use for tilecodes that have not yet been set.
@@ -22,17 +22,61 @@
 #ifndef _CAMOTO_GAMEMAPS_MAPTYPE_HPP_
 #define _CAMOTO_GAMEMAPS_MAPTYPE_HPP_
 
+#include <limits>
 #include <string>
 #include <vector>
 #include <camoto/stream.hpp>
 #include <camoto/suppitem.hpp>
 #include <camoto/gamemaps/map.hpp>
+#include <camoto/gamemaps/probe.hpp>
 
 /// Main namespace
 namespace camoto {
 /// Namespace for this library
 namespace gamemaps {
 
+/// Rectangular area of a map, used to open only part of it.
+struct MapRegion
+{
+	unsigned int x;      ///< Left edge, in tiles
+	unsigned int y;      ///< Top edge, in tiles
+	unsigned int width;  ///< Width, in tiles
+	unsigned int height; ///< Height, in tiles
+};
+
+/// Quick checks used to skip formats when autodetecting a file's format.
+/**
+ * A Detector checks these before calling MapType::isInstance(), so they
+ * must never reject a file that isInstance() would accept.  The default
+ * values accept every file.
+ */
+struct DetectFilter
+{
+	/// Bytes that must appear at a fixed offset in the file.
+	struct Signature
+	{
+		stream::pos offset; ///< Offset from the start of the file
+		std::string bytes;  ///< Content that must appear at offset
+	};
+
+	/// Create a filter that accepts every file.
+	inline DetectFilter()
+		:	minSize(0),
+			maxSize(std::numeric_limits<stream::len>::max())
+	{
+	}
+
+	/// The only valid file sizes, in bytes.  If empty, minSize and maxSize
+	/// are used instead.
+	std::vector<stream::len> sizes;
+
+	stream::len minSize; ///< Smallest valid file size, in bytes
+	stream::len maxSize; ///< Largest valid file size, in bytes
+
+	/// Signatures that must all be present.
+	std::vector<Signature> signatures;
+};
+
 /// Interface to a particular map format.
 class MapType
 {
@@ -83,6 +127,29 @@ class MapType
 		 */
 		virtual Certainty isInstance(stream::input_sptr psMap) const = 0;
 
+		/// Check data already read from a file to see if it's in this format.
+		/**
+		 * This does the same checks as the other isInstance(), but on a Probe
+		 * rather than directly on the file.  When checking a file against many
+		 * formats, create a single Probe and pass it to each one so the file is
+		 * only read once.
+		 *
+		 * @param probe
+		 *   Data from the file to test.
+		 *
+		 * @return A single confidence value from \ref MapType::Certainty.
+		 */
+		virtual Certainty isInstance(const Probe& probe) const = 0;
+
+		/// Get the quick checks a file must pass to be in this format.
+		/**
+		 * This is used by Detector to avoid calling isInstance() for formats
+		 * that a file obviously isn't in.
+		 *
+		 * @return Filter that accepts every file isInstance() might accept.
+		 */
+		virtual DetectFilter getDetectFilter() const = 0;
+
 		/// Create a blank map in this format.
 		/**
 		 * This function creates an empty map in the given format.
@@ -113,6 +180,44 @@ class MapType
 		 */
 		virtual MapPtr open(stream::input_sptr input, SuppData& suppData) const = 0;
 
+		/// Open only part of a map file.
+		/**
+		 * This is the same as open(), except that only the tiles and objects
+		 * lying within the given region are loaded.  Formats with a fixed layout
+		 * seek straight to the data needed, so the time taken depends on the
+		 * size of the region rather than the size of the map.  This is intended
+		 * for displaying a small viewport of a large map.
+		 *
+		 * The returned map has the same dimensions as the full map, and items
+		 * have the same coordinates as they would if the whole map were opened.
+		 * Objects are included if their origin lies within the region.
+		 *
+		 * Games that divide their maps into fixed-size screens (e.g. God of
+		 * Thunder) only read the screens overlapping the region, so passing the
+		 * area of a single screen loads just that screen.
+		 *
+		 * @param input
+		 *   The map file.
+		 *
+		 * @param suppData
+		 *   Any supplemental data required by this format (see getRequiredSupps())
+		 *
+		 * @param region
+		 *   Area to load, in units of the map's tile size (see
+		 *   Map2D::getTileSize()).  Any part of the region outside the map is
+		 *   ignored.
+		 *
+		 * @return A shared pointer to an instance of the Map class.
+		 *
+		 * @note Formats without specific support for this load the whole map,
+		 *   so callers must not assume items outside the region are absent.
+		 *
+		 * @warning The map must not be written back over the original file, as
+		 *   anything outside the region will be missing.
+		 */
+		virtual MapPtr openRegion(stream::input_sptr input, SuppData& suppData,
+			const MapRegion& region) const = 0;
+
 		/// Write a map out to a file in this format.
 		/**
 		 * @param map
@@ -136,6 +241,67 @@ class MapType
 		virtual void write(MapPtr map, stream::output_sptr output,
 			SuppData& suppData) const = 0;
 
+		/// Save only the parts of a map that have changed.
+		/**
+		 * This is for saving a map repeatedly to the same files, such as when an
+		 * editor autosaves.  The map is encoded in memory as for write(), then
+		 * compared against a copy of the data as it was last saved, and only the
+		 * byte ranges that differ are written.  Any stream whose length has
+		 * changed (e.g. a format with variable-length sections where the data
+		 * has grown or shrunk) is rewritten in full instead.
+		 *
+		 * The first time a map is saved this way there is no copy to compare
+		 * against, so the existing content of each stream is read in instead.
+		 * The same happens if the map was last saved to a different stream, or
+		 * if write() has since been used on this one.
+		 *
+		 * @param map
+		 *   The map to write out.
+		 *
+		 * @param output
+		 *   The stream holding the map data to update.
+		 *
+		 * @param suppData
+		 *   Any supplemental data required by this format (see getRequiredSupps())
+		 *
+		 * @throw stream::error on I/O error or a map limitation, as for write().
+		 *   Map limitations are found before anything is written, but an I/O
+		 *   error may leave the streams partially updated.
+		 *
+		 * @warning The streams must contain the map as it was opened or last
+		 *   saved with writeChanges(), and not have been changed by anything
+		 *   else since.  Use write() or writeFiles() to save anywhere else.
+		 */
+		virtual void writeChanges(MapPtr map, stream::inout_sptr output,
+			SuppData& suppData) const = 0;
+
+		/// Write a map out to files on disk, replacing them atomically.
+		/**
+		 * Each file is written to a temporary file in the same directory, and
+		 * only once every file has been written successfully are they renamed
+		 * over the originals.  This means an error part way through (e.g. a map
+		 * limitation or a full disk) leaves the original files intact.  If one
+		 * of the renames fails, any files already replaced are put back, so
+		 * either every file is updated or none are.
+		 *
+		 * Files being replaced keep their permissions.  Since the map is never
+		 * held in memory, this is also the quickest way to save to disk.
+		 *
+		 * @param map
+		 *   The map to write out.
+		 *
+		 * @param filename
+		 *   Path of the map file.  It is created if it does not exist.
+		 *
+		 * @param suppFilenames
+		 *   Paths of any supplemental files, usually as returned by
+		 *   getRequiredSupps().
+		 *
+		 * @throw stream::error on I/O error or a map limitation, as for write().
+		 */
+		virtual void writeFiles(MapPtr map, const std::string& filename,
+			const SuppFilenames& suppFilenames) const = 0;
+
 		/// Get a list of any required supplemental files.
 		/**
 		 * For some map formats, data is stored externally to the map file
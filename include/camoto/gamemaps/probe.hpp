@@ -0,0 +1,127 @@
+/**
+ * @file  camoto/gamemaps/probe.hpp
+ * @brief Data read from a file for checking its format.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_PROBE_HPP_
+#define _CAMOTO_GAMEMAPS_PROBE_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <camoto/stream.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// Start and end of a file, read once and checked by every map format.
+/**
+ * Autodetection passes the same file to MapType::isInstance() for every
+ * format.  Rather than each format seeking about and reading the file itself,
+ * a Probe reads the file once and each format checks the copy in memory.
+ *
+ * Small files are read in full.  For larger files only the start and end are
+ * read, which is where the format checks look.  A read from anywhere else is
+ * passed on to the underlying stream.
+ *
+ * None of the functions throw exceptions.  Reads past the end of the file
+ * or that fail return fewer bytes than requested instead.
+ *
+ * @note Multithreading: All functions may be called from multiple threads at
+ *   the same time.
+ */
+class DLL_EXPORT Probe
+{
+	public:
+		/// Read the parts of a file needed for checking its format.
+		/**
+		 * @param input
+		 *   File to check.  Its seek position is changed.  It must not be
+		 *   modified while this object exists, but it may be released.
+		 *
+		 * @throw stream::error
+		 *   The file could not be read.
+		 */
+		Probe(stream::input_sptr input);
+
+		/// Get the size of the file.
+		/**
+		 * @return File size, in bytes.
+		 */
+		stream::len size() const;
+
+		/// Copy some of the file into a buffer.
+		/**
+		 * @param offset
+		 *   Offset from the start of the file of the first byte to copy.
+		 *
+		 * @param buffer
+		 *   Where to copy the data.
+		 *
+		 * @param len
+		 *   Number of bytes to copy.
+		 *
+		 * @return Number of bytes copied.  This is less than len if the end of
+		 *   the file was reached or the data could not be read.
+		 */
+		stream::len read(stream::pos offset, void *buffer, stream::len len) const;
+
+		/// Read a byte.
+		/**
+		 * @param offset
+		 *   Offset from the start of the file.
+		 *
+		 * @param value
+		 *   On return, the byte at offset.  Unchanged if false is returned.
+		 *
+		 * @return true on success, false if offset is past the end of the file.
+		 */
+		bool readU8(stream::pos offset, uint8_t *value) const;
+
+		/// Read a little-endian 16-bit integer.
+		/**
+		 * @param offset
+		 *   Offset from the start of the file.
+		 *
+		 * @param value
+		 *   On return, the value at offset.  Unchanged if false is returned.
+		 *
+		 * @return true on success, false if the value extends past the end of
+		 *   the file.
+		 */
+		bool readU16le(stream::pos offset, uint16_t *value) const;
+
+	protected:
+		stream::input_sptr input;  ///< File being checked, if not all in memory
+		stream::len lenFile;       ///< Size of the file, in bytes
+		const uint8_t *whole;      ///< Entire file if already in memory, or NULL
+		std::vector<uint8_t> head; ///< Start of the file
+		std::vector<uint8_t> tail; ///< End of the file, if not all in head
+		stream::pos offTail;       ///< Offset of tail[0] in the file
+		mutable boost::mutex lock; ///< Serialises reads from input
+};
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_PROBE_HPP_
@@ -0,0 +1,267 @@
+/**
+ * @file  camoto/gamemaps/render.hpp
+ * @brief Draw a Map2D as it would appear in the game.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_RENDER_HPP_
+#define _CAMOTO_GAMEMAPS_RENDER_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <camoto/gamegraphics/palettetable.hpp>
+#include <camoto/gamemaps/map2d.hpp>
+#include <camoto/gamemaps/tile_atlas.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// A map drawn by Map2DRenderer.
+struct DLL_EXPORT RenderedMap
+{
+	unsigned int width;  ///< Image width, in pixels
+	unsigned int height; ///< Image height, in pixels
+
+	/// One palette index per pixel, one row after another.
+	std::vector<uint8_t> pixels;
+
+	/// Colours used by pixels.
+	/**
+	 * Entries with an alpha of zero are transparent.  If there was room in
+	 * the palette, entry 0 has been inserted as the transparent colour and
+	 * every tile colour moved up by one, so that gaps in the map can be told
+	 * apart from colours that are used by the tiles.
+	 */
+	gamegraphics::PaletteTablePtr palette;
+};
+
+/// Draw maps as they would appear in the game.
+/**
+ * Tile images are taken from a TileAtlas.  If one is supplied, it can be
+ * shared by any number of renderers, including ones on other threads.  Any
+ * tile that is not in it is loaded into the renderer's own atlas instead.
+ * This is kept between calls to render(), so create one of these and reuse
+ * it for every map that uses the same tilesets.
+ *
+ * The renderer's own atlas is emptied whenever a different
+ * TilesetCollection is passed to render().  It assumes that all maps drawn
+ * with the same tilesets are in the same format, so they convert the same
+ * tile codes into the same images.
+ *
+ * @note Multithreading: Only one thread may use each instance at a time.
+ */
+class DLL_EXPORT Map2DRenderer
+{
+	public:
+		/// Create a renderer that loads each tile the first time it is drawn.
+		Map2DRenderer();
+
+		/// Create a renderer that takes tiles from an existing atlas.
+		/**
+		 * @param atlas
+		 *   Atlas holding the tiles.  It is only used when render() is given
+		 *   the same TilesetCollection the atlas was built from, and is never
+		 *   modified.
+		 */
+		Map2DRenderer(const TileAtlasPtr& atlas);
+
+		/// Draw an entire map.
+		/**
+		 * Each layer is drawn on top of the one before it.  Tiles without an
+		 * image, or which could not be loaded, are not drawn.
+		 *
+		 * @param map
+		 *   Map to draw.
+		 *
+		 * @param tileset
+		 *   Tilesets to draw the map with, as passed to
+		 *   Map2D::Layer::imageFromCode().
+		 *
+		 * @param out
+		 *   On return, the map image.
+		 */
+		void render(const Map2DPtr& map, const TilesetCollectionPtr& tileset,
+			RenderedMap *out);
+
+		/// Draw an entire map, using multiple threads.
+		/**
+		 * Every tile image is looked up first on the calling thread, then the
+		 * image is split into horizontal bands which are drawn on up to the
+		 * given number of threads at once.  Each band only visits the items
+		 * that overlap it, in the same order as render() would, so the result
+		 * is identical whatever the number of threads.
+		 *
+		 * @param map
+		 *   Map to draw.
+		 *
+		 * @param tileset
+		 *   Tilesets to draw the map with, as passed to
+		 *   Map2D::Layer::imageFromCode().
+		 *
+		 * @param out
+		 *   On return, the map image.
+		 *
+		 * @param threads
+		 *   Maximum number of bands to draw at the same time, including the
+		 *   calling thread.  1 or 0 draws the whole image on the calling
+		 *   thread.
+		 */
+		void render(const Map2DPtr& map, const TilesetCollectionPtr& tileset,
+			RenderedMap *out, unsigned int threads);
+
+		/// Draw part of a map into an existing image.
+		/**
+		 * Only the items that can be seen in the area are looked at, including
+		 * images larger than a tile that start in a cell above or to the left
+		 * of it, so the time taken depends on the size of the area rather than
+		 * the size of the map.  This suits an editor redrawing its window each
+		 * time it is scrolled.  The exception is the first call for each map,
+		 * which goes through every layer once to find its largest image and,
+		 * for layers that are not a grid of tiles, to index the items by
+		 * location.  If the map's caps include Map2D::HasViewport,
+		 * passing Map2D::viewportX and Map2D::viewportY as the size shows the
+		 * same area as the game would.
+		 *
+		 * Within the bounds of the map, the result is the same as the matching
+		 * area of the image from render(), using the palette from
+		 * getPalette().  Outside them, images that hang over the right or
+		 * bottom edge of the map are drawn in full, where render() cuts them
+		 * off at the edge of its image.
+		 *
+		 * @param map
+		 *   Map to draw.
+		 *
+		 * @param tileset
+		 *   Tilesets to draw the map with, as passed to
+		 *   Map2D::Layer::imageFromCode().
+		 *
+		 * @param x
+		 *   Left edge of the area to draw, in pixels from the left of the map.
+		 *
+		 * @param y
+		 *   Top edge of the area to draw, in pixels from the top of the map.
+		 *
+		 * @param width
+		 *   Width of the area, in pixels.
+		 *
+		 * @param height
+		 *   Height of the area, in pixels.
+		 *
+		 * @param pixels
+		 *   Where to draw the top-left pixel of the area.  Every pixel in the
+		 *   area is overwritten with a palette index.
+		 *
+		 * @param stride
+		 *   Number of bytes from one row of pixels to the next.  Must be at
+		 *   least width.
+		 */
+		void renderRegion(const Map2DPtr& map,
+			const TilesetCollectionPtr& tileset, unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height, uint8_t *pixels,
+			unsigned int stride);
+
+		/// Get the palette used by images drawn with the given tilesets.
+		/**
+		 * @param tileset
+		 *   Tilesets the map will be drawn with.
+		 *
+		 * @return The same palette as render() puts in RenderedMap::palette.
+		 */
+		gamegraphics::PaletteTablePtr getPalette(
+			const TilesetCollectionPtr& tileset) const;
+
+		/// Forget all images loaded into the renderer's own atlas.
+		void clearCache();
+
+		/// Get the number of images loaded into the renderer's own atlas.
+		unsigned long getCacheSize() const;
+
+	protected:
+		TileAtlasPtr atlas; ///< Shared atlas, or empty if none supplied
+		TileAtlasPtr cache; ///< Tiles missing from atlas, loaded as needed
+
+		/// Draw an area of a map, shared by render() and renderRegion().
+		/**
+		 * @param map
+		 *   Map to draw.
+		 *
+		 * @param tileset
+		 *   Tilesets to draw the map with.
+		 *
+		 * @param wholeMap
+		 *   true if the area covers the whole map, so every item is visited
+		 *   without looking for the ones in the area first.
+		 *
+		 * @param x
+		 *   Left edge of the area, in pixels.
+		 *
+		 * @param y
+		 *   Top edge of the area, in pixels.
+		 *
+		 * @param width
+		 *   Width of the area, in pixels.
+		 *
+		 * @param height
+		 *   Height of the area, in pixels.
+		 *
+		 * @param pixels
+		 *   Where to draw the top-left pixel of the area.
+		 *
+		 * @param stride
+		 *   Number of bytes from one row of pixels to the next.
+		 *
+		 * @param threads
+		 *   Maximum number of bands to draw at the same time.
+		 */
+		void draw(const Map2DPtr& map, const TilesetCollectionPtr& tileset,
+			bool wholeMap, unsigned int x, unsigned int y, unsigned int width,
+			unsigned int height, uint8_t *pixels, unsigned int stride,
+			unsigned int threads);
+
+		/// Get the image for an item, loading it if it is not in either atlas.
+		/**
+		 * @param layerIndex
+		 *   Index of layer in the map.
+		 *
+		 * @param layer
+		 *   Layer containing item.
+		 *
+		 * @param item
+		 *   Item to find the image for.
+		 *
+		 * @param sharedAtlas
+		 *   true to look in atlas first, false to only use cache.
+		 *
+		 * @param src
+		 *   On return, the atlas holding the tile.
+		 *
+		 * @return The tile.  Its width is zero if nothing should be drawn for
+		 *   this item.
+		 */
+		const TileAtlas::Tile& getTile(unsigned int layerIndex,
+			const Map2D::LayerPtr& layer, const Map2D::Layer::ItemPtr& item,
+			bool sharedAtlas, const TileAtlas **src);
+};
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_RENDER_HPP_
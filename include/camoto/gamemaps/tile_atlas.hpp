@@ -0,0 +1,183 @@
+/**
+ * @file  camoto/gamemaps/tile_atlas.hpp
+ * @brief Decoded tile images shared between maps and threads.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_TILE_ATLAS_HPP_
+#define _CAMOTO_GAMEMAPS_TILE_ATLAS_HPP_
+
+#include <stdint.h>
+#include <utility>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <camoto/gamemaps/map2d.hpp>
+
+#ifndef DLL_EXPORT
+#define DLL_EXPORT
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// Every tile image a map format can draw, decoded in advance.
+/**
+ * Tiles are looked up by layer index and tile code, and are obtained from
+ * the layers with Map2D::Layer::imageFromCode().  All the pixels are kept in
+ * one plane of palette indices, and all the masks in a second plane with
+ * one bit per pixel.  Each tile's rows are stored one after another, and
+ * each row of the mask starts on a new byte.
+ *
+ * Since the images come from the layers, an atlas suits one map format with
+ * one set of tilesets.  It can then be used for any number of maps in that
+ * format, such as all the levels in an episode.
+ *
+ * @note Multithreading: Once built, the const functions may be called from
+ *   multiple threads at the same time.  add() must not be called while any
+ *   other thread is using the atlas.
+ */
+class DLL_EXPORT TileAtlas
+{
+	public:
+		/// Position of one tile within the atlas.
+		struct Tile {
+			unsigned int width;        ///< Image width in pixels, 0 if no image
+			unsigned int height;       ///< Image height in pixels, 0 if no image
+			unsigned long pixelOffset; ///< Offset of first pixel in pixel plane
+			unsigned long maskOffset;  ///< Offset of first byte in mask plane
+		};
+
+		/// Create an empty atlas, to be filled by add().
+		/**
+		 * @param tileset
+		 *   Tilesets to load images from.
+		 */
+		TileAtlas(const TilesetCollectionPtr& tileset);
+
+		/// Decode every tile a map format can use.
+		/**
+		 * Every item in each layer's Map2D::Layer::getValidItemList() is
+		 * added to the atlas.
+		 *
+		 * @param map
+		 *   Any map in the format the atlas will be used for.
+		 *
+		 * @param tileset
+		 *   Tilesets to load images from.
+		 */
+		TileAtlas(const Map2DPtr& map, const TilesetCollectionPtr& tileset);
+
+		/// Get the tilesets the images come from.
+		const TilesetCollectionPtr& getTileset() const;
+
+		/// Get the number of tiles in the atlas.
+		unsigned long getTileCount() const;
+
+		/// Find a tile.
+		/**
+		 * @param layerIndex
+		 *   Index of the layer in the map.
+		 *
+		 * @param code
+		 *   Map2D::Layer::Item::code of the item.
+		 *
+		 * @return The tile, or NULL if it has not been added to the atlas.
+		 */
+		const Tile *find(unsigned int layerIndex, unsigned int code) const;
+
+		/// Decode a tile and add it to the atlas.
+		/**
+		 * @param layerIndex
+		 *   Index of layer in the map.
+		 *
+		 * @param layer
+		 *   Layer containing item.
+		 *
+		 * @param item
+		 *   Item whose image is to be added.
+		 *
+		 * @return The new tile, or the existing one if the item's code has
+		 *   already been added for this layer.  The reference stays valid for
+		 *   as long as the atlas exists.
+		 */
+		const Tile& add(unsigned int layerIndex, const Map2D::LayerPtr& layer,
+			const Map2D::Layer::ItemPtr& item);
+
+		/// Get the first pixel of a tile.
+		/**
+		 * @return Pointer to Tile::width * Tile::height palette indices.  It
+		 *   becomes invalid if add() is called again.
+		 */
+		inline const uint8_t *getPixels(const Tile& tile) const
+		{
+			return &this->pixels[tile.pixelOffset];
+		}
+
+		/// Get the first byte of a tile's mask.
+		/**
+		 * @return Pointer to Tile::height rows of getMaskStride() bytes.  The
+		 *   most significant bit of each byte is the leftmost pixel, and a set
+		 *   bit means the pixel is opaque.  It becomes invalid if add() is
+		 *   called again.
+		 */
+		inline const uint8_t *getMask(const Tile& tile) const
+		{
+			return &this->mask[tile.maskOffset];
+		}
+
+		/// Get the number of bytes in each row of a tile's mask.
+		static inline unsigned int getMaskStride(const Tile& tile)
+		{
+			return (tile.width + 7) / 8;
+		}
+
+		/// Is a pixel within a tile opaque?
+		/**
+		 * @param tile
+		 *   Tile to check.
+		 *
+		 * @param x
+		 *   Horizontal offset from the left of the tile, in pixels.
+		 *
+		 * @param y
+		 *   Vertical offset from the top of the tile, in pixels.
+		 *
+		 * @return true if the pixel is drawn, false if it is transparent or
+		 *   outside the tile.
+		 */
+		bool hitTest(const Tile& tile, unsigned int x, unsigned int y) const;
+
+	protected:
+		/// Key into tiles, the layer index then the tile code.
+		typedef std::pair<unsigned int, unsigned int> TileKey;
+
+		TilesetCollectionPtr tileset; ///< Where the images came from
+		std::vector<uint8_t> pixels;  ///< Palette index of every pixel
+		std::vector<uint8_t> mask;    ///< Opacity bit of every pixel
+
+		/// Location of each tile in the planes.
+		boost::unordered_map<TileKey, Tile> tiles;
+};
+
+/// Shared pointer to a TileAtlas.
+typedef boost::shared_ptr<TileAtlas> TileAtlasPtr;
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_TILE_ATLAS_HPP_
@@ -18,14 +18,42 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include <boost/filesystem.hpp>
+#include <camoto/stream_file.hpp>
 #include <camoto/stream_memory.hpp>
+#include <camoto/stream_string.hpp>
 #include "base-maptype.hpp"
+#include "map2d-generic.hpp"
+
+/// Unchanged bytes between two changes that are written anyway.
+/**
+ * Rewriting a short run of unchanged data is cheaper than a separate seek and
+ * write, particularly over a network.
+ */
+#define DELTA_MERGE_GAP 64
 
 namespace camoto {
 namespace gamemaps {
 
 typedef std::map<SuppItem::Type, stream::expanding_inout_sptr> ExpandingSuppDataRW;
 
+ItemCatalogue::ItemCatalogue(Builder build)
+	:	build(build)
+{
+}
+
+Map2D::Layer::ItemPtrVectorPtr ItemCatalogue::get() const
+{
+	boost::mutex::scoped_lock lock(this->mutex);
+	if (!this->items) {
+		Map2D::Layer::ItemPtrVectorPtr items(new Map2D::Layer::ItemPtrVector());
+		this->build(*items);
+		this->items = items;
+	}
+	return this->items;
+}
+
 MapType_Base::MapType_Base()
 {
 }
@@ -34,9 +62,164 @@ MapType_Base::~MapType_Base()
 {
 }
 
+MapType::Certainty MapType_Base::isInstance(stream::input_sptr psMap) const
+{
+	Probe probe(psMap);
+	return this->isInstance(probe);
+}
+
+DetectFilter MapType_Base::getDetectFilter() const
+{
+	return DetectFilter();
+}
+
+MapPtr MapType_Base::openRegion(stream::input_sptr input, SuppData& suppData,
+	const MapRegion& region) const
+{
+	return this->open(input, suppData);
+}
+
+/// Target filename and the temporary file written in its place.
+typedef std::vector<std::pair<std::string, std::string> > Renames;
+
+/// Rename temporary files over their targets, so either all or none succeed.
+/**
+ * @param renames
+ *   Files to rename, in order.  Every temporary file is gone on return, even
+ *   if an exception is thrown.
+ *
+ * @param backupSuffix
+ *   Added to the target filenames to get a name to keep the originals under
+ *   until every rename has been done.
+ *
+ * @throw stream::error if a file could not be replaced.  In this case any
+ *   files that had already been replaced are back the way they were.
+ */
+static void replaceFiles(const Renames& renames, const std::string& backupSuffix)
+{
+	// Backup of each target, or empty if the target did not exist.  The last
+	// file does not need one, because if its rename fails it is untouched.
+	std::vector<std::string> backups;
+	unsigned int done = 0;
+	try {
+		for (unsigned int i = 0; i + 1 < renames.size(); i++) {
+			backups.push_back(std::string());
+			if (!boost::filesystem::exists(renames[i].first)) continue;
+			std::string backup = renames[i].first + backupSuffix;
+			// Hard links leave the original in place and copy nothing, but not
+			// every filesystem supports them.
+			boost::system::error_code ec;
+			boost::filesystem::create_hard_link(renames[i].first, backup, ec);
+			if (ec) boost::filesystem::copy_file(renames[i].first, backup);
+			backups.back() = backup;
+		}
+		for (; done < renames.size(); done++) {
+			boost::filesystem::rename(renames[done].second, renames[done].first);
+		}
+	} catch (const boost::filesystem::filesystem_error& e) {
+		boost::system::error_code ec;
+		// Put back the files that were already replaced
+		for (unsigned int i = 0; i < done; i++) {
+			if (backups[i].empty()) {
+				boost::filesystem::remove(renames[i].first, ec);
+			} else {
+				boost::filesystem::rename(backups[i], renames[i].first, ec);
+			}
+		}
+		for (unsigned int i = done; i < renames.size(); i++) {
+			boost::filesystem::remove(renames[i].second, ec);
+			if ((i < backups.size()) && (!backups[i].empty())) {
+				boost::filesystem::remove(backups[i], ec);
+			}
+		}
+		throw stream::error(std::string("Unable to replace files: ") + e.what());
+	}
+
+	for (std::vector<std::string>::const_iterator i = backups.begin();
+		i != backups.end(); i++
+	) {
+		if (i->empty()) continue;
+		boost::system::error_code ec;
+		boost::filesystem::remove(*i, ec);
+	}
+	return;
+}
+
+/// Read the entire content of a stream.
+static void readAll(stream::inout_sptr source, std::string *out)
+{
+	out->resize(source->size());
+	if (out->empty()) return;
+	source->seekg(0, stream::start);
+	source->read(&(*out)[0], out->length());
+	return;
+}
+
+/// Update a stream so it matches the given data.
+/**
+ * @param target
+ *   Stream to update.
+ *
+ * @param data
+ *   New content for the stream.  This is swapped with saved to avoid a copy,
+ *   so on return it holds the old content.
+ *
+ * @param saved
+ *   Current content of the stream.  On return this is set to data.
+ */
+static void patchStream(stream::inout_sptr target, std::string *data,
+	std::string *saved)
+{
+	std::string::size_type len = data->length();
+	if ((saved->length() != len) || (target->size() != len)) {
+		// Length has changed, so rewrite the whole thing
+		target->truncate(len);
+		target->seekp(0, stream::start);
+		target->write(data->data(), len);
+		target->flush();
+		saved->swap(*data);
+		return;
+	}
+
+	const char *newData = data->data();
+	const char *oldData = saved->data();
+	std::string::size_type i = 0;
+	while (i < len) {
+		// Most of the data is usually unchanged, so skip it a block at a time
+		if ((i + DELTA_MERGE_GAP <= len)
+			&& (memcmp(newData + i, oldData + i, DELTA_MERGE_GAP) == 0)
+		) {
+			i += DELTA_MERGE_GAP;
+			continue;
+		}
+		if (newData[i] == oldData[i]) {
+			i++;
+			continue;
+		}
+		// Find the end of this change, including any more changes that follow
+		// closely enough to be written at the same time.
+		std::string::size_type end = i + 1;
+		for (std::string::size_type j = end;
+			(j < len) && (j < end + DELTA_MERGE_GAP); j++
+		) {
+			if (newData[j] != oldData[j]) end = j + 1;
+		}
+		target->seekp(i, stream::start);
+		target->write(newData + i, end - i);
+		i = end;
+	}
+	target->flush();
+	saved->swap(*data);
+	return;
+}
+
 void MapType_Base::write(MapPtr map, stream::output_sptr output,
 	SuppData& suppData) const
 {
+	// The output no longer necessarily matches what writeChanges() last saved.
+	GenericMap2D *genMap = dynamic_cast<GenericMap2D *>(map.get());
+	if (genMap) genMap->clearSavedData(output);
+
 	stream::memory_sptr expOut(new stream::memory);
 	ExpandingSuppData expSuppData;
 	ExpandingSuppDataRW expSuppDataRW;
@@ -72,5 +255,117 @@ void MapType_Base::write(MapPtr map, stream::output_sptr output,
 	return;
 }
 
+void MapType_Base::writeChanges(MapPtr map, stream::inout_sptr output,
+	SuppData& suppData) const
+{
+	GenericMap2D *genMap = dynamic_cast<GenericMap2D *>(map.get());
+	if (!genMap) {
+		// Nowhere to keep a copy of the saved data, so rewrite everything.
+		this->write(map, output, suppData);
+		return;
+	}
+
+	// Encode the map into memory first, so any map limitations are reported
+	// before the files are touched.
+	stream::string_sptr expOut(new stream::string());
+	ExpandingSuppData expSuppData;
+	std::map<SuppItem::Type, stream::string_sptr> expSuppStrings;
+	for (SuppData::const_iterator i = suppData.begin(); i != suppData.end(); i++) {
+		stream::string_sptr s(new stream::string());
+		expSuppStrings[i->first] = s;
+		expSuppData[i->first] = s;
+	}
+	this->write(map, expOut, expSuppData);
+
+	// Until everything has been written, the map has no saved data that
+	// could be out of date.
+	GenericMap2D::SavedData saved;
+	if (!genMap->takeSavedData(output, &saved)) {
+		// First save to these streams, so compare against what is in them now.
+		readAll(output, &saved.main);
+		for (SuppData::iterator i = suppData.begin(); i != suppData.end(); i++) {
+			readAll(i->second, &saved.supps[i->first]);
+		}
+	}
+
+	patchStream(output, expOut->str(), &saved.main);
+	for (SuppData::iterator i = suppData.begin(); i != suppData.end(); i++) {
+		patchStream(i->second, expSuppStrings[i->first]->str(),
+			&saved.supps[i->first]);
+	}
+	genMap->putSavedData(output, &saved);
+	return;
+}
+
+void MapType_Base::writeFiles(MapPtr map, const std::string& filename,
+	const SuppFilenames& suppFilenames) const
+{
+	Renames renames;
+
+	// Pick temporary names alongside the targets, so the renames never have
+	// to cross filesystems.
+	std::string tmpSuffix =
+		boost::filesystem::unique_path(".%%%%-%%%%").string();
+
+	try {
+		stream::file_sptr output(new stream::file());
+		renames.push_back(std::make_pair(filename, filename + tmpSuffix + ".tmp"));
+		output->create(renames.back().second.c_str());
+
+		SuppData suppData;
+		for (SuppFilenames::const_iterator i = suppFilenames.begin();
+			i != suppFilenames.end(); i++
+		) {
+			stream::file_sptr s(new stream::file());
+			renames.push_back(std::make_pair(i->second,
+				i->second + tmpSuffix + ".tmp"));
+			s->create(renames.back().second.c_str());
+			suppData[i->first] = s;
+		}
+
+		// Nothing else can see the temporary files, so if they can grow by
+		// themselves there is no need to buffer the map in memory first.
+		stream::expanding_output_sptr directOut =
+			boost::dynamic_pointer_cast<stream::expanding_output>(output);
+		ExpandingSuppData directSuppData;
+		for (SuppData::const_iterator i = suppData.begin(); i != suppData.end(); i++) {
+			if (!directOut) break;
+			stream::expanding_output_sptr s =
+				boost::dynamic_pointer_cast<stream::expanding_output>(i->second);
+			if (!s) directOut.reset(); // fall back to buffering
+			directSuppData[i->first] = s;
+		}
+		if (directOut) {
+			this->write(map, directOut, directSuppData);
+			directOut->flush();
+			for (ExpandingSuppData::iterator i = directSuppData.begin();
+				i != directSuppData.end(); i++
+			) {
+				i->second->flush();
+			}
+		} else {
+			this->write(map, output, suppData);
+		}
+		// Streams are closed here as they go out of scope
+	} catch (...) {
+		for (Renames::const_iterator i = renames.begin(); i != renames.end(); i++) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(i->second, ec);
+		}
+		throw;
+	}
+
+	// Give the new files the same permissions as the ones they replace
+	for (Renames::const_iterator i = renames.begin(); i != renames.end(); i++) {
+		boost::system::error_code ec;
+		boost::filesystem::file_status st = boost::filesystem::status(i->first, ec);
+		if (ec || !boost::filesystem::exists(st)) continue;
+		boost::filesystem::permissions(i->second, st.permissions(), ec);
+	}
+
+	replaceFiles(renames, tmpSuffix + ".bak");
+	return;
+}
+
 } // namespace gamemaps
 } // namespace camoto
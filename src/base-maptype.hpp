@@ -21,7 +21,9 @@
 #ifndef _CAMOTO_GAMEMAPS_BASE_MAPTYPE_HPP_
 #define _CAMOTO_GAMEMAPS_BASE_MAPTYPE_HPP_
 
+#include <boost/thread/mutex.hpp>
 #include <camoto/gamemaps/maptype.hpp>
+#include <camoto/gamemaps/map2d.hpp>
 
 namespace camoto {
 namespace gamemaps {
@@ -29,6 +31,46 @@ namespace gamemaps {
 /// SuppData equivalent but with expanding output streams instead.
 typedef std::map<SuppItem::Type, stream::expanding_output_sptr> ExpandingSuppData;
 
+/// List of permitted items built on first use and shared between maps.
+/**
+ * The lists returned by Map2D::Layer::getValidItemList() are the same for
+ * every map of a given format, so rather than building them again each time
+ * a map is opened, the MapType holds one of these and hands the same list to
+ * every layer.  The items are allocated normally rather than from a map's
+ * ItemArena, so they do not keep any map's memory alive.
+ *
+ * Nothing may modify the list or its items once it has been built.
+ * Map2D::Layer::getValidItemList() hands out the shared list as read-only,
+ * and GenericMap2D::Layer::getEditableValidItemList() copies it for callers
+ * that need to change it.
+ */
+class ItemCatalogue
+{
+	public:
+		/// Function that adds the permitted items to an empty list.
+		typedef void (*Builder)(Map2D::Layer::ItemPtrVector& items);
+
+		/// Prepare a catalogue.  The list is not built until it is first used.
+		/**
+		 * @param build
+		 *   Function to call to populate the list.
+		 */
+		ItemCatalogue(Builder build);
+
+		/// Get the list, building it first if this is the first call.
+		/**
+		 * This is safe to call from multiple threads at once.
+		 *
+		 * @return The shared list of items.
+		 */
+		Map2D::Layer::ItemPtrVectorPtr get() const;
+
+	protected:
+		Builder build;                                ///< Populates the list
+		mutable boost::mutex mutex;                   ///< Guards items
+		mutable Map2D::Layer::ItemPtrVectorPtr items; ///< Null until built
+};
+
 /// Standard functionality used by all map types
 class MapType_Base: virtual public MapType
 {
@@ -36,9 +78,27 @@ class MapType_Base: virtual public MapType
 		MapType_Base();
 		virtual ~MapType_Base();
 
+		/// Read the file into a Probe and check that.
+		virtual Certainty isInstance(stream::input_sptr psMap) const;
+
+		virtual Certainty isInstance(const Probe& probe) const = 0;
+
+		/// Accept every file, leaving all the checks to isInstance().
+		virtual DetectFilter getDetectFilter() const;
+
+		/// Open the whole map, as this format cannot open part of one.
+		virtual MapPtr openRegion(stream::input_sptr input, SuppData& suppData,
+			const MapRegion& region) const;
+
 		virtual void write(MapPtr map, stream::output_sptr output,
 			SuppData& suppData) const;
 
+		virtual void writeChanges(MapPtr map, stream::inout_sptr output,
+			SuppData& suppData) const;
+
+		virtual void writeFiles(MapPtr map, const std::string& filename,
+			const SuppFilenames& suppFilenames) const;
+
 		virtual void write(MapPtr map, stream::expanding_output_sptr output,
 			ExpandingSuppData& suppData) const = 0;
 };
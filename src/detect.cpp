@@ -0,0 +1,338 @@
+/**
+ * @file  detect.cpp
+ * @brief Work out which format a map file is in.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/bind.hpp>
+#include <boost/exception_ptr.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <camoto/gamemaps/detect.hpp>
+
+namespace camoto {
+namespace gamemaps {
+
+/// Does the file pass the size and signature checks in a filter?
+static bool passesFilter(const DetectFilter& filter, const Probe& probe)
+{
+	if (filter.sizes.empty()) {
+		stream::len len = probe.size();
+		if ((len < filter.minSize) || (len > filter.maxSize)) return false;
+	}
+	for (std::vector<DetectFilter::Signature>::const_iterator
+		i = filter.signatures.begin(); i != filter.signatures.end(); i++
+	) {
+		if (i->bytes.empty()) continue;
+		std::string data(i->bytes.length(), '\0');
+		if (probe.read(i->offset, &data[0], data.length()) != data.length()) {
+			return false;
+		}
+		if (data != i->bytes) return false;
+	}
+	return true;
+}
+
+/// Does the filename have one of the given extensions?
+static bool extensionMatches(const std::string& filename,
+	const std::vector<std::string>& extensions)
+{
+	std::string ext = boost::filesystem::path(filename).extension().string();
+	if (ext.empty()) return false;
+	ext.erase(0, 1); // leading dot
+	for (std::vector<std::string>::const_iterator i = extensions.begin();
+		i != extensions.end(); i++
+	) {
+		if (boost::algorithm::iequals(ext, *i)) return true;
+	}
+	return false;
+}
+
+/// Order matches so the most likely is first.
+static bool moreLikely(const DetectMatch& a, const DetectMatch& b)
+{
+	if (a.certainty != b.certainty) return a.certainty > b.certainty;
+	bool aSupps = !a.needsSupps || a.suppsPresent;
+	bool bSupps = !b.needsSupps || b.suppsPresent;
+	if (aSupps != bSupps) return aSupps;
+	return a.extensionMatch && !b.extensionMatch;
+}
+
+/// Candidate formats being checked by one or more threads.
+struct CheckQueue
+{
+	const std::vector<unsigned int> *candidates; ///< Indices into types
+	const MapTypeVector *types;                  ///< Detector::types
+	const Probe *probe;                          ///< File being checked
+	bool stopWhenCertain;                        ///< Stop at DefinitelyYes?
+
+	boost::mutex lock;    ///< Protects the fields below
+	unsigned int next;    ///< Index into candidates of the next to check
+	unsigned int limit;   ///< Candidates at or past this index are not needed
+	std::vector<MapType::Certainty> results; ///< Result for each candidate
+	boost::exception_ptr error; ///< First unexpected exception, if any
+	unsigned int errorAt; ///< Index into candidates that threw error
+};
+
+/// Check candidates from the queue until there are none left.
+/**
+ * Candidates are taken in order, so once one returns DefinitelyYes every
+ * candidate before it has already been taken by some thread and will be
+ * finished, while none after it are started.
+ *
+ * Any exception other than stream::error is kept in the queue instead of
+ * being thrown, and treated like DefinitelyYes in that nothing after it is
+ * started.  This way the caller can rethrow it once every thread has
+ * finished, and only if checking in turn would have got that far.
+ */
+static void checkCandidates(CheckQueue *queue)
+{
+	for (;;) {
+		unsigned int c;
+		{
+			boost::mutex::scoped_lock lock(queue->lock);
+			if (queue->next >= queue->limit) return;
+			c = queue->next++;
+		}
+
+		unsigned int t = (*queue->candidates)[c];
+		MapType::Certainty certainty = MapType::DefinitelyNo;
+		bool failed = false;
+		boost::exception_ptr error;
+		try {
+			certainty = (*queue->types)[t]->isInstance(*queue->probe);
+		} catch (const stream::error&) {
+			// Treat an unreadable file as not being in this format
+		} catch (...) {
+			failed = true;
+			error = boost::current_exception();
+		}
+
+		boost::mutex::scoped_lock lock(queue->lock);
+		queue->results[c] = certainty;
+		if (failed && ((!queue->error) || (c < queue->errorAt))) {
+			queue->error = error;
+			queue->errorAt = c;
+		}
+		if (
+			(failed || (
+				queue->stopWhenCertain
+				&& (certainty == MapType::DefinitelyYes)
+			))
+			&& (c + 1 < queue->limit)
+		) {
+			queue->limit = c + 1;
+		}
+	}
+}
+
+/// Wait for the threads in a group when going out of scope.
+/**
+ * This makes sure no thread is left using data on the stack of a function
+ * that has thrown an exception.
+ */
+class JoinGuard
+{
+	public:
+		JoinGuard(boost::thread_group *threads)
+			:	threads(threads)
+		{
+		}
+
+		~JoinGuard()
+		{
+			this->threads->join_all();
+		}
+
+	protected:
+		boost::thread_group *threads; ///< Threads to wait for
+};
+
+Detector::Detector(const ManagerPtr& manager)
+{
+	MapTypePtr type;
+	for (unsigned int i = 0; (type = manager->getMapType(i)); i++) {
+		this->types.push_back(type);
+	}
+	this->buildIndex();
+}
+
+Detector::Detector(const MapTypeVector& types)
+	:	types(types)
+{
+	this->buildIndex();
+}
+
+void Detector::buildIndex()
+{
+	for (unsigned int i = 0; i < this->types.size(); i++) {
+		this->filters.push_back(this->types[i]->getDetectFilter());
+		const DetectFilter& filter = this->filters.back();
+		if (filter.sizes.empty()) {
+			this->byRange.push_back(i);
+		} else {
+			for (std::vector<stream::len>::const_iterator
+				s = filter.sizes.begin(); s != filter.sizes.end(); s++
+			) {
+				this->bySize[*s].push_back(i);
+			}
+		}
+	}
+	return;
+}
+
+DetectMatchVector Detector::detect(stream::input_sptr input,
+	const std::string& filename) const
+{
+	Probe probe(input);
+	return this->detect(input, probe, filename, 1, false);
+}
+
+DetectMatchVector Detector::detect(stream::input_sptr input,
+	const Probe& probe, const std::string& filename) const
+{
+	return this->detect(input, probe, filename, 1, false);
+}
+
+DetectMatchVector Detector::detect(stream::input_sptr input,
+	const Probe& probe, const std::string& filename, unsigned int threads,
+	bool stopWhenCertain) const
+{
+	// Find the formats that accept this file size, in Manager order
+	std::vector<unsigned int> sizeMatches;
+	std::map<stream::len, std::vector<unsigned int> >::const_iterator sized =
+		this->bySize.find(probe.size());
+	if (sized != this->bySize.end()) sizeMatches = sized->second;
+	sizeMatches.insert(sizeMatches.end(), this->byRange.begin(),
+		this->byRange.end());
+	std::sort(sizeMatches.begin(), sizeMatches.end());
+
+	// The filters are quick, so run them here and only hand the formats that
+	// pass on to other threads.
+	std::vector<unsigned int> candidates;
+	for (std::vector<unsigned int>::const_iterator i = sizeMatches.begin();
+		i != sizeMatches.end(); i++
+	) {
+		if (passesFilter(this->filters[*i], probe)) candidates.push_back(*i);
+	}
+
+	CheckQueue queue;
+	queue.candidates = &candidates;
+	queue.types = &this->types;
+	queue.probe = &probe;
+	queue.stopWhenCertain = stopWhenCertain;
+	queue.next = 0;
+	queue.limit = candidates.size();
+	queue.results.assign(candidates.size(), MapType::DefinitelyNo);
+	queue.errorAt = 0;
+
+	{
+		// The calling thread does its share too, so only start the extra ones.
+		// There are none at all for a single candidate.
+		boost::thread_group workers;
+		JoinGuard guard(&workers);
+		for (unsigned int i = 1; (i < threads) && (i < candidates.size()); i++) {
+			try {
+				workers.create_thread(boost::bind(checkCandidates, &queue));
+			} catch (const boost::thread_resource_error&) {
+				// Carry on with the threads that did start, if any
+				break;
+			}
+		}
+		checkCandidates(&queue);
+	}
+	if (queue.error && (queue.errorAt < queue.limit)) {
+		boost::rethrow_exception(queue.error);
+	}
+
+	DetectMatchVector matches;
+	for (unsigned int c = 0; c < queue.limit; c++) {
+		if (queue.results[c] == MapType::DefinitelyNo) continue;
+		DetectMatch match;
+		match.type = this->types[candidates[c]];
+		match.certainty = queue.results[c];
+		matches.push_back(match);
+	}
+	Detector::rank(&matches, input, filename);
+	return matches;
+}
+
+void Detector::rank(DetectMatchVector *matches, stream::input_sptr input,
+	const std::string& filename)
+{
+	for (DetectMatchVector::iterator match = matches->begin();
+		match != matches->end(); match++
+	) {
+		switch (match->certainty) {
+			case MapType::DefinitelyYes:
+				match->reason = "signature matched";
+				break;
+			case MapType::PossiblyYes:
+				match->reason = "all checks passed but there is no signature";
+				break;
+			default:
+				match->reason = "checks were inconclusive";
+				break;
+		}
+
+		match->extensionMatch = !filename.empty()
+			&& extensionMatches(filename, match->type->getFileExtensions());
+		if (match->extensionMatch) {
+			match->reason += "; filename extension matched";
+		}
+
+		// See whether any supplemental files are present
+		match->needsSupps = false;
+		match->suppsPresent = false;
+		if (filename.empty()) continue;
+		if (match->supps.empty()) {
+			try {
+				match->supps = match->type->getRequiredSupps(input, filename);
+			} catch (const stream::error&) {
+				// Treat this as if the files are missing
+				match->needsSupps = true;
+				match->reason += "; unable to work out supplemental files";
+			}
+		}
+		if (!match->supps.empty()) {
+			match->needsSupps = true;
+			match->suppsPresent = true;
+			for (SuppFilenames::const_iterator s = match->supps.begin();
+				s != match->supps.end(); s++
+			) {
+				boost::system::error_code ec;
+				if (!boost::filesystem::is_regular_file(s->second, ec)) {
+					match->suppsPresent = false;
+					match->reason += "; supplemental file " + s->second
+						+ " not found";
+					break;
+				}
+			}
+			if (match->suppsPresent) {
+				match->reason += "; all supplemental files present";
+			}
+		}
+	}
+
+	std::stable_sort(matches->begin(), matches->end(), moreLikely);
+	return;
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,324 @@
+/**
+ * @file  detect_cache.cpp
+ * @brief On-disk cache of format detection results.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#include <camoto/gamemaps/detect.hpp>
+#include <camoto/gamemaps/detect_cache.hpp>
+#include <camoto/gamemaps/input_mmap.hpp>
+
+#ifndef PACKAGE_VERSION
+#define PACKAGE_VERSION "unknown"
+#endif
+
+/// Amount of the file to hash at a time, when it is not in memory.
+#define HASH_CHUNK_LEN 65536
+
+/// Seconds since a file last changed before its saved hash can be trusted.
+#define STAMP_SETTLE_TIME 2
+
+namespace camoto {
+namespace gamemaps {
+
+/// Add data to a 64-bit FNV-1a hash.
+static void hashData(uint64_t *hash, const uint8_t *data, stream::len len)
+{
+	uint64_t h = *hash;
+	for (const uint8_t *end = data + len; data != end; data++) {
+		h ^= *data;
+		h *= 0x100000001b3ULL;
+	}
+	*hash = h;
+	return;
+}
+
+/// Hash the whole content of a stream.
+static uint64_t hashStream(stream::input_sptr input, stream::len len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	input_mmap *mem = dynamic_cast<input_mmap *>(input.get());
+	if (mem) {
+		hashData(&hash, mem->data(), len);
+		return hash;
+	}
+	std::vector<uint8_t> buf(HASH_CHUNK_LEN);
+	input->seekg(0, stream::start);
+	for (;;) {
+		stream::len lenRead = input->try_read(&buf[0], buf.size());
+		if (lenRead == 0) break;
+		hashData(&hash, &buf[0], lenRead);
+	}
+	return hash;
+}
+
+/// Describe a file on disk precisely enough to tell when it has changed.
+/**
+ * @param filename
+ *   Full path of the file.
+ *
+ * @param len
+ *   Size of the stream being checked, which must be the size of the file.
+ *
+ * @param stamp
+ *   On return, the file's size, device, inode and times as text.
+ *
+ * @return true if stamp was set, false if the file must be hashed instead
+ *   because it has changed too recently, is not the same size as the stream,
+ *   or the system doesn't give precise enough times.
+ */
+static bool getFileStamp(const std::string& filename, stream::len len,
+	std::string *stamp)
+{
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_STRUCT_STAT_ST_MTIM) \
+	&& defined(HAVE_STRUCT_STAT_ST_CTIM)
+	struct stat st;
+	if (stat(filename.c_str(), &st) != 0) return false;
+	if (!S_ISREG(st.st_mode) || ((stream::len)st.st_size != len)) return false;
+
+	// Times are only as fine as the file system's clock, so a file written
+	// again moments after it was hashed could end up with the same times.
+	if (st.st_mtim.tv_sec + STAMP_SETTLE_TIME > std::time(NULL)) return false;
+
+	std::ostringstream s;
+	s << len << ' ' << (unsigned long long)st.st_dev << ' '
+		<< (unsigned long long)st.st_ino << ' '
+		<< (long long)st.st_mtim.tv_sec << '.' << std::setfill('0')
+		<< std::setw(9) << st.st_mtim.tv_nsec << ' '
+		<< (long long)st.st_ctim.tv_sec << '.' << std::setw(9)
+		<< st.st_ctim.tv_nsec;
+	*stamp = s.str();
+	return true;
+#else
+	return false;
+#endif
+}
+
+DetectCache::DetectCache(const ManagerPtr& manager, const std::string& path)
+	:	manager(manager),
+		path(path),
+		hits(0),
+		misses(0)
+{
+	boost::system::error_code ec;
+	boost::filesystem::create_directories(path, ec);
+	if (!boost::filesystem::is_directory(path)) {
+		throw stream::error("Unable to create cache folder " + path);
+	}
+}
+
+/// Write a cache file alongside its final name then rename it into place.
+/**
+ * This way other readers never see a partially written file.  Errors are
+ * ignored, as the cache is only an optimisation.
+ */
+static void replaceEntry(const std::string& entry, const std::string& content)
+{
+	std::string tmp = entry
+		+ boost::filesystem::unique_path(".%%%%-%%%%.tmp").string();
+	{
+		std::ofstream file(tmp.c_str());
+		file << content;
+		file.close();
+		if (!file) {
+			boost::system::error_code ec;
+			boost::filesystem::remove(tmp, ec);
+			return;
+		}
+	}
+	boost::system::error_code ec;
+	boost::filesystem::rename(tmp, entry, ec);
+	if (ec) boost::filesystem::remove(tmp, ec);
+	return;
+}
+
+DetectMatchVector DetectCache::detect(stream::input_sptr input,
+	const std::string& filename)
+{
+	stream::len len = input->size();
+
+	// If the file on disk is exactly as it was the last time it was hashed,
+	// reuse that hash instead of reading the whole file.
+	std::string fileEntry, fullName, stamp;
+	if (!filename.empty()) {
+		fullName = boost::filesystem::absolute(filename).string();
+		if (getFileStamp(fullName, len, &stamp)) {
+			uint64_t pathHash = 0xcbf29ce484222325ULL;
+			hashData(&pathHash, (const uint8_t *)fullName.data(),
+				fullName.length());
+			std::ostringstream fileName;
+			fileName << "file-" << std::hex << std::setfill('0')
+				<< std::setw(16) << pathHash;
+			fileEntry = (boost::filesystem::path(this->path) / fileName.str())
+				.string();
+		}
+	}
+	uint64_t hash;
+	if (fileEntry.empty()) {
+		hash = hashStream(input, len);
+	} else if (!this->loadHash(fileEntry, fullName, stamp, &hash)) {
+		hash = hashStream(input, len);
+		this->saveHash(fileEntry, fullName, stamp, hash);
+	}
+
+	std::ostringstream name, key;
+	name << std::hex << std::setfill('0') << std::setw(16) << hash << '-'
+		<< std::dec << len;
+	key << "libgamemaps " PACKAGE_VERSION " " << name.str();
+	std::string entry = (boost::filesystem::path(this->path) / name.str())
+		.string();
+
+	DetectMatchVector matches;
+	if (this->load(entry, key.str(), filename, &matches)) {
+		Detector::rank(&matches, input, filename);
+		boost::mutex::scoped_lock lock(this->lock);
+		this->hits++;
+		return matches;
+	}
+
+	matches = this->manager->detect(input, filename);
+	this->save(entry, key.str(), filename, matches);
+	boost::mutex::scoped_lock lock(this->lock);
+	this->misses++;
+	return matches;
+}
+
+unsigned long DetectCache::getHits() const
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	return this->hits;
+}
+
+unsigned long DetectCache::getMisses() const
+{
+	boost::mutex::scoped_lock lock(this->lock);
+	return this->misses;
+}
+
+bool DetectCache::load(const std::string& entry, const std::string& key,
+	const std::string& filename, DetectMatchVector *matches) const
+{
+	std::ifstream file(entry.c_str());
+	if (!file) return false;
+
+	std::string line;
+	if (!std::getline(file, line) || (line != key)) return false;
+
+	// Supplemental filenames only apply to the name they were worked out from
+	std::string suppsFor;
+	if (!std::getline(file, line) || (line.compare(0, 9, "filename ") != 0)) {
+		return false;
+	}
+	suppsFor = line.substr(9);
+	bool keepSupps = !filename.empty() && (filename == suppsFor);
+
+	matches->clear();
+	while (std::getline(file, line)) {
+		std::istringstream fields(line);
+		std::string field;
+		fields >> field;
+		if (field == "match") {
+			std::string code;
+			int certainty;
+			if (!(fields >> code >> certainty)) return false;
+			if ((certainty <= MapType::DefinitelyNo)
+				|| (certainty > MapType::DefinitelyYes)
+			) {
+				return false;
+			}
+			DetectMatch match;
+			match.type = this->manager->getMapTypeByCode(code);
+			if (!match.type) return false;
+			match.certainty = (MapType::Certainty)certainty;
+			matches->push_back(match);
+		} else if (field == "supp") {
+			int type;
+			if (matches->empty() || !(fields >> type)) return false;
+			std::string suppName;
+			std::getline(fields >> std::ws, suppName);
+			if (keepSupps) {
+				matches->back().supps[(SuppItem::Type)type] = suppName;
+			}
+		} else {
+			return false;
+		}
+	}
+	return true;
+}
+
+void DetectCache::save(const std::string& entry, const std::string& key,
+	const std::string& filename, const DetectMatchVector& matches) const
+{
+	std::ostringstream file;
+	file << key << "\nfilename " << filename << "\n";
+	for (DetectMatchVector::const_iterator i = matches.begin();
+		i != matches.end(); i++
+	) {
+		file << "match " << i->type->getMapCode() << ' ' << (int)i->certainty
+			<< "\n";
+		for (SuppFilenames::const_iterator s = i->supps.begin();
+			s != i->supps.end(); s++
+		) {
+			file << "supp " << (int)s->first << ' ' << s->second << "\n";
+		}
+	}
+	replaceEntry(entry, file.str());
+	return;
+}
+
+bool DetectCache::loadHash(const std::string& entry,
+	const std::string& filename, const std::string& stamp, uint64_t *hash) const
+{
+	std::ifstream file(entry.c_str());
+	if (!file) return false;
+
+	std::string line;
+	if (!std::getline(file, line) || (line != "libgamemaps " PACKAGE_VERSION)) {
+		return false;
+	}
+	if (!std::getline(file, line) || (line != "filename " + filename)) {
+		return false;
+	}
+	if (!std::getline(file, line) || (line != "stamp " + stamp)) return false;
+	if (!(file >> std::hex >> *hash)) return false;
+	return true;
+}
+
+void DetectCache::saveHash(const std::string& entry,
+	const std::string& filename, const std::string& stamp, uint64_t hash) const
+{
+	std::ostringstream file;
+	file << "libgamemaps " PACKAGE_VERSION "\nfilename " << filename
+		<< "\nstamp " << stamp << "\n" << std::hex << hash << "\n";
+	replaceEntry(entry, file.str());
+	return;
+}
+
+} // namespace gamemaps
+} // namespace camoto
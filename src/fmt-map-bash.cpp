@@ -25,6 +25,7 @@
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-bash.hpp"
 
 /// Width of map tiles
@@ -383,14 +384,16 @@ class Map2D_Bash: virtual public GenericMap2D
 	public:
 		Map2D_Bash(const Attributes& attributes,
 			unsigned int width, unsigned int height,
-			LayerPtrVector& layers)
+			LayerPtrVector& layers,
+			const ItemArenaPtr& arena)
 			:	GenericMap2D(
 					attributes, GraphicsFilenames(),
 					Map2D::HasViewport,
 					MB_VIEWPORT_WIDTH, MB_VIEWPORT_HEIGHT,
 					width, height,
 					MB_TILE_WIDTH, MB_TILE_HEIGHT,
-					layers, Map2D::PathPtrVectorPtr()
+					layers, Map2D::PathPtrVectorPtr(),
+					arena
 				)
 		{
 			// Populate the graphics filenames
@@ -417,6 +420,133 @@ class Map2D_Bash: virtual public GenericMap2D
 };
 
 
+/// Populate the list of permitted background tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= MB_MAX_VALID_BG_TILECODE; i++) {
+		if (i == MB_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted attributes.
+static void buildValidAttrItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < 16; i++) {
+		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
+		ta->type = Map2D::Layer::Item::Blocking;
+		ta->x = 0;
+		ta->y = 0;
+		ta->code = i;
+		ta->blocking().flags = 0;
+		if (i & 1) ta->blocking().flags |= Map2D::Layer::Item::BlockLeft;
+		if (i & 2) ta->blocking().flags |= Map2D::Layer::Item::BlockRight;
+		if (i & 4) ta->blocking().flags |= Map2D::Layer::Item::BlockTop;
+		if (i & 8) ta->blocking().flags |= Map2D::Layer::Item::BlockBottom;
+		items.push_back(ta);
+	}
+	{
+		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
+		ta->type = Map2D::Layer::Item::Blocking;
+		ta->x = 0;
+		ta->y = 0;
+		ta->code = 32;
+		ta->blocking().flags = 0;
+		ta->blocking().flags |= Map2D::Layer::Item::Slant45;
+		items.push_back(ta);
+	}
+	{
+		// Ladder
+		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
+		ta->type = Map2D::Layer::Item::Movement;
+		ta->x = 0;
+		ta->y = 0;
+		ta->code = 64;
+		ta->movement().flags = Map2D::Layer::Item::DistanceLimit;
+		ta->movement().distLeft = 0;
+		ta->movement().distRight = 0;
+		ta->movement().distUp = Map2D::Layer::Item::DistIndeterminate;
+		ta->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
+		items.push_back(ta);
+	}
+	{
+		// Top of ladder (can stand on)
+		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
+		ta->type = Map2D::Layer::Item::Blocking | Map2D::Layer::Item::Movement;
+		ta->x = 0;
+		ta->y = 0;
+		ta->code = 64 | 4;
+		ta->blocking().flags = Map2D::Layer::Item::BlockTop;
+		ta->movement().flags = Map2D::Layer::Item::DistanceLimit;
+		ta->movement().distLeft = 0;
+		ta->movement().distRight = 0;
+		ta->movement().distUp = Map2D::Layer::Item::DistIndeterminate;
+		ta->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
+		items.push_back(ta);
+	}
+	return;
+}
+
+/// Populate the list of permitted interactive flags.
+static void buildValidPointItems(Map2D::Layer::ItemPtrVector& items)
+{
+	Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
+	ta->type = Map2D::Layer::Item::Flags;
+	ta->x = 0;
+	ta->y = 0;
+	ta->code = 1;
+	ta->generalFlags = Map2D::Layer::Item::Interactive;
+	items.push_back(ta);
+	return;
+}
+
+/// Populate the list of permitted foreground tiles.
+static void buildValidFGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= MB_MAX_VALID_FG_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		if (i == MB_DEFAULT_FGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted sprites.
+static void buildValidSprites(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int s = 0; s < sizeof(spriteFilenames) / sizeof(const char *); s++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = 1000000 + s;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Bash::MapType_Bash()
+	:	validBGCatalogue(buildValidBGItems),
+		validAttrCatalogue(buildValidAttrItems),
+		validPointCatalogue(buildValidPointItems),
+		validFGCatalogue(buildValidFGItems),
+		validSpriteCatalogue(buildValidSprites)
+{
+}
+
 std::string MapType_Bash::getMapCode() const
 {
 	return "map-bash";
@@ -441,10 +571,10 @@ std::vector<std::string> MapType_Bash::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Bash::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Bash::isInstance(const Probe& probe) const
 {
 	bool maybe = false;
-	stream::len len = psMap->size();
+	stream::len len = probe.size();
 
 	// Make sure the file is large enough...
 	// TESTED BY: fmt_map_bash_isinstance_c01
@@ -457,8 +587,7 @@ MapType::Certainty MapType_Bash::isInstance(stream::input_sptr psMap) const
 	uint8_t data[218]; // 7*31+1
 	memset(data, 0, sizeof(data));
 	uint8_t *d = data;
-	psMap->seekg(0, stream::start);
-	psMap->read(d, len);
+	if (probe.read(0, d, len) != len) return MapType::DefinitelyNo; // read error
 	for (int n = 0; n < 7; n++) {
 		bool null = false;
 		for (int i = 0; i < 31; i++) {
@@ -483,6 +612,14 @@ MapType::Certainty MapType_Bash::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Bash::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 187;
+	filter.maxSize = 217;
+	return filter;
+}
+
 MapPtr MapType_Bash::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -491,6 +628,8 @@ MapPtr MapType_Bash::create(SuppData& suppData) const
 
 MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	stream::input_sptr bg = suppData[SuppItem::Layer1];
 	stream::input_sptr fg = suppData[SuppItem::Layer2];
 	stream::input_sptr spr = suppData[SuppItem::Layer3];
@@ -567,137 +706,67 @@ MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::Layer::ItemPtrVectorPtr bgpoints(new Map2D::Layer::ItemPtrVector());
 	bgtiles->reserve(mapWidth * mapHeight);
 	bgattributes->reserve(mapWidth * mapHeight);
-	for (unsigned int y = 0; y < mapHeight; y++) {
-		for (unsigned int x = 0; x < mapWidth; x++) {
-			uint16_t code;
-			bg >> u16le(code);
-			lenBG -= 2;
-
-			if ((code & 0x1FF) != MB_DEFAULT_BGTILE) {
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-				t->type = Map2D::Layer::Item::Default;
-				t->x = x;
-				t->y = y;
-				t->code = code & 0x1FF;
-				bgtiles->push_back(t);
-			}
 
-			if ((code >> 9) & ~16) {
-				Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-				ta->type = Map2D::Layer::Item::Blocking;
-				ta->x = x;
-				ta->y = y;
-				ta->code = (code >> 9) & ~16; // deselect point item flag
-				ta->blockingFlags = 0;
-				if (code & (1<<9)) ta->blockingFlags |= Map2D::Layer::Item::BlockLeft;
-				if (code & (2<<9)) ta->blockingFlags |= Map2D::Layer::Item::BlockRight;
-				if (code & (4<<9)) ta->blockingFlags |= Map2D::Layer::Item::BlockTop;
-				if (code & (8<<9)) ta->blockingFlags |= Map2D::Layer::Item::BlockBottom;
-				if (code & (32<<9)) ta->blockingFlags |= Map2D::Layer::Item::Slant45;
-				if (code & (64<<9)) {
-					ta->type |= Map2D::Layer::Item::Movement;
-					ta->movementFlags = Map2D::Layer::Item::DistanceLimit;
-					ta->movementDistLeft = 0;
-					ta->movementDistRight = 0;
-					ta->movementDistUp = Map2D::Layer::Item::DistIndeterminate;
-					ta->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
-				}
-				bgattributes->push_back(ta);
-			}
+	unsigned int lenCodes = mapWidth * mapHeight;
+	if (lenBG < (stream::pos)(lenCodes * 2)) lenCodes = lenBG / 2;
+	std::vector<uint16_t> bgcodes(lenCodes);
+	if (lenCodes) readBlock16le(bg, &bgcodes[0], lenCodes);
 
-			if (code & (16<<9)) {
-				Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-				ta->type = Map2D::Layer::Item::Flags;
-				ta->x = x;
-				ta->y = y;
-				ta->code = 1;
-				ta->generalFlags = Map2D::Layer::Item::Interactive;
-				bgpoints->push_back(ta);
-			}
+	for (unsigned int i = 0; i < lenCodes; i++) {
+		unsigned int x = i % mapWidth;
+		unsigned int y = i / mapWidth;
+		uint16_t code = bgcodes[i];
 
-			if (lenBG < 2) break;
+		if ((code & 0x1FF) != MB_DEFAULT_BGTILE) {
+			Map2D::Layer::ItemPtr t(createItem(arena));
+			t->type = Map2D::Layer::Item::Default;
+			t->x = x;
+			t->y = y;
+			t->code = code & 0x1FF;
+			bgtiles->push_back(t);
 		}
-		if (lenBG < 2) break;
-	}
 
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= MB_MAX_VALID_BG_TILECODE; i++) {
-		if (i == MB_DEFAULT_BGTILE) continue;
+		if ((code >> 9) & ~16) {
+			Map2D::Layer::ItemPtr ta(createItem(arena));
+			ta->type = Map2D::Layer::Item::Blocking;
+			ta->x = x;
+			ta->y = y;
+			ta->code = (code >> 9) & ~16; // deselect point item flag
+			ta->blocking().flags = 0;
+			if (code & (1<<9)) ta->blocking().flags |= Map2D::Layer::Item::BlockLeft;
+			if (code & (2<<9)) ta->blocking().flags |= Map2D::Layer::Item::BlockRight;
+			if (code & (4<<9)) ta->blocking().flags |= Map2D::Layer::Item::BlockTop;
+			if (code & (8<<9)) ta->blocking().flags |= Map2D::Layer::Item::BlockBottom;
+			if (code & (32<<9)) ta->blocking().flags |= Map2D::Layer::Item::Slant45;
+			if (code & (64<<9)) {
+				ta->type |= Map2D::Layer::Item::Movement;
+				ta->movement().flags = Map2D::Layer::Item::DistanceLimit;
+				ta->movement().distLeft = 0;
+				ta->movement().distRight = 0;
+				ta->movement().distUp = Map2D::Layer::Item::DistIndeterminate;
+				ta->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
+			}
+			bgattributes->push_back(ta);
+		}
 
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
+		if (code & (16<<9)) {
+			Map2D::Layer::ItemPtr ta(createItem(arena));
+			ta->type = Map2D::Layer::Item::Flags;
+			ta->x = x;
+			ta->y = y;
+			ta->code = 1;
+			ta->generalFlags = Map2D::Layer::Item::Interactive;
+			bgpoints->push_back(ta);
+		}
 	}
+
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 	Map2D::LayerPtr bgLayer(new Layer_BashBackground(bgtiles, validBGItems));
 
-	Map2D::Layer::ItemPtrVectorPtr validAttrItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i < 16; i++) {
-		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-		ta->type = Map2D::Layer::Item::Blocking;
-		ta->x = 0;
-		ta->y = 0;
-		ta->code = i;
-		ta->blockingFlags = 0;
-		if (i & 1) ta->blockingFlags |= Map2D::Layer::Item::BlockLeft;
-		if (i & 2) ta->blockingFlags |= Map2D::Layer::Item::BlockRight;
-		if (i & 4) ta->blockingFlags |= Map2D::Layer::Item::BlockTop;
-		if (i & 8) ta->blockingFlags |= Map2D::Layer::Item::BlockBottom;
-		validAttrItems->push_back(ta);
-	}
-	{
-		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-		ta->type = Map2D::Layer::Item::Blocking;
-		ta->x = 0;
-		ta->y = 0;
-		ta->code = 32;
-		ta->blockingFlags = 0;
-		ta->blockingFlags |= Map2D::Layer::Item::Slant45;
-		validAttrItems->push_back(ta);
-	}
-	{
-		// Ladder
-		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-		ta->type = Map2D::Layer::Item::Movement;
-		ta->x = 0;
-		ta->y = 0;
-		ta->code = 64;
-		ta->movementFlags = Map2D::Layer::Item::DistanceLimit;
-		ta->movementDistLeft = 0;
-		ta->movementDistRight = 0;
-		ta->movementDistUp = Map2D::Layer::Item::DistIndeterminate;
-		ta->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
-		validAttrItems->push_back(ta);
-	}
-	{
-		// Top of ladder (can stand on)
-		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-		ta->type = Map2D::Layer::Item::Blocking | Map2D::Layer::Item::Movement;
-		ta->x = 0;
-		ta->y = 0;
-		ta->code = 64 | 4;
-		ta->blockingFlags = Map2D::Layer::Item::BlockTop;
-		ta->movementFlags = Map2D::Layer::Item::DistanceLimit;
-		ta->movementDistLeft = 0;
-		ta->movementDistRight = 0;
-		ta->movementDistUp = Map2D::Layer::Item::DistIndeterminate;
-		ta->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
-		validAttrItems->push_back(ta);
-	}
+	Map2D::Layer::ItemPtrVectorPtr validAttrItems = this->validAttrCatalogue.get();
 	Map2D::LayerPtr attrLayer(new Layer_BashInvisible("Attributes", bgattributes, validAttrItems));
 
-	Map2D::Layer::ItemPtrVectorPtr validPointItems(new Map2D::Layer::ItemPtrVector());
-	{
-		Map2D::Layer::ItemPtr ta(new Map2D::Layer::Item());
-		ta->type = Map2D::Layer::Item::Flags;
-		ta->x = 0;
-		ta->y = 0;
-		ta->code = 1;
-		ta->generalFlags = Map2D::Layer::Item::Interactive;
-		validPointItems->push_back(ta);
-	}
+	Map2D::Layer::ItemPtrVectorPtr validPointItems = this->validPointCatalogue.get();
 	Map2D::LayerPtr pointLayer(new Layer_BashInvisible("Interactive flags", bgpoints, validPointItems));
 
 	// Read the foreground layer
@@ -707,34 +776,24 @@ MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 
 	Map2D::Layer::ItemPtrVectorPtr fgtiles(new Map2D::Layer::ItemPtrVector());
 	fgtiles->reserve(mapWidth * mapHeight);
-	for (unsigned int y = 0; y < mapHeight; y++) {
-		for (unsigned int x = 0; x < mapWidth; x++) {
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = x;
-			t->y = y;
-			uint8_t code;
-			fg >> u8(code);
-			lenFG--;
-			t->code = code;
-			if (code != MB_DEFAULT_FGTILE) fgtiles->push_back(t);
-			if (lenFG < 1) break;
-		}
-		if (lenFG < 1) break;
-	}
 
-	Map2D::Layer::ItemPtrVectorPtr validFGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= MB_MAX_VALID_FG_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		if (i == MB_DEFAULT_FGTILE) continue;
+	lenCodes = mapWidth * mapHeight;
+	if (lenFG < (stream::pos)lenCodes) lenCodes = lenFG;
+	std::vector<uint8_t> fgcodes(lenCodes);
+	if (lenCodes) fg->read(&fgcodes[0], lenCodes);
 
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+	for (unsigned int i = 0; i < lenCodes; i++) {
+		if (fgcodes[i] == MB_DEFAULT_FGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validFGItems->push_back(t);
+		t->x = i % mapWidth;
+		t->y = i / mapWidth;
+		t->code = fgcodes[i];
+		fgtiles->push_back(t);
 	}
+
+	Map2D::Layer::ItemPtrVectorPtr validFGItems = this->validFGCatalogue.get();
 	Map2D::LayerPtr fgLayer(new Layer_BashForeground(fgtiles, validFGItems));
 
 	// Read the sprite layer
@@ -744,7 +803,7 @@ MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 
 	Map2D::Layer::ItemPtrVectorPtr sprtiles(new Map2D::Layer::ItemPtrVector());
 	while (lenSpr > 4) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		uint32_t lenEntry;
 		uint32_t unknown1, unknown2;
@@ -775,15 +834,7 @@ MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 		lenSpr -= lenEntry;
 	}
 
-	Map2D::Layer::ItemPtrVectorPtr validSprites(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int s = 0; s < sizeof(spriteFilenames) / sizeof(const char *); s++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = 1000000 + s;
-		validSprites->push_back(t);
-	}
+	Map2D::Layer::ItemPtrVectorPtr validSprites = this->validSpriteCatalogue.get();
 	Map2D::LayerPtr sprLayer(new Layer_BashSprite(sprtiles, validSprites));
 
 
@@ -794,7 +845,7 @@ MapPtr MapType_Bash::open(stream::input_sptr input, SuppData& suppData) const
 	layers.push_back(attrLayer);
 	layers.push_back(pointLayer);
 
-	Map2DPtr map(new Map2D_Bash(attributes, mapWidth, mapHeight, layers));
+	Map2DPtr map(new Map2D_Bash(attributes, mapWidth, mapHeight, layers, arena));
 
 	return map;
 }
@@ -881,14 +932,14 @@ void MapType_Bash::write(MapPtr map, stream::expanding_output_sptr output,
 				}
 				uint16_t code = 0;
 				if (ta->type & Map2D::Layer::Item::Blocking) {
-					if (ta->blockingFlags & Map2D::Layer::Item::BlockLeft) code |= (1<<9);
-					if (ta->blockingFlags & Map2D::Layer::Item::BlockRight) code |= (2<<9);
-					if (ta->blockingFlags & Map2D::Layer::Item::BlockTop) code |= (4<<9);
-					if (ta->blockingFlags & Map2D::Layer::Item::BlockBottom) code |= (8<<9);
-					if (ta->blockingFlags & Map2D::Layer::Item::Slant45) code |= (32<<9);
+					if (ta->blocking().flags & Map2D::Layer::Item::BlockLeft) code |= (1<<9);
+					if (ta->blocking().flags & Map2D::Layer::Item::BlockRight) code |= (2<<9);
+					if (ta->blocking().flags & Map2D::Layer::Item::BlockTop) code |= (4<<9);
+					if (ta->blocking().flags & Map2D::Layer::Item::BlockBottom) code |= (8<<9);
+					if (ta->blocking().flags & Map2D::Layer::Item::Slant45) code |= (32<<9);
 				}
 				if (ta->type & Map2D::Layer::Item::Movement) {
-					if (ta->movementFlags & Map2D::Layer::Item::DistanceLimit) code |= (64<<9);
+					if (ta->movement().flags & Map2D::Layer::Item::DistanceLimit) code |= (64<<9);
 				}
 				bgdata[(*i)->y * mapWidth + (*i)->x] |= code;
 			}
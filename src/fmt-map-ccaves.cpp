@@ -106,6 +106,15 @@ class Layer_CCavesBackground: virtual public GenericMap2D::Layer
 };
 
 
+//static const unsigned int fgtile = MAKE_TILE(21, 20); // solid cyan
+//static const unsigned int fgtile = MAKE_TILE(19, 20); // blue rock
+//static const unsigned int fgtile = MAKE_TILE(22, 12); // solid blue
+//static const unsigned int fgtile = MAKE_TILE(21, 12); // wavy green
+static const unsigned int block_tile = MAKE_TILE(21, 32); // solid brown
+//static const unsigned int ibeam_tile = MAKE_TILE(19,  3); // blue
+static const unsigned int ibeam_tile = MAKE_TILE(19,  6); // red
+static const unsigned int underscore_tile = MAKE_TILE(19,  0); // blue
+
 /// Convert the CCTF_* flags into Map2D flags
 void setFlags(Map2D::Layer::ItemPtr& item, unsigned int flags)
 {
@@ -114,32 +123,131 @@ void setFlags(Map2D::Layer::ItemPtr& item, unsigned int flags)
 			break;
 		case CCTF_MV_VERT:
 			item->type |= Map2D::Layer::Item::Movement;
-			item->movementFlags = Map2D::Layer::Item::DistanceLimit;
-			item->movementDistLeft = 0;
-			item->movementDistRight = 0;
-			item->movementDistUp = Map2D::Layer::Item::DistIndeterminate;
-			item->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
+			item->movement().flags = Map2D::Layer::Item::DistanceLimit;
+			item->movement().distLeft = 0;
+			item->movement().distRight = 0;
+			item->movement().distUp = Map2D::Layer::Item::DistIndeterminate;
+			item->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
 			break;
 		case CCTF_MV_HORZ:
 			item->type |= Map2D::Layer::Item::Movement;
-			item->movementFlags = Map2D::Layer::Item::DistanceLimit;
-			item->movementDistLeft = Map2D::Layer::Item::DistIndeterminate;
-			item->movementDistRight = Map2D::Layer::Item::DistIndeterminate;
-			item->movementDistUp = 0;
-			item->movementDistDown = 0;
+			item->movement().flags = Map2D::Layer::Item::DistanceLimit;
+			item->movement().distLeft = Map2D::Layer::Item::DistIndeterminate;
+			item->movement().distRight = Map2D::Layer::Item::DistIndeterminate;
+			item->movement().distUp = 0;
+			item->movement().distDown = 0;
 			break;
 		case CCTF_MV_DROP:
 			item->type |= Map2D::Layer::Item::Movement;
-			item->movementFlags = Map2D::Layer::Item::DistanceLimit;
-			item->movementDistLeft = 0;
-			item->movementDistRight = 0;
-			item->movementDistUp = 0;
-			item->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
+			item->movement().flags = Map2D::Layer::Item::DistanceLimit;
+			item->movement().distLeft = 0;
+			item->movement().distRight = 0;
+			item->movement().distUp = 0;
+			item->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
 			break;
 	}
 	return;
 }
 
+/// Populate the list of tiles that can be placed in the background layer.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < sizeof(tileMapVine) / sizeof(TILE_MAP_VINE); i++) {
+		TILE_MAP_VINE& m = tileMapVine[i];
+
+		Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+		item->type = Map2D::Layer::Item::Default;
+		item->x = 0; // required for selections to work
+		item->y = 0;
+		item->code = m.tileIndexMid;
+		items.push_back(item);
+
+		item.reset(new Map2D::Layer::Item());
+		item->type = Map2D::Layer::Item::Default;
+		item->x = 0; // required for selections to work
+		item->y = 0;
+		item->code = m.tileIndexEnd;
+		items.push_back(item);
+	}
+
+	for (unsigned int i = 0; i < sizeof(tileMapSign) / sizeof(TILE_MAP_SIGN); i++) {
+		TILE_MAP_SIGN& m = tileMapSign[i];
+
+		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
+			if (m.tileIndexBG[j] == ___________) continue;
+			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+			item->type = Map2D::Layer::Item::Default;
+			item->x = 0; // required for selections to work
+			item->y = 0;
+			item->code = m.tileIndexBG[j];
+			if (j == 0) setFlags(item, m.flags);
+			items.push_back(item);
+		}
+	}
+
+	for (unsigned int i = 0; i < sizeof(tileMap) / sizeof(TILE_MAP); i++) {
+		TILE_MAP& m = tileMap[i];
+
+		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
+			if (m.tileIndexBG[j] == ___________) continue;
+			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+			item->type = Map2D::Layer::Item::Default;
+			item->x = 0; // required for selections to work
+			item->y = 0;
+			if (IS_IBEAM(m.tileIndexBG[j])) {
+				item->code = CCT_IBEAM(ibeam_tile, m.tileIndexBG[j]);
+			} else if (IS_BLOCK(m.tileIndexBG[j])) {
+				item->code = CCT_BLOCK(block_tile, m.tileIndexBG[j]);
+			} else if (m.tileIndexBG[j] == CCT_USCORE) {
+				item->code = underscore_tile;
+			} else {
+				item->code = m.tileIndexBG[j];
+			}
+			if (j == 0) setFlags(item, m.flags);
+			items.push_back(item);
+		}
+	}
+
+	for (unsigned int i = 0; i < sizeof(tileMap4x1) / sizeof(TILE_MAP); i++) {
+		TILE_MAP& m = tileMap4x1[i];
+
+		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
+			if (m.tileIndexBG[j] == ___________) continue;
+			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+			item->type = Map2D::Layer::Item::Default;
+			item->x = 0; // required for selections to work
+			item->y = 0;
+			item->code = m.tileIndexBG[j];
+			if (j == 0) setFlags(item, m.flags);
+			items.push_back(item);
+		}
+	}
+	return;
+}
+
+/// Populate the list of tiles that can be placed in the overlay layer.
+static void buildValidFGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < sizeof(tileMap) / sizeof(TILE_MAP); i++) {
+		TILE_MAP& m = tileMap[i];
+		if (m.tileIndexFG == ___________) continue;
+
+		Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+		item->type = Map2D::Layer::Item::Default;
+		item->x = 0; // required for selections to work
+		item->y = 0;
+		item->code = m.tileIndexFG;
+		items.push_back(item);
+	}
+	return;
+}
+
+MapType_CCaves::MapType_CCaves()
+	:	validBGCatalogue(buildValidBGItems),
+		validFGCatalogue(buildValidFGItems)
+{
+}
+
 std::string MapType_CCaves::getMapCode() const
 {
 	return "map-ccaves";
@@ -164,20 +272,20 @@ std::vector<std::string> MapType_CCaves::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_CCaves::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_CCaves::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
-
-	psMap->seekg(0, stream::start);
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_ccaves_isinstance_c01
 	if (lenMap < CC_MAP_WIDTH + 1) return MapType::DefinitelyNo; // too small
 
 	uint8_t row[CC_MAP_WIDTH];
+	stream::pos offset = 0;
 	unsigned int y;
 	for (y = 0; (y < CC_MAX_MAP_HEIGHT) && lenMap; y++) {
 		uint8_t lenRow;
-		psMap >> u8(lenRow);
+		if (!probe.readU8(offset, &lenRow)) return MapType::DefinitelyNo;
+		offset++;
 		lenMap--;
 
 		// Incorrect row length
@@ -189,12 +297,15 @@ MapType::Certainty MapType_CCaves::isInstance(stream::input_sptr psMap) const
 		if (lenMap < CC_MAP_WIDTH) return MapType::DefinitelyNo;
 
 		// Ensure the row data is valid
-		psMap->read(row, CC_MAP_WIDTH);
+		if (probe.read(offset, row, CC_MAP_WIDTH) != CC_MAP_WIDTH) {
+			return MapType::DefinitelyNo; // read error
+		}
 		for (unsigned int x = 0; x < CC_MAP_WIDTH; x++) {
 			// TESTED BY: fmt_map_ccaves_isinstance_c04
 			if (row[x] > CC_MAX_VALID_TILECODE) return MapType::DefinitelyNo; // invalid tile
 		}
 
+		offset += CC_MAP_WIDTH;
 		lenMap -= CC_MAP_WIDTH;
 	}
 
@@ -205,6 +316,14 @@ MapType::Certainty MapType_CCaves::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_CCaves::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = CC_MAP_WIDTH + 1;
+	filter.maxSize = (CC_MAX_MAP_HEIGHT - 1) * (CC_MAP_WIDTH + 1);
+	return filter;
+}
+
 MapPtr MapType_CCaves::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -213,6 +332,8 @@ MapPtr MapType_CCaves::create(SuppData& suppData) const
 
 MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	stream::pos lenMap = input->size();
 
 	input->seekg(0, stream::start);
@@ -224,23 +345,14 @@ MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 
 	unsigned int height = lenMap / (CC_MAP_WIDTH + 1);
 
-	//unsigned int fgtile = MAKE_TILE(21, 20); // solid cyan
-	//unsigned int fgtile = MAKE_TILE(19, 20); // blue rock
-	//unsigned int fgtile = MAKE_TILE(22, 12); // solid blue
-	//unsigned int fgtile = MAKE_TILE(21, 12); // wavy green
-	unsigned int block_tile = MAKE_TILE(21, 32); // solid brown
-	//unsigned int ibeam_tile = MAKE_TILE(19,  3); // blue
-	unsigned int ibeam_tile = MAKE_TILE(19,  6); // red
-	unsigned int underscore_tile = MAKE_TILE(19,  0); // blue
-
 	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
 	tiles->reserve(CC_MAP_WIDTH * height);
 	Map2D::Layer::ItemPtrVectorPtr fgtiles(new Map2D::Layer::ItemPtrVector());
 //	unsigned long c = 0;
 
 /// Add a tile to the map vector
-#define INSERT_TILE(dx, dy, val, flags) { \
-	Map2D::Layer::ItemPtr t(new Map2D::Layer::Item()); \
+#define INSERT_TILE(dx, dy, val, mvFlags) { \
+	Map2D::Layer::ItemPtr t(createItem(arena)); \
 	t->type = Map2D::Layer::Item::Default; \
 	t->x = x + (dx); \
 	t->y = y + (dy); \
@@ -253,32 +365,32 @@ MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 	} else { \
 		t->code = (val); \
 	} \
-	switch (flags) { \
+	switch (mvFlags) { \
 		case CCTF_MV_NONE: \
 			break; \
 		case CCTF_MV_VERT: \
 			t->type |= Map2D::Layer::Item::Movement; \
-			t->movementFlags = Map2D::Layer::Item::DistanceLimit; \
-			t->movementDistLeft = 0; \
-			t->movementDistRight = 0; \
-			t->movementDistUp = Map2D::Layer::Item::DistIndeterminate; \
-			t->movementDistDown = Map2D::Layer::Item::DistIndeterminate; \
+			t->movement().flags = Map2D::Layer::Item::DistanceLimit; \
+			t->movement().distLeft = 0; \
+			t->movement().distRight = 0; \
+			t->movement().distUp = Map2D::Layer::Item::DistIndeterminate; \
+			t->movement().distDown = Map2D::Layer::Item::DistIndeterminate; \
 			break; \
 		case CCTF_MV_HORZ: \
 			t->type |= Map2D::Layer::Item::Movement; \
-			t->movementFlags = Map2D::Layer::Item::DistanceLimit; \
-			t->movementDistLeft = Map2D::Layer::Item::DistIndeterminate; \
-			t->movementDistRight = Map2D::Layer::Item::DistIndeterminate; \
-			t->movementDistUp = 0; \
-			t->movementDistDown = 0; \
+			t->movement().flags = Map2D::Layer::Item::DistanceLimit; \
+			t->movement().distLeft = Map2D::Layer::Item::DistIndeterminate; \
+			t->movement().distRight = Map2D::Layer::Item::DistIndeterminate; \
+			t->movement().distUp = 0; \
+			t->movement().distDown = 0; \
 			break; \
 		case CCTF_MV_DROP: \
 			t->type |= Map2D::Layer::Item::Movement; \
-			t->movementFlags = Map2D::Layer::Item::DistanceLimit; \
-			t->movementDistLeft = 0; \
-			t->movementDistRight = 0; \
-			t->movementDistUp = 0; \
-			t->movementDistDown = Map2D::Layer::Item::DistIndeterminate; \
+			t->movement().flags = Map2D::Layer::Item::DistanceLimit; \
+			t->movement().distLeft = 0; \
+			t->movement().distRight = 0; \
+			t->movement().distUp = 0; \
+			t->movement().distDown = Map2D::Layer::Item::DistIndeterminate; \
 			break; \
 	} \
 	tiles->push_back(t); \
@@ -372,7 +484,7 @@ MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 					SET_NEXT_TILE(0, 1, m.tileIndexBG[2]);
 					SET_NEXT_TILE(1, 1, m.tileIndexBG[3]);
 					if (m.tileIndexFG != ___________) {
-						Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+						Map2D::Layer::ItemPtr t(createItem(arena));
 						t->type = Map2D::Layer::Item::Default;
 						t->x = x;
 						t->y = y;
@@ -403,88 +515,10 @@ MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 #undef BGTILE
 #undef SET_NEXT_TILE
 
-	// Create a list of all the tiles that can be placed in a level
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	Map2D::Layer::ItemPtrVectorPtr validFGItems(new Map2D::Layer::ItemPtrVector());
-
-	for (unsigned int i = 0; i < sizeof(tileMapVine) / sizeof(TILE_MAP_VINE); i++) {
-		TILE_MAP_VINE& m = tileMapVine[i];
-
-		Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
-		item->type = Map2D::Layer::Item::Default;
-		item->x = 0; // required for selections to work
-		item->y = 0;
-		item->code = m.tileIndexMid;
-		validBGItems->push_back(item);
-
-		item.reset(new Map2D::Layer::Item());
-		item->type = Map2D::Layer::Item::Default;
-		item->x = 0; // required for selections to work
-		item->y = 0;
-		item->code = m.tileIndexEnd;
-		validBGItems->push_back(item);
-	}
-
-	for (unsigned int i = 0; i < sizeof(tileMapSign) / sizeof(TILE_MAP_SIGN); i++) {
-		TILE_MAP_SIGN& m = tileMapSign[i];
-
-		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
-			if (m.tileIndexBG[j] == ___________) continue;
-			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
-			item->type = Map2D::Layer::Item::Default;
-			item->x = 0; // required for selections to work
-			item->y = 0;
-			item->code = m.tileIndexBG[j];
-			if (j == 0) setFlags(item, m.flags);
-			validBGItems->push_back(item);
-		}
-	}
-
-	for (unsigned int i = 0; i < sizeof(tileMap) / sizeof(TILE_MAP); i++) {
-		TILE_MAP& m = tileMap[i];
-
-		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
-			if (m.tileIndexBG[j] == ___________) continue;
-			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
-			item->type = Map2D::Layer::Item::Default;
-			item->x = 0; // required for selections to work
-			item->y = 0;
-			if (IS_IBEAM(m.tileIndexBG[j])) {
-				item->code = CCT_IBEAM(ibeam_tile, m.tileIndexBG[j]);
-			} else if (IS_BLOCK(m.tileIndexBG[j])) {
-				item->code = CCT_BLOCK(block_tile, m.tileIndexBG[j]);
-			} else if (m.tileIndexBG[j] == CCT_USCORE) {
-				item->code = underscore_tile;
-			} else {
-				item->code = m.tileIndexBG[j];
-			}
-			if (j == 0) setFlags(item, m.flags);
-			validBGItems->push_back(item);
-		}
-		if (m.tileIndexFG != ___________) {
-			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
-			item->type = Map2D::Layer::Item::Default;
-			item->x = 0; // required for selections to work
-			item->y = 0;
-			item->code = m.tileIndexFG;
-			validFGItems->push_back(item);
-		}
-	}
-
-	for (unsigned int i = 0; i < sizeof(tileMap4x1) / sizeof(TILE_MAP); i++) {
-		TILE_MAP& m = tileMap4x1[i];
-
-		for (unsigned int j = 0; j < sizeof(m.tileIndexBG) / sizeof(int); j++) {
-			if (m.tileIndexBG[j] == ___________) continue;
-			Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
-			item->type = Map2D::Layer::Item::Default;
-			item->x = 0; // required for selections to work
-			item->y = 0;
-			item->code = m.tileIndexBG[j];
-			if (j == 0) setFlags(item, m.flags);
-			validBGItems->push_back(item);
-		}
-	}
+	// The lists of tiles that can be placed in a level are shared between all
+	// maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
+	Map2D::Layer::ItemPtrVectorPtr validFGItems = this->validFGCatalogue.get();
 
 	Map2D::LayerPtr bgLayer(new Layer_CCavesBackground("Background", tiles, validBGItems));
 	Map2D::LayerPtr fgLayer(new Layer_CCavesBackground("Overlay", fgtiles, validFGItems));
@@ -499,7 +533,8 @@ MapPtr MapType_CCaves::open(stream::input_sptr input, SuppData& suppData) const
 		CC_VIEWPORT_WIDTH, CC_VIEWPORT_HEIGHT,
 		CC_MAP_WIDTH, height,
 		CC_TILE_WIDTH, CC_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
@@ -547,27 +582,27 @@ void MapType_CCaves::write(MapPtr map, stream::expanding_output_sptr output,
 		bgsrc[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
 		if (
 			((*i)->type & Map2D::Layer::Item::Movement)
-			&& ((*i)->movementFlags & Map2D::Layer::Item::DistanceLimit)
+			&& ((*i)->movement().flags & Map2D::Layer::Item::DistanceLimit)
 		) {
 			if (
-				((*i)->movementDistUp == Map2D::Layer::Item::DistIndeterminate)
-				&& ((*i)->movementDistDown == Map2D::Layer::Item::DistIndeterminate)
-				&& ((*i)->movementDistLeft == 0)
-				&& ((*i)->movementDistRight == 0)
+				((*i)->movement().distUp == Map2D::Layer::Item::DistIndeterminate)
+				&& ((*i)->movement().distDown == Map2D::Layer::Item::DistIndeterminate)
+				&& ((*i)->movement().distLeft == 0)
+				&& ((*i)->movement().distRight == 0)
 			) {
 				bgattr[(*i)->y * mapWidth + (*i)->x] = CCTF_MV_VERT;
 			} else if (
-				((*i)->movementDistUp == 0)
-				&& ((*i)->movementDistDown == 0)
-				&& ((*i)->movementDistLeft == Map2D::Layer::Item::DistIndeterminate)
-				&& ((*i)->movementDistRight == Map2D::Layer::Item::DistIndeterminate)
+				((*i)->movement().distUp == 0)
+				&& ((*i)->movement().distDown == 0)
+				&& ((*i)->movement().distLeft == Map2D::Layer::Item::DistIndeterminate)
+				&& ((*i)->movement().distRight == Map2D::Layer::Item::DistIndeterminate)
 			) {
 				bgattr[(*i)->y * mapWidth + (*i)->x] = CCTF_MV_HORZ;
 			} else if (
-				((*i)->movementDistUp == 0)
-				&& ((*i)->movementDistDown == Map2D::Layer::Item::DistIndeterminate)
-				&& ((*i)->movementDistLeft == 0)
-				&& ((*i)->movementDistRight == 0)
+				((*i)->movement().distUp == 0)
+				&& ((*i)->movement().distDown == Map2D::Layer::Item::DistIndeterminate)
+				&& ((*i)->movement().distLeft == 0)
+				&& ((*i)->movement().distRight == 0)
 			) {
 				bgattr[(*i)->y * mapWidth + (*i)->x] = CCTF_MV_DROP;
 			} else {
@@ -30,17 +30,24 @@ namespace gamemaps {
 class MapType_CCaves: virtual public MapType_Base
 {
 	public:
+		MapType_CCaves();
+
 		virtual std::string getMapCode() const;
 		virtual std::string getFriendlyName() const;
 		virtual std::vector<std::string> getFileExtensions() const;
 		virtual std::vector<std::string> getGameList() const;
-		virtual Certainty isInstance(stream::input_sptr psMap) const;
+		virtual Certainty isInstance(const Probe& probe) const;
+		virtual DetectFilter getDetectFilter() const;
 		virtual MapPtr create(SuppData& suppData) const;
 		virtual MapPtr open(stream::input_sptr input, SuppData& suppData) const;
 		virtual void write(MapPtr map, stream::expanding_output_sptr output,
 			ExpandingSuppData& suppData) const;
 		virtual SuppFilenames getRequiredSupps(stream::input_sptr input,
 			const std::string& filename) const;
+
+	protected:
+		ItemCatalogue validBGCatalogue; ///< Permitted background tiles
+		ItemCatalogue validFGCatalogue; ///< Permitted overlay tiles
 };
 
 } // namespace gamemaps
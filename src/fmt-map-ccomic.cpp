@@ -71,6 +71,28 @@ class Layer_CComicBackground: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= CC_MAX_VALID_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		//if (i == CC_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_CComic::MapType_CComic()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_CComic::getMapCode() const
 {
 	return "map-ccomic";
@@ -95,27 +117,28 @@ std::vector<std::string> MapType_CComic::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_CComic::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_CComic::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data to read the map dimensions
 	// TESTED BY: fmt_map_ccomic_isinstance_c01
 	if (lenMap < 4) return MapType::DefinitelyNo;
 
-	psMap->seekg(0, stream::start);
-	unsigned int width, height;
-	psMap >> u16le(width) >> u16le(height);
+	uint16_t width, height;
+	if (!probe.readU16le(0, &width)) return MapType::DefinitelyNo;
+	if (!probe.readU16le(2, &height)) return MapType::DefinitelyNo;
 
-	// Make sure the dimensions cover the entire file
+	// Make sure the dimensions cover the entire file.  The values are widened
+	// first so the multiplication cannot overflow a signed int.
 	// TESTED BY: fmt_map_ccomic_isinstance_c02
-	unsigned int mapLen = width * height;
+	unsigned int mapLen = (unsigned int)width * height;
 	if (lenMap != mapLen + 4) return MapType::DefinitelyNo;
 
 	// Read in the map and make sure all the tile codes are within range
 	uint8_t *bg = new uint8_t[mapLen];
 	boost::scoped_array<uint8_t> scoped_bg(bg);
-	stream::len r = psMap->try_read(bg, mapLen);
+	stream::len r = probe.read(4, bg, mapLen);
 	if (r != mapLen) return MapType::DefinitelyNo; // read error
 	for (unsigned int i = 0; i < mapLen; i++) {
 		// Make sure each tile is within range
@@ -129,6 +152,13 @@ MapType::Certainty MapType_CComic::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_CComic::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 4;
+	return filter;
+}
+
 MapPtr MapType_CComic::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -137,6 +167,8 @@ MapPtr MapType_CComic::create(SuppData& suppData) const
 
 MapPtr MapType_CComic::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 	unsigned int width, height;
 	input >> u16le(width) >> u16le(height);
@@ -153,7 +185,7 @@ MapPtr MapType_CComic::open(stream::input_sptr input, SuppData& suppData) const
 		// The default tile actually has an image, so don't exclude it
 		//if (bg[i] == CC_DEFAULT_BGTILE) continue;
 
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		t->x = i % width;
 		t->y = i / width;
@@ -161,19 +193,8 @@ MapPtr MapType_CComic::open(stream::input_sptr input, SuppData& suppData) const
 		tiles->push_back(t);
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= CC_MAX_VALID_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		//if (i == CC_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Create the map structures
 	Map2D::LayerPtr bgLayer(new Layer_CComicBackground(tiles, validBGItems));
@@ -187,7 +208,8 @@ MapPtr MapType_CComic::open(stream::input_sptr input, SuppData& suppData) const
 		193, 160, // viewport size
 		width, height,
 		CC_TILE_WIDTH, CC_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
@@ -30,17 +30,23 @@ namespace gamemaps {
 class MapType_CComic: virtual public MapType_Base
 {
 	public:
+		MapType_CComic();
+
 		virtual std::string getMapCode() const;
 		virtual std::string getFriendlyName() const;
 		virtual std::vector<std::string> getFileExtensions() const;
 		virtual std::vector<std::string> getGameList() const;
-		virtual Certainty isInstance(stream::input_sptr psMap) const;
+		virtual Certainty isInstance(const Probe& probe) const;
+		virtual DetectFilter getDetectFilter() const;
 		virtual MapPtr create(SuppData& suppData) const;
 		virtual MapPtr open(stream::input_sptr input, SuppData& suppData) const;
 		virtual void write(MapPtr map, stream::expanding_output_sptr output,
 			ExpandingSuppData& suppData) const;
 		virtual SuppFilenames getRequiredSupps(stream::input_sptr input,
 			const std::string& filename) const;
+
+	protected:
+		ItemCatalogue validBGCatalogue; ///< Permitted tiles
 };
 
 } // namespace gamemaps
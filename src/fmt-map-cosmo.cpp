@@ -21,9 +21,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-cosmo.hpp"
 
 /// Width of each tile in pixels
@@ -114,13 +117,13 @@ class Layer_CosmoActor: virtual public GenericMap2D::Layer
 class Layer_CosmoBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_CosmoBackground(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_CosmoBackground(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -156,14 +159,16 @@ class Map2D_Cosmo: virtual public GenericMap2D
 {
 	public:
 		Map2D_Cosmo(const Attributes& attributes, unsigned int width,
-			LayerPtrVector& layers)
+			LayerPtrVector& layers,
+			const ItemArenaPtr& arena, const LayerLoaderVector& loaders)
 			:	GenericMap2D(
 					attributes, Map::GraphicsFilenames(),
 					Map2D::HasViewport,
 					CCA_VIEWPORT_WIDTH, CCA_VIEWPORT_HEIGHT,
 					width, 32768 / width,
 					CCA_TILE_WIDTH, CCA_TILE_HEIGHT,
-					layers, Map2D::PathPtrVectorPtr()
+					layers, Map2D::PathPtrVectorPtr(),
+					arena, loaders
 				)
 		{
 			// Populate the graphics filenames
@@ -223,6 +228,36 @@ class Map2D_Cosmo: virtual public GenericMap2D
 };
 
 
+/// Populate the list of permitted background tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	items.reserve(CCA_NUM_SOLID_TILES + CCA_NUM_MASKED_TILES);
+	for (unsigned int i = 0; i < CCA_NUM_SOLID_TILES; i++) {
+		// Background tiles first
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i << 3;
+		items.push_back(t);
+	}
+	for (unsigned int i = 0; i < CCA_NUM_MASKED_TILES; i++) {
+		// Then foreground tiles
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = (CCA_NUM_SOLID_TILES + i * 5) << 3;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Cosmo::MapType_Cosmo()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_Cosmo::getMapCode() const
 {
 	return "map-cosmo";
@@ -247,22 +282,21 @@ std::vector<std::string> MapType_Cosmo::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Cosmo::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Cosmo::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_cosmo_isinstance_c01/c02
 	if (lenMap < 6 + CCA_LAYER_LEN_BG) return MapType::DefinitelyNo; // too short
 
 	uint16_t mapWidth;
-	psMap->seekg(2, stream::start);
-	psMap >> u16le(mapWidth);
+	if (!probe.readU16le(2, &mapWidth)) return MapType::DefinitelyNo;
 
 	// TESTED BY: fmt_map_cosmo_isinstance_c03
 	if (mapWidth > CCA_MAX_WIDTH) return MapType::DefinitelyNo; // map too wide
 
 	uint16_t numActorInts;
-	psMap >> u16le(numActorInts);
+	if (!probe.readU16le(4, &numActorInts)) return MapType::DefinitelyNo;
 
 	// TESTED BY: fmt_map_cosmo_isinstance_c04
 	if (numActorInts > (CCA_MAX_ACTORS * 3)) return MapType::DefinitelyNo; // too many actors
@@ -280,14 +314,47 @@ MapType::Certainty MapType_Cosmo::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Cosmo::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 6 + CCA_LAYER_LEN_BG;
+	return filter;
+}
+
 MapPtr MapType_Cosmo::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Decode the background layer the first time it is requested.
+/**
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param mapWidth
+ *   Width of the map, in tiles.
+ *
+ * @param lenTiles
+ *   Number of tile codes in raw.
+ *
+ * @param validBGItems
+ *   List of permitted background tiles.
+ */
+static Map2D::LayerPtr loadCosmoBackground(RawBlockPtr raw,
+	unsigned int mapWidth, unsigned int lenTiles,
+	Map2D::Layer::ItemPtrVectorPtr validBGItems)
+{
+	TileGridPtr tiles(new TileGrid(mapWidth, 32768 / mapWidth));
+	// Don't store zero codes (these are transparent/no-tile)
+	if (lenTiles) decodeGrid16le(&raw->at(0), tiles.get(), lenTiles, 0);
+	return Map2D::LayerPtr(new Layer_CosmoBackground(tiles, validBGItems));
+}
+
 MapPtr MapType_Cosmo::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	stream::pos lenMap = input->size();
 	input->seekg(0, stream::start);
 
@@ -415,7 +482,7 @@ MapPtr MapType_Cosmo::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::Layer::ItemPtrVectorPtr actors(new Map2D::Layer::ItemPtrVector());
 	actors->reserve(numActors);
 	for (unsigned int i = 0; i < numActors; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->code)
@@ -425,11 +492,11 @@ MapPtr MapType_Cosmo::open(stream::input_sptr input, SuppData& suppData) const
 		switch (t->code) {
 			case 295: // falling star
 				t->type = Map2D::Layer::Item::Movement;
-				t->movementFlags = Map2D::Layer::Item::DistanceLimit;
-				t->movementDistLeft = 0;
-				t->movementDistRight = 0;
-				t->movementDistUp = 0;
-				t->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
+				t->movement().flags = Map2D::Layer::Item::DistanceLimit;
+				t->movement().distLeft = 0;
+				t->movement().distRight = 0;
+				t->movement().distUp = 0;
+				t->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
 				t->code = 31 + 1; // normal star image
 				break;
 		}
@@ -440,50 +507,26 @@ MapPtr MapType_Cosmo::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::Layer::ItemPtrVectorPtr validActorItems(new Map2D::Layer::ItemPtrVector());
 	Map2D::LayerPtr actorLayer(new Layer_CosmoActor(actors, validActorItems));
 
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(CCA_NUM_TILES_BG);
-
-	for (unsigned int i = 0; (i < CCA_NUM_TILES_BG) && (lenMap >= 2); i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % mapWidth;
-		t->y = i / mapWidth;
-		input >> u16le(t->code);
-		// Don't push zero codes (these are transparent/no-tile)
-		if (t->code != 0) tiles->push_back(t);
-		lenMap -= 2;
-	}
+	// Read the background layer, but leave it to be decoded when needed
+	unsigned int lenTiles = std::min<unsigned int>(CCA_NUM_TILES_BG,
+		mapWidth * (32768 / mapWidth));
+	lenTiles = std::min<unsigned int>(lenTiles, lenMap / 2);
+	RawBlockPtr bgRaw = readRawBlock(input, lenTiles * 2);
+	lenMap -= lenTiles * 2;
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i < CCA_NUM_SOLID_TILES; i++) {
-		// Background tiles first
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i << 3;
-		validBGItems->push_back(t);
-	}
-	for (unsigned int i = 0; i < CCA_NUM_MASKED_TILES; i++) {
-		// Then foreground tiles
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = (CCA_NUM_SOLID_TILES + i * 5) << 3;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Create the map structures
-	Map2D::LayerPtr bgLayer(new Layer_CosmoBackground(tiles, validBGItems));
-
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
 	layers.push_back(actorLayer);
 
-	Map2DPtr map(new Map2D_Cosmo(attributes, mapWidth, layers));
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadCosmoBackground, bgRaw, mapWidth, lenTiles,
+		validBGItems);
+
+	Map2DPtr map(new Map2D_Cosmo(attributes, mapWidth, layers, arena, loaders));
 
 	return map;
 }
@@ -576,8 +619,8 @@ void MapType_Cosmo::write(MapPtr map, stream::expanding_output_sptr output,
 		// Map any falling actors to the correct code
 		if (
 			((*i)->type & Map2D::Layer::Item::Movement) &&
-			((*i)->movementFlags & Map2D::Layer::Item::DistanceLimit) &&
-			((*i)->movementDistDown == Map2D::Layer::Item::DistIndeterminate)
+			((*i)->movement().flags & Map2D::Layer::Item::DistanceLimit) &&
+			((*i)->movement().distDown == Map2D::Layer::Item::DistIndeterminate)
 		) {
 			switch ((*i)->code) {
 				case 31 + 1: finalCode = 295; break; // falling star
@@ -591,24 +634,12 @@ void MapType_Cosmo::write(MapPtr map, stream::expanding_output_sptr output,
 	}
 
 	// Write the background layer
-	unsigned long lenBG = mapWidth * mapHeight;
-	uint16_t *bg = new uint16_t[lenBG];
-	boost::scoped_array<uint16_t> sbg(bg);
-	// Set the default background tile
-	memset(bg, 0x00, lenBG * 2); // 2 == sizeof(uint16le)
-
-	layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		bg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
-	}
-
+	TileGridPtr bg = getTileGrid(map2d->getLayer(0), mapWidth, mapHeight);
 	for (unsigned int i = 0; i < mapWidth * mapHeight; i++) {
-		output << u16le(bg[i]);
+		uint32_t code = bg->codes[i];
+		// Empty cells are written as code zero (no tile)
+		if (code == INVALID_TILECODE) code = 0;
+		output << u16le(code);
 	}
 
 	output->flush();
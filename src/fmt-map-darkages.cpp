@@ -136,6 +136,28 @@ class Layer_DarkAgesBackground: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= DA_MAX_VALID_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		//if (i == DA_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_DarkAges::MapType_DarkAges()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_DarkAges::getMapCode() const
 {
 	return "map-darkages";
@@ -160,9 +182,9 @@ std::vector<std::string> MapType_DarkAges::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_DarkAges::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_DarkAges::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data to read the map dimensions
 	// TESTED BY: fmt_map_darkages_isinstance_c01
@@ -172,6 +194,13 @@ MapType::Certainty MapType_DarkAges::isInstance(stream::input_sptr psMap) const
 	return MapType::PossiblyYes;
 }
 
+DetectFilter MapType_DarkAges::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(1152);
+	return filter;
+}
+
 MapPtr MapType_DarkAges::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -180,6 +209,8 @@ MapPtr MapType_DarkAges::create(SuppData& suppData) const
 
 MapPtr MapType_DarkAges::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 	const unsigned int mapLen = DA_MAP_WIDTH * DA_MAP_HEIGHT;
 
@@ -194,7 +225,7 @@ MapPtr MapType_DarkAges::open(stream::input_sptr input, SuppData& suppData) cons
 		// The default tile actually has an image, so don't exclude it
 		//if (bg[i] == DA_DEFAULT_BGTILE) continue;
 
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		t->x = i % DA_MAP_WIDTH;
 		t->y = i / DA_MAP_WIDTH;
@@ -202,19 +233,8 @@ MapPtr MapType_DarkAges::open(stream::input_sptr input, SuppData& suppData) cons
 		tiles->push_back(t);
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= DA_MAX_VALID_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		//if (i == DA_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Create the map structures
 	Map2D::LayerPtr bgLayer(new Layer_DarkAgesBackground(tiles, validBGItems));
@@ -228,7 +248,8 @@ MapPtr MapType_DarkAges::open(stream::input_sptr input, SuppData& suppData) cons
 		240, 144, // viewport size
 		DA_MAP_WIDTH, DA_MAP_HEIGHT,
 		DA_TILE_WIDTH, DA_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
@@ -55,13 +55,13 @@ using namespace camoto::gamegraphics;
 class Layer_DDaveBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_DDaveBackground(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_DDaveBackground(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -84,14 +84,16 @@ class Layer_DDaveBackground: virtual public GenericMap2D::Layer
 class Map2D_DDave: virtual public GenericMap2D
 {
 	public:
-		Map2D_DDave(LayerPtrVector& layers, PathPtrVectorPtr& paths)
+		Map2D_DDave(LayerPtrVector& layers, PathPtrVectorPtr& paths,
+			const ItemArenaPtr& arena)
 			:	GenericMap2D(
 					Map::Attributes(), Map::GraphicsFilenames(),
 					Map2D::HasViewport | Map2D::HasPaths | Map2D::FixedPathCount,
 					20 * DD_TILE_WIDTH, 10 * DD_TILE_HEIGHT, // viewport size
 					DD_MAP_WIDTH, DD_MAP_HEIGHT,
 					DD_TILE_WIDTH, DD_TILE_HEIGHT,
-					layers, paths
+					layers, paths,
+					arena
 				)
 		{
 		}
@@ -109,6 +111,28 @@ class Map2D_DDave: virtual public GenericMap2D
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= DD_MAX_VALID_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		if (i == DD_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_DDave::MapType_DDave()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_DDave::getMapCode() const
 {
 	return "map-ddave";
@@ -133,17 +157,16 @@ std::vector<std::string> MapType_DDave::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_DDave::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_DDave::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_ddave_isinstance_c01
 	if (lenMap != DD_FILESIZE) return MapType::DefinitelyNo; // wrong size
 
 	// Read in the layer and make sure all the tile codes are within range
 	uint8_t bg[DD_LAYER_LEN_BG];
-	psMap->seekg(DD_LAYER_OFF_BG, stream::start);
-	stream::len r = psMap->try_read(bg, DD_LAYER_LEN_BG);
+	stream::len r = probe.read(DD_LAYER_OFF_BG, bg, DD_LAYER_LEN_BG);
 	if (r != DD_LAYER_LEN_BG) return MapType::DefinitelyNo; // read error
 	for (unsigned int i = 0; i < DD_LAYER_LEN_BG; i++) {
 		// TESTED BY: fmt_map_ddave_isinstance_c02
@@ -154,6 +177,13 @@ MapType::Certainty MapType_DDave::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_DDave::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(DD_FILESIZE);
+	return filter;
+}
+
 MapPtr MapType_DDave::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -162,6 +192,8 @@ MapPtr MapType_DDave::create(SuppData& suppData) const
 
 MapPtr MapType_DDave::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 
 	// Read the path
@@ -193,30 +225,13 @@ MapPtr MapType_DDave::open(stream::input_sptr input, SuppData& suppData) const
 	uint8_t bg[DD_LAYER_LEN_BG];
 	input->read((char *)bg, DD_LAYER_LEN_BG);
 
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(DD_MAP_WIDTH * DD_MAP_HEIGHT);
+	TileGridPtr tiles(new TileGrid(DD_MAP_WIDTH, DD_MAP_HEIGHT));
 	for (unsigned int i = 0; i < DD_LAYER_LEN_BG; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % DD_MAP_WIDTH;
-		t->y = i / DD_MAP_WIDTH;
-		t->code = bg[i];
-		if (t->code != DD_DEFAULT_BGTILE) tiles->push_back(t);
+		if (bg[i] != DD_DEFAULT_BGTILE) tiles->codes[i] = bg[i];
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= DD_MAX_VALID_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		if (i == DD_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Create the map structures
 	Map2D::LayerPtr bgLayer(new Layer_DDaveBackground(tiles, validBGItems));
@@ -224,7 +239,7 @@ MapPtr MapType_DDave::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::LayerPtrVector layers;
 	layers.push_back(bgLayer);
 
-	Map2DPtr map(new Map2D_DDave(layers, paths));
+	Map2DPtr map(new Map2D_DDave(layers, paths, arena));
 	return map;
 }
 
@@ -285,17 +300,11 @@ void MapType_DDave::write(MapPtr map, stream::expanding_output_sptr output,
 
 	// Write the background layer
 	uint8_t bg[DD_LAYER_LEN_BG];
-	memset(bg, DD_DEFAULT_BGTILE, DD_LAYER_LEN_BG); // default background tile
-	Map2D::LayerPtr layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		if (((*i)->x > DD_MAP_WIDTH) || ((*i)->y > DD_MAP_HEIGHT)) {
-			throw stream::error("Layer has tiles outside map boundary!");
-		}
-		bg[(*i)->y * DD_MAP_WIDTH + (*i)->x] = (*i)->code;
+	TileGridPtr grid = getTileGrid(map2d->getLayer(0), DD_MAP_WIDTH,
+		DD_MAP_HEIGHT);
+	for (unsigned int i = 0; i < DD_LAYER_LEN_BG; i++) {
+		uint32_t code = grid->codes[i];
+		bg[i] = (code == INVALID_TILECODE) ? DD_DEFAULT_BGTILE : code;
 	}
 	output->write((char *)bg, DD_LAYER_LEN_BG);
 
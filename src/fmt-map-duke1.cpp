@@ -21,8 +21,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
+#include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-duke1.hpp"
 
 #define DN1_MAP_WIDTH            128
@@ -48,7 +51,19 @@ using namespace camoto::gamegraphics;
 class Layer_Duke1Background: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_Duke1Background(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_Duke1Background(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
+			:	GenericMap2D::Layer(
+					"Background",
+					Map2D::Layer::NoCaps,
+					0, 0,
+					0, 0,
+					tiles, validItems
+				)
+		{
+		}
+
+		Layer_Duke1Background(ItemPtrVectorPtr& items,
+			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
@@ -105,18 +120,19 @@ std::vector<std::string> MapType_Duke1::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Duke1::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Duke1::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_duke1_isinstance_c01
 	if (lenMap != DN1_FILESIZE) return MapType::DefinitelyNo; // wrong size
 
 	// Read in the layer and make sure all the tile codes are within range
-	psMap->seekg(0, stream::start);
+	boost::scoped_array<uint8_t> bg(new uint8_t[DN1_FILESIZE]);
+	stream::len r = probe.read(0, bg.get(), DN1_FILESIZE);
+	if (r != DN1_FILESIZE) return MapType::DefinitelyNo; // read error
 	for (unsigned int i = 0; i < DN1_LAYER_LEN; i++) {
-		uint16_t tile;
-		psMap >> u16le(tile);
+		uint16_t tile = bg[i * 2] | (bg[i * 2 + 1] << 8);
 		// TESTED BY: fmt_map_duke1_isinstance_c02
 		if (tile > DN1_MAX_VALID_TILECODE) return MapType::DefinitelyNo; // invalid tile
 	}
@@ -125,51 +141,107 @@ MapType::Certainty MapType_Duke1::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Duke1::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(DN1_FILESIZE);
+	return filter;
+}
+
 MapPtr MapType_Duke1::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
-MapPtr MapType_Duke1::open(stream::input_sptr input, SuppData& suppData) const
+/// Decode the background layer the first time it is requested.
+/**
+ * @param raw
+ *   Tile codes read from the map file.
+ */
+static Map2D::LayerPtr loadDuke1Background(RawBlockPtr raw)
 {
-	input->seekg(0, stream::start);
-
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(DN1_LAYER_LEN);
-	for (unsigned int i = 0; i < DN1_LAYER_LEN; i++) {
-		uint16_t tileCode;
-		input >> u16le(tileCode);
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % DN1_MAP_WIDTH;
-		t->y = i / DN1_MAP_WIDTH;
-		t->code = tileCode;
-		if (t->code != DN1_DEFAULT_BGTILE) tiles->push_back(t);
-	}
+	TileGridPtr tiles(new TileGrid(DN1_MAP_WIDTH, DN1_MAP_HEIGHT));
+	decodeGrid16le(&raw->at(0), tiles.get(), DN1_LAYER_LEN, DN1_DEFAULT_BGTILE);
 
 	// Populate the list of permitted tiles
 	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
 
-	// Create the map structures
-	Map2D::LayerPtr bgLayer(new Layer_Duke1Background(tiles, validBGItems));
-
-	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
+	return Map2D::LayerPtr(new Layer_Duke1Background(tiles, validBGItems));
+}
 
+/// Create the map structure around the background layer.
+static MapPtr createDuke1Map(Map2D::LayerPtrVector& layers,
+	const ItemArenaPtr& arena, const GenericMap2D::LayerLoaderVector& loaders)
+{
 	Map2DPtr map(new GenericMap2D(
 		Map::Attributes(), Map::GraphicsFilenames(),
 		Map2D::HasViewport,
 		13 * DN1_TILE_WIDTH, 10 * DN1_TILE_HEIGHT, // viewport size
 		DN1_MAP_WIDTH, DN1_MAP_HEIGHT,
 		DN1_TILE_WIDTH, DN1_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena, loaders
 	));
 
 	return map;
 }
 
+MapPtr MapType_Duke1::open(stream::input_sptr input, SuppData& suppData) const
+{
+	input->seekg(0, stream::start);
+
+	// Read the background layer, but leave it to be decoded when needed
+	RawBlockPtr bgRaw = readRawBlock(input, DN1_LAYER_LEN * 2);
+
+	// Create the map structures
+	Map2D::LayerPtrVector layers;
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
+
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadDuke1Background, bgRaw);
+
+	return createDuke1Map(layers, ItemArenaPtr(), loaders);
+}
+
+MapPtr MapType_Duke1::openRegion(stream::input_sptr input,
+	SuppData& suppData, const MapRegion& region) const
+{
+	ItemArenaPtr arena(new ItemArena());
+
+	// Read only the rows and columns within the region
+	MapRegion area = region;
+	clipRegion(&area, DN1_MAP_WIDTH, DN1_MAP_HEIGHT);
+	RawBlockPtr bg = readGridRegion(input, 0, DN1_MAP_WIDTH, 2,
+		area.y, area.height, area.x, area.width);
+
+	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
+	tiles->reserve(area.width * area.height);
+	const uint8_t *raw = bg->empty() ? NULL : &bg->at(0);
+	for (unsigned int y = area.y; y < area.y + area.height; y++) {
+		for (unsigned int x = area.x; x < area.x + area.width; x++) {
+			unsigned int code = raw[0] | (raw[1] << 8);
+			raw += 2;
+			if (code == DN1_DEFAULT_BGTILE) continue;
+			Map2D::Layer::ItemPtr t(createItem(arena));
+			t->type = Map2D::Layer::Item::Default;
+			t->x = x;
+			t->y = y;
+			t->code = code;
+			tiles->push_back(t);
+		}
+	}
+
+	// Populate the list of permitted tiles
+	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
+
+	// Create the map structures
+	Map2D::LayerPtrVector layers;
+	layers.push_back(Map2D::LayerPtr(new Layer_Duke1Background(tiles, validBGItems)));
+
+	return createDuke1Map(layers, arena, GenericMap2D::LayerLoaderVector());
+}
+
 void MapType_Duke1::write(MapPtr map, stream::expanding_output_sptr output,
 	ExpandingSuppData& suppData) const
 {
@@ -179,23 +251,12 @@ void MapType_Duke1::write(MapPtr map, stream::expanding_output_sptr output,
 		throw stream::error("Incorrect layer count for this format.");
 
 	// Write the background layer
-	uint16_t bg[DN1_LAYER_LEN];
-	for (unsigned int i = 0; i < DN1_LAYER_LEN; i++) {
-		bg[i] = DN1_DEFAULT_BGTILE;
-	}
-	Map2D::LayerPtr layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		if (((*i)->x > DN1_MAP_WIDTH) || ((*i)->y > DN1_MAP_HEIGHT)) {
-			throw stream::error("Layer has tiles outside map boundary!");
-		}
-		bg[(*i)->y * DN1_MAP_WIDTH + (*i)->x] = (*i)->code;
-	}
+	TileGridPtr bg = getTileGrid(map2d->getLayer(0), DN1_MAP_WIDTH,
+		DN1_MAP_HEIGHT);
 	for (unsigned int i = 0; i < DN1_LAYER_LEN; i++) {
-		output << u16le(bg[i]);
+		uint32_t code = bg->codes[i];
+		if (code == INVALID_TILECODE) code = DN1_DEFAULT_BGTILE;
+		output << u16le(code);
 	}
 
 	output->flush();
@@ -24,6 +24,7 @@
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-got.hpp"
 
 /// Length of entire map, in bytes
@@ -218,6 +219,73 @@ class Layer_GOTObject: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted background tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= GOT_MAX_VALID_BG_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		//if (i == GOT_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted actors.
+static void buildValidActorItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 1; i <= GOT_MAX_VALID_ACTOR_TILECODE; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted objects.
+static void buildValidObjItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 1; i <= GOT_MAX_VALID_OBJ_TILECODE; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted songs.
+static void buildValidMusItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < GOT_MAX_SONGS; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = 256 + i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_GOT::MapType_GOT()
+	:	validBGCatalogue(buildValidBGItems),
+		validActorCatalogue(buildValidActorItems),
+		validObjCatalogue(buildValidObjItems),
+		validMusCatalogue(buildValidMusItems)
+{
+}
+
 std::string MapType_GOT::getMapCode() const
 {
 	return "map-got";
@@ -241,17 +309,17 @@ std::vector<std::string> MapType_GOT::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_GOT::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_GOT::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data
 	// TESTED BY: fmt_map_got_isinstance_c01
 	if (lenMap != GOT_SCR_LEN * GOT_MAP_NUMSCREENS) return MapType::DefinitelyNo;
 
-	psMap->seekg(0, stream::start);
 	uint8_t bg[GOT_SCR_LEN_BG];
-	psMap->read(bg, GOT_SCR_LEN_BG);
+	stream::len r = probe.read(0, bg, GOT_SCR_LEN_BG);
+	if (r != GOT_SCR_LEN_BG) return MapType::DefinitelyNo; // read error
 	for (int i = 0; i < GOT_SCR_LEN_BG; i++) {
 		// Map code out of range
 		// TESTED BY: fmt_map_got_isinstance_c02
@@ -262,17 +330,62 @@ MapType::Certainty MapType_GOT::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_GOT::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(GOT_SCR_LEN * GOT_MAP_NUMSCREENS);
+	return filter;
+}
+
 MapPtr MapType_GOT::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Is the given cell within the area being loaded?
+static inline bool inArea(const MapRegion *area, unsigned int x, unsigned int y)
+{
+	return !area || (
+		(x >= area->x) && (x < area->x + area->width) &&
+		(y >= area->y) && (y < area->y + area->height)
+	);
+}
+
 MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 {
-	input->seekg(0, stream::start);
+	return this->openScreens(input, NULL);
+}
+
+MapPtr MapType_GOT::openRegion(stream::input_sptr input, SuppData& suppData,
+	const MapRegion& region) const
+{
+	MapRegion area = region;
+	clipRegion(&area, GOT_SCR_WIDTH * GOT_MAP_SCREENCOUNT_HORIZ,
+		GOT_SCR_HEIGHT * GOT_MAP_SCREENCOUNT_VERT);
+	return this->openScreens(input, &area);
+}
+
+MapPtr MapType_GOT::openScreens(stream::input_sptr input,
+	const MapRegion *area) const
+{
+	ItemArenaPtr arena(new ItemArena());
+
+	// Work out which screens to read
+	unsigned int firstScreenX = 0, lastScreenX = GOT_MAP_SCREENCOUNT_HORIZ;
+	unsigned int firstScreenY = 0, lastScreenY = GOT_MAP_SCREENCOUNT_VERT;
+	if (area) {
+		if ((area->width == 0) || (area->height == 0)) {
+			lastScreenX = lastScreenY = 0;
+		} else {
+			firstScreenX = area->x / GOT_SCR_WIDTH;
+			lastScreenX = (area->x + area->width - 1) / GOT_SCR_WIDTH + 1;
+			firstScreenY = area->y / GOT_SCR_HEIGHT;
+			lastScreenY = (area->y + area->height - 1) / GOT_SCR_HEIGHT + 1;
+		}
+	}
 
-	// Read the whole map since it's so small
+	// Read a whole screen at a time since they're so small
 	uint8_t *mapData = new uint8_t[GOT_SCR_LEN];
 	boost::scoped_array<uint8_t> scoped_mapData(mapData);
 
@@ -285,26 +398,36 @@ MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 	for (unsigned int s = 0; s < GOT_MAP_NUMSCREENS; s++) {
 		unsigned int originX = s % GOT_MAP_SCREENCOUNT_HORIZ;
 		unsigned int originY = s / GOT_MAP_SCREENCOUNT_HORIZ;
+		if (
+			(originX < firstScreenX) || (originX >= lastScreenX) ||
+			(originY < firstScreenY) || (originY >= lastScreenY)
+		) {
+			continue;
+		}
 
+		input->seekg(s * GOT_SCR_LEN, stream::start);
 		input->read((char *)mapData, GOT_SCR_LEN);
 
 		// Process the background layer
-		tiles->reserve(GOT_SCR_LEN_BG);
 		for (unsigned int i = 0; i < GOT_SCR_LEN_BG; i++) {
 			// The default tile actually has an image, so don't exclude it
 			//if (bg[i] == GOT_DEFAULT_BGTILE) continue;
 
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+			unsigned int x = originX * GOT_SCR_WIDTH + i % GOT_SCR_WIDTH;
+			unsigned int y = originY * GOT_SCR_HEIGHT + i / GOT_SCR_WIDTH;
+			if (!inArea(area, x, y)) continue;
+
+			Map2D::Layer::ItemPtr t(createItem(arena));
 			t->type = Map2D::Layer::Item::Default;
-			t->x = originX * GOT_SCR_WIDTH + i % GOT_SCR_WIDTH;
-			t->y = originY * GOT_SCR_HEIGHT + i / GOT_SCR_WIDTH;
+			t->x = x;
+			t->y = y;
 			t->code = mapData[i];
 			tiles->push_back(t);
 		}
 
 		// Get the default BG tile for this screen
 		{
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+			Map2D::Layer::ItemPtr t(createItem(arena));
 			t->type = Map2D::Layer::Item::Default;
 			t->x = originX;
 			t->y = originY;
@@ -314,7 +437,7 @@ MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 
 		// Get the default song for this screen
 		{
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+			Map2D::Layer::ItemPtr t(createItem(arena));
 			t->type = Map2D::Layer::Item::Default;
 			t->x = originX;
 			t->y = originY;
@@ -326,10 +449,14 @@ MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 		for (unsigned int i = 0; i < GOT_NUM_ACTORS; i++) {
 			if (mapData[GOT_ACTOR_OFFSET + i] == 0) continue;
 
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+			unsigned int x = originX * GOT_SCR_WIDTH + mapData[GOT_ACTOR_OFFSET + 16 + i] % GOT_SCR_WIDTH;
+			unsigned int y = originY * GOT_SCR_HEIGHT + mapData[GOT_ACTOR_OFFSET + 16 + i] / GOT_SCR_WIDTH;
+			if (!inArea(area, x, y)) continue;
+
+			Map2D::Layer::ItemPtr t(createItem(arena));
 			t->type = Map2D::Layer::Item::Default;
-			t->x = originX * GOT_SCR_WIDTH + mapData[GOT_ACTOR_OFFSET + 16 + i] % GOT_SCR_WIDTH;
-			t->y = originY * GOT_SCR_HEIGHT + mapData[GOT_ACTOR_OFFSET + 16 + i] / GOT_SCR_WIDTH;
+			t->x = x;
+			t->y = y;
 			t->code = mapData[GOT_ACTOR_OFFSET + i] - 1;
 			tilesActor->push_back(t);
 		}
@@ -338,60 +465,29 @@ MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 		for (unsigned int i = 0; i < GOT_NUM_OBJECTS; i++) {
 			if (mapData[GOT_OBJ_OFFSET + i] == 0) continue;
 
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = originX * GOT_SCR_WIDTH
+			unsigned int x = originX * GOT_SCR_WIDTH
 				+ (mapData[GOT_OBJ_OFFSET + 30 + i * 2]
 					| (mapData[GOT_OBJ_OFFSET + 30 + i * 2 + 1] << 8));
-			t->y = originY * GOT_SCR_HEIGHT
+			unsigned int y = originY * GOT_SCR_HEIGHT
 				+ (mapData[GOT_OBJ_OFFSET + 90 + i * 2]
 					| (mapData[GOT_OBJ_OFFSET + 90 + i * 2 + 1] << 8));
+			if (!inArea(area, x, y)) continue;
+
+			Map2D::Layer::ItemPtr t(createItem(arena));
+			t->type = Map2D::Layer::Item::Default;
+			t->x = x;
+			t->y = y;
 			t->code = mapData[GOT_OBJ_OFFSET + i] - 1;
 			tilesObj->push_back(t);
 		}
 
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= GOT_MAX_VALID_BG_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		//if (i == GOT_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
-	Map2D::Layer::ItemPtrVectorPtr validActorItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 1; i <= GOT_MAX_VALID_ACTOR_TILECODE; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validActorItems->push_back(t);
-	}
-	Map2D::Layer::ItemPtrVectorPtr validObjItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 1; i <= GOT_MAX_VALID_OBJ_TILECODE; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validObjItems->push_back(t);
-	}
-	Map2D::Layer::ItemPtrVectorPtr validMusItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i < GOT_MAX_SONGS; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = 256 + i;
-		validMusItems->push_back(t);
-	}
+	// The lists of permitted tiles are shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
+	Map2D::Layer::ItemPtrVectorPtr validActorItems = this->validActorCatalogue.get();
+	Map2D::Layer::ItemPtrVectorPtr validObjItems = this->validObjCatalogue.get();
+	Map2D::Layer::ItemPtrVectorPtr validMusItems = this->validMusCatalogue.get();
 
 	// Create the map structures
 	Map2D::LayerPtr musLayer(new Layer_GOTFlags("Music", tilesMus, validMusItems));
@@ -414,7 +510,8 @@ MapPtr MapType_GOT::open(stream::input_sptr input, SuppData& suppData) const
 		GOT_SCR_WIDTH * GOT_MAP_SCREENCOUNT_HORIZ,
 		GOT_SCR_HEIGHT * GOT_MAP_SCREENCOUNT_VERT,
 		GOT_TILE_WIDTH, GOT_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
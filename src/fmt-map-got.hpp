@@ -30,17 +30,41 @@ namespace gamemaps {
 class MapType_GOT: virtual public MapType_Base
 {
 	public:
+		MapType_GOT();
+
 		virtual std::string getMapCode() const;
 		virtual std::string getFriendlyName() const;
 		virtual std::vector<std::string> getFileExtensions() const;
 		virtual std::vector<std::string> getGameList() const;
-		virtual Certainty isInstance(stream::input_sptr psMap) const;
+		virtual Certainty isInstance(const Probe& probe) const;
+		virtual DetectFilter getDetectFilter() const;
 		virtual MapPtr create(SuppData& suppData) const;
 		virtual MapPtr open(stream::input_sptr input, SuppData& suppData) const;
+		virtual MapPtr openRegion(stream::input_sptr input, SuppData& suppData,
+			const MapRegion& region) const;
 		virtual void write(MapPtr map, stream::expanding_output_sptr output,
 			ExpandingSuppData& suppData) const;
 		virtual SuppFilenames getRequiredSupps(stream::input_sptr input,
 			const std::string& filename) const;
+
+	protected:
+		/// Read the screens overlapping an area of the map.
+		/**
+		 * @param input
+		 *   The map file.
+		 *
+		 * @param area
+		 *   Area to load, already clipped to the map, or NULL to load every
+		 *   screen in full.
+		 *
+		 * @return The map.
+		 */
+		MapPtr openScreens(stream::input_sptr input, const MapRegion *area) const;
+
+		ItemCatalogue validBGCatalogue;    ///< Permitted background tiles
+		ItemCatalogue validActorCatalogue; ///< Permitted actors
+		ItemCatalogue validObjCatalogue;   ///< Permitted objects
+		ItemCatalogue validMusCatalogue;   ///< Permitted songs
 };
 
 } // namespace gamemaps
@@ -21,9 +21,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-harry.hpp"
 
 /// Width of each tile in pixels
@@ -86,14 +88,14 @@ class Layer_HarryActor: virtual public GenericMap2D::Layer
 class Layer_HarryBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_HarryBackground(const std::string& name, ItemPtrVectorPtr& items,
+		Layer_HarryBackground(const std::string& name, TileGridPtr& tiles,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					name,
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -113,6 +115,43 @@ class Layer_HarryBackground: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted actors.
+static void buildValidActorItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= HH_MAX_VALID_TILECODE_ACTOR; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted background and foreground tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= HH_MAX_VALID_TILECODE_BG; i++) {
+		// The default tile actually has an image, so don't exclude it
+		if (i == HH_DEFAULT_TILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Harry::MapType_Harry()
+	:	validActorCatalogue(buildValidActorItems),
+		validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_Harry::getMapCode() const
 {
 	return "map-harry";
@@ -138,28 +177,28 @@ std::vector<std::string> MapType_Harry::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Harry::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Harry::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 	// TESTED BY: fmt_map_harry_isinstance_c01
 	if (lenMap < 29 + 768 + 256 + 10 + 2 + 4) return MapType::DefinitelyNo; // too short
 
-	psMap->seekg(0, stream::start);
+	// Read everything up to and including the actor count
+	uint8_t header[0x12 + 11 + 768 + 256 + 10 + 2];
+	if (probe.read(0, header, sizeof(header)) != sizeof(header)) {
+		return MapType::DefinitelyNo; // read error
+	}
 
 	// Check the signature
-	char sig[0x12];
-	psMap->read(sig, 0x12);
 	// TESTED BY: fmt_map_harry_isinstance_c02
-	if (strncmp(sig, "\x11SubZero Game File", 0x12) != 0) return MapType::DefinitelyNo;
+	if (memcmp(header, "\x11SubZero Game File", 0x12) != 0) return MapType::DefinitelyNo;
 	lenMap -= 0x12;
 
 	// Skip flags
-	psMap->seekg(11, stream::cur);
 	lenMap -= 11;
 
 	// Check palette is within range
-	char pal[768];
-	psMap->read(pal, 768);
+	const char *pal = (const char *)header + 0x12 + 11;
 	for (int i = 0; i < 768; i++) {
 		// TESTED BY: fmt_map_harry_isinstance_c03
 		if (pal[i] > 0x40) return MapType::DefinitelyNo;
@@ -167,8 +206,7 @@ MapType::Certainty MapType_Harry::isInstance(stream::input_sptr psMap) const
 	lenMap -= 768;
 
 	// Check tile flags are within range
-	char tileFlags[256];
-	psMap->read(tileFlags, 256);
+	const char *tileFlags = pal + 768;
 	for (int i = 0; i < 256; i++) {
 		// TESTED BY: fmt_map_harry_isinstance_c04
 		if (tileFlags[i] > 0x01) return MapType::DefinitelyNo;
@@ -176,25 +214,25 @@ MapType::Certainty MapType_Harry::isInstance(stream::input_sptr psMap) const
 	lenMap -= 256;
 
 	// Skip unknown block
-	psMap->seekg(10, stream::cur);
 	lenMap -= 10;
 
 	// isinstance_c01 should have prevented this
 	assert(lenMap >= 6);
 
-	uint16_t numActors;
-	psMap >> u16le(numActors);
+	const uint8_t *actorCount = header + sizeof(header) - 2;
+	uint16_t numActors = actorCount[0] | (actorCount[1] << 8);
 	lenMap -= 2;
 
 	// TESTED BY: fmt_map_harry_isinstance_c05
 	if (lenMap < (unsigned)(numActors * HH_ACTOR_LEN + 4)) return MapType::DefinitelyNo;
 
-	psMap->seekg(numActors * HH_ACTOR_LEN, stream::cur);
+	stream::pos offSize = sizeof(header) + numActors * HH_ACTOR_LEN;
 	lenMap -= numActors * HH_ACTOR_LEN;
 
 	assert(lenMap >= 4);
 	uint16_t mapWidth, mapHeight;
-	psMap >> u16le(mapWidth) >> u16le(mapHeight);
+	if (!probe.readU16le(offSize, &mapWidth)) return MapType::DefinitelyNo;
+	if (!probe.readU16le(offSize + 2, &mapHeight)) return MapType::DefinitelyNo;
 	lenMap -= 4;
 
 	// TESTED BY: fmt_map_harry_isinstance_c06
@@ -204,14 +242,55 @@ MapType::Certainty MapType_Harry::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Harry::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 29 + 768 + 256 + 10 + 2 + 4;
+	DetectFilter::Signature sig;
+	sig.offset = 0;
+	sig.bytes = std::string("\x11SubZero Game File", 0x12);
+	filter.signatures.push_back(sig);
+	return filter;
+}
+
 MapPtr MapType_Harry::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Decode a tile layer the first time it is requested.
+/**
+ * @param title
+ *   Name of the layer.
+ *
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param mapWidth
+ *   Width of the map, in tiles.
+ *
+ * @param mapHeight
+ *   Height of the map, in tiles.
+ *
+ * @param validItems
+ *   List of permitted tiles.
+ */
+static Map2D::LayerPtr loadHarryLayer(const char *title, RawBlockPtr raw,
+	unsigned int mapWidth, unsigned int mapHeight,
+	Map2D::Layer::ItemPtrVectorPtr validItems)
+{
+	TileGridPtr tiles(new TileGrid(mapWidth, mapHeight));
+	if (!raw->empty()) {
+		decodeGrid8(&raw->at(0), tiles.get(), raw->size(), HH_DEFAULT_TILE);
+	}
+	return Map2D::LayerPtr(new Layer_HarryBackground(title, tiles, validItems));
+}
+
 MapPtr MapType_Harry::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 
 	Map::Attributes attributes;
@@ -259,19 +338,19 @@ MapPtr MapType_Harry::open(stream::input_sptr input, SuppData& suppData) const
 
 	// Create a fake object with the player's starting location
 	{
-		Map2D::Layer::ItemPtr p(new Map2D::Layer::Item);
+		Map2D::Layer::ItemPtr p(createItem(arena));
 		p->type = Map2D::Layer::Item::Player;
 		p->x = startX;
 		p->y = startY;
 		p->code = 0; // unused
-		p->playerNumber = 0; // player 1
-		p->playerFacingLeft = false; // fixed?
+		p->player().number = 0; // player 1
+		p->player().facingLeft = false; // fixed?
 		actors->push_back(p);
 	}
 
 	// Read the real objects
 	for (unsigned int i = 0; i < numActors; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		input
 			>> u8(code)
 			>> u16le(t->x)
@@ -287,83 +366,41 @@ MapPtr MapType_Harry::open(stream::input_sptr input, SuppData& suppData) const
 		input->seekg(128-1-2-2, stream::cur);
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validActorItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= HH_MAX_VALID_TILECODE_ACTOR; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validActorItems->push_back(t);
-	}
-
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validActorItems = this->validActorCatalogue.get();
 	Map2D::LayerPtr actorLayer(new Layer_HarryActor(actors, validActorItems));
 
 	uint16_t mapWidth, mapHeight;
 	input >> u16le(mapWidth) >> u16le(mapHeight);
 
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr bgtiles(new Map2D::Layer::ItemPtrVector());
-	bgtiles->reserve(mapWidth * mapHeight);
-
-	for (unsigned int y = 0; y < mapHeight; y++) {
-		for (unsigned int x = 0; x < mapWidth; x++) {
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = x;
-			t->y = y;
-			input >> u8(code);
-			t->code = code;
-			if (t->code != HH_DEFAULT_TILE) bgtiles->push_back(t);
-		}
-	}
+	// Read the background and foreground layers, but leave them to be decoded
+	// when needed
+	stream::len lenLayer = mapWidth * mapHeight;
+	RawBlockPtr bgRaw = readRawBlock(input, lenLayer);
+	RawBlockPtr fgRaw = readRawBlock(input, lenLayer);
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= HH_MAX_VALID_TILECODE_BG; i++) {
-		// The default tile actually has an image, so don't exclude it
-		if (i == HH_DEFAULT_TILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
-	Map2D::LayerPtr bgLayer(new Layer_HarryBackground("Background", bgtiles, validBGItems));
-
-	// Read the foreground layer
-	Map2D::Layer::ItemPtrVectorPtr fgtiles(new Map2D::Layer::ItemPtrVector());
-	fgtiles->reserve(mapWidth * mapHeight);
-	for (unsigned int y = 0; y < mapHeight; y++) {
-		for (unsigned int x = 0; x < mapWidth; x++) {
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = x;
-			t->y = y;
-			input >> u8(code);
-			t->code = code;
-			if (t->code != HH_DEFAULT_TILE) fgtiles->push_back(t);
-		}
-	}
-
-	// Same items are valid in both FG and BG layers, so reuse BG list here
-	Map2D::LayerPtr fgLayer(new Layer_HarryBackground("Foreground", fgtiles, validBGItems));
+	// Same items are valid in both FG and BG layers, so reuse BG list for both
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
-	layers.push_back(fgLayer);
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
+	layers.push_back(Map2D::LayerPtr()); // foreground, loaded on demand
 	layers.push_back(actorLayer);
 
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadHarryLayer, "Background", bgRaw,
+		mapWidth, mapHeight, validBGItems);
+	loaders[1] = boost::bind(loadHarryLayer, "Foreground", fgRaw,
+		mapWidth, mapHeight, validBGItems);
+
 	Map2DPtr map(new GenericMap2D(
 		attributes, Map::GraphicsFilenames(),
 		Map2D::HasViewport,
 		HH_VIEWPORT_WIDTH, HH_VIEWPORT_HEIGHT,
 		mapWidth, mapHeight,
 		HH_TILE_WIDTH, HH_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena, loaders
 	));
 
 	return map;
@@ -407,7 +444,7 @@ void MapType_Harry::write(MapPtr map, stream::expanding_output_sptr output,
 				// We've already set the player position
 				throw stream::error("This map format can only have one player.");
 			}
-			if ((*i)->playerNumber == 0) {
+			if ((*i)->player().number == 0) {
 				startX = (*i)->x;
 				startY = (*i)->y;
 				setPlayer = true;
@@ -470,30 +507,18 @@ void MapType_Harry::write(MapPtr map, stream::expanding_output_sptr output,
 	unsigned long lenTiles = mapWidth * mapHeight;
 	uint8_t *tiles = new uint8_t[lenTiles];
 	boost::scoped_array<uint8_t> stiles(tiles);
-	// Set the default background tile
-	memset(tiles, HH_DEFAULT_TILE, lenTiles);
-
-	layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr itemsBG = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = itemsBG->begin();
-		i != itemsBG->end();
-		i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		tiles[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	TileGridPtr grid = getTileGrid(map2d->getLayer(0), mapWidth, mapHeight);
+	for (unsigned long i = 0; i < lenTiles; i++) {
+		uint32_t code = grid->codes[i];
+		tiles[i] = (code == INVALID_TILECODE) ? HH_DEFAULT_TILE : code;
 	}
 	output->write((char *)tiles, lenTiles);
 
 	// Write the foreground layer
-	memset(tiles, HH_DEFAULT_TILE, lenTiles);
-	layer = map2d->getLayer(1);
-	const Map2D::Layer::ItemPtrVectorPtr itemsFG = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = itemsFG->begin();
-		i != itemsFG->end();
-		i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		tiles[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	grid = getTileGrid(map2d->getLayer(1), mapWidth, mapHeight);
+	for (unsigned long i = 0; i < lenTiles; i++) {
+		uint32_t code = grid->codes[i];
+		tiles[i] = (code == INVALID_TILECODE) ? HH_DEFAULT_TILE : code;
 	}
 	output->write((char *)tiles, lenTiles);
 
@@ -21,8 +21,10 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include <camoto/iostream_helpers.hpp>
 #include "fmt-map-hocus.hpp"
 
@@ -61,6 +63,18 @@ using namespace camoto::gamegraphics;
 class Layer_HocusBackground: virtual public GenericMap2D::Layer
 {
 	public:
+		Layer_HocusBackground(const std::string& name, TileGridPtr& tiles,
+			ItemPtrVectorPtr& validItems)
+			:	GenericMap2D::Layer(
+					name,
+					Map2D::Layer::NoCaps,
+					0, 0,
+					0, 0,
+					tiles, validItems
+				)
+		{
+		}
+
 		Layer_HocusBackground(const std::string& name, ItemPtrVectorPtr& items,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
@@ -112,9 +126,9 @@ std::vector<std::string> MapType_Hocus::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Hocus::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Hocus::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 	// TESTED BY: fmt_map_hocus_isinstance_c01
 	if (lenMap != 14400) return MapType::DefinitelyNo; // wrong size
 
@@ -122,74 +136,150 @@ MapType::Certainty MapType_Hocus::isInstance(stream::input_sptr psMap) const
 	return MapType::PossiblyYes;
 }
 
+DetectFilter MapType_Hocus::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(14400);
+	return filter;
+}
+
 MapPtr MapType_Hocus::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
-MapPtr MapType_Hocus::open(stream::input_sptr input, SuppData& suppData) const
+/// Decode a tile layer the first time it is requested.
+/**
+ * @param title
+ *   Name of the layer.
+ *
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param emptyCode
+ *   Tile code used for empty cells in this layer.
+ */
+static Map2D::LayerPtr loadHocusLayer(const char *title, RawBlockPtr raw,
+	unsigned int emptyCode)
 {
-	input->seekg(0, stream::start);
-
-	uint8_t code;
+	TileGridPtr tiles(new TileGrid(HP_MAP_WIDTH, HP_MAP_HEIGHT));
+	decodeGrid8(&raw->at(0), tiles.get(), HP_MAP_SIZE, emptyCode);
 
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr bgtiles(new Map2D::Layer::ItemPtrVector());
-	bgtiles->reserve(HP_MAP_WIDTH * HP_MAP_HEIGHT);
+	Map2D::Layer::ItemPtrVectorPtr validItems(new Map2D::Layer::ItemPtrVector());
+	return Map2D::LayerPtr(new Layer_HocusBackground(title, tiles, validItems));
+}
 
-	for (unsigned int y = 0; y < HP_MAP_HEIGHT; y++) {
-		for (unsigned int x = 0; x < HP_MAP_WIDTH; x++) {
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+/// Read the tiles within a region of one layer.
+/**
+ * @param input
+ *   Layer file.
+ *
+ * @param area
+ *   Region to read, already clipped to the map.
+ *
+ * @param emptyCode
+ *   Tile code used for empty cells in this layer.
+ *
+ * @param arena
+ *   Arena to allocate the tiles from.
+ *
+ * @return The tiles within the region.
+ */
+static Map2D::Layer::ItemPtrVectorPtr readHocusRegion(stream::input_sptr input,
+	const MapRegion& area, unsigned int emptyCode, const ItemArenaPtr& arena)
+{
+	RawBlockPtr raw = readGridRegion(input, 0, HP_MAP_WIDTH, 1,
+		area.y, area.height, area.x, area.width);
+
+	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
+	tiles->reserve(raw->size());
+	unsigned int i = 0;
+	for (unsigned int y = area.y; y < area.y + area.height; y++) {
+		for (unsigned int x = area.x; x < area.x + area.width; x++) {
+			unsigned int code = (*raw)[i++];
+			if (code == emptyCode) continue;
+			Map2D::Layer::ItemPtr t(createItem(arena));
 			t->type = Map2D::Layer::Item::Default;
 			t->x = x;
 			t->y = y;
-			input >> u8(code);
 			t->code = code;
-			if (t->code != HP_DEFAULT_TILE_BG) bgtiles->push_back(t);
+			tiles->push_back(t);
 		}
 	}
+	return tiles;
+}
 
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	Map2D::LayerPtr bgLayer(new Layer_HocusBackground("Background", bgtiles, validBGItems));
+/// Create the map structure around the layers.
+static MapPtr createHocusMap(Map2D::LayerPtrVector& layers,
+	const ItemArenaPtr& arena, const GenericMap2D::LayerLoaderVector& loaders)
+{
+	Map2DPtr map(new GenericMap2D(
+		Map::Attributes(), Map::GraphicsFilenames(),
+		Map2D::HasViewport,
+		HP_VIEWPORT_WIDTH, HP_VIEWPORT_HEIGHT,
+		HP_MAP_WIDTH, HP_MAP_HEIGHT,
+		HP_TILE_WIDTH, HP_TILE_HEIGHT,
+		layers, Map2D::PathPtrVectorPtr(),
+		arena, loaders
+	));
+
+	return map;
+}
+
+MapPtr MapType_Hocus::open(stream::input_sptr input, SuppData& suppData) const
+{
+	input->seekg(0, stream::start);
+
+	// Read the background layer, but leave it to be decoded when needed
+	RawBlockPtr bgRaw = readRawBlock(input, HP_MAP_SIZE);
 
 	stream::input_sptr layerFile = suppData[SuppItem::Layer1];
 	assert(layerFile);
 
 	// Read the foreground layer
-	Map2D::Layer::ItemPtrVectorPtr fgtiles(new Map2D::Layer::ItemPtrVector());
-	fgtiles->reserve(HP_MAP_WIDTH * HP_MAP_HEIGHT);
+	RawBlockPtr fgRaw = readRawBlock(layerFile, HP_MAP_SIZE);
 
-	for (unsigned int y = 0; y < HP_MAP_HEIGHT; y++) {
-		for (unsigned int x = 0; x < HP_MAP_WIDTH; x++) {
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = x;
-			t->y = y;
-			layerFile >> u8(code);
-			t->code = code;
-			if (t->code != HP_DEFAULT_TILE_BG) fgtiles->push_back(t);
-		}
-	}
+	Map2D::LayerPtrVector layers;
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
+	layers.push_back(Map2D::LayerPtr()); // foreground, loaded on demand
+	//layers.push_back(actorLayer);
+
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadHocusLayer, "Background", bgRaw,
+		HP_DEFAULT_TILE_BG);
+	loaders[1] = boost::bind(loadHocusLayer, "Foreground", fgRaw,
+		HP_DEFAULT_TILE_FG);
+
+	return createHocusMap(layers, ItemArenaPtr(), loaders);
+}
+
+MapPtr MapType_Hocus::openRegion(stream::input_sptr input,
+	SuppData& suppData, const MapRegion& region) const
+{
+	ItemArenaPtr arena(new ItemArena());
+
+	MapRegion area = region;
+	clipRegion(&area, HP_MAP_WIDTH, HP_MAP_HEIGHT);
+
+	stream::input_sptr layerFile = suppData[SuppItem::Layer1];
+	assert(layerFile);
 
+	Map2D::Layer::ItemPtrVectorPtr bgtiles =
+		readHocusRegion(input, area, HP_DEFAULT_TILE_BG, arena);
+	Map2D::Layer::ItemPtrVectorPtr fgtiles =
+		readHocusRegion(layerFile, area, HP_DEFAULT_TILE_FG, arena);
+
+	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
 	Map2D::Layer::ItemPtrVectorPtr validFGItems(new Map2D::Layer::ItemPtrVector());
-	Map2D::LayerPtr fgLayer(new Layer_HocusBackground("Foreground", fgtiles, validFGItems));
 
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
-	layers.push_back(fgLayer);
-	//layers.push_back(actorLayer);
+	layers.push_back(Map2D::LayerPtr(
+		new Layer_HocusBackground("Background", bgtiles, validBGItems)));
+	layers.push_back(Map2D::LayerPtr(
+		new Layer_HocusBackground("Foreground", fgtiles, validFGItems)));
 
-	Map2DPtr map(new GenericMap2D(
-		Map::Attributes(), Map::GraphicsFilenames(),
-		Map2D::HasViewport,
-		HP_VIEWPORT_WIDTH, HP_VIEWPORT_HEIGHT,
-		HP_MAP_WIDTH, HP_MAP_HEIGHT,
-		HP_TILE_WIDTH, HP_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
-	));
-
-	return map;
+	return createHocusMap(layers, arena, GenericMap2D::LayerLoaderVector());
 }
 
 void MapType_Hocus::write(MapPtr map, stream::expanding_output_sptr output,
@@ -200,25 +290,14 @@ void MapType_Hocus::write(MapPtr map, stream::expanding_output_sptr output,
 	if (map2d->getLayerCount() != 2)
 		throw stream::error("Incorrect layer count for this format.");
 
-	unsigned int mapWidth, mapHeight;
-	map2d->getMapSize(&mapWidth, &mapHeight);
-
-	Map2D::LayerPtr layer;
-
 	// Write the background layer
 	boost::scoped_array<uint8_t> tiles(new uint8_t[HP_MAP_SIZE]);
 
-	// Set the default background tile
-	memset(tiles.get(), HP_DEFAULT_TILE_BG, HP_MAP_SIZE);
-
-	layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr itemsBG = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = itemsBG->begin();
-		i != itemsBG->end();
-		i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		tiles[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	TileGridPtr grid = getTileGrid(map2d->getLayer(0), HP_MAP_WIDTH,
+		HP_MAP_HEIGHT);
+	for (unsigned int i = 0; i < HP_MAP_SIZE; i++) {
+		uint32_t code = grid->codes[i];
+		tiles[i] = (code == INVALID_TILECODE) ? HP_DEFAULT_TILE_BG : code;
 	}
 
 	output->write((char *)tiles.get(), HP_MAP_SIZE);
@@ -229,17 +308,10 @@ void MapType_Hocus::write(MapPtr map, stream::expanding_output_sptr output,
 	stream::output_sptr layerFile = suppData[SuppItem::Layer1];
 	assert(layerFile);
 
-	// Set the default background tile
-	memset(tiles.get(), HP_DEFAULT_TILE_FG, HP_MAP_SIZE);
-
-	layer = map2d->getLayer(1);
-	const Map2D::Layer::ItemPtrVectorPtr itemsFG = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = itemsFG->begin();
-		i != itemsFG->end();
-		i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		tiles[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	grid = getTileGrid(map2d->getLayer(1), HP_MAP_WIDTH, HP_MAP_HEIGHT);
+	for (unsigned int i = 0; i < HP_MAP_SIZE; i++) {
+		uint32_t code = grid->codes[i];
+		tiles[i] = (code == INVALID_TILECODE) ? HP_DEFAULT_TILE_FG : code;
 	}
 
 	layerFile->seekp(0, stream::start);
@@ -21,9 +21,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
+#include "map2d-rle.hpp"
 #include "fmt-map-nukem2.hpp"
 
 /// Width of each tile in pixels
@@ -103,13 +106,13 @@ class Layer_Nukem2Actor: virtual public GenericMap2D::Layer
 class Layer_Nukem2Background: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_Nukem2Background(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_Nukem2Background(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -136,13 +139,13 @@ class Layer_Nukem2Background: virtual public GenericMap2D::Layer
 class Layer_Nukem2Foreground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_Nukem2Foreground(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_Nukem2Foreground(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Foreground",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -170,14 +173,16 @@ class Map2D_Nukem2: virtual public GenericMap2D
 {
 	public:
 		Map2D_Nukem2(const Attributes& attributes,
-			unsigned int width, LayerPtrVector& layers)
+			unsigned int width, LayerPtrVector& layers,
+			const ItemArenaPtr& arena, const LayerLoaderVector& loaders)
 			:	GenericMap2D(
 					attributes, GraphicsFilenames(),
 					Map2D::HasViewport,
 					DN2_VIEWPORT_WIDTH, DN2_VIEWPORT_HEIGHT,
 					width, DN2_NUM_TILES_BG / width,
 					DN2_TILE_WIDTH, DN2_TILE_HEIGHT,
-					layers, Map2D::PathPtrVectorPtr()
+					layers, Map2D::PathPtrVectorPtr(),
+					arena, loaders
 				)
 		{
 			// Populate the graphics filenames
@@ -217,6 +222,40 @@ class Map2D_Nukem2: virtual public GenericMap2D
 };
 
 
+/// Populate the list of permitted background tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < DN2_NUM_SOLID_TILES; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted foreground tiles.
+static void buildValidFGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i < DN2_NUM_MASKED_TILES; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Nukem2::MapType_Nukem2()
+	:	validBGCatalogue(buildValidBGItems),
+		validFGCatalogue(buildValidFGItems)
+{
+}
+
 std::string MapType_Nukem2::getMapCode() const
 {
 	return "map-nukem2";
@@ -241,34 +280,27 @@ std::vector<std::string> MapType_Nukem2::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Nukem2::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Nukem2::isInstance(const Probe& probe) const
 {
-	stream::len lenMap = psMap->size();
+	stream::len lenMap = probe.size();
 
 	// TESTED BY: fmt_map_nukem2_isinstance_c01
 	if (lenMap < 2+13+13+13+1+1+2+2 + 2+DN2_LAYER_LEN_BG) return MapType::DefinitelyNo; // too short
 
-	psMap->seekg(0, stream::start);
 	uint16_t bgOffset;
-	std::string zoneFile, backFile, musFile;
-	psMap
-		>> u16le(bgOffset)
-	;
+	if (!probe.readU16le(0, &bgOffset)) return MapType::DefinitelyNo;
 
 	// TESTED BY: fmt_map_nukem2_isinstance_c02
 	if (bgOffset > lenMap - (2+DN2_LAYER_LEN_BG)) return MapType::DefinitelyNo; // offset wrong
 
-	psMap->seekg(13 * 3 + 4, stream::cur);
-
 	uint16_t numActorInts;
-	psMap >> u16le(numActorInts);
+	if (!probe.readU16le(2 + 13 * 3 + 4, &numActorInts)) return MapType::DefinitelyNo;
 
 	// TESTED BY: fmt_map_nukem2_isinstance_c03
 	if (2+13*3+6 + numActorInts * 2 + 2+DN2_LAYER_LEN_BG > lenMap) return MapType::DefinitelyNo; // too many actors
 
-	psMap->seekg(bgOffset + 2+DN2_LAYER_LEN_BG, stream::start);
 	uint16_t lenExtra;
-	psMap >> u16le(lenExtra);
+	if (!probe.readU16le(bgOffset + 2+DN2_LAYER_LEN_BG, &lenExtra)) return MapType::DefinitelyNo;
 	// TESTED BY: fmt_map_nukem2_isinstance_c04
 	if (bgOffset + 2+DN2_LAYER_LEN_BG + lenExtra+2 > lenMap) return MapType::DefinitelyNo; // extra data too long
 
@@ -279,14 +311,134 @@ MapType::Certainty MapType_Nukem2::isInstance(stream::input_sptr psMap) const
 	return MapType::PossiblyYes;
 }
 
+DetectFilter MapType_Nukem2::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 2+13+13+13+1+1+2+2 + 2+DN2_LAYER_LEN_BG;
+	return filter;
+}
+
 MapPtr MapType_Nukem2::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Compression used for the foreground layer's extra bits.
+/**
+ * Blocks of differing bytes are split at 0x7F bytes, as 0x80 freezes the
+ * game.  The last block is split at 0x80 instead, and trailing zeroes are
+ * left out, which is how earlier versions of this library wrote the data.
+ */
+static const RLECodec_Signed nukem2ExtraRLE(0x7F, 0x80, 0x00);
+
+/// Expand the RLE-compressed extra bits into two bits per tile.
+/**
+ * @param raw
+ *   Compressed data read from the map file.
+ *
+ * @param extraValues
+ *   Array of DN2_NUM_TILES_BG values to receive the extra bits, already
+ *   shifted into position to be OR'd with the foreground tile code.
+ */
+static void decodeNukem2Extra(const std::vector<uint8_t>& raw,
+	unsigned int *extraValues)
+{
+	// Each byte holds the bits for four tiles.  Tiles not covered by the data
+	// have no extra bits.
+	uint8_t packed[DN2_NUM_TILES_BG / 4];
+	memset(packed, 0, sizeof(packed));
+	unsigned int lenPacked;
+	if (!raw.empty()) {
+		nukem2ExtraRLE.decode(&raw[0], raw.size(), packed, sizeof(packed),
+			&lenPacked);
+	}
+	unsigned int *ev = extraValues;
+	for (unsigned int i = 0; i < sizeof(packed); i++) {
+		uint8_t code = packed[i];
+		*ev++ = (code << 5) & 0x60;
+		*ev++ = (code << 3) & 0x60;
+		*ev++ = (code << 1) & 0x60;
+		*ev++ = (code >> 1) & 0x60;
+	}
+	return;
+}
+
+/// Decode the background or foreground layer the first time it is requested.
+/**
+ * Both layers are stored interleaved in the same block of tile codes, so the
+ * same data is used for each and only the requested layer is extracted.
+ *
+ * @param rawTiles
+ *   Tile codes read from the map file.
+ *
+ * @param rawExtra
+ *   RLE-compressed extra bits for the foreground layer.
+ *
+ * @param mapWidth
+ *   Width of the map, in tiles.
+ *
+ * @param foreground
+ *   true to decode the foreground layer, false for the background layer.
+ *
+ * @param validItems
+ *   List of permitted tiles in the layer.
+ */
+static Map2D::LayerPtr loadNukem2Layer(RawBlockPtr rawTiles,
+	RawBlockPtr rawExtra, unsigned int mapWidth, bool foreground,
+	Map2D::Layer::ItemPtrVectorPtr validItems)
+{
+	// The tile count isn't always a multiple of the map width, so round the
+	// grid height up to keep any tiles in the last partial row.
+	unsigned int gridHeight = (DN2_NUM_TILES_BG + mapWidth - 1) / mapWidth;
+	TileGridPtr tiles(new TileGrid(mapWidth, gridHeight));
+	uint32_t *codes = &tiles->codes[0];
+
+	// Any cells past the end of the data are left empty, as a zero code means
+	// no tile in either layer.
+	unsigned int lenTiles = rawTiles->size() / 2;
+	const uint8_t *raw = lenTiles ? &rawTiles->at(0) : NULL;
+
+	if (!foreground) {
+		for (unsigned int i = 0; i < lenTiles; i++) {
+			unsigned int v = raw[i * 2] | (raw[i * 2 + 1] << 8);
+			unsigned int code;
+			if (v & 0x8000) {
+				// This cell has a foreground and background tile
+				code = v & 0x3FF;
+			} else if (v < DN2_NUM_SOLID_TILES * DN2_TILE_WIDTH) {
+				// Background only tile
+				code = v >> 3;
+			} else {
+				// Foreground only tile
+				continue;
+			}
+			if (code != DN2_DEFAULT_BGTILE) codes[i] = code;
+		}
+		return Map2D::LayerPtr(new Layer_Nukem2Background(tiles, validItems));
+	}
+
+	unsigned int extraValues[DN2_NUM_TILES_BG];
+	memset(extraValues, 0, sizeof(extraValues));
+	decodeNukem2Extra(*rawExtra, extraValues);
+
+	for (unsigned int i = 0; i < lenTiles; i++) {
+		unsigned int v = raw[i * 2] | (raw[i * 2 + 1] << 8);
+		if (v & 0x8000) {
+			// This cell has a foreground and background tile
+			codes[i] = ((v >> 10) & 0x1F) | extraValues[i];
+		} else if (v >= DN2_NUM_SOLID_TILES * DN2_TILE_WIDTH) {
+			// Foreground only tile
+			codes[i] = ((v >> 3) - DN2_NUM_SOLID_TILES) / 5;
+		}
+	}
+	return Map2D::LayerPtr(new Layer_Nukem2Foreground(tiles, validItems));
+}
+
 MapPtr MapType_Nukem2::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	stream::pos lenMap = input->size();
 	input->seekg(0, stream::start);
 
@@ -395,7 +547,7 @@ MapPtr MapType_Nukem2::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::Layer::ItemPtrVectorPtr actors(new Map2D::Layer::ItemPtrVector());
 	actors->reserve(numActors);
 	for (unsigned int i = 0; i < numActors; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		input
 			>> u16le(t->code)
 			>> u16le(t->x)
@@ -414,134 +566,21 @@ MapPtr MapType_Nukem2::open(stream::input_sptr input, SuppData& suppData) const
 		>> u16le(mapWidth)
 	;
 
-	// Read the main layer
-	Map2D::Layer::ItemPtrVectorPtr tilesBG(new Map2D::Layer::ItemPtrVector());
-	Map2D::Layer::ItemPtrVectorPtr tilesFG(new Map2D::Layer::ItemPtrVector());
-	unsigned int tileValues[DN2_NUM_TILES_BG];
-	memset(tileValues, 0, sizeof(tileValues));
-
-	unsigned int *v = tileValues;
-	for (unsigned int i = 0; (i < DN2_NUM_TILES_BG) && (lenMap >= 2); i++) {
-		input >> u16le(*v++);
-		lenMap -= 2;
-	}
+	// Read the main layer and the extra bits, but leave them to be decoded
+	// when the layers are needed
+	unsigned int lenTiles = DN2_NUM_TILES_BG;
+	if (lenMap < (stream::pos)(lenTiles * 2)) lenTiles = lenMap / 2;
+	RawBlockPtr rawTiles = readRawBlock(input, lenTiles * 2);
+	lenMap -= lenTiles * 2;
 
 	uint16_t lenExtra;
 	input >> u16le(lenExtra);
-	unsigned int extraValues[DN2_NUM_TILES_BG];
-	memset(extraValues, 0, sizeof(extraValues));
-	unsigned int *ev = extraValues;
-	unsigned int *ev_end = extraValues + DN2_NUM_TILES_BG;
-	for (unsigned int i = 0; i < lenExtra; i++) {
-		uint8_t code;
-		input >> u8(code);
-		lenMap--;
-		if (code & 0x80) {
-			// Multiple bytes concatenated together
-			// code == 0xFF for one byte, 0xFE for two bytes, etc.
-			unsigned int len = 0x100 - code;
-			while (len--) {
-				input >> u8(code);
-				lenMap--;
-				i++;
-				if (ev + 4 >= ev_end) break;
-				*ev++ = (code << 5) & 0x60;
-				*ev++ = (code << 3) & 0x60;
-				*ev++ = (code << 1) & 0x60;
-				*ev++ = (code >> 1) & 0x60;
-			}
-		} else {
-			unsigned int len = code;
-			input >> u8(code);
-			lenMap--;
-			i++;
-			if (code == 0x00) {
-				ev += len * 4; // faster
-			} else {
-				while (len--) {
-					if (ev + 4 >= ev_end) break;
-					*ev++ = (code << 5) & 0x60;
-					*ev++ = (code << 3) & 0x60;
-					*ev++ = (code << 1) & 0x60;
-					*ev++ = (code >> 1) & 0x60;
-				}
-			}
-		}
-		if (ev + 4 > ev_end) {
-			// This would read past the end of the array, so skip it
-			lenMap -= lenExtra - i - 1;
-			input->seekg(lenExtra - i - 1, stream::cur);
-			break;
-		}
-	}
+	RawBlockPtr rawExtra = readRawBlock(input, lenExtra);
+	lenMap -= lenExtra;
 
-	v = tileValues;
-	ev = extraValues;
-	for (unsigned int i = 0; i < DN2_NUM_TILES_BG; i++) {
-		if (*v & 0x8000) {
-			// This cell has a foreground and background tile
-			{
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-				t->type = Map2D::Layer::Item::Default;
-				t->x = i % mapWidth;
-				t->y = i / mapWidth;
-				t->code = *v & 0x3FF;
-				if (t->code != DN2_DEFAULT_BGTILE) tilesBG->push_back(t);
-			}
-
-			{
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-				t->type = Map2D::Layer::Item::Default;
-				t->x = i % mapWidth;
-				t->y = i / mapWidth;
-				t->code = ((*v >> 10) & 0x1F) | *ev;
-				tilesFG->push_back(t);
-			}
-
-		} else if (*v < DN2_NUM_SOLID_TILES * DN2_TILE_WIDTH) {
-			// Background only tile
-
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = i % mapWidth;
-			t->y = i / mapWidth;
-			t->code = *v >> 3;
-			if (t->code != DN2_DEFAULT_BGTILE) tilesBG->push_back(t);
-		} else {
-			// Foreground only tile
-
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = i % mapWidth;
-			t->y = i / mapWidth;
-			t->code = ((*v >> 3) - DN2_NUM_SOLID_TILES) / 5;
-			tilesFG->push_back(t);
-		}
-		v++;
-		ev++;
-	}
-
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i < DN2_NUM_SOLID_TILES; i++) {
-		// Background tiles first
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
-	Map2D::Layer::ItemPtrVectorPtr validFGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i < DN2_NUM_MASKED_TILES; i++) {
-		// Then foreground tiles
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validFGItems->push_back(t);
-	}
+	// The lists of permitted tiles are shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
+	Map2D::Layer::ItemPtrVectorPtr validFGItems = this->validFGCatalogue.get();
 
 	// Trailing filenames
 	attr.type = Map::Attribute::Filename;
@@ -575,15 +614,19 @@ MapPtr MapType_Nukem2::open(stream::input_sptr input, SuppData& suppData) const
 	attributes.push_back(attr);
 
 	// Create the map structures
-	Map2D::LayerPtr bgLayer(new Layer_Nukem2Background(tilesBG, validBGItems));
-	Map2D::LayerPtr fgLayer(new Layer_Nukem2Foreground(tilesFG, validFGItems));
-
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
-	layers.push_back(fgLayer);
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
+	layers.push_back(Map2D::LayerPtr()); // foreground, loaded on demand
 	layers.push_back(actorLayer);
 
-	Map2DPtr map(new Map2D_Nukem2(attributes, mapWidth, layers));
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadNukem2Layer, rawTiles, rawExtra, mapWidth,
+		false, validBGItems);
+	loaders[1] = boost::bind(loadNukem2Layer, rawTiles, rawExtra, mapWidth,
+		true, validFGItems);
+
+	Map2DPtr map(new Map2D_Nukem2(attributes, mapWidth, layers, arena,
+		loaders));
 
 	return map;
 }
@@ -679,22 +722,13 @@ void MapType_Nukem2::write(MapPtr map, stream::expanding_output_sptr output,
 	// Set the default extra bits
 	memset(extra, 0x00, DN2_NUM_TILES_BG * sizeof(uint16_t));
 
-	Map2D::LayerPtr layerBG = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layerBG->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator
-		i = items->begin(); i != items->end(); i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		bg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
-	}
-
-	Map2D::LayerPtr layerFG = map2d->getLayer(1);
-	const Map2D::Layer::ItemPtrVectorPtr itemsFG = layerFG->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator
-		i = itemsFG->begin(); i != itemsFG->end(); i++
-	) {
-		assert(((*i)->x < mapWidth) && ((*i)->y < mapHeight));
-		fg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	// Same rounding as when the map was read, to include the last partial row
+	unsigned int gridHeight = (DN2_NUM_TILES_BG + mapWidth - 1) / mapWidth;
+	TileGridPtr gridBG = getTileGrid(map2d->getLayer(0), mapWidth, gridHeight);
+	TileGridPtr gridFG = getTileGrid(map2d->getLayer(1), mapWidth, gridHeight);
+	for (unsigned int i = 0; i < DN2_NUM_TILES_BG; i++) {
+		if (gridBG->codes[i] != INVALID_TILECODE) bg[i] = gridBG->codes[i];
+		if (gridFG->codes[i] != INVALID_TILECODE) fg[i] = gridFG->codes[i];
 	}
 
 	output << u16le(mapWidth);
@@ -718,91 +752,23 @@ void MapType_Nukem2::write(MapPtr map, stream::expanding_output_sptr output,
 		}
 	}
 
-	std::vector<int> rawExtra;
+	std::vector<uint8_t> rawExtra(DN2_NUM_TILES_BG / 4);
 	for (unsigned int i = 0; i < DN2_NUM_TILES_BG / 4; i++) {
-		rawExtra.push_back(
+		rawExtra[i] =
 			  (extra[i * 4 + 0] >> 5)
 			| (extra[i * 4 + 1] >> 3)
 			| (extra[i * 4 + 2] >> 1)
 			| (extra[i * 4 + 3] << 1)
-		);
+		;
 	}
 
-	std::vector<int> rleExtra;
-	std::vector<int> diffCount;
-	std::vector<int>::iterator i = rawExtra.begin();
-	assert(i != rawExtra.end());
-	int lastByte = *i;
-	int lastByteCount = 1;
-	i++;
-	for (; i != rawExtra.end(); i++) {
-		if (lastByte == *i) {
-			// Write out the different bytes so this byte will get written as at
-			// least a duplicate
-			while (!diffCount.empty()) {
-				std::vector<int>::iterator end;
-				int len;
-				if (diffCount.size() > 0x7F) { // 0x80 length freezes the game
-					len = 0x7F;
-					end = diffCount.begin() + 0x7F;
-				} else {
-					len = diffCount.size();
-					end = diffCount.end();
-				}
-				rleExtra.push_back(0x100 - len);
-				rleExtra.insert(rleExtra.end(), diffCount.begin(), end);
-				diffCount.erase(diffCount.begin(), end);
-			}
-			assert(diffCount.empty());
-			lastByteCount++;
-		} else {
-			// This byte is different to the last
-			if (lastByteCount > 1) {
-				while (lastByteCount > 0) {
-					int amt = std::min(0x7F, lastByteCount);
-					rleExtra.push_back(amt);
-					rleExtra.push_back(lastByte);
-					lastByteCount -= amt;
-				}
-				// proceed with this new, different byte becoming lastByte
-			} else {
-				diffCount.push_back(lastByte);
-			}
-			lastByte = *i;
-			lastByteCount = 1;
-		}
-	}
-	while (!diffCount.empty()) {
-		std::vector<int>::iterator end;
-		int len;
-		if (diffCount.size() > 0x80) {
-			len = 0x80;
-			end = diffCount.begin() + 0x80;
-		} else {
-			len = diffCount.size();
-			end = diffCount.end();
-		}
-		rleExtra.push_back(0x100 - len);
-		rleExtra.insert(rleExtra.end(), diffCount.begin(), end);
-		diffCount.erase(diffCount.begin(), end);
-	}
-	if ((lastByte != 0x00) && (lastByteCount > 0)) {
-		// Need to write out trailing repeated data
-		while (lastByteCount > 0) {
-			int amt = std::min(0x7F, lastByteCount);
-			rleExtra.push_back(amt);
-			rleExtra.push_back(lastByte);
-			lastByteCount -= amt;
-		}
-	}
+	std::vector<uint8_t> rleExtra;
+	nukem2ExtraRLE.encode(&rawExtra[0], rawExtra.size(), &rleExtra);
 	// Last two bytes are always 0x00
 	rleExtra.push_back(0x00);
 	rleExtra.push_back(0x00);
-
 	output << u16le(rleExtra.size());
-	for (std::vector<int>::iterator i = rleExtra.begin(); i != rleExtra.end(); i++) {
-		output << u8(*i);
-	}
+	output->write(&rleExtra[0], rleExtra.size());
 
 	// Zone attribute filename (null-padded, not space-padded)
 	Map::Attribute& attr8 = map->attributes[ATTR_ZONEATTR];
@@ -49,14 +49,14 @@ using namespace camoto::gamegraphics;
 class Layer_RockfordBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_RockfordBackground(ItemPtrVectorPtr& items,
+		Layer_RockfordBackground(TileGridPtr& tiles,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -81,6 +81,37 @@ class Layer_RockfordBackground: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	unsigned int validItems[] = {
+		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+		0x08, 0x09, 0x0A, 0x0B, 0x0C,
+		0x10,
+		0x28, 0x2C, 0x2D, 0x2E,
+		0x30, 0x34, 0x35, 0x36, 0x37,
+		0x38,
+		0x53,
+		0x70, 0x74, 0x7C,
+		0x80, 0x82, 0x84, 0x88,
+		0xC4,
+	};
+	for (unsigned int i = 0; i < sizeof(validItems) / sizeof(unsigned int); i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Rockford::MapType_Rockford()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_Rockford::getMapCode() const
 {
 	return "map-rockford";
@@ -105,20 +136,18 @@ std::vector<std::string> MapType_Rockford::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Rockford::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Rockford::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data to read the map dimensions
 	// TESTED BY: fmt_map_rockford_isinstance_c01
 	if (lenMap != ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT) return MapType::DefinitelyNo;
 
-	psMap->seekg(0, stream::start);
-
 	// Read in the map and make sure all the tile codes are within range
 	uint8_t *bg = new uint8_t[ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT];
 	boost::scoped_array<uint8_t> scoped_bg(bg);
-	stream::len r = psMap->try_read(bg, ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
+	stream::len r = probe.read(0, bg, ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
 	if (r != ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT) return MapType::DefinitelyNo; // read error
 	for (unsigned int i = 0; i < ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT; i++) {
 		// Make sure each tile is within range
@@ -132,6 +161,13 @@ MapType::Certainty MapType_Rockford::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Rockford::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
+	return filter;
+}
+
 MapPtr MapType_Rockford::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -140,6 +176,8 @@ MapPtr MapType_Rockford::create(SuppData& suppData) const
 
 MapPtr MapType_Rockford::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 
 	// Read the background layer
@@ -147,41 +185,15 @@ MapPtr MapType_Rockford::open(stream::input_sptr input, SuppData& suppData) cons
 	boost::scoped_array<uint8_t> scoped_bg(bg);
 	input->read(bg, ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
 
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
+	TileGridPtr tiles(new TileGrid(ROCKFORD_MAP_WIDTH, ROCKFORD_MAP_HEIGHT));
 	for (unsigned int i = 0; i < ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT; i++) {
 		// The default tile actually has an image, so don't exclude it
 		//if (bg[i] == ROCKFORD_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % ROCKFORD_MAP_WIDTH;
-		t->y = i / ROCKFORD_MAP_WIDTH;
-		t->code = bg[i];
-		tiles->push_back(t);
+		tiles->codes[i] = bg[i];
 	}
 
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	unsigned int validItems[] = {
-		0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
-		0x08, 0x09, 0x0A, 0x0B, 0x0C,
-		0x10,
-		0x28, 0x2C, 0x2D, 0x2E,
-		0x30, 0x34, 0x35, 0x36, 0x37,
-		0x38,
-		0x53,
-		0x70, 0x74, 0x7C,
-		0x80, 0x82, 0x84, 0x88,
-		0xC4,
-	};
-	for (unsigned int i = 0; i < sizeof(validItems) / sizeof(unsigned int); i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 	Map2D::LayerPtr bgLayer(new Layer_RockfordBackground(tiles, validBGItems));
 
 	Map2D::LayerPtrVector layers;
@@ -193,7 +205,8 @@ MapPtr MapType_Rockford::open(stream::input_sptr input, SuppData& suppData) cons
 		320, 176, // viewport size
 		ROCKFORD_MAP_WIDTH, ROCKFORD_MAP_HEIGHT,
 		ROCKFORD_TILE_WIDTH, ROCKFORD_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
@@ -218,16 +231,11 @@ void MapType_Rockford::write(MapPtr map, stream::expanding_output_sptr output,
 	// Write the background layer
 	uint8_t *bg = new uint8_t[ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT];
 	boost::scoped_array<uint8_t> scoped_bg(bg);
-	memset(bg, ROCKFORD_DEFAULT_BGTILE, ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		if (((*i)->x > mapWidth) || ((*i)->y > mapHeight)) {
-			throw stream::error("Layer has tiles outside map boundary!");
-		}
-		bg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	TileGridPtr grid = getTileGrid(layer, ROCKFORD_MAP_WIDTH,
+		ROCKFORD_MAP_HEIGHT);
+	for (unsigned int i = 0; i < ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT; i++) {
+		uint32_t code = grid->codes[i];
+		bg[i] = (code == INVALID_TILECODE) ? ROCKFORD_DEFAULT_BGTILE : code;
 	}
 
 	output->write(bg, ROCKFORD_MAP_WIDTH * ROCKFORD_MAP_HEIGHT);
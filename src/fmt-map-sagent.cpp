@@ -175,9 +175,9 @@ std::vector<std::string> MapType_SAgent::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_SAgent::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_SAgent::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_sagent_isinstance_c01
 	if (lenMap != SAM_MAP_FILESIZE) return MapType::DefinitelyNo; // too small
@@ -185,13 +185,16 @@ MapType::Certainty MapType_SAgent::isInstance(stream::input_sptr psMap) const
 	bool worldMap = this->isWorldMap();
 
 	// Skip first row
-	psMap->seekg(SAM_MAP_WIDTH_BYTES, stream::start);
+	stream::pos offset = SAM_MAP_WIDTH_BYTES;
 
 	uint8_t row[SAM_MAP_WIDTH_BYTES];
 	unsigned int y;
 	for (y = 0; (y < SAM_MAP_FILESIZE / SAM_MAP_WIDTH_BYTES - 1) && lenMap; y++) {
 		// Ensure the row data is valid
-		psMap->read(row, SAM_MAP_WIDTH_BYTES);
+		if (probe.read(offset, row, SAM_MAP_WIDTH_BYTES) != SAM_MAP_WIDTH_BYTES) {
+			return MapType::DefinitelyNo; // read error
+		}
+		offset += SAM_MAP_WIDTH_BYTES;
 		for (unsigned int x = 0; x < SAM_MAP_WIDTH; x++) {
 			// Invalid tile
 			// TESTED BY: fmt_map_sagent_isinstance_c02
@@ -224,6 +227,13 @@ MapType::Certainty MapType_SAgent::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_SAgent::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(SAM_MAP_FILESIZE);
+	return filter;
+}
+
 MapPtr MapType_SAgent::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -232,6 +242,8 @@ MapPtr MapType_SAgent::create(SuppData& suppData) const
 
 MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	stream::pos lenMap = input->size();
 
 	input->seekg(0, stream::start);
@@ -334,7 +346,7 @@ MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 								for (unsigned int dx = 0; dx < 4; dx++) {
 									int code = m.tiles[dy * 4 + dx];
 									if (code >= 0) {
-										Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+										Map2D::Layer::ItemPtr t(createItem(arena));
 										t->type = Map2D::Layer::Item::Default;
 										t->x = x - (3 - dx);
 										t->y = y - (2 - dy);
@@ -350,7 +362,7 @@ MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 			}
 			if (code >= 0) {
 				// There's a tile from the first list (not from the tileMap) so add that
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+				Map2D::Layer::ItemPtr t(createItem(arena));
 				t->type = Map2D::Layer::Item::Default;
 				t->x = x;
 				t->y = y;
@@ -365,7 +377,7 @@ MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 	Map2D::Layer::ItemPtrVectorPtr validItems(new Map2D::Layer::ItemPtrVector());
 	for (unsigned int i = 1; i < 4; i++) {
 		// Add the background tiles
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		t->x = 0;
 		t->y = 0;
@@ -375,7 +387,7 @@ MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 	for (const TILE_MAP *next = tm; next->code > 0; next++) {
 		for (unsigned int i = 0; i < 4 * 3; i++) {
 			if (next->tiles[i] >= 0) {
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+				Map2D::Layer::ItemPtr t(createItem(arena));
 				t->type = Map2D::Layer::Item::Default;
 				t->x = 0;
 				t->y = 0;
@@ -397,7 +409,8 @@ MapPtr MapType_SAgent::open(stream::input_sptr input, SuppData& suppData) const
 		SAM_VIEWPORT_WIDTH, SAM_VIEWPORT_HEIGHT,
 		SAM_MAP_WIDTH, height,
 		SAM_TILE_WIDTH, SAM_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
 	));
 
 	return map;
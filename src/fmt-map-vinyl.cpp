@@ -21,9 +21,11 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-vinyl.hpp"
 
 #define VGFM_TILE_WIDTH             16
@@ -46,14 +48,14 @@ using namespace camoto::gamegraphics;
 class Layer_VinylMap: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_VinylMap(const std::string& name, ItemPtrVectorPtr& items,
+		Layer_VinylMap(const std::string& name, TileGridPtr& tiles,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					name,
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -74,6 +76,42 @@ class Layer_VinylMap: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted background tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= VGFM_MAX_VALID_BGTILECODE; i++) {
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+/// Populate the list of permitted foreground tiles.
+static void buildValidFGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= VGFM_MAX_VALID_FGTILECODE; i++) {
+		if (i == VGFM_DEFAULT_TILE_FG) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Vinyl::MapType_Vinyl()
+	:	validBGCatalogue(buildValidBGItems),
+		validFGCatalogue(buildValidFGItems)
+{
+}
+
 std::string MapType_Vinyl::getMapCode() const
 {
 	return "map-vinyl";
@@ -98,33 +136,34 @@ std::vector<std::string> MapType_Vinyl::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Vinyl::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Vinyl::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data to read the map dimensions
 	// TESTED BY: fmt_map_vinyl_isinstance_c01
 	if (lenMap < 4) return MapType::DefinitelyNo;
 
-	psMap->seekg(0, stream::start);
-	unsigned int width, height;
-	psMap >> u16le(height) >> u16le(width);
+	uint16_t width, height;
+	if (!probe.readU16le(0, &height)) return MapType::DefinitelyNo;
+	if (!probe.readU16le(2, &width)) return MapType::DefinitelyNo;
 
-	// Make sure the dimensions cover the entire file
+	// Make sure the dimensions cover the entire file.  The values are widened
+	// first so the multiplication cannot overflow a signed int.
 	// TESTED BY: fmt_map_vinyl_isinstance_c02
-	unsigned int expLen = 4 + width * height * 3; // 3 = uint16 bg + uint8 fg
+	unsigned int mapLen = (unsigned int)width * height;
+	unsigned int expLen = 4 + mapLen * 3; // 3 = uint16 bg + uint8 fg
 	if (lenMap != expLen) return MapType::DefinitelyNo;
 
 	// Read in the map and make sure all the tile codes are within range
-	for (unsigned int i = 0; i < width * height; i++) {
+	unsigned int lenBG = mapLen * 2;
+	boost::scoped_array<uint8_t> bg(new uint8_t[lenBG]);
+	stream::len r = probe.read(4, bg.get(), lenBG);
+	if (r != lenBG) return MapType::DefinitelyNo; // read error
+	for (unsigned int i = 0; i < mapLen; i++) {
 		// Make sure each tile is within range
 		// TESTED BY: fmt_map_vinyl_isinstance_c03
-		uint16_t code;
-		try {
-			psMap >> u16le(code);
-		} catch (...) {
-			return MapType::DefinitelyNo;
-		}
+		uint16_t code = bg[i * 2] | (bg[i * 2 + 1] << 8);
 		if (code > VGFM_MAX_VALID_BGTILECODE) {
 			return MapType::DefinitelyNo;
 		}
@@ -134,85 +173,98 @@ MapType::Certainty MapType_Vinyl::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Vinyl::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = 4;
+	return filter;
+}
+
 MapPtr MapType_Vinyl::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Decode the background layer the first time it is requested.
+/**
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param width
+ *   Width of the map, in tiles.
+ *
+ * @param height
+ *   Height of the map, in tiles.
+ *
+ * @param validItems
+ *   List of permitted tiles.
+ */
+static Map2D::LayerPtr loadVinylBackground(RawBlockPtr raw,
+	unsigned int width, unsigned int height,
+	Map2D::Layer::ItemPtrVectorPtr validItems)
+{
+	TileGridPtr tiles(new TileGrid(width, height));
+	unsigned int mapLen = width * height;
+	if (mapLen) decodeGrid16le(&raw->at(0), tiles.get(), mapLen, INVALID_TILECODE);
+	return Map2D::LayerPtr(new Layer_VinylMap("Background", tiles, validItems));
+}
+
+/// Decode the foreground layer the first time it is requested.
+/**
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param width
+ *   Width of the map, in tiles.
+ *
+ * @param height
+ *   Height of the map, in tiles.
+ *
+ * @param validItems
+ *   List of permitted tiles.
+ */
+static Map2D::LayerPtr loadVinylForeground(RawBlockPtr raw,
+	unsigned int width, unsigned int height,
+	Map2D::Layer::ItemPtrVectorPtr validItems)
+{
+	TileGridPtr tiles(new TileGrid(width, height));
+	unsigned int mapLen = width * height;
+	if (mapLen) decodeGrid8(&raw->at(0), tiles.get(), mapLen, VGFM_DEFAULT_TILE_FG);
+	return Map2D::LayerPtr(new Layer_VinylMap("Foreground", tiles, validItems));
+}
+
 MapPtr MapType_Vinyl::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 	unsigned int width, height;
 	input >> u16le(height) >> u16le(width);
 	unsigned int mapLen = width * height;
 
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr bgtiles(new Map2D::Layer::ItemPtrVector());
-	bgtiles->reserve(mapLen);
-	for (unsigned int i = 0; i < mapLen; i++) {
-		uint16_t code;
-		input >> u16le(code);
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % width;
-		t->y = i / width;
-		t->code = code;
-		bgtiles->push_back(t);
-	}
+	// Read the background layer, but leave it to be decoded when needed
+	RawBlockPtr bgRaw = readRawBlock(input, mapLen * 2);
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= VGFM_MAX_VALID_BGTILECODE; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
-
-	// Create the map structures
-	Map2D::LayerPtr bgLayer(new Layer_VinylMap("Background", bgtiles, validBGItems));
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Read the foreground layer
-	uint8_t *fg = new uint8_t[mapLen];
-	boost::scoped_array<uint8_t> scoped_fg(fg);
-	input->read((char *)fg, mapLen);
+	RawBlockPtr fgRaw = readRawBlock(input, mapLen);
 
-	Map2D::Layer::ItemPtrVectorPtr fgtiles(new Map2D::Layer::ItemPtrVector());
-	fgtiles->reserve(mapLen);
-	for (unsigned int i = 0; i < mapLen; i++) {
-		if (fg[i] == VGFM_DEFAULT_TILE_FG) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % width;
-		t->y = i / width;
-		t->code = fg[i];
-		fgtiles->push_back(t);
-	}
-
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validFGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= VGFM_MAX_VALID_FGTILECODE; i++) {
-		if (i == VGFM_DEFAULT_TILE_FG) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validFGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validFGItems = this->validFGCatalogue.get();
 
 	// Create the map structures
-	Map2D::LayerPtr fgLayer(new Layer_VinylMap("Foreground", fgtiles, validFGItems));
-
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
-	layers.push_back(fgLayer);
+	layers.push_back(Map2D::LayerPtr()); // background, loaded on demand
+	layers.push_back(Map2D::LayerPtr()); // foreground, loaded on demand
+
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[0] = boost::bind(loadVinylBackground, bgRaw, width, height,
+		validBGItems);
+	loaders[1] = boost::bind(loadVinylForeground, fgRaw, width, height,
+		validFGItems);
 
 	Map2DPtr map(new GenericMap2D(
 		Map::Attributes(), Map::GraphicsFilenames(),
@@ -220,7 +272,8 @@ MapPtr MapType_Vinyl::open(stream::input_sptr input, SuppData& suppData) const
 		320, 159, // viewport size
 		width, height,
 		VGFM_TILE_WIDTH, VGFM_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena, loaders
 	));
 
 	return map;
@@ -242,38 +295,22 @@ void MapType_Vinyl::write(MapPtr map, stream::expanding_output_sptr output,
 
 	// Write the background layer
 	{
-		Map2D::LayerPtr layer = map2d->getLayer(0);
-		uint16_t *bg = new uint16_t[mapLen];
-		boost::scoped_array<uint16_t> scoped_bg(bg);
-		memset(bg, 0, mapLen);
-		const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-		for (Map2D::Layer::ItemPtrVector::const_iterator
-			i = items->begin(); i != items->end(); i++
-		) {
-			if (((*i)->x > mapWidth) || ((*i)->y > mapHeight)) {
-				throw stream::error("Layer has tiles outside map boundary!");
-			}
-			bg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
-		}
+		TileGridPtr bg = getTileGrid(map2d->getLayer(0), mapWidth, mapHeight);
 		for (unsigned int i = 0; i < mapLen; i++) {
-			output << u16le(*bg++);
+			uint32_t code = bg->codes[i];
+			if (code == INVALID_TILECODE) code = 0;
+			output << u16le(code);
 		}
 	}
 
 	// Write the foreground layer
 	{
-		Map2D::LayerPtr layer = map2d->getLayer(1);
+		TileGridPtr grid = getTileGrid(map2d->getLayer(1), mapWidth, mapHeight);
 		uint8_t *fg = new uint8_t[mapLen];
 		boost::scoped_array<uint8_t> scoped_fg(fg);
-		memset(fg, VGFM_DEFAULT_TILE_FG, mapLen);
-		const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-		for (Map2D::Layer::ItemPtrVector::const_iterator
-			i = items->begin(); i != items->end(); i++
-		) {
-			if (((*i)->x > mapWidth) || ((*i)->y > mapHeight)) {
-				throw stream::error("Layer has tiles outside map boundary!");
-			}
-			fg[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+		for (unsigned int i = 0; i < mapLen; i++) {
+			uint32_t code = grid->codes[i];
+			fg[i] = (code == INVALID_TILECODE) ? VGFM_DEFAULT_TILE_FG : code;
 		}
 		output->write((char *)fg, mapLen);
 	}
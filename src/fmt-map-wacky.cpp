@@ -57,13 +57,13 @@ using namespace camoto::gamegraphics;
 class Layer_WackyBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_WackyBackground(ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
+		Layer_WackyBackground(TileGridPtr& tiles, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Surface",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -87,6 +87,28 @@ class Layer_WackyBackground: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= WW_MAX_VALID_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		if (i == WW_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Wacky::MapType_Wacky()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_Wacky::getMapCode() const
 {
 	return "map-wacky";
@@ -111,19 +133,17 @@ std::vector<std::string> MapType_Wacky::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Wacky::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Wacky::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_wacky_isinstance_c01
 	if (lenMap != WW_FILESIZE) return MapType::DefinitelyNo; // wrong size
 
 	// Read in the layer and make sure all the tile codes are within range
 	uint8_t bg[WW_LAYER_LEN_BG];
-	psMap->seekg(WW_LAYER_OFF_BG, stream::start);
-	// This will throw an exception on a short read which is ok, because we
-	// wouldn't be here if the file was too small anyway (isinstance_c01)
-	psMap->read(bg, WW_LAYER_LEN_BG);
+	stream::len r = probe.read(WW_LAYER_OFF_BG, bg, WW_LAYER_LEN_BG);
+	if (r != WW_LAYER_LEN_BG) return MapType::DefinitelyNo; // read error
 
 	for (unsigned int i = 0; i < WW_LAYER_LEN_BG; i++) {
 		// TESTED BY: fmt_map_wacky_isinstance_c02
@@ -134,6 +154,13 @@ MapType::Certainty MapType_Wacky::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Wacky::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(WW_FILESIZE);
+	return filter;
+}
+
 MapPtr MapType_Wacky::create(SuppData& suppData) const
 {
 	/// @todo Implement MapType_Wacky::create()
@@ -142,36 +169,21 @@ MapPtr MapType_Wacky::create(SuppData& suppData) const
 
 MapPtr MapType_Wacky::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 
 	// Read the background layer
 	uint8_t bg[WW_LAYER_LEN_BG];
 	input->read((char *)bg, WW_LAYER_LEN_BG);
 
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(WW_MAP_WIDTH * WW_MAP_HEIGHT);
+	TileGridPtr tiles(new TileGrid(WW_MAP_WIDTH, WW_MAP_HEIGHT));
 	for (unsigned int i = 0; i < WW_LAYER_LEN_BG; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % WW_MAP_WIDTH;
-		t->y = i / WW_MAP_WIDTH;
-		t->code = bg[i];
-		tiles->push_back(t);
+		tiles->codes[i] = bg[i];
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= WW_MAX_VALID_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		if (i == WW_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	// Create the map structures
 	Map2D::LayerPtr bgLayer(new Layer_WackyBackground(tiles, validBGItems));
@@ -215,7 +227,8 @@ MapPtr MapType_Wacky::open(stream::input_sptr input, SuppData& suppData) const
 		0, 0,
 		WW_MAP_WIDTH, WW_MAP_HEIGHT,
 		WW_TILE_WIDTH, WW_TILE_HEIGHT,
-		layers, paths
+		layers, paths,
+		arena
 	));
 
 	return map;
@@ -241,17 +254,11 @@ void MapType_Wacky::write(MapPtr map, stream::expanding_output_sptr output,
 
 	// Write the background layer
 	uint8_t bg[WW_LAYER_LEN_BG];
-	memset(bg, WW_DEFAULT_BGTILE, WW_LAYER_LEN_BG); // default background tile
-	Map2D::LayerPtr layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		if (((*i)->x > WW_MAP_WIDTH) || ((*i)->y > WW_MAP_HEIGHT)) {
-			throw stream::error("Layer has tiles outside map boundary!");
-		}
-		bg[(*i)->y * WW_MAP_WIDTH + (*i)->x] = (*i)->code;
+	TileGridPtr grid = getTileGrid(map2d->getLayer(0), WW_MAP_WIDTH,
+		WW_MAP_HEIGHT);
+	for (unsigned int i = 0; i < WW_LAYER_LEN_BG; i++) {
+		uint32_t code = grid->codes[i];
+		bg[i] = (code == INVALID_TILECODE) ? WW_DEFAULT_BGTILE : code;
 	}
 
 	output->write((char *)bg, WW_LAYER_LEN_BG);
@@ -21,9 +21,12 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/bind.hpp>
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
+#include "map2d-rle.hpp"
 #include <camoto/util.hpp>
 #include "fmt-map-wordresc.hpp"
 
@@ -100,14 +103,14 @@ using namespace camoto::gamegraphics;
 class Layer_WordRescueBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_WordRescueBackground(ItemPtrVectorPtr& items,
+		Layer_WordRescueBackground(TileGridPtr& tiles,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::NoCaps,
 					0, 0,
 					0, 0,
-					items, validItems
+					tiles, validItems
 				)
 		{
 		}
@@ -248,14 +251,16 @@ class Map2D_WordRescue: virtual public GenericMap2D
 	public:
 		Map2D_WordRescue(const Attributes& attributes,
 			unsigned int width, unsigned int height,
-			LayerPtrVector& layers)
+			LayerPtrVector& layers,
+			const ItemArenaPtr& arena, const LayerLoaderVector& loaders)
 			:	GenericMap2D(
 					attributes, GraphicsFilenames(),
 					Map2D::HasViewport,
 					WR_VIEWPORT_WIDTH, WR_VIEWPORT_HEIGHT,
 					width, height,
 					WR_BGTILE_WIDTH, WR_BGTILE_HEIGHT,
-					layers, Map2D::PathPtrVectorPtr()
+					layers, Map2D::PathPtrVectorPtr(),
+					arena, loaders
 				)
 		{
 			// Populate the graphics filenames
@@ -303,49 +308,140 @@ class Map2D_WordRescue: virtual public GenericMap2D
 		}
 };
 
+/// Compression used for the tile layers, a count byte then the tile code.
+static const RLECodec_CountValue wordrescRLE(0xFF);
+
 /// Write the given data to the stream, RLE encoded
-int rleWrite(stream::output_sptr output, uint8_t *data, int len)
+int rleWrite(stream::output_sptr output, const uint8_t *data, int len)
+{
+	if (len <= 0) return 0;
+	std::vector<uint8_t> rle;
+	wordrescRLE.encode(data, len, &rle);
+	output->write(&rle[0], rle.size());
+	return rle.size();
+}
+
+/// Decode the attribute layer the first time it is requested.
+/**
+ * @param raw
+ *   Compressed tile layers read from the map file.
+ *
+ * @param offset
+ *   Offset into raw where the attribute layer starts.
+ *
+ * @param atWidth
+ *   Width of the attribute layer, in tiles.
+ *
+ * @param atHeight
+ *   Height of the attribute layer, in tiles.
+ *
+ * @param arena
+ *   Arena to allocate the layer's items from.
+ *
+ * @param validAtItems
+ *   List of permitted attribute tiles.
+ */
+static Map2D::LayerPtr loadWordRescueAttributes(RawBlockPtr raw,
+	unsigned int offset, unsigned int atWidth, unsigned int atHeight,
+	ItemArenaPtr arena, Map2D::Layer::ItemPtrVectorPtr validAtItems)
 {
-	int lenWritten = 0;
-
-	// RLE encode the data
-	uint8_t lastCount = 0;
-	uint8_t lastCode = data[0];
-	for (int i = 0; i < len; i++) {
-		if (data[i] == lastCode) {
-			if (lastCount == 0xFF) {
-				output
-					<< u8(lastCount)
-					<< u8(lastCode)
+	unsigned int lenAttr = atWidth * atHeight;
+	// Some level files seem to be truncated (maybe for efficiency), so
+	// anything missing is left as the default tile.
+	std::vector<uint8_t> attrCodes(lenAttr, WR_DEFAULT_ATTILE);
+	if (lenAttr && (offset < raw->size())) {
+		unsigned int lenDecoded;
+		wordrescRLE.decode(&raw->at(offset), raw->size() - offset,
+			&attrCodes[0], lenAttr, &lenDecoded);
+	}
+
+	Map2D::Layer::ItemPtrVectorPtr atItems(new Map2D::Layer::ItemPtrVector());
+	for (unsigned int i = 0; i < lenAttr; i++) {
+		uint8_t code = attrCodes[i];
+		if (code == WR_DEFAULT_ATTILE) continue;
+		Map2D::Layer::ItemPtr t(createItem(arena));
+		t->x = i % atWidth + 1;
+		t->y = i / atWidth;
+		t->code = code;
+		switch (code) {
+			case 0x73:
+				t->type = Map2D::Layer::Item::Blocking;
+				t->blocking().flags =
+					Map2D::Layer::Item::BlockLeft
+					| Map2D::Layer::Item::BlockRight
+					| Map2D::Layer::Item::BlockTop
+					| Map2D::Layer::Item::BlockBottom
 				;
-				lenWritten += 2;
-				lastCount = 1;
-			} else {
-				lastCount++;
-			}
-		} else {
-			output
-				<< u8(lastCount)
-				<< u8(lastCode)
-			;
-			lenWritten += 2;
-			lastCode = data[i];
-			lastCount = 1;
+				break;
+			case 0x74:
+				t->type = Map2D::Layer::Item::Blocking;
+				t->blocking().flags =
+					Map2D::Layer::Item::BlockTop
+					| Map2D::Layer::Item::JumpDown
+				;
+				break;
+			default:
+				t->type = Map2D::Layer::Item::Default;
+				break;
 		}
+		atItems->push_back(t);
 	}
-	// Write out the last tile
-	if (lastCount > 0) {
-		output
-			<< u8(lastCount)
-			<< u8(lastCode)
-		;
-		lenWritten += 2;
-	}
+	return Map2D::LayerPtr(new Layer_WordRescueAttribute(atItems, validAtItems));
+}
+
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+	for (unsigned int i = 0; i <= WR_MAX_VALID_TILECODE; i++) {
+		// The default tile actually has an image, so don't exclude it
+		if (i == WR_DEFAULT_BGTILE) continue;
 
-	return lenWritten;
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
 }
 
+/// Populate the list of permitted attribute tiles.
+static void buildValidAtItems(Map2D::Layer::ItemPtrVector& items)
+{
+#define ADD_TILE(ty, c, bf) \
+	{ \
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item()); \
+		t->type = ty; \
+		t->x = 0; \
+		t->y = 0; \
+		t->code = c; \
+		t->blocking().flags = bf; \
+		items.push_back(t); \
+	}
 
+	ADD_TILE(Map2D::Layer::Item::Blocking, 0x73, Map2D::Layer::Item::BlockLeft
+		| Map2D::Layer::Item::BlockRight
+		| Map2D::Layer::Item::BlockTop
+		| Map2D::Layer::Item::BlockBottom);
+
+	ADD_TILE(Map2D::Layer::Item::Blocking, 0x74, Map2D::Layer::Item::BlockTop
+		| Map2D::Layer::Item::JumpDown);
+
+	for (int i = 0; i < 7; i++) {
+		ADD_TILE(Map2D::Layer::Item::Default, 0x0000 + i, 0); // question mark box
+	}
+
+	ADD_TILE(Map2D::Layer::Item::Default, 0x00FD, 0); // unknown (see tile mapping code)
+#undef ADD_TILE
+	return;
+}
+
+MapType_WordRescue::MapType_WordRescue()
+	:	validBGCatalogue(buildValidBGItems),
+		validAtCatalogue(buildValidAtItems)
+{
+}
 
 std::string MapType_WordRescue::getMapCode() const
 {
@@ -390,9 +486,9 @@ std::vector<std::string> MapType_WordRescue::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_WordRescue::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_WordRescue::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 #define WR_MIN_HEADER_SIZE (2*15 + 4*7) // includes INDEX_LETTER
 
@@ -401,17 +497,14 @@ MapType::Certainty MapType_WordRescue::isInstance(stream::input_sptr psMap) cons
 	if (lenMap < WR_MIN_HEADER_SIZE) return MapType::DefinitelyNo;
 
 	uint16_t mapWidth, mapHeight;
-	psMap->seekg(0, stream::start);
-	psMap
-		>> u16le(mapWidth)
-		>> u16le(mapHeight)
-	;
+	if (!probe.readU16le(0, &mapWidth)) return MapType::DefinitelyNo;
+	if (!probe.readU16le(2, &mapHeight)) return MapType::DefinitelyNo;
 
 	// Map size of zero is invalid
 	// TESTED BY: fmt_map_wordresc_isinstance_c05
 	if (mapWidth * mapHeight == 0) return MapType::DefinitelyNo;
 
-	psMap->seekg(2*7, stream::cur);
+	stream::pos offset = 4 + 2*7;
 
 	// Check the items are each within range
 	unsigned int minSize = WR_MIN_HEADER_SIZE;
@@ -421,7 +514,8 @@ MapType::Certainty MapType_WordRescue::isInstance(stream::input_sptr psMap) cons
 			lenBlock = WR_NUM_LETTERS * 4;
 		} else {
 			uint16_t count;
-			psMap >> u16le(count);
+			if (!probe.readU16le(offset, &count)) return MapType::DefinitelyNo;
+			offset += 2;
 			lenBlock = count * 4;
 			if (i == INDEX_DRIP) {
 				// Extra byte for each of these
@@ -435,32 +529,40 @@ MapType::Certainty MapType_WordRescue::isInstance(stream::input_sptr psMap) cons
 		// Make sure the item count is within range
 		// TESTED BY: fmt_map_wordresc_isinstance_c02
 		if (lenMap < minSize) return MapType::DefinitelyNo;
-		psMap->seekg(lenBlock, stream::cur);
+		offset += lenBlock;
 	}
 
 	// Read in the layer and make sure all the tile codes are within range
 	for (int i = 0; i < mapWidth * mapHeight; ) {
-		uint8_t num, code;
 		minSize += 2;
 		// Make sure the background layer isn't cut off
 		// TESTED BY: fmt_map_wordresc_isinstance_c03
 		if (lenMap < minSize) return MapType::DefinitelyNo;
 
-		psMap >> u8(num) >> u8(code);
-		i += num;
+		uint8_t rle[2]; // count, code
+		if (probe.read(offset, rle, 2) != 2) return MapType::DefinitelyNo;
+		offset += 2;
+		i += rle[0];
 
 		// Ignore the default tile (otherwise it would be out of range)
-		if (code == WR_DEFAULT_BGTILE) continue;
+		if (rle[1] == WR_DEFAULT_BGTILE) continue;
 
 		// Make sure the tile values are within range
 		// TESTED BY: fmt_map_wordresc_isinstance_c04
-		if (code > WR_MAX_VALID_TILECODE) return MapType::DefinitelyNo;
+		if (rle[1] > WR_MAX_VALID_TILECODE) return MapType::DefinitelyNo;
 	}
 
 	// TESTED BY: fmt_map_wordresc_isinstance_c00
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_WordRescue::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = WR_MIN_HEADER_SIZE;
+	return filter;
+}
+
 MapPtr MapType_WordRescue::create(SuppData& suppData) const
 {
 	// TODO: Implement
@@ -469,6 +571,8 @@ MapPtr MapType_WordRescue::create(SuppData& suppData) const
 
 MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	input->seekg(0, stream::start);
 
 	uint16_t mapWidth, mapHeight;
@@ -553,7 +657,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t gruzzleCount;
 	input >> u16le(gruzzleCount);
 	for (unsigned int i = 0; i < gruzzleCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -566,13 +670,13 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t dripCount;
 	input >> u16le(dripCount);
 	for (unsigned int i = 0; i < dripCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Movement;
-		t->movementFlags = Map2D::Layer::Item::DistanceLimit;
-		t->movementDistLeft = 0;
-		t->movementDistRight = 0;
-		t->movementDistUp = 0;
-		t->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
+		t->movement().flags = Map2D::Layer::Item::DistanceLimit;
+		t->movement().distLeft = 0;
+		t->movement().distRight = 0;
+		t->movement().distUp = 0;
+		t->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
 		input
 			>> u16le(t->x)
 			>> u16le(t->y)
@@ -585,7 +689,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t slimeCount;
 	input >> u16le(slimeCount);
 	for (unsigned int i = 0; i < slimeCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -598,7 +702,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t bookCount;
 	input >> u16le(bookCount);
 	for (unsigned int i = 0; i < bookCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -609,7 +713,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	}
 
 	for (unsigned int i = 0; i < WR_NUM_LETTERS; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -622,7 +726,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t animCount;
 	input >> u16le(animCount);
 	for (unsigned int i = 0; i < animCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -635,7 +739,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	uint16_t fgCount;
 	input >> u16le(fgCount);
 	for (unsigned int i = 0; i < fgCount; i++) {
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		input
 			>> u16le(t->x)
@@ -647,16 +751,16 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 
 	// Add the map entrance and exit as special items
 	{
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Player;
 		t->x = startX;
 		t->y = startY;
-		t->playerNumber = 0;
+		t->player().number = 0;
 		t->code = WR_CODE_ENTRANCE;
 		items8->push_back(t);
 	}
 	{
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Default;
 		t->x = endX;
 		t->y = endY;
@@ -669,7 +773,7 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	Map2D::Layer::ItemPtrVectorPtr validItem16Items(new Map2D::Layer::ItemPtrVector());
 #define ADD_TILE(n, c)	  \
 	{ \
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item()); \
+		Map2D::Layer::ItemPtr t(createItem(arena)); \
 		t->type = Map2D::Layer::Item::Default; \
 		t->x = 0; \
 		t->y = 0; \
@@ -692,13 +796,13 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	ADD_TILE(8, WR_CODE_EXIT);
 #undef ADD_TILE
 	{
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		Map2D::Layer::ItemPtr t(createItem(arena));
 		t->type = Map2D::Layer::Item::Movement;
-		t->movementFlags = Map2D::Layer::Item::DistanceLimit;
-		t->movementDistLeft = 0;
-		t->movementDistRight = 0;
-		t->movementDistUp = 0;
-		t->movementDistDown = Map2D::Layer::Item::DistIndeterminate;
+		t->movement().flags = Map2D::Layer::Item::DistanceLimit;
+		t->movement().distLeft = 0;
+		t->movement().distRight = 0;
+		t->movement().distUp = 0;
+		t->movement().distDown = Map2D::Layer::Item::DistIndeterminate;
 		t->x = 0;
 		t->y = 0;
 		t->code = WR_CODE_DRIP;
@@ -710,129 +814,48 @@ MapPtr MapType_WordRescue::open(stream::input_sptr input, SuppData& suppData) co
 	Map2D::LayerPtr item16Layer(new Layer_WordRescueObject(
 		"Coarse items", Map2D::Layer::UseImageDims, 0, 0, items16, validItem16Items));
 
-	// Read the background layer
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(mapWidth * mapHeight);
-	for (int i = 0; i < mapWidth * mapHeight; ) {
-		uint8_t num, code;
-		input >> u8(num) >> u8(code);
-		if (code == WR_DEFAULT_BGTILE) {
-			i += num;
-		} else {
-			while (num-- > 0) {
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-				t->type = Map2D::Layer::Item::Default;
-				t->x = i % mapWidth;
-				t->y = i / mapWidth;
-				t->code = code;
-				tiles->push_back(t);
-				i++;
-			}
+	// Both tile layers are compressed, one after the other, up to the end of
+	// the file
+	RawBlockPtr rawLayers = readRawBlock(input, input->size() - input->tellg());
+	const uint8_t *rle = rawLayers->empty() ? NULL : &rawLayers->at(0);
+
+	// Read the background layer now, to find where the attribute layer starts
+	// and so a truncated file is reported when it is opened.
+	unsigned int lenTiles = mapWidth * mapHeight;
+	unsigned int lenUsed = 0;
+	TileGridPtr tiles(new TileGrid(mapWidth, mapHeight));
+	if (lenTiles) {
+		std::vector<uint8_t> tileCodes(lenTiles);
+		unsigned int lenDecoded;
+		lenUsed = wordrescRLE.decode(rle, rawLayers->size(), &tileCodes[0],
+			lenTiles, &lenDecoded);
+		if (lenDecoded < lenTiles) {
+			throw stream::error("Background layer is cut short.");
 		}
+		// Cells with the default tile are left empty
+		decodeGrid8(&tileCodes[0], tiles.get(), lenTiles, WR_DEFAULT_BGTILE);
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
-	for (unsigned int i = 0; i <= WR_MAX_VALID_TILECODE; i++) {
-		// The default tile actually has an image, so don't exclude it
-		if (i == WR_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
-	}
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
 	Map2D::LayerPtr bgLayer(new Layer_WordRescueBackground(tiles, validBGItems));
 
-	// Read the attribute layer
-	Map2D::Layer::ItemPtrVectorPtr atItems(new Map2D::Layer::ItemPtrVector());
-	uint16_t atWidth = mapWidth * 2;
-	uint16_t atHeight = mapHeight * 2;
-	atItems->reserve(atWidth * atHeight);
-	for (int i = 0; i < atWidth * atHeight; ) {
-		uint8_t num, code;
-		try {
-			input >> u8(num) >> u8(code);
-		} catch (const stream::incomplete_read&) {
-			// Some level files seem to be truncated (maybe for efficiency)
-			break;
-		}
-		if (code == WR_DEFAULT_ATTILE) {
-			i += num;
-		} else {
-			while (num-- > 0) {
-				Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-				t->x = i % atWidth + 1;
-				t->y = i / atWidth;
-				t->code = code;
-				switch (code) {
-					case 0x73:
-						t->type = Map2D::Layer::Item::Blocking;
-						t->blockingFlags =
-							Map2D::Layer::Item::BlockLeft
-							| Map2D::Layer::Item::BlockRight
-							| Map2D::Layer::Item::BlockTop
-							| Map2D::Layer::Item::BlockBottom
-						;
-						break;
-					case 0x74:
-						t->type = Map2D::Layer::Item::Blocking;
-						t->blockingFlags =
-							Map2D::Layer::Item::BlockTop
-							| Map2D::Layer::Item::JumpDown
-						;
-						break;
-					default:
-						t->type = Map2D::Layer::Item::Default;
-						break;
-				}
-				atItems->push_back(t);
-				i++;
-			}
-		}
-	}
-
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validAtItems(new Map2D::Layer::ItemPtrVector());
-
-#define ADD_TILE(ty, c, bf) \
-	{ \
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item()); \
-		t->type = ty; \
-		t->x = 0; \
-		t->y = 0; \
-		t->code = c; \
-		t->blockingFlags = bf; \
-		validAtItems->push_back(t); \
-	}
-
-	ADD_TILE(Map2D::Layer::Item::Blocking, 0x73, Map2D::Layer::Item::BlockLeft
-		| Map2D::Layer::Item::BlockRight
-		| Map2D::Layer::Item::BlockTop
-		| Map2D::Layer::Item::BlockBottom);
-
-	ADD_TILE(Map2D::Layer::Item::Blocking, 0x74, Map2D::Layer::Item::BlockTop
-		| Map2D::Layer::Item::JumpDown);
-
-	for (int i = 0; i < 7; i++) {
-		ADD_TILE(Map2D::Layer::Item::Default, 0x0000 + i, 0); // question mark box
-	}
-
-	ADD_TILE(Map2D::Layer::Item::Default, 0x00FD, 0); // unknown (see tile mapping code)
-#undef ADD_TILE
-
-	Map2D::LayerPtr atLayer(new Layer_WordRescueAttribute(atItems, validAtItems));
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validAtItems = this->validAtCatalogue.get();
 
 	Map2D::LayerPtrVector layers;
 	layers.push_back(bgLayer);
-	layers.push_back(atLayer);
+	layers.push_back(Map2D::LayerPtr()); // attributes, loaded on demand
 	layers.push_back(item8Layer);
 	layers.push_back(item16Layer);
 
-	Map2DPtr map(new Map2D_WordRescue(attributes, mapWidth, mapHeight, layers));
+	GenericMap2D::LayerLoaderVector loaders(layers.size());
+	loaders[1] = boost::bind(loadWordRescueAttributes, rawLayers, lenUsed,
+		mapWidth * 2, mapHeight * 2, arena, validAtItems);
+
+	Map2DPtr map(new Map2D_WordRescue(attributes, mapWidth, mapHeight, layers,
+		arena, loaders));
 
 	return map;
 }
@@ -962,24 +985,16 @@ void MapType_WordRescue::write(MapPtr map, stream::expanding_output_sptr output,
 
 	// Write the background layer
 	unsigned long lenTiles = mapWidth * mapHeight;
-	uint8_t *tiles = new uint8_t[lenTiles];
-	boost::scoped_array<uint8_t> stiles(tiles);
-	// Set the default background tile
-	memset(tiles, WR_DEFAULT_BGTILE, lenTiles);
-	layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr bgitems = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = bgitems->begin();
-		i != bgitems->end();
-		i++
-	) {
-		if (((*i)->x > mapWidth) || ((*i)->y > mapHeight)) {
-			throw stream::error(createString("Layer has tiles outside map "
-				"boundary at (" << (*i)->x << "," << (*i)->y << ")"));
-		}
-		tiles[(*i)->y * mapWidth + (*i)->x] = (*i)->code;
+	std::vector<uint8_t> tiles(lenTiles);
+	TileGridPtr bg = getTileGrid(map2d->getLayer(0), mapWidth, mapHeight);
+	for (unsigned long i = 0; i < lenTiles; i++) {
+		uint32_t code = bg->codes[i];
+		// Empty cells are written as the default background tile
+		if (code == INVALID_TILECODE) code = WR_DEFAULT_BGTILE;
+		tiles[i] = code;
 	}
 
-	rleWrite(output, tiles, lenTiles);
+	if (lenTiles) rleWrite(output, &tiles[0], lenTiles);
 
 	// Write the attribute layer
 	unsigned long lenAttr = mapWidth * mapHeight * 4;
@@ -995,8 +1010,8 @@ void MapType_WordRescue::write(MapPtr map, stream::expanding_output_sptr output,
 	) {
 		uint16_t code = (*i)->code;
 
-		if (((*i)->type & Map2D::Layer::Item::Blocking) && (*i)->blockingFlags) {
-			if ((*i)->blockingFlags & Map2D::Layer::Item::JumpDown) {
+		if (((*i)->type & Map2D::Layer::Item::Blocking) && (*i)->blocking().flags) {
+			if ((*i)->blocking().flags & Map2D::Layer::Item::JumpDown) {
 				code = 0x74;
 			} else {
 				// Probably all Block* flags set
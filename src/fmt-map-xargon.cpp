@@ -23,8 +23,9 @@
 
 #include <iostream>
 #include <list>
-#include <boost/scoped_array.hpp>
+#include <boost/bind.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include <camoto/iostream_helpers.hpp>
 #include <camoto/stream_string.hpp>
 #include "fmt-map-xargon.hpp"
@@ -52,14 +53,14 @@ using namespace camoto::gamegraphics;
 class Layer_SweeneyBackground: virtual public GenericMap2D::Layer
 {
 	public:
-		Layer_SweeneyBackground(ItemPtrVectorPtr& items,
+		Layer_SweeneyBackground(TileGridPtr& tiles,
 			MapType_Sweeney::image_map_sptr imgMap, ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
 					"Background",
 					Map2D::Layer::HasPalette,
 					0, 0,   // Layer size unused
 					0, 0,
-					items, validItems
+					tiles, validItems
 				),
 				imgMap(imgMap)
 		{
@@ -285,16 +286,48 @@ SuppFilenames MapType_Xargon::getRequiredSupps(stream::input_sptr input,
 // MapType_Sweeney
 //
 
-MapType::Certainty MapType_Sweeney::isInstance(stream::input_sptr psMap) const
+/// Populate the list of permitted objects.
+static void buildValidObjItems(Map2D::Layer::ItemPtrVector& items)
 {
-	stream::pos lenMap = psMap->size();
+	Map2D::Layer::ItemPtr v(new Map2D::Layer::Item());
+	v->type = Map2D::Layer::Item::Default;
+	v->x = 0;
+	v->y = 0;
+	v->code = 0x33; // Clouds
+	items.push_back(v);
+
+	v.reset(new Map2D::Layer::Item());
+	v->type = Map2D::Layer::Item::Text;
+	v->x = 0;
+	v->y = 0;
+	v->text().font = 0;
+	v->text().content = "Small text";
+	items.push_back(v);
+
+	v.reset(new Map2D::Layer::Item());
+	v->type = Map2D::Layer::Item::Text;
+	v->x = 0;
+	v->y = 0;
+	v->text().font = 0;
+	v->text().content = "Large text";
+	items.push_back(v);
+	return;
+}
+
+MapType_Sweeney::MapType_Sweeney()
+	:	validObjCatalogue(buildValidObjItems)
+{
+}
+
+MapType::Certainty MapType_Sweeney::isInstance(const Probe& probe) const
+{
+	stream::pos lenMap = probe.size();
 
 	// TESTED BY: fmt_map_xargon_isinstance_c01
 	if (lenMap < XR_OFFSET_OBJLAYER + 2) return MapType::DefinitelyNo; // too short
 
-	psMap->seekg(XR_OFFSET_OBJLAYER, stream::start);
 	uint16_t numObjects;
-	psMap >> u16le(numObjects);
+	if (!probe.readU16le(XR_OFFSET_OBJLAYER, &numObjects)) return MapType::DefinitelyNo;
 
 	stream::pos offStrings = XR_OFFSET_OBJLAYER + 2 +
 		numObjects * XR_OBJ_ENTRY_LEN + this->lenSavedata;
@@ -304,18 +337,16 @@ MapType::Certainty MapType_Sweeney::isInstance(stream::input_sptr psMap) const
 
 	// TESTED BY: fmt_map_xargon_isinstance_c03
 	if (lenMap < offStrings + 3) return MapType::DefinitelyNo; // too short
-	psMap->seekg(offStrings, stream::start);
 
 	unsigned int i;
 	for (i = 0; i < XR_SAFETY_MAX_STRINGS; i++) {
 		uint16_t lenStr;
-		psMap >> u16le(lenStr);
+		if (!probe.readU16le(offStrings, &lenStr)) return MapType::DefinitelyNo;
 		offStrings += lenStr + 2 + 1; // +2 for uint16le, +1 for terminating null
 		if (offStrings == lenMap) break; // reached EOF
 
 		// Make sure the next string's length field isn't cut
 		if (lenMap < offStrings + 2) return MapType::DefinitelyNo;
-		psMap->seekg(offStrings, stream::start);
 	}
 	if (i == XR_SAFETY_MAX_STRINGS) return MapType::DefinitelyNo; // too many strings
 
@@ -323,14 +354,88 @@ MapType::Certainty MapType_Sweeney::isInstance(stream::input_sptr psMap) const
 	return MapType::DefinitelyYes;
 }
 
+DetectFilter MapType_Sweeney::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.minSize = XR_OFFSET_OBJLAYER + 2;
+	return filter;
+}
+
 MapPtr MapType_Sweeney::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Decode the background tiles within a region.
+/**
+ * @param raw
+ *   Tile codes read from the map file, covering only the region.  Like the
+ *   file, these are stored one column after another.
+ *
+ * @param area
+ *   Region the tile codes cover.
+ *
+ * @return A grid covering the whole map, with only the non-empty tiles within
+ *   the region set.
+ */
+static TileGridPtr decodeSweeneyBackground(const RawBlockPtr& raw,
+	const MapRegion& area)
+{
+	TileGridPtr tiles(new TileGrid(XR_MAP_WIDTH, XR_MAP_HEIGHT));
+	if (raw->empty()) return tiles;
+
+	decodeGridColumns16le(&raw->at(0), tiles.get(), area.x, area.y,
+		area.width, area.height, INVALID_TILECODE);
+
+	// Only the lower bits select the tile, so blank those that are empty spots
+	for (std::vector<uint32_t>::iterator i = tiles->codes.begin();
+		i != tiles->codes.end(); i++
+	) {
+		if ((*i & 0x03FF) == 0) *i = INVALID_TILECODE;
+	}
+	return tiles;
+}
+
+/// Decode the background layer the first time it is requested.
+/**
+ * @param raw
+ *   Tile codes read from the map file.
+ *
+ * @param imgMap
+ *   Mapping from tile codes to images.
+ *
+ * @param validBGItems
+ *   List of permitted tiles.
+ */
+static Map2D::LayerPtr loadSweeneyBackground(RawBlockPtr raw,
+	MapType_Sweeney::image_map_sptr imgMap,
+	Map2D::Layer::ItemPtrVectorPtr validBGItems)
+{
+	MapRegion all = {0, 0, XR_MAP_WIDTH, XR_MAP_HEIGHT};
+	TileGridPtr tiles = decodeSweeneyBackground(raw, all);
+	return Map2D::LayerPtr(
+		new Layer_SweeneyBackground(tiles, imgMap, validBGItems));
+}
+
 MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 {
+	return this->openArea(input, suppData, NULL);
+}
+
+MapPtr MapType_Sweeney::openRegion(stream::input_sptr input,
+	SuppData& suppData, const MapRegion& region) const
+{
+	MapRegion area = region;
+	clipRegion(&area, XR_MAP_WIDTH, XR_MAP_HEIGHT);
+	return this->openArea(input, suppData, &area);
+}
+
+MapPtr MapType_Sweeney::openArea(stream::input_sptr input, SuppData& suppData,
+	const MapRegion *area) const
+{
+	ItemArenaPtr arena(new ItemArena());
+
 	// Read the tile properties from the suppdata
 	stream::input_sptr dma = suppData[SuppItem::Extra1];
 	assert(dma);
@@ -354,7 +459,7 @@ MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 		;
 
 		// Add to list of valid tiles
-		v.reset(new Map2D::Layer::Item());
+		v = createItem(arena);
 		v->type = Map2D::Layer::Item::Default;
 		v->x = 0;
 		v->y = 0;
@@ -376,27 +481,22 @@ MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 	}
 
 	// Read the background layer
-	input->seekg(0, stream::start);
-
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(XR_MAP_WIDTH * XR_MAP_HEIGHT);
-	for (unsigned int x = 0; x < XR_MAP_WIDTH; x++) {
-		for (unsigned int y = 0; y < XR_MAP_HEIGHT; y++) {
-			uint16_t code;
-			input >> u16le(code);
-			if ((code & 0x03FF) == 0) continue; // empty spot
-			Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-			t->type = Map2D::Layer::Item::Default;
-			t->x = x;
-			t->y = y;
-			t->code = code;
-			tiles->push_back(t);
-		}
+	Map2D::LayerPtr bgLayer;
+	RawBlockPtr bgRaw;
+	if (area) {
+		// Only read the columns and rows within the region
+		RawBlockPtr raw = readGridRegion(input, 0, XR_MAP_HEIGHT, 2,
+			area->x, area->width, area->y, area->height);
+		TileGridPtr tiles = decodeSweeneyBackground(raw, *area);
+		bgLayer.reset(new Layer_SweeneyBackground(tiles, imgMap, validBGItems));
+		input->seekg(XR_OFFSET_OBJLAYER, stream::start);
+	} else {
+		// Leave the tiles to be decoded when needed
+		input->seekg(0, stream::start);
+		bgRaw = readRawBlock(input, XR_MAP_WIDTH * XR_MAP_HEIGHT * 2);
 	}
 	lenMap -= XR_MAP_WIDTH * XR_MAP_HEIGHT * 2;
 
-	Map2D::LayerPtr bgLayer(new Layer_SweeneyBackground(tiles, imgMap, validBGItems));
-
 	// Read the object layer
 	uint16_t numObjects;
 	input >> u16le(numObjects);
@@ -470,8 +570,20 @@ MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 			>> u16le(zapHold)
 		;
 
+		if (area && (
+			(x / XR_TILE_WIDTH < area->x) ||
+			(x / XR_TILE_WIDTH >= area->x + area->width) ||
+			(y / XR_TILE_HEIGHT < area->y) ||
+			(y / XR_TILE_HEIGHT >= area->y + area->height)
+		)) {
+			// Outside the region, but the text strings are assigned in order so
+			// skip over this object's one.
+			if (pointer && !mapStrings.empty()) mapStrings.pop_front();
+			continue;
+		}
+
 		//SweeneyObject *obj = new SweeneyObject;
-		Map2D::Layer::ItemPtr obj(new Map2D::Layer::Item);
+		Map2D::Layer::ItemPtr obj(createItem(arena));
 		obj->type = Map2D::Layer::Item::Default;
 		obj->x = x;
 		obj->y = y;
@@ -480,48 +592,27 @@ MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 		if (pointer) {
 			// This one refers to a text entry
 			obj->type |= Map2D::Layer::Item::Text;
-			obj->textFont = 0; ///< @todo Correct font
+			obj->text().font = 0; ///< @todo Correct font
 			if (!mapStrings.empty()) {
-				obj->textContent = mapStrings.front();
+				obj->text().content = mapStrings.front();
 				mapStrings.pop_front();
 			}
 		}
 		if (spdHoriz || spdVert) {
 			obj->type |= Map2D::Layer::Item::Movement;
-			obj->movementSpeedX = spdHoriz; ///< @todo Correct calculation
-			obj->movementSpeedY = spdVert;  ///< @todo Correct calculation
-			obj->movementDistLeft = 0;
-			obj->movementDistRight = 0;
-			obj->movementDistUp = 0;
-			obj->movementDistDown = 0;
+			obj->movement().speedX = spdHoriz; ///< @todo Correct calculation
+			obj->movement().speedY = spdVert;  ///< @todo Correct calculation
+			obj->movement().distLeft = 0;
+			obj->movement().distRight = 0;
+			obj->movement().distUp = 0;
+			obj->movement().distDown = 0;
 		}
 		objects->push_back(obj);
 	}
 	lenMap -= XR_OBJ_ENTRY_LEN * numObjects;
 
-	Map2D::Layer::ItemPtrVectorPtr validObjItems(new Map2D::Layer::ItemPtrVector());
-	v.reset(new Map2D::Layer::Item());
-	v->type = Map2D::Layer::Item::Default;
-	v->x = 0;
-	v->y = 0;
-	v->code = 0x33; // Clouds
-	validObjItems->push_back(v);
-
-	v.reset(new Map2D::Layer::Item);
-	v->type = Map2D::Layer::Item::Text;
-	v->x = 0;
-	v->y = 0;
-	v->textFont = 0;
-	v->textContent = "Small text";
-	validObjItems->push_back(v);
-
-	v.reset(new Map2D::Layer::Item);
-	v->type = Map2D::Layer::Item::Text;
-	v->x = 0;
-	v->y = 0;
-	v->textFont = 0;
-	v->textContent = "Large text";
-	validObjItems->push_back(v);
+	// The list of permitted objects is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validObjItems = this->validObjCatalogue.get();
 
 	Map2D::LayerPtr objLayer(new Layer_SweeneyObject(objects, imgMap, validObjItems));
 
@@ -529,16 +620,24 @@ MapPtr MapType_Sweeney::open(stream::input_sptr input, SuppData& suppData) const
 	assert(input->tellg() == (unsigned)(XR_OFFSET_OBJLAYER + 2 + numObjects * XR_OBJ_ENTRY_LEN));
 
 	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
+	layers.push_back(bgLayer); // null if loaded on demand
 	layers.push_back(objLayer);
 
+	GenericMap2D::LayerLoaderVector loaders;
+	if (!bgLayer) {
+		loaders.resize(layers.size());
+		loaders[0] = boost::bind(loadSweeneyBackground, bgRaw, imgMap,
+			validBGItems);
+	}
+
 	Map2DPtr map(new GenericMap2D(
 		Map::Attributes(), Map::GraphicsFilenames(),
 		Map2D::HasViewport,
 		this->viewportWidth, this->viewportHeight,
 		XR_MAP_WIDTH, XR_MAP_HEIGHT,
 		XR_TILE_WIDTH, XR_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
+		layers, Map2D::PathPtrVectorPtr(),
+		arena, loaders
 	));
 
 	return map;
@@ -553,27 +652,15 @@ void MapType_Sweeney::write(MapPtr map, stream::expanding_output_sptr output,
 		throw stream::error("Incorrect layer count for this format.");
 
 	// Write the background layer
-	uint16_t *bg = new uint16_t[XR_MAP_WIDTH * XR_MAP_HEIGHT];
-	boost::scoped_array<uint16_t> sbg(bg);
-	// Set the default background tile
-	memset(bg, 0x00, XR_MAP_WIDTH * XR_MAP_HEIGHT * 2); // 2 == sizeof(uint16le)
-
-	Map2D::LayerPtr layer = map2d->getLayer(0);
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		assert(((*i)->x < XR_MAP_WIDTH) && ((*i)->y < XR_MAP_HEIGHT));
-		bg[(*i)->x * XR_MAP_HEIGHT + (*i)->y] = (*i)->code;
-	}
-
-	for (unsigned int i = 0; i < XR_MAP_WIDTH * XR_MAP_HEIGHT; i++) {
-		output << u16le(bg[i]);
-	}
+	TileGridPtr bg = getTileGrid(map2d->getLayer(0), XR_MAP_WIDTH,
+		XR_MAP_HEIGHT);
+	std::vector<uint8_t> bgRaw(XR_MAP_WIDTH * XR_MAP_HEIGHT * 2);
+	// Empty cells are written as code zero (no tile)
+	encodeGridColumns16le(*bg, &bgRaw[0], 0x0000);
+	output->write(&bgRaw[0], bgRaw.size());
 
 	// Write the object layer
-	layer = map2d->getLayer(1);
+	Map2D::LayerPtr layer = map2d->getLayer(1);
 	const Map2D::Layer::ItemPtrVectorPtr objects = layer->getAllItems();
 
 	uint16_t numObjects = objects->size();
@@ -589,8 +676,8 @@ void MapType_Sweeney::write(MapPtr map, stream::expanding_output_sptr output,
 		uint16_t spdHoriz;
 		uint16_t spdVert;
 		if (obj->type & Map2D::Layer::Item::Movement) {
-			spdHoriz = obj->movementSpeedX;
-			spdVert = obj->movementSpeedY;
+			spdHoriz = obj->movement().speedX;
+			spdVert = obj->movement().speedY;
 		} else {
 			spdHoriz = 0;
 			spdVert = 0;
@@ -641,10 +728,10 @@ void MapType_Sweeney::write(MapPtr map, stream::expanding_output_sptr output,
 		i++
 	) {
 		if ((*i)->type & Map2D::Layer::Item::Text) {
-			unsigned int len = (*i)->textContent.length();
+			unsigned int len = (*i)->text().content.length();
 			if (len > 255) throw stream::error("Cannot write a text element longer than 255 characters.");
 			output << u8(len);
-			output->write((*i)->textContent);
+			output->write((*i)->text().content);
 		}
 	}
 
@@ -31,9 +31,14 @@ namespace gamemaps {
 class MapType_Sweeney: virtual public MapType_Base
 {
 	public:
-		virtual Certainty isInstance(stream::input_sptr psMap) const;
+		MapType_Sweeney();
+
+		virtual Certainty isInstance(const Probe& probe) const;
+		virtual DetectFilter getDetectFilter() const;
 		virtual MapPtr create(SuppData& suppData) const;
 		virtual MapPtr open(stream::input_sptr input, SuppData& suppData) const;
+		virtual MapPtr openRegion(stream::input_sptr input, SuppData& suppData,
+			const MapRegion& region) const;
 		virtual void write(MapPtr map, stream::expanding_output_sptr output,
 			ExpandingSuppData& suppData) const;
 
@@ -41,9 +46,27 @@ class MapType_Sweeney: virtual public MapType_Base
 		typedef boost::shared_ptr<image_map> image_map_sptr;
 
 	protected:
+		/// Read the map, or only part of it.
+		/**
+		 * @param input
+		 *   The map file.
+		 *
+		 * @param suppData
+		 *   Supplemental data, as passed to open().
+		 *
+		 * @param area
+		 *   Area to load, already clipped to the map, or NULL to load the whole
+		 *   map.
+		 *
+		 * @return The map.
+		 */
+		MapPtr openArea(stream::input_sptr input, SuppData& suppData,
+			const MapRegion *area) const;
+
 		unsigned int viewportWidth;
 		unsigned int viewportHeight;
 		unsigned int lenSavedata;
+		ItemCatalogue validObjCatalogue; ///< Permitted objects
 };
 
 /// Jill of the Jungle level reader/writer.
@@ -24,6 +24,7 @@
 #include <boost/scoped_array.hpp>
 #include <camoto/iostream_helpers.hpp>
 #include "map2d-generic.hpp"
+#include "map2d-decode.hpp"
 #include "fmt-map-zone66.hpp"
 
 /// Width of the map, in tiles
@@ -52,6 +53,18 @@ using namespace camoto::gamegraphics;
 class Layer_Zone66Background: virtual public GenericMap2D::Layer
 {
 	public:
+		Layer_Zone66Background(TileGridPtr& tiles,
+			ItemPtrVectorPtr& validItems)
+			:	GenericMap2D::Layer(
+					"Background",
+					Map2D::Layer::NoCaps,
+					0, 0,
+					0, 0,
+					tiles, validItems
+				)
+		{
+		}
+
 		Layer_Zone66Background(ItemPtrVectorPtr& items,
 			ItemPtrVectorPtr& validItems)
 			:	GenericMap2D::Layer(
@@ -80,6 +93,30 @@ class Layer_Zone66Background: virtual public GenericMap2D::Layer
 };
 
 
+/// Populate the list of permitted tiles.
+static void buildValidBGItems(Map2D::Layer::ItemPtrVector& items)
+{
+/// @todo Add all tiles instead of just ones already in the map, and rewrite the map on save
+	for (unsigned int i = 0; i < 300; i++) {
+
+		// The default tile actually has an image, so don't exclude it
+		//if (i == Z66_DEFAULT_BGTILE) continue;
+
+		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
+		t->type = Map2D::Layer::Item::Default;
+		t->x = 0;
+		t->y = 0;
+		t->code = i;
+		items.push_back(t);
+	}
+	return;
+}
+
+MapType_Zone66::MapType_Zone66()
+	:	validBGCatalogue(buildValidBGItems)
+{
+}
+
 std::string MapType_Zone66::getMapCode() const
 {
 	return "map-zone66";
@@ -104,9 +141,9 @@ std::vector<std::string> MapType_Zone66::getGameList() const
 	return vcGames;
 }
 
-MapType::Certainty MapType_Zone66::isInstance(stream::input_sptr psMap) const
+MapType::Certainty MapType_Zone66::isInstance(const Probe& probe) const
 {
-	stream::pos lenMap = psMap->size();
+	stream::pos lenMap = probe.size();
 
 	// Make sure there's enough data to read the map dimensions
 	// TESTED BY: fmt_map_zone66_isinstance_c01
@@ -116,14 +153,69 @@ MapType::Certainty MapType_Zone66::isInstance(stream::input_sptr psMap) const
 	return MapType::PossiblyYes;
 }
 
+DetectFilter MapType_Zone66::getDetectFilter() const
+{
+	DetectFilter filter;
+	filter.sizes.push_back(Z66_MAP_WIDTH * Z66_MAP_HEIGHT);
+	return filter;
+}
+
 MapPtr MapType_Zone66::create(SuppData& suppData) const
 {
 	// TODO: Implement
 	throw stream::error("Not implemented yet!");
 }
 
+/// Read the table mapping the codes in the map file to tile numbers.
+/**
+ * @param dataMapBG
+ *   Tile mapping table (the Extra1 supp).
+ *
+ * @param tilemap
+ *   Array of 256 entries to receive the tile number for each code.
+ */
+static void readZone66Tilemap(stream::input_sptr dataMapBG,
+	unsigned int *tilemap)
+{
+	if (!dataMapBG) throw stream::error("Mandatory Extra1 supplementary item (Z66 tile mapping table) was not supplied.");
+	dataMapBG->seekg(0, stream::start);
+	uint16_t lenTilemap, unknown;
+	dataMapBG
+		>> u16le(lenTilemap)
+		>> u16le(unknown)
+	;
+	if (lenTilemap > 256) lenTilemap = 256;
+	for (unsigned int i = 0; i < lenTilemap; i++) {
+		dataMapBG >> u16le(tilemap[i]);
+	}
+	for (unsigned int i = lenTilemap; i < 256; i++) tilemap[i] = Z66_DEFAULT_BGTILE;
+	return;
+}
+
+/// Create the map structure around the background layer.
+static MapPtr createZone66Map(Map2D::LayerPtr& bgLayer,
+	const ItemArenaPtr& arena)
+{
+	Map2D::LayerPtrVector layers;
+	layers.push_back(bgLayer);
+
+	Map2DPtr map(new GenericMap2D(
+		Map::Attributes(), Map::GraphicsFilenames(),
+		Map2D::HasViewport,
+		320, 200, // viewport size
+		Z66_MAP_WIDTH, Z66_MAP_HEIGHT,
+		Z66_TILE_WIDTH, Z66_TILE_HEIGHT,
+		layers, Map2D::PathPtrVectorPtr(),
+		arena
+	));
+
+	return map;
+}
+
 MapPtr MapType_Zone66::open(stream::input_sptr input, SuppData& suppData) const
 {
+	ItemArenaPtr arena(new ItemArena());
+
 	// Read the background layer
 	uint8_t *bg = new uint8_t[Z66_MAP_BG_LEN];
 	boost::scoped_array<uint8_t> scoped_bg(bg);
@@ -137,68 +229,64 @@ MapPtr MapType_Zone66::open(stream::input_sptr input, SuppData& suppData) const
 	}
 
 	// Read the tile mapping table
-	stream::input_sptr dataMapBG = suppData[SuppItem::Extra1];
-	if (!dataMapBG) throw stream::error("Mandatory Extra1 supplementary item (Z66 tile mapping table) was not supplied.");
-	dataMapBG->seekg(0, stream::start);
-	uint16_t lenTilemap, unknown;
-	dataMapBG
-		>> u16le(lenTilemap)
-		>> u16le(unknown)
-	;
-	if (lenTilemap > 256) lenTilemap = 256;
 	unsigned int tilemap[256];
-	for (unsigned int i = 0; i < lenTilemap; i++) {
-		dataMapBG >> u16le(tilemap[i]);
-	}
-	for (unsigned int i = lenTilemap; i < 256; i++) tilemap[i] = Z66_DEFAULT_BGTILE;
+	readZone66Tilemap(suppData[SuppItem::Extra1], tilemap);
 
-	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
-	tiles->reserve(Z66_MAP_BG_LEN);
+	TileGridPtr tiles(new TileGrid(Z66_MAP_WIDTH, Z66_MAP_HEIGHT));
 	for (unsigned int i = 0; i < Z66_MAP_BG_LEN; i++) {
 		// The default tile actually has an image, so don't exclude it
 		//if (bg[i] == Z66_DEFAULT_BGTILE) continue;
-
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = i % Z66_MAP_WIDTH;
-		t->y = i / Z66_MAP_WIDTH;
-		t->code = tilemap[bg[i]];
-		tiles->push_back(t);
+		tiles->codes[i] = tilemap[bg[i]];
 	}
 
-	// Populate the list of permitted tiles
-	Map2D::Layer::ItemPtrVectorPtr validBGItems(new Map2D::Layer::ItemPtrVector());
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
 
-/// @todo Add all tiles instead of just ones already in the map, and rewrite the map on save
-	for (unsigned int i = 0; i < 300; i++) {
+	// Create the map structures
+	Map2D::LayerPtr bgLayer(new Layer_Zone66Background(tiles, validBGItems));
 
-		// The default tile actually has an image, so don't exclude it
-		//if (i == Z66_DEFAULT_BGTILE) continue;
+	return createZone66Map(bgLayer, arena);
+}
 
-		Map2D::Layer::ItemPtr t(new Map2D::Layer::Item());
-		t->type = Map2D::Layer::Item::Default;
-		t->x = 0;
-		t->y = 0;
-		t->code = i;
-		validBGItems->push_back(t);
+MapPtr MapType_Zone66::openRegion(stream::input_sptr input,
+	SuppData& suppData, const MapRegion& region) const
+{
+	// Leave short files to open(), which fills in the missing tiles
+	if (input->size() < Z66_MAP_BG_LEN) return this->open(input, suppData);
+
+	ItemArenaPtr arena(new ItemArena());
+
+	// Read the tile mapping table
+	unsigned int tilemap[256];
+	readZone66Tilemap(suppData[SuppItem::Extra1], tilemap);
+
+	// Read only the rows and columns within the region
+	MapRegion area = region;
+	clipRegion(&area, Z66_MAP_WIDTH, Z66_MAP_HEIGHT);
+	RawBlockPtr bg = readGridRegion(input, 0, Z66_MAP_WIDTH, 1,
+		area.y, area.height, area.x, area.width);
+
+	Map2D::Layer::ItemPtrVectorPtr tiles(new Map2D::Layer::ItemPtrVector());
+	tiles->reserve(bg->size());
+	unsigned int i = 0;
+	for (unsigned int y = area.y; y < area.y + area.height; y++) {
+		for (unsigned int x = area.x; x < area.x + area.width; x++) {
+			Map2D::Layer::ItemPtr t(createItem(arena));
+			t->type = Map2D::Layer::Item::Default;
+			t->x = x;
+			t->y = y;
+			t->code = tilemap[(*bg)[i++]];
+			tiles->push_back(t);
+		}
 	}
 
+	// The list of permitted tiles is shared between all maps
+	Map2D::Layer::ItemPtrVectorPtr validBGItems = this->validBGCatalogue.get();
+
 	// Create the map structures
 	Map2D::LayerPtr bgLayer(new Layer_Zone66Background(tiles, validBGItems));
 
-	Map2D::LayerPtrVector layers;
-	layers.push_back(bgLayer);
-
-	Map2DPtr map(new GenericMap2D(
-		Map::Attributes(), Map::GraphicsFilenames(),
-		Map2D::HasViewport,
-		320, 200, // viewport size
-		Z66_MAP_WIDTH, Z66_MAP_HEIGHT,
-		Z66_TILE_WIDTH, Z66_TILE_HEIGHT,
-		layers, Map2D::PathPtrVectorPtr()
-	));
-
-	return map;
+	return createZone66Map(bgLayer, arena);
 }
 
 void MapType_Zone66::write(MapPtr map, stream::expanding_output_sptr output,
@@ -223,19 +311,16 @@ void MapType_Zone66::write(MapPtr map, stream::expanding_output_sptr output,
 	uint8_t *bg = new uint8_t[Z66_MAP_BG_LEN];
 	boost::scoped_array<uint8_t> scoped_bg(bg);
 	memset(bg, Z66_DEFAULT_BGTILE, Z66_MAP_BG_LEN); // default background tile
-	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
-		i != items->end();
-		i++
-	) {
-		if (((*i)->x > mapWidth) || ((*i)->y > mapHeight)) {
-			throw stream::error("Layer has tiles outside map boundary!");
-		}
+	TileGridPtr grid = getTileGrid(layer, Z66_MAP_WIDTH, Z66_MAP_HEIGHT);
+	for (unsigned int i = 0; i < Z66_MAP_BG_LEN; i++) {
+		uint32_t code = grid->codes[i];
+		if (code == INVALID_TILECODE) continue;
+
 		// Look for an existing tile mapping first
 		bool found = false;
 		for (unsigned int m = 0; m < numTileMappings; m++) {
-			if (mapBG[m] == (*i)->code) {
-				bg[(*i)->y * mapWidth + (*i)->x] = m;
+			if (mapBG[m] == code) {
+				bg[i] = m;
 				found = true;
 				break;
 			}
@@ -247,10 +332,10 @@ void MapType_Zone66::write(MapPtr map, stream::expanding_output_sptr output,
 					"Zone 66 only supports up to 256 different tiles in each level.  "
 					"Please remove some tiles and try again.");
 			}
-			bg[(*i)->y * mapWidth + (*i)->x] = numTileMappings;
-			mapBG[numTileMappings++] = (*i)->code;
+			bg[i] = numTileMappings;
+			mapBG[numTileMappings++] = code;
 			/// @todo Use the correct "destroyed" tile code
-			mapBG[numTileMappings++] = (*i)->code;
+			mapBG[numTileMappings++] = code;
 		}
 	}
 	output->seekp(0, stream::start);
@@ -0,0 +1,146 @@
+/**
+ * @file  input_mmap.cpp
+ * @brief Read-only stream backed by a memory-mapped file.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <camoto/gamemaps/input_mmap.hpp>
+
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#define USE_MMAP
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/// Amount to read at a time when the file can't be mapped, in bytes.
+#define MMAP_READ_CHUNK 65536
+
+namespace camoto {
+namespace gamemaps {
+
+input_mmap::input_mmap(const std::string& filename)
+	:	content(NULL),
+		lenContent(0),
+		offset(0),
+		mapping(NULL)
+{
+#ifdef USE_MMAP
+	int fd = ::open(filename.c_str(), O_RDONLY);
+	if (fd < 0) throw stream::open_error(strerror(errno));
+
+	struct stat st;
+	bool empty = false;
+	if ((fstat(fd, &st) == 0) && S_ISREG(st.st_mode)) {
+		if (st.st_size == 0) {
+			// Nothing to map, and nothing to read either
+			empty = true;
+		} else {
+			void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (p != MAP_FAILED) {
+				this->mapping = p;
+				this->content = (const uint8_t *)p;
+				this->lenContent = st.st_size;
+			}
+		}
+	}
+	::close(fd);
+	// Anything we couldn't map (pipes, devices, etc.) is read in below.
+	if (this->mapping || empty) return;
+#endif
+
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) throw stream::open_error(strerror(errno));
+	for (;;) {
+		stream::len lenBefore = this->buffer.size();
+		this->buffer.resize(lenBefore + MMAP_READ_CHUNK);
+		size_t r = fread(&this->buffer[lenBefore], 1, MMAP_READ_CHUNK, f);
+		this->buffer.resize(lenBefore + r);
+		if (r < MMAP_READ_CHUNK) break;
+	}
+	bool failed = ferror(f);
+	fclose(f);
+	if (failed) throw stream::open_error("Error reading " + filename);
+
+	this->lenContent = this->buffer.size();
+	if (this->lenContent) this->content = &this->buffer[0];
+}
+
+input_mmap::~input_mmap()
+{
+#ifdef USE_MMAP
+	if (this->mapping) munmap(this->mapping, this->lenContent);
+#endif
+}
+
+stream::len input_mmap::try_read(uint8_t *buffer, stream::len len)
+{
+	if (this->offset >= this->lenContent) return 0;
+	len = std::min<stream::len>(len, this->lenContent - this->offset);
+	memcpy(buffer, this->content + this->offset, len);
+	this->offset += len;
+	return len;
+}
+
+void input_mmap::seekg(stream::delta off, stream::seek_from from)
+{
+	stream::delta base;
+	switch (from) {
+		case stream::start: base = 0; break;
+		case stream::cur: base = this->offset; break;
+		case stream::end: base = this->lenContent; break;
+		default: base = 0; break;
+	}
+	stream::delta target = base + off;
+	if ((target < 0) || (target > (stream::delta)this->lenContent)) {
+		throw stream::seek_error("Cannot seek beyond the end of the file.");
+	}
+	this->offset = target;
+	return;
+}
+
+stream::pos input_mmap::tellg() const
+{
+	return this->offset;
+}
+
+stream::len input_mmap::size() const
+{
+	return this->lenContent;
+}
+
+const uint8_t *input_mmap::data() const
+{
+	return this->content;
+}
+
+bool input_mmap::isMapped() const
+{
+	return this->mapping != NULL;
+}
+
+} // namespace gamemaps
+} // namespace camoto
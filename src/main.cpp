@@ -18,7 +18,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <boost/scoped_ptr.hpp>
 #include <camoto/gamemaps/manager.hpp>
+#include <camoto/gamemaps/detect.hpp>
 
 // Include all the file formats for the Manager to load
 #include "fmt-map-bash.hpp"
@@ -49,12 +51,17 @@ class ActualManager: virtual public Manager
 		/// List of available map types.
 		MapTypeVector vcTypes;
 
+		/// Index of vcTypes for detect().
+		boost::scoped_ptr<Detector> detector;
+
 	public:
 		ActualManager();
 		~ActualManager();
 
 		virtual const MapTypePtr getMapType(unsigned int iIndex) const;
 		virtual const MapTypePtr getMapTypeByCode(const std::string& strCode) const;
+		virtual DetectMatchVector detect(stream::input_sptr input,
+			const std::string& filename) const;
 };
 
 const ManagerPtr getManager()
@@ -84,6 +91,8 @@ ActualManager::ActualManager()
 	this->vcTypes.push_back(MapTypePtr(new MapType_WordRescue()));
 	this->vcTypes.push_back(MapTypePtr(new MapType_Xargon()));
 	this->vcTypes.push_back(MapTypePtr(new MapType_Zone66()));
+
+	this->detector.reset(new Detector(this->vcTypes));
 }
 
 ActualManager::~ActualManager()
@@ -105,5 +114,12 @@ const MapTypePtr ActualManager::getMapTypeByCode(const std::string& strCode)
 	return MapTypePtr();
 }
 
+DetectMatchVector ActualManager::detect(stream::input_sptr input,
+	const std::string& filename) const
+{
+	Probe probe(input);
+	return this->detector->detect(input, probe, filename, 1, true);
+}
+
 } // namespace gamemaps
 } // namespace camoto
@@ -0,0 +1,187 @@
+/**
+ * @file  map2d-arena.hpp
+ * @brief Memory arena for allocating the items in a map.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_MAP2D_ARENA_HPP_
+#define _CAMOTO_GAMEMAPS_MAP2D_ARENA_HPP_
+
+#include <stdint.h>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <vector>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include <camoto/gamemaps/map2d.hpp>
+
+namespace camoto {
+namespace gamemaps {
+
+/// Block of memory that map items are allocated from.
+/**
+ * Allocations are carved off the end of large blocks and never individually
+ * released.  All the memory is freed in one go when the arena is destroyed.
+ *
+ * Every allocation holds a reference to the arena, so it lives until both
+ * the map and every item that came from it have been released.  An intrusive
+ * count is used rather than having each allocator hold a shared_ptr, as
+ * allocate_shared() copies the allocator several times per item and each
+ * copy would otherwise cost an atomic increment and decrement.
+ *
+ * Allocation and release are both thread safe.  Layers of the same map
+ * share one arena and may create items from a grid on any thread, so each
+ * allocation takes a lock.  It is almost never contended, since items are
+ * normally created by one thread while a map is being opened.
+ */
+class ItemArena:
+	public boost::intrusive_ref_counter<ItemArena, boost::thread_safe_counter>
+{
+	public:
+		/// Create an empty arena.  No memory is allocated until it is needed.
+		ItemArena();
+
+		/// Free all the memory in the arena.
+		~ItemArena();
+
+		/// Allocate some memory from the arena.
+		/**
+		 * The arena's reference count is incremented, and must be decremented
+		 * again with intrusive_ptr_release() once the memory is no longer used.
+		 *
+		 * @param len
+		 *   Number of bytes required.
+		 *
+		 * @return Pointer to the memory, suitably aligned for any type.
+		 */
+		void *allocate(std::size_t len);
+
+	protected:
+		boost::mutex lock;             ///< Held while allocating
+		std::vector<uint8_t *> blocks; ///< Every block allocated so far
+		uint8_t *next;                 ///< Next free byte in the current block
+		std::size_t remaining;         ///< Bytes left in the current block
+};
+
+/// Shared pointer to an ItemArena.
+typedef boost::intrusive_ptr<ItemArena> ItemArenaPtr;
+
+/// Standard allocator that allocates from an ItemArena.
+template <class T>
+class ArenaAllocator
+{
+	public:
+		typedef T value_type;
+		typedef T *pointer;
+		typedef const T *const_pointer;
+		typedef T& reference;
+		typedef const T& const_reference;
+		typedef std::size_t size_type;
+		typedef std::ptrdiff_t difference_type;
+
+		template <class U>
+		struct rebind
+		{
+			typedef ArenaAllocator<U> other;
+		};
+
+		/// Allocate from the given arena.
+		/**
+		 * @param arena
+		 *   Arena to allocate from.  The caller must hold a reference to it for
+		 *   the life of the allocator, except for allocator copies used to
+		 *   release memory as each allocation holds its own reference.
+		 */
+		ArenaAllocator(const ItemArenaPtr& arena)
+			:	arena(arena.get())
+		{
+		}
+
+		template <class U>
+		ArenaAllocator(const ArenaAllocator<U>& other)
+			:	arena(other.arena)
+		{
+		}
+
+		pointer address(reference x) const
+		{
+			return &x;
+		}
+
+		const_pointer address(const_reference x) const
+		{
+			return &x;
+		}
+
+		pointer allocate(size_type n, const void *hint = 0)
+		{
+			return static_cast<pointer>(this->arena->allocate(n * sizeof(T)));
+		}
+
+		void deallocate(pointer p, size_type n)
+		{
+			// Memory is only released when the arena is destroyed, which may be
+			// now if this was the last reference.
+			intrusive_ptr_release(this->arena);
+		}
+
+		size_type max_size() const
+		{
+			return std::numeric_limits<size_type>::max() / sizeof(T);
+		}
+
+		void construct(pointer p, const T& val)
+		{
+			new (p) T(val);
+		}
+
+		void destroy(pointer p)
+		{
+			p->~T();
+		}
+
+		ItemArena *arena; ///< Arena to allocate from
+};
+
+template <class T, class U>
+inline bool operator ==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena == b.arena;
+}
+
+template <class T, class U>
+inline bool operator !=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b)
+{
+	return a.arena != b.arena;
+}
+
+/// Create a new item, allocating it and its reference count from an arena.
+/**
+ * @param arena
+ *   Arena to allocate from.  This is normally created at the start of the
+ *   MapType::open() implementation and then passed to GenericMap2D.
+ *
+ * @return A new item with all fields set to zero.
+ */
+Map2D::Layer::ItemPtr createItem(const ItemArenaPtr& arena);
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_MAP2D_ARENA_HPP_
@@ -0,0 +1,90 @@
+/**
+ * @file  map2d-blit.hpp
+ * @brief Copy tile images into a framebuffer.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_MAP2D_BLIT_HPP_
+#define _CAMOTO_GAMEMAPS_MAP2D_BLIT_HPP_
+
+#include <stdint.h>
+
+namespace camoto {
+namespace gamemaps {
+
+/// How blitTile() treats pixels that the mask marks as transparent.
+enum BlitMode {
+	BlitMasked, ///< Leave the framebuffer pixel as it is
+	BlitClear,  ///< Set the framebuffer pixel to 0
+	BlitOpaque, ///< Ignore the mask and draw every pixel
+};
+
+/// Draw part of a tile into an 8-bit framebuffer.
+/**
+ * The tile is in the format used by TileAtlas, with one palette index per
+ * pixel and one mask bit per pixel, the most significant bit first and each
+ * row of the mask starting on a new byte.
+ *
+ * The caller clips the tile to the framebuffer beforehand, so no checks are
+ * done per pixel.  Each whole mask byte is drawn as eight pixels at once in a
+ * 64-bit value.  Unclipped tiles 8, 16 or 32 pixels wide are drawn a whole
+ * row at a time with SSE2 instead when the library is compiled for a CPU
+ * that has it, and 32-pixel rows use AVX2 if configure was run with
+ * --enable-avx2.
+ *
+ * @param dst
+ *   Framebuffer pixel to draw the top-left of the visible area at.
+ *
+ * @param dstStride
+ *   Number of bytes from one framebuffer row to the next.
+ *
+ * @param pixels
+ *   First pixel of the tile.
+ *
+ * @param mask
+ *   First byte of the tile's mask.
+ *
+ * @param tileWidth
+ *   Full width of the tile, in pixels.
+ *
+ * @param srcX
+ *   First column of the tile to draw.
+ *
+ * @param srcY
+ *   First row of the tile to draw.
+ *
+ * @param width
+ *   Number of columns to draw.
+ *
+ * @param height
+ *   Number of rows to draw.
+ *
+ * @param colourOffset
+ *   Value added to each tile pixel as it is drawn.
+ *
+ * @param mode
+ *   How to draw the pixels that are transparent in the mask.
+ */
+void blitTile(uint8_t *dst, unsigned int dstStride, const uint8_t *pixels,
+	const uint8_t *mask, unsigned int tileWidth, unsigned int srcX,
+	unsigned int srcY, unsigned int width, unsigned int height,
+	uint8_t colourOffset, BlitMode mode);
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_MAP2D_BLIT_HPP_
@@ -0,0 +1,242 @@
+/**
+ * @file  map2d-decode.hpp
+ * @brief Helper functions for reading whole layers at once.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_MAP2D_DECODE_HPP_
+#define _CAMOTO_GAMEMAPS_MAP2D_DECODE_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/gamemaps/maptype.hpp>
+#include "map2d-generic.hpp"
+
+namespace camoto {
+namespace gamemaps {
+
+/// Raw bytes of a layer, held until the layer is decoded.
+typedef boost::shared_ptr<std::vector<uint8_t> > RawBlockPtr;
+
+/// Read a block of bytes so it can be decoded later.
+/**
+ * This is used to load the data for a layer during MapType::open() without
+ * decoding it, so that the decoding can be put off until the layer is first
+ * requested via GenericMap2D::LayerLoader.
+ *
+ * @param input
+ *   Stream to read from, at the current seek position.
+ *
+ * @param len
+ *   Number of bytes to read.
+ *
+ * @return The block of data.
+ *
+ * @throw stream::incomplete_read
+ *   Fewer than len bytes were available.
+ */
+RawBlockPtr readRawBlock(stream::input_sptr input, stream::len len);
+
+/// Limit a region to the area of a map.
+/**
+ * @param region
+ *   Region passed to MapType::openRegion().  On return it has been shrunk so
+ *   that it lies entirely within the map, which may leave it with a width or
+ *   height of zero.
+ *
+ * @param mapWidth
+ *   Map width, in tiles.
+ *
+ * @param mapHeight
+ *   Map height, in tiles.
+ *
+ * @return true if some of the region is within the map, false if the region
+ *   is empty or lies entirely outside the map.
+ */
+bool clipRegion(MapRegion *region, unsigned int mapWidth,
+	unsigned int mapHeight);
+
+/// Read the cells of a fixed-size grid that fall within a region.
+/**
+ * Many formats store a layer as a fixed-size array of cells, one row after
+ * another.  This reads a rectangle out of such a layer with one seek and
+ * read per row, skipping everything outside the rectangle.  For layers stored
+ * one column after another, pass the column range as the rows and the row
+ * range as the cells.
+ *
+ * @param input
+ *   Stream to read from.
+ *
+ * @param offset
+ *   Offset of the first cell in the grid.
+ *
+ * @param rowLen
+ *   Number of cells in each stored row.
+ *
+ * @param cellSize
+ *   Size of each cell, in bytes.
+ *
+ * @param firstRow
+ *   Index of the first row to read.
+ *
+ * @param numRows
+ *   Number of rows to read.
+ *
+ * @param firstCell
+ *   Index of the first cell to read in each row.
+ *
+ * @param numCells
+ *   Number of cells to read in each row.
+ *
+ * @return Block of numRows * numCells * cellSize bytes, with the cells from
+ *   each row following on from the previous row.
+ *
+ * @throw stream::incomplete_read
+ *   The grid is cut off before the end of the region.
+ */
+RawBlockPtr readGridRegion(stream::input_sptr input, stream::pos offset,
+	unsigned int rowLen, unsigned int cellSize,
+	unsigned int firstRow, unsigned int numRows,
+	unsigned int firstCell, unsigned int numCells);
+
+/// Read a run of little-endian 16-bit values with a single read() call.
+/**
+ * This is much quicker than extracting each value with u16le(), as the
+ * stream is only called once and the conversion is a simple loop.
+ *
+ * @param input
+ *   Stream to read from, at the current seek position.
+ *
+ * @param dest
+ *   Array of at least count elements to receive the values, in host byte
+ *   order.
+ *
+ * @param count
+ *   Number of values to read.
+ *
+ * @throw stream::incomplete_read
+ *   Fewer than count values were available.
+ */
+void readBlock16le(stream::input_sptr input, uint16_t *dest, unsigned int count);
+
+/// Read a layer of 8-bit tile codes into a grid with a single read() call.
+/**
+ * @param input
+ *   Stream to read from, at the current seek position.
+ *
+ * @param grid
+ *   Grid to populate, starting at the first cell.
+ *
+ * @param count
+ *   Number of codes to read.  Must not exceed the number of cells in the
+ *   grid.  Any cells after this are left untouched.
+ *
+ * @param emptyCode
+ *   Code that means there is no tile in the cell.  Cells with this code are
+ *   set to INVALID_TILECODE.  Pass INVALID_TILECODE to keep every code.
+ *
+ * @throw stream::incomplete_read
+ *   Fewer than count codes were available.
+ */
+void readGrid8(stream::input_sptr input, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode);
+
+/// Read a layer of little-endian 16-bit tile codes into a grid.
+/**
+ * Same as readGrid8() but each code is two bytes.
+ */
+void readGrid16le(stream::input_sptr input, TileGrid *grid,
+	unsigned int count, unsigned int emptyCode);
+
+/// Decode a layer of 8-bit tile codes from memory into a grid.
+/**
+ * Same as readGrid8() but the codes come from a block already in memory,
+ * such as one returned by readRawBlock().
+ *
+ * @param raw
+ *   At least count bytes of tile codes.
+ */
+void decodeGrid8(const uint8_t *raw, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode);
+
+/// Decode a layer of little-endian 16-bit tile codes from memory into a grid.
+/**
+ * Same as readGrid16le() but the codes come from a block already in memory,
+ * such as one returned by readRawBlock().
+ *
+ * @param raw
+ *   At least count * 2 bytes of tile codes.
+ */
+void decodeGrid16le(const uint8_t *raw, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode);
+
+/// Decode a block of little-endian 16-bit tile codes stored column by column.
+/**
+ * Some formats store a layer one column after another, rather than one row
+ * after another as TileGrid does.  This transposes the codes in square
+ * blocks small enough to stay in the CPU cache, which is much quicker than
+ * working through the whole of each column in turn.
+ *
+ * @param raw
+ *   width * height codes, being width columns of height codes each.
+ *
+ * @param grid
+ *   Grid to populate.
+ *
+ * @param x
+ *   Grid column to put the first column of codes in.
+ *
+ * @param y
+ *   Grid row to put the first code of each column in.
+ *
+ * @param width
+ *   Number of columns in raw.  x + width must not exceed the grid width.
+ *
+ * @param height
+ *   Number of codes in each column.  y + height must not exceed the grid
+ *   height.
+ *
+ * @param emptyCode
+ *   Code that means there is no tile in the cell, as for readGrid8().
+ */
+void decodeGridColumns16le(const uint8_t *raw, TileGrid *grid,
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+	unsigned int emptyCode);
+
+/// Encode a grid as little-endian 16-bit tile codes, column by column.
+/**
+ * This is the reverse of decodeGridColumns16le(), for the whole grid.
+ *
+ * @param grid
+ *   Grid to encode.
+ *
+ * @param raw
+ *   Buffer of at least grid.width * grid.height * 2 bytes to receive the
+ *   codes.
+ *
+ * @param emptyCode
+ *   Code to write for cells set to INVALID_TILECODE.
+ */
+void encodeGridColumns16le(const TileGrid& grid, uint8_t *raw,
+	unsigned int emptyCode);
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_MAP2D_DECODE_HPP_
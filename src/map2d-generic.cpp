@@ -31,17 +31,29 @@ GenericMap2D::GenericMap2D(const Attributes& attributes,
 	unsigned int viewportWidth, unsigned int viewportHeight,
 	unsigned int width, unsigned int height,
 	unsigned int tileWidth, unsigned int tileHeight,
-	const LayerPtrVector& layers, PathPtrVectorPtr paths)
+	const LayerPtrVector& layers, PathPtrVectorPtr paths,
+	const ItemArenaPtr& arena, const LayerLoaderVector& loaders)
 	:	Map2D(attributes, graphicsFilenames, caps, viewportWidth, viewportHeight),
 		width(width), height(height),
 		tileWidth(tileWidth), tileHeight(tileHeight),
 		layers(layers),
-		paths(paths)
+		paths(paths),
+		arena(arena),
+		loaders(loaders)
 {
 	assert(width > 0);
 	assert(height > 0);
 	assert(tileWidth > 0);
 	assert(tileHeight > 0);
+	assert(loaders.empty() || (loaders.size() == layers.size()));
+
+	if (!this->arena) this->arena.reset(new ItemArena());
+	for (LayerPtrVector::const_iterator l = this->layers.begin();
+		l != this->layers.end();
+		l++
+	) {
+		this->adoptLayer(*l);
+	}
 }
 
 GenericMap2D::~GenericMap2D()
@@ -77,6 +89,8 @@ void GenericMap2D::setTileSize(unsigned int x, unsigned int y)
 
 	this->tileWidth = x;
 	this->tileHeight = y;
+	boost::mutex::scoped_lock lock(this->layerLock);
+	this->updateLayerTileSize();
 	return;
 }
 
@@ -88,7 +102,21 @@ unsigned int GenericMap2D::getLayerCount() const
 Map2D::LayerPtr GenericMap2D::getLayer(unsigned int index)
 {
 	assert(index < this->getLayerCount());
-	return this->layers[index];
+
+	boost::mutex::scoped_lock lock(this->layerLock);
+	LayerPtr& layer = this->layers[index];
+	if (!layer) {
+		assert(index < this->loaders.size());
+		assert(this->loaders[index]);
+		// If the loader throws, the layer stays unloaded and the next call will
+		// try again.
+		LayerPtr loaded = this->loaders[index]();
+		this->adoptLayer(loaded);
+		layer = loaded;
+		// The loader is not needed again, so free whatever data it was holding
+		this->loaders[index].clear();
+	}
+	return layer;
 }
 
 Map2D::PathPtrVectorPtr GenericMap2D::getPaths()
@@ -103,5 +131,60 @@ Map2D::ImageAttachment GenericMap2D::getBackgroundImage(
 	return Map2D::NoBackground;
 }
 
+bool GenericMap2D::takeSavedData(const stream::output_sptr& output,
+	SavedData *out)
+{
+	*out = SavedData();
+	if (this->saved.output.lock() != output) return false;
+	out->main.swap(this->saved.main);
+	out->supps.swap(this->saved.supps);
+	this->saved = SavedData();
+	return true;
+}
+
+void GenericMap2D::putSavedData(const stream::output_sptr& output,
+	SavedData *data)
+{
+	this->saved.output = output;
+	this->saved.main.swap(data->main);
+	this->saved.supps.swap(data->supps);
+	*data = SavedData();
+	return;
+}
+
+void GenericMap2D::clearSavedData(const stream::output_sptr& output)
+{
+	if (this->saved.output.lock() == output) this->saved = SavedData();
+	return;
+}
+
+void GenericMap2D::updateLayerTileSize()
+{
+	for (LayerPtrVector::const_iterator l = this->layers.begin();
+		l != this->layers.end();
+		l++
+	) {
+		boost::shared_ptr<GenericMap2D::Layer> layer =
+			boost::dynamic_pointer_cast<GenericMap2D::Layer>(*l);
+		if (layer && !(layer->getCaps() & Map2D::Layer::HasOwnTileSize)) {
+			layer->setMapTileSize(this->tileWidth, this->tileHeight);
+		}
+	}
+	return;
+}
+
+void GenericMap2D::adoptLayer(const LayerPtr& l)
+{
+	boost::shared_ptr<GenericMap2D::Layer> layer =
+		boost::dynamic_pointer_cast<GenericMap2D::Layer>(l);
+	if (!layer) return;
+
+	layer->arena = this->arena;
+	if (!(layer->getCaps() & Map2D::Layer::HasOwnTileSize)) {
+		layer->setMapTileSize(this->tileWidth, this->tileHeight);
+	}
+	return;
+}
+
 } // namespace gamemaps
 } // namespace camoto
@@ -21,17 +21,78 @@
 #ifndef _CAMOTO_GAMEMAPS_MAP2D_GENERIC_HPP_
 #define _CAMOTO_GAMEMAPS_MAP2D_GENERIC_HPP_
 
+#include <stdint.h>
+#include <map>
+#include <vector>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/weak_ptr.hpp>
+#include <camoto/stream.hpp>
+#include <camoto/suppitem.hpp>
 #include <camoto/gamemaps/map2d.hpp>
+#include "map2d-arena.hpp"
 
 namespace camoto {
 namespace gamemaps {
 
+/// Contiguous storage for a layer made up of a fixed grid of tiles.
+/**
+ * Grid-based formats store one code per cell.  Keeping these in a flat array
+ * instead of allocating a Map2D::Layer::Item for every cell makes opening and
+ * writing these maps considerably cheaper.  Items are only created if
+ * GenericMap2D::Layer::getAllItems() is called.
+ */
+class TileGrid
+{
+	public:
+		/// Create a new grid with every cell empty.
+		/**
+		 * @param width
+		 *   Grid width, as number of tiles.
+		 *
+		 * @param height
+		 *   Grid height, as number of tiles.
+		 *
+		 * @param hasFlags
+		 *   true to allocate the flags plane, false to leave it empty.
+		 */
+		TileGrid(unsigned int width, unsigned int height, bool hasFlags = false);
+
+		/// Get the index into codes/flags for the given cell.
+		inline unsigned int index(unsigned int x, unsigned int y) const
+		{
+			return y * this->width + x;
+		}
+
+		unsigned int width;  ///< Grid width, in tiles
+		unsigned int height; ///< Grid height, in tiles
+
+		/// Tile code of each cell in row-major order, INVALID_TILECODE if empty.
+		std::vector<uint32_t> codes;
+
+		/// Optional Map2D::Layer::Item::generalFlags value for each cell.
+		/**
+		 * This vector is empty if the layer has no per-cell flags, otherwise it
+		 * is the same size as codes.
+		 */
+		std::vector<uint8_t> flags;
+};
+
+/// Shared pointer to a TileGrid.
+typedef boost::shared_ptr<TileGrid> TileGridPtr;
+
 /// 2D grid-based Map.
 class GenericMap2D: public Map2D
 {
 	public:
 		class Layer;
 
+		/// Function that decodes a layer the first time it is requested.
+		typedef boost::function<Map2D::LayerPtr ()> LayerLoader;
+
+		/// Vector of layer loaders, one entry per layer.
+		typedef std::vector<LayerLoader> LayerLoaderVector;
+
 		/// Create a new 2D map.
 		/**
 		 * @param attributes
@@ -77,6 +138,19 @@ class GenericMap2D: public Map2D
 		 * @param paths
 		 *   Possibly empty vector of map paths.
 		 *
+		 * @param arena
+		 *   Arena the items in the layers were allocated from, so it can be
+		 *   released along with the map.  If this is a null pointer a new arena
+		 *   is created, and used for any items the layers create later (e.g.
+		 *   when converting a TileGrid into items.)
+		 *
+		 * @param loaders
+		 *   Optional functions to decode layers on demand.  If not empty, this
+		 *   must be the same size as layers.  Any layer with a null pointer in
+		 *   layers is left undecoded until getLayer() is first called for it,
+		 *   at which point the loader at the same index is called to create it.
+		 *   The loader is then released, along with any data it holds.
+		 *
 		 * @note tileWidth and tileHeight should specify the smallest multiple of
 		 *   the underlying tile size, in the event a map uses different tile sizes
 		 *   between layers.  This way the level will be resized by a multiple of
@@ -95,7 +169,9 @@ class GenericMap2D: public Map2D
 			unsigned int viewportWidth, unsigned int viewportHeight,
 			unsigned int width, unsigned int height,
 			unsigned int tileWidth, unsigned int tileHeight,
-			const LayerPtrVector& layers, PathPtrVectorPtr paths);
+			const LayerPtrVector& layers, PathPtrVectorPtr paths,
+			const ItemArenaPtr& arena = ItemArenaPtr(),
+			const LayerLoaderVector& loaders = LayerLoaderVector());
 
 		/// Destructor.
 		virtual ~GenericMap2D();
@@ -111,6 +187,52 @@ class GenericMap2D: public Map2D
 			const TilesetCollectionPtr& tileset, gamegraphics::ImagePtr *outImage,
 			gamegraphics::PaletteEntry *outColour) const;
 
+		/// Content of each file as last saved by MapType::writeChanges().
+		struct SavedData {
+			boost::weak_ptr<stream::output> output; ///< Stream saved to
+			std::string main; ///< Main map file
+			std::map<SuppItem::Type, std::string> supps; ///< Supplementary files
+		};
+
+		/// Take the data last saved to a stream by MapType::writeChanges().
+		/**
+		 * The content is moved out of the map rather than copied, so the map
+		 * has no saved data until putSavedData() is called.  This way an error
+		 * part way through saving leaves nothing out of date behind.
+		 *
+		 * @param output
+		 *   Stream holding the main map file.
+		 *
+		 * @param out
+		 *   On return, the saved content if it was saved to output, otherwise
+		 *   empty.
+		 *
+		 * @return true if the map was last saved to output, false if it was
+		 *   saved elsewhere or not at all.
+		 */
+		bool takeSavedData(const stream::output_sptr& output, SavedData *out);
+
+		/// Store the content that has just been saved by MapType::writeChanges().
+		/**
+		 * @param output
+		 *   Stream holding the main map file.
+		 *
+		 * @param data
+		 *   Content now in the files.  This is moved into the map and is empty
+		 *   on return.
+		 */
+		void putSavedData(const stream::output_sptr& output, SavedData *data);
+
+		/// Forget the saved data if it was saved to the given stream.
+		/**
+		 * Called when the stream is overwritten some other way, so it no longer
+		 * matches what writeChanges() last saved there.
+		 *
+		 * @param output
+		 *   Stream that has been overwritten.
+		 */
+		void clearSavedData(const stream::output_sptr& output);
+
 	protected:
 		unsigned int viewportWidth;   ///< Width of viewport in pixels.
 		unsigned int viewportHeight;  ///< Height of viewport in pixels.
@@ -120,10 +242,31 @@ class GenericMap2D: public Map2D
 		unsigned int tileHeight;      ///< Height of tiles in all layers, in pixels.
 		LayerPtrVector layers;        ///< Map layers
 		PathPtrVectorPtr paths;       ///< Map paths
+		ItemArenaPtr arena;           ///< Memory used by the layer items
+		LayerLoaderVector loaders;    ///< Decoders for layers not yet loaded
+		boost::mutex layerLock;       ///< Serialises loading of layers
+
+		/// Pass the map tile size on to layers that don't have their own.
+		void updateLayerTileSize();
+
+		/// Prepare a layer for use in this map.
+		/**
+		 * Sets the layer's arena and tile size.  Called for each layer as it is
+		 * added to the map.
+		 *
+		 * @param layer
+		 *   Layer to prepare.  May be a null pointer.
+		 */
+		void adoptLayer(const LayerPtr& layer);
+
+	private:
+		SavedData saved;              ///< Last content saved by writeChanges()
 };
 
 class GenericMap2D::Layer: virtual public Map2D::Layer
 {
+	friend class GenericMap2D;
+
 	public:
 		/// Create a new layer.
 		/**
@@ -158,6 +301,19 @@ class GenericMap2D::Layer: virtual public Map2D::Layer
 			unsigned int height, unsigned int tileWidth, unsigned int tileHeight,
 			ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems);
 
+		/// Create a new layer backed by a dense tile grid.
+		/**
+		 * Parameters are the same as the other constructor, except that the
+		 * layer content is supplied as a TileGrid instead of a vector of items.
+		 *
+		 * @param grid
+		 *   Tile codes for every cell in the layer.  Cells set to
+		 *   INVALID_TILECODE are empty and will not appear in getAllItems().
+		 */
+		Layer(const std::string& title, int caps, unsigned int width,
+			unsigned int height, unsigned int tileWidth, unsigned int tileHeight,
+			TileGridPtr& grid, ItemPtrVectorPtr& validItems);
+
 		/// Destructor.
 		virtual ~Layer();
 
@@ -168,6 +324,14 @@ class GenericMap2D::Layer: virtual public Map2D::Layer
 		virtual void getTileSize(unsigned int *x, unsigned int *y) const;
 		virtual void setTileSize(unsigned int x, unsigned int y);
 		virtual ItemPtrVectorPtr getAllItems();
+		virtual ItemPtr getItemAt(unsigned int x, unsigned int y);
+		virtual ItemPtrVectorPtr getItemsInRect(unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height);
+		virtual ItemPtrVectorPtr getItemsInRect(unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height,
+			const TilesetCollectionPtr& tileset);
+		virtual void addItem(const ItemPtr& item);
+		virtual void moveItem(const ItemPtr& item, unsigned int x, unsigned int y);
 		virtual camoto::gamegraphics::ImagePtr imageFromCode(
 			const Map2D::Layer::ItemPtr& item,
 			const TilesetCollectionPtr& tileset) const;
@@ -175,20 +339,224 @@ class GenericMap2D::Layer: virtual public Map2D::Layer
 			unsigned int x, unsigned int y, unsigned int *maxCount) const;
 		virtual gamegraphics::PaletteTablePtr getPalette(
 			const TilesetCollectionPtr& tileset) const;
-		virtual const ItemPtrVectorPtr getValidItemList() const;
+		virtual ConstItemPtrVectorPtr getValidItemList() const;
+		virtual ItemPtrVectorPtr getEditableValidItemList();
+
+		/// Get the dense tile grid backing this layer.
+		/**
+		 * Any changes made to items returned by getItemAt() or getItemsInRect()
+		 * are copied into the grid first.
+		 *
+		 * @return The grid passed to the constructor, or a null pointer if the
+		 *   layer was created from a vector of items, or if getAllItems(),
+		 *   addItem() or moveItem() has since been called (in which case the
+		 *   items are authoritative as they may have been modified.)
+		 */
+		const TileGridPtr& getTileGrid();
+
+		/// Get the size of the largest image an item in this layer can have.
+		/**
+		 * This covers every tile code in the layer as well as every item in
+		 * getValidItemList(), so it stays correct when an item's code is
+		 * changed to one of those.  Codes changed through items handed out from
+		 * a grid are also picked up.  Finding this the first time looks up
+		 * every tile code once, after that it is cached.
+		 *
+		 * @param tileset
+		 *   Tileset to pass to imageFromCode().
+		 *
+		 * @param width
+		 *   On return, the width of the largest image in tiles, at least 1.
+		 *
+		 * @param height
+		 *   On return, the height of the largest image in tiles, at least 1.
+		 */
+		void getMaxExtent(const TilesetCollectionPtr& tileset,
+			unsigned int *width, unsigned int *height);
 
 	protected:
+		/// Set the tile size inherited from the map.
+		/**
+		 * Called by GenericMap2D for layers that do not have HasOwnTileSize, so
+		 * that item image sizes can be converted into a number of tiles.
+		 *
+		 * @param x
+		 *   Map tile width, in pixels.
+		 *
+		 * @param y
+		 *   Map tile height, in pixels.
+		 */
+		void setMapTileSize(unsigned int x, unsigned int y);
+
+		/// Index every item in the layer by location.
+		/**
+		 * The layer is divided into buckets, each covering a square of
+		 * 2^indexShift cells.  Usually this is one cell per bucket, but layers
+		 * with pixel coordinates or only a handful of items use larger buckets so
+		 * the index does not end up much bigger than the item list itself.
+		 */
+		void rebuildIndex();
+
+		/// Make sure the index is up to date, rebuilding it if necessary.
+		/**
+		 * Does nothing while the layer is held in a grid, as lookups go straight
+		 * to the grid instead.
+		 */
+		void checkIndex();
+
+		/// Add items->at(i) into the index at its current location.
+		/**
+		 * @return false if the item lies outside the index and it needs to be
+		 *   rebuilt.
+		 */
+		bool indexLink(unsigned int i);
+
+		/// Size of an item's image, in tiles.
+		struct Extent {
+			unsigned int width;  ///< Image width, in tiles
+			unsigned int height; ///< Image height, in tiles
+		};
+
+		/// Get the size of the image used by the given item.
+		/**
+		 * Sizes are cached by tile code, until a different tileset is passed in.
+		 *
+		 * @param item
+		 *   Item to look up.
+		 *
+		 * @param tileset
+		 *   Tileset to pass to imageFromCode().
+		 *
+		 * @return Image size in tiles, rounded up.  Items without an image are
+		 *   one tile in size.
+		 */
+		const Extent& getExtent(const ItemPtr& item,
+			const TilesetCollectionPtr& tileset);
+
+		/// Work out maxExtent if it is not yet known.
+		/**
+		 * @param tileset
+		 *   Tileset to pass to imageFromCode().  If this differs from the last
+		 *   call, all cached extents are discarded.
+		 */
+		void updateMaxExtent(const TilesetCollectionPtr& tileset);
+
+		/// Enlarge maxExtent if needed so it covers the given size.
+		void growMaxExtent(const Extent& e);
+
+		/// Keep maxExtent correct after a tile code is placed in the layer.
+		/**
+		 * maxExtent is enlarged if the code's size is already known, otherwise
+		 * it is reset so it will be worked out again when next needed.
+		 *
+		 * @param code
+		 *   Tile code of the new or changed item.
+		 */
+		void codeAdded(unsigned int code);
+
+		/// Create a new item from a grid cell.
+		/**
+		 * @param index
+		 *   Cell to read, as returned by TileGrid::index().
+		 */
+		ItemPtr createGridItem(unsigned int index);
+
+		/// Get the item for a grid cell, without converting the whole grid.
+		/**
+		 * The same item is returned each time the same cell is requested, and
+		 * changes made to it are copied back into the grid by syncGrid().
+		 *
+		 * @param index
+		 *   Cell to read, as returned by TileGrid::index().
+		 *
+		 * @return The cell's item, or a null pointer if the cell is empty.
+		 */
+		ItemPtr getGridItem(unsigned int index);
+
+		/// Copy any changes made to items from getGridItem() into the grid.
+		/**
+		 * If an item has been moved to a different cell, the grid is converted
+		 * into items by getAllItems() instead.  Changed codes are passed to
+		 * codeAdded().
+		 */
+		void syncGrid();
+
+		/// Get the bucket containing the given coordinates.
+		inline unsigned int indexBucket(unsigned int x, unsigned int y) const
+		{
+			return (y >> this->indexShift) * this->indexWidth
+				+ (x >> this->indexShift);
+		}
+
+
 		std::string title;       ///< Layer's friendly name
 		int caps;                ///< Map capabilities
 		unsigned int width;      ///< Map width, in tiles
 		unsigned int height;     ///< Map height, in tiles
-		unsigned int tileWidth;  ///< Tile width, in pixels
-		unsigned int tileHeight; ///< Tile height, in pixels
+		unsigned int tileWidth;  ///< Tile width, in pixels (from map if not HasOwnTileSize)
+		unsigned int tileHeight; ///< Tile height, in pixels (from map if not HasOwnTileSize)
 		ItemPtrVectorPtr items;  ///< Vector of all items in the layer
+		TileGridPtr grid;        ///< Dense tile storage, if items not yet created
+		ItemArenaPtr arena;      ///< Where to allocate items created from grid
+
+		/// Items handed out from grid cells so far, by cell index.
+		std::map<unsigned int, ItemPtr> cellItems;
+
 		gamegraphics::PaletteTablePtr pal; ///< Optional palette for layer
-		ItemPtrVectorPtr validItems; ///< Vector of possible items in the layer
+		ItemPtrVectorPtr validItems; ///< Vector of possible items, maybe shared
+
+		/// This layer's own copy of validItems, made by getEditableValidItemList().
+		ItemPtrVectorPtr ownValidItems;
+
+		unsigned int indexShift;  ///< log2 of the bucket size, in cells
+		unsigned int indexWidth;  ///< Index width, in buckets
+		unsigned int indexHeight; ///< Index height, in buckets
+
+		/// Index into items of the first (highest indexed) item in each bucket.
+		std::vector<unsigned int> indexHead;
+
+		/// Index into items of the next item in the same bucket, for each item.
+		/**
+		 * Each bucket's chain is kept in descending order, so the first match
+		 * found is the one drawn on top.  This vector is empty if the index has
+		 * not been built yet.
+		 */
+		std::vector<unsigned int> indexNext;
+
+		/// Image size of each tile code, for extentTileset.
+		std::map<unsigned int, Extent> extents;
+
+		/// Tileset the cached extents were obtained from.
+		TilesetCollectionPtr extentTileset;
+
+		/// Largest image size of any item in the layer, 0x0 if not yet known.
+		Extent maxExtent;
 };
 
+/// Get the tile codes of a grid-based layer as a TileGrid.
+/**
+ * This is used by format writers to access a layer's content without caring
+ * whether it is still held in a TileGrid or has been converted to items.
+ *
+ * @param layer
+ *   Layer to read.
+ *
+ * @param width
+ *   Expected layer width, as number of tiles.
+ *
+ * @param height
+ *   Expected layer height, as number of tiles.
+ *
+ * @return The layer's own TileGrid if it still has one, otherwise a new grid
+ *   populated from getAllItems().  Cells with no item are INVALID_TILECODE.
+ *   The returned grid must not be modified.
+ *
+ * @throw stream::error
+ *   An item lies outside the given dimensions.
+ */
+TileGridPtr getTileGrid(const Map2D::LayerPtr& layer, unsigned int width,
+	unsigned int height);
+
 } // namespace gamemaps
 } // namespace camoto
 
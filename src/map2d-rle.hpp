@@ -0,0 +1,186 @@
+/**
+ * @file  map2d-rle.hpp
+ * @brief Run-length encoding shared by the map formats.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_MAP2D_RLE_HPP_
+#define _CAMOTO_GAMEMAPS_MAP2D_RLE_HPP_
+
+#include <stdint.h>
+#include <vector>
+
+namespace camoto {
+namespace gamemaps {
+
+/// Count the bytes at the start of a buffer that are the same as the first.
+/**
+ * This uses SSE2 to compare 16 bytes at a time when the library is compiled
+ * for a CPU that has it, which includes every x86-64 CPU.  Blocks of 32 bytes
+ * are compared with AVX2 instead if configure was run with --enable-avx2.
+ *
+ * @param data
+ *   Data to check.
+ *
+ * @param len
+ *   Number of bytes in data.  Must be at least 1.
+ *
+ * @return Length of the run at the start of data, between 1 and len.
+ */
+unsigned int rleCountSame(const uint8_t *data, unsigned int len);
+
+/// Count the bytes at the start of a buffer that differ from the next byte.
+/**
+ * This is the length of the block of bytes that cannot be written as a run,
+ * up to where the next run of two or more bytes begins.  The last byte has
+ * no following byte, so it is never counted.
+ *
+ * This uses SSE2 or AVX2 in the same way as rleCountSame().
+ *
+ * @param data
+ *   Data to check.
+ *
+ * @param len
+ *   Number of bytes in data.  Must be at least 1.
+ *
+ * @return Offset of the first byte that is the same as the byte after it, or
+ *   len - 1 if there is no such byte.
+ */
+unsigned int rleCountDiff(const uint8_t *data, unsigned int len);
+
+/// A run-length encoding used by one or more file formats.
+/**
+ * Each encoding works on whole buffers in memory.  The formats create a
+ * static instance of the one they use.
+ */
+class RLECodec
+{
+	public:
+		virtual ~RLECodec();
+
+		/// Compress a block of data.
+		/**
+		 * @param data
+		 *   Data to compress.
+		 *
+		 * @param len
+		 *   Number of bytes in data.  Must be at least 1.
+		 *
+		 * @param out
+		 *   Compressed data is appended to the end of this vector.
+		 */
+		virtual void encode(const uint8_t *data, unsigned int len,
+			std::vector<uint8_t> *out) const = 0;
+
+		/// Expand compressed data.
+		/**
+		 * Decoding stops once the output buffer is full or the input runs out,
+		 * whichever happens first.  Runs that would go past the end of the
+		 * output are cut short.
+		 *
+		 * @param in
+		 *   Compressed data.
+		 *
+		 * @param lenIn
+		 *   Number of bytes in in.
+		 *
+		 * @param out
+		 *   Buffer to receive the expanded data.
+		 *
+		 * @param lenOut
+		 *   Size of the output buffer, in bytes.
+		 *
+		 * @param lenWritten
+		 *   On return, the number of bytes written to out.  This is less than
+		 *   lenOut if the input ran out first.
+		 *
+		 * @return Number of bytes of input used.  Any after this belong to
+		 *   whatever follows the compressed data.
+		 */
+		virtual unsigned int decode(const uint8_t *in, unsigned int lenIn,
+			uint8_t *out, unsigned int lenOut, unsigned int *lenWritten) const = 0;
+};
+
+/// Every run is written as a count byte then the value byte.
+/**
+ * Bytes that do not repeat are written as a run of one.  Used by Word Rescue.
+ */
+class RLECodec_CountValue: virtual public RLECodec
+{
+	public:
+		/// Set up the encoding.
+		/**
+		 * @param maxRun
+		 *   Longest run that can be written with one count, at most 255.
+		 *   Longer runs are split.
+		 */
+		RLECodec_CountValue(unsigned int maxRun);
+
+		virtual void encode(const uint8_t *data, unsigned int len,
+			std::vector<uint8_t> *out) const;
+		virtual unsigned int decode(const uint8_t *in, unsigned int lenIn,
+			uint8_t *out, unsigned int lenOut, unsigned int *lenWritten) const;
+
+	protected:
+		unsigned int maxRun; ///< Longest run in one count/value pair
+};
+
+/// Runs and blocks of differing bytes, told apart by the sign of the count.
+/**
+ * A count byte below 0x80 is followed by one value byte, which is repeated
+ * count times.  A count byte of 0x80 or more is followed by 0x100 - count
+ * bytes which are copied as-is.  Used by Duke Nukem II.
+ *
+ * The options cover the quirks of the existing encoders, which must be kept
+ * so files are written exactly as they were before.
+ */
+class RLECodec_Signed: virtual public RLECodec
+{
+	public:
+		/// Set up the encoding.
+		/**
+		 * @param maxLiteral
+		 *   Longest block of differing bytes to write with one count, at most
+		 *   0x80.
+		 *
+		 * @param maxLastLiteral
+		 *   Same as maxLiteral, but used instead for the block just before
+		 *   the final byte when that byte is not part of a run.
+		 *
+		 * @param omitTrailing
+		 *   If the data ends in a run of this byte value, the run is not
+		 *   written because the reader fills with this value anyway.  Set to
+		 *   -1 to always write the final run.
+		 */
+		RLECodec_Signed(unsigned int maxLiteral, unsigned int maxLastLiteral,
+			int omitTrailing);
+
+		virtual void encode(const uint8_t *data, unsigned int len,
+			std::vector<uint8_t> *out) const;
+		virtual unsigned int decode(const uint8_t *in, unsigned int lenIn,
+			uint8_t *out, unsigned int lenOut, unsigned int *lenWritten) const;
+
+	protected:
+		unsigned int maxLiteral;     ///< Longest block of differing bytes
+		unsigned int maxLastLiteral; ///< Same, before a final lone byte
+		int omitTrailing;            ///< Value of a final run to leave out, or -1
+};
+
+} // namespace gamemaps
+} // namespace camoto
+
+#endif // _CAMOTO_GAMEMAPS_MAP2D_RLE_HPP_
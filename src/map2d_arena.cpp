@@ -0,0 +1,83 @@
+/**
+ * @file  map2d_arena.cpp
+ * @brief Memory arena for allocating the items in a map.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/make_shared.hpp>
+#include "map2d-arena.hpp"
+
+/// Size of each block allocated by the arena, in bytes.
+#define ARENA_BLOCK_SIZE 65536
+
+/// Alignment of each allocation, in bytes.
+#define ARENA_ALIGN 16
+
+namespace camoto {
+namespace gamemaps {
+
+ItemArena::ItemArena()
+	:	next(NULL),
+		remaining(0)
+{
+}
+
+ItemArena::~ItemArena()
+{
+	for (std::vector<uint8_t *>::iterator i = this->blocks.begin();
+		i != this->blocks.end();
+		i++
+	) {
+		delete[] *i;
+	}
+}
+
+void *ItemArena::allocate(std::size_t len)
+{
+	len = (len + ARENA_ALIGN - 1) & ~(std::size_t)(ARENA_ALIGN - 1);
+
+	boost::mutex::scoped_lock guard(this->lock);
+
+	if (len > this->remaining) {
+		if (len > ARENA_BLOCK_SIZE / 4) {
+			// Large allocation, give it a block of its own so we don't waste the
+			// rest of the current block.
+			uint8_t *block = new uint8_t[len];
+			this->blocks.push_back(block);
+			intrusive_ptr_add_ref(this);
+			return block;
+		}
+		this->next = new uint8_t[ARENA_BLOCK_SIZE];
+		this->blocks.push_back(this->next);
+		this->remaining = ARENA_BLOCK_SIZE;
+	}
+
+	void *p = this->next;
+	this->next += len;
+	this->remaining -= len;
+	intrusive_ptr_add_ref(this);
+	return p;
+}
+
+Map2D::Layer::ItemPtr createItem(const ItemArenaPtr& arena)
+{
+	return boost::allocate_shared<Map2D::Layer::Item>(
+		ArenaAllocator<Map2D::Layer::Item>(arena));
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,293 @@
+/**
+ * @file  map2d_blit.cpp
+ * @brief Copy tile images into a framebuffer.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include "map2d-blit.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+/// Mask bit for each of eight pixels, leftmost first, as bytes in memory order.
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define BLIT_MASK_BITS 0x8040201008040201ULL
+#else
+#define BLIT_MASK_BITS 0x0102040810204080ULL
+#endif
+
+/// Value with every byte set to 0x01.
+#define BLIT_BYTES_01 0x0101010101010101ULL
+
+/// Value with every byte set to 0x7F.
+#define BLIT_BYTES_7F 0x7F7F7F7F7F7F7F7FULL
+
+/// Value with every byte set to 0x80.
+#define BLIT_BYTES_80 0x8080808080808080ULL
+
+/// Expand one mask byte into 0xFF for each opaque pixel, in memory order.
+static inline uint64_t expandMask8(uint8_t mask)
+{
+	// Pick out a different bit in each byte, then turn any set bit into 0x80
+	// by adding 0x7F, which can never carry into the next byte.
+	uint64_t bits = ((mask * BLIT_BYTES_01) & BLIT_MASK_BITS) + BLIT_BYTES_7F;
+	return ((bits & BLIT_BYTES_80) >> 7) * 0xFF;
+}
+
+/// Add the same value to eight bytes at once, without carrying between them.
+static inline uint64_t addBytes8(uint64_t a, uint64_t b)
+{
+	return ((a & BLIT_BYTES_7F) + (b & BLIT_BYTES_7F)) ^ ((a ^ b) & BLIT_BYTES_80);
+}
+
+/// Draw eight pixels that share one mask byte, without SIMD instructions.
+template <BlitMode mode>
+static inline void blitGroup8(uint8_t *dst, const uint8_t *pixels,
+	uint8_t mask, uint64_t offset)
+{
+	if (mode != BlitOpaque) {
+		if (mask == 0x00) {
+			if (mode == BlitClear) memset(dst, 0, 8);
+			return;
+		}
+	}
+	uint64_t src;
+	memcpy(&src, pixels, 8);
+	src = addBytes8(src, offset);
+	if ((mode != BlitOpaque) && (mask != 0xFF)) {
+		uint64_t m = expandMask8(mask);
+		if (mode == BlitMasked) {
+			uint64_t old;
+			memcpy(&old, dst, 8);
+			src = (src & m) | (old & ~m);
+		} else {
+			src &= m;
+		}
+	}
+	memcpy(dst, &src, 8);
+	return;
+}
+
+#if defined(__SSE2__)
+
+/// Expand the first two bytes of a mask row into 0xFF per opaque pixel.
+static inline __m128i expandMask16(const uint8_t *mask)
+{
+	// Copy byte 0 into the first eight lanes and byte 1 into the next eight
+	__m128i m = _mm_cvtsi32_si128(mask[0] | (mask[1] << 8));
+	m = _mm_unpacklo_epi8(m, m);
+	m = _mm_unpacklo_epi16(m, m);
+	m = _mm_unpacklo_epi32(m, m);
+	const __m128i bits = _mm_set1_epi64x((int64_t)BLIT_MASK_BITS);
+	return _mm_cmpeq_epi8(_mm_and_si128(m, bits), bits);
+}
+
+/// Combine 16 tile pixels with the framebuffer.
+template <BlitMode mode>
+static inline __m128i blend16(__m128i src, __m128i dst, __m128i mask)
+{
+	switch (mode) {
+		case BlitMasked:
+			return _mm_or_si128(_mm_and_si128(mask, src), _mm_andnot_si128(mask, dst));
+		case BlitClear:
+			return _mm_and_si128(mask, src);
+		case BlitOpaque:
+			break;
+	}
+	return src;
+}
+
+/// Draw one row of a tile 8 pixels wide.
+template <BlitMode mode>
+static inline void blitRow8(uint8_t *dst, const uint8_t *pixels,
+	const uint8_t *mask, __m128i offset)
+{
+	__m128i src = _mm_add_epi8(
+		_mm_loadl_epi64((const __m128i *)pixels), offset);
+	__m128i out = src;
+	if (mode != BlitOpaque) {
+		__m128i m = _mm_cvtsi32_si128(mask[0]);
+		m = _mm_unpacklo_epi8(m, m);
+		m = _mm_unpacklo_epi16(m, m);
+		m = _mm_unpacklo_epi32(m, m);
+		const __m128i bits = _mm_set1_epi64x((int64_t)BLIT_MASK_BITS);
+		m = _mm_cmpeq_epi8(_mm_and_si128(m, bits), bits);
+		out = blend16<mode>(src, _mm_loadl_epi64((const __m128i *)dst), m);
+	}
+	_mm_storel_epi64((__m128i *)dst, out);
+	return;
+}
+
+/// Draw one row of a tile 16 pixels wide.
+template <BlitMode mode>
+static inline void blitRow16(uint8_t *dst, const uint8_t *pixels,
+	const uint8_t *mask, __m128i offset)
+{
+	__m128i src = _mm_add_epi8(
+		_mm_loadu_si128((const __m128i *)pixels), offset);
+	__m128i out = src;
+	if (mode != BlitOpaque) {
+		out = blend16<mode>(src, _mm_loadu_si128((const __m128i *)dst),
+			expandMask16(mask));
+	}
+	_mm_storeu_si128((__m128i *)dst, out);
+	return;
+}
+
+/// Draw one row of a tile 32 pixels wide.
+template <BlitMode mode>
+static inline void blitRow32(uint8_t *dst, const uint8_t *pixels,
+	const uint8_t *mask, __m128i offset)
+{
+#if defined(__AVX2__)
+	__m256i src = _mm256_add_epi8(
+		_mm256_loadu_si256((const __m256i *)pixels),
+		_mm256_broadcastsi128_si256(offset));
+	if (mode != BlitOpaque) {
+		// Copy each of the four mask bytes into eight lanes
+		uint32_t maskBytes;
+		memcpy(&maskBytes, mask, 4);
+		__m256i m = _mm256_shuffle_epi8(_mm256_set1_epi32(maskBytes),
+			_mm256_set_epi64x(0x0303030303030303LL, 0x0202020202020202LL,
+				0x0101010101010101LL, 0));
+		const __m256i bits = _mm256_set1_epi64x((int64_t)BLIT_MASK_BITS);
+		m = _mm256_cmpeq_epi8(_mm256_and_si256(m, bits), bits);
+		if (mode == BlitMasked) {
+			src = _mm256_blendv_epi8(
+				_mm256_loadu_si256((const __m256i *)dst), src, m);
+		} else {
+			src = _mm256_and_si256(src, m);
+		}
+	}
+	_mm256_storeu_si256((__m256i *)dst, src);
+#else
+	blitRow16<mode>(dst, pixels, mask, offset);
+	blitRow16<mode>(dst + 16, pixels + 16, mask + 2, offset);
+#endif
+	return;
+}
+#endif // __SSE2__
+
+/// Draw one pixel of a tile.
+template <BlitMode mode>
+static inline void blitPixel(uint8_t *dst, const uint8_t *pixels,
+	const uint8_t *mask, unsigned int tX, uint8_t colourOffset)
+{
+	if ((mode == BlitOpaque) || (mask[tX >> 3] & (0x80 >> (tX & 7)))) {
+		*dst = pixels[tX] + colourOffset;
+	} else if (mode == BlitClear) {
+		*dst = 0;
+	}
+	return;
+}
+
+/// Draw the visible part of a tile, with the mode known at compile time.
+template <BlitMode mode>
+static void blitRows(uint8_t *dst, unsigned int dstStride,
+	const uint8_t *pixels, const uint8_t *mask, unsigned int tileWidth,
+	unsigned int srcX, unsigned int width, unsigned int height,
+	uint8_t colourOffset)
+{
+	unsigned int maskStride = (tileWidth + 7) / 8;
+#if defined(__SSE2__)
+	if ((srcX == 0) && (width == tileWidth)) {
+		__m128i offset = _mm_set1_epi8(colourOffset);
+		switch (width) {
+			case 8:
+				for (unsigned int y = 0; y < height; y++) {
+					blitRow8<mode>(dst, pixels, mask, offset);
+					dst += dstStride;
+					pixels += 8;
+					mask += 1;
+				}
+				return;
+			case 16:
+				for (unsigned int y = 0; y < height; y++) {
+					blitRow16<mode>(dst, pixels, mask, offset);
+					dst += dstStride;
+					pixels += 16;
+					mask += 2;
+				}
+				return;
+			case 32:
+				for (unsigned int y = 0; y < height; y++) {
+					blitRow32<mode>(dst, pixels, mask, offset);
+					dst += dstStride;
+					pixels += 32;
+					mask += 4;
+				}
+				return;
+		}
+	}
+#endif
+	// Pixels before the first whole mask byte, and the whole bytes after that
+	unsigned int lead = std::min((8 - (srcX & 7)) & 7, width);
+	unsigned int groups = (width - lead) / 8;
+	uint64_t offset = colourOffset * BLIT_BYTES_01;
+	for (unsigned int y = 0; y < height; y++) {
+		unsigned int x = 0;
+		for (; x < lead; x++) {
+			blitPixel<mode>(dst + x, pixels, mask, srcX + x, colourOffset);
+		}
+		for (unsigned int g = 0; g < groups; g++, x += 8) {
+			unsigned int tX = srcX + x;
+			blitGroup8<mode>(dst + x, pixels + tX, mask[tX >> 3], offset);
+		}
+		for (; x < width; x++) {
+			blitPixel<mode>(dst + x, pixels, mask, srcX + x, colourOffset);
+		}
+		dst += dstStride;
+		pixels += tileWidth;
+		mask += maskStride;
+	}
+	return;
+}
+
+void blitTile(uint8_t *dst, unsigned int dstStride, const uint8_t *pixels,
+	const uint8_t *mask, unsigned int tileWidth, unsigned int srcX,
+	unsigned int srcY, unsigned int width, unsigned int height,
+	uint8_t colourOffset, BlitMode mode)
+{
+	pixels += srcY * tileWidth;
+	mask += srcY * ((tileWidth + 7) / 8);
+	switch (mode) {
+		case BlitMasked:
+			blitRows<BlitMasked>(dst, dstStride, pixels, mask, tileWidth, srcX,
+				width, height, colourOffset);
+			break;
+		case BlitClear:
+			blitRows<BlitClear>(dst, dstStride, pixels, mask, tileWidth, srcX,
+				width, height, colourOffset);
+			break;
+		case BlitOpaque:
+			blitRows<BlitOpaque>(dst, dstStride, pixels, mask, tileWidth, srcX,
+				width, height, colourOffset);
+			break;
+	}
+	return;
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,252 @@
+/**
+ * @file  map2d_decode.cpp
+ * @brief Helper functions for reading whole layers at once.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <vector>
+#include <camoto/gamemaps/input_mmap.hpp>
+#include "map2d-decode.hpp"
+
+/// Number of cells along each side of the blocks transposed at a time.
+#define TRANSPOSE_BLOCK 16u
+
+namespace camoto {
+namespace gamemaps {
+
+/// Get the next block of data straight out of memory, if possible.
+/**
+ * If the stream already holds the whole file in memory, the block is used
+ * where it is rather than being copied out with read().
+ *
+ * @param input
+ *   Stream to read from.  If a pointer is returned, the read position is
+ *   moved past the block.
+ *
+ * @param len
+ *   Size of the block, in bytes.
+ *
+ * @return Pointer to the block, or NULL if the caller should read() it
+ *   instead.
+ */
+static const uint8_t *directBlock(stream::input_sptr& input, stream::len len)
+{
+	input_mmap *mem = dynamic_cast<input_mmap *>(input.get());
+	if (!mem) return NULL;
+
+	stream::pos off = mem->tellg();
+	// If the block is cut off, leave it to read() to report the error
+	if (off + len > mem->size()) return NULL;
+
+	mem->seekg(len, stream::cur);
+	return mem->data() + off;
+}
+
+RawBlockPtr readRawBlock(stream::input_sptr input, stream::len len)
+{
+	RawBlockPtr block(new std::vector<uint8_t>(len));
+	if (len == 0) return block;
+
+	const uint8_t *raw = directBlock(input, len);
+	if (raw) {
+		memcpy(&block->at(0), raw, len);
+	} else {
+		input->read(&block->at(0), len);
+	}
+	return block;
+}
+
+bool clipRegion(MapRegion *region, unsigned int mapWidth,
+	unsigned int mapHeight)
+{
+	if ((region->x >= mapWidth) || (region->y >= mapHeight)) {
+		region->width = 0;
+		region->height = 0;
+		return false;
+	}
+	region->width = std::min(region->width, mapWidth - region->x);
+	region->height = std::min(region->height, mapHeight - region->y);
+	return (region->width > 0) && (region->height > 0);
+}
+
+RawBlockPtr readGridRegion(stream::input_sptr input, stream::pos offset,
+	unsigned int rowLen, unsigned int cellSize,
+	unsigned int firstRow, unsigned int numRows,
+	unsigned int firstCell, unsigned int numCells)
+{
+	assert(firstCell + numCells <= rowLen);
+
+	stream::len lenRow = numCells * cellSize;
+	input->seekg(offset + (firstRow * rowLen + firstCell) * cellSize,
+		stream::start);
+	if (numCells == rowLen) {
+		// Whole rows are contiguous so they can be read in one go
+		return readRawBlock(input, lenRow * numRows);
+	}
+
+	RawBlockPtr block(new std::vector<uint8_t>(lenRow * numRows));
+	if (block->empty()) return block;
+
+	stream::delta skip = (rowLen - numCells) * cellSize;
+	for (unsigned int r = 0; r < numRows; r++) {
+		if (r > 0) input->seekg(skip, stream::cur);
+		uint8_t *dest = &block->at(r * lenRow);
+		const uint8_t *raw = directBlock(input, lenRow);
+		if (raw) {
+			memcpy(dest, raw, lenRow);
+		} else {
+			input->read(dest, lenRow);
+		}
+	}
+	return block;
+}
+
+void readBlock16le(stream::input_sptr input, uint16_t *dest, unsigned int count)
+{
+	if (count == 0) return;
+
+	const uint8_t *raw = directBlock(input, count * 2);
+	if (!raw) {
+		// Read the raw bytes into the destination, then convert them in place.
+		// Each value only overwrites the two bytes it was decoded from.
+		input->read((uint8_t *)dest, count * 2);
+		raw = (const uint8_t *)dest;
+	}
+	for (unsigned int i = 0; i < count; i++) {
+		dest[i] = raw[i * 2] | (raw[i * 2 + 1] << 8);
+	}
+	return;
+}
+
+void readGrid8(stream::input_sptr input, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode)
+{
+	assert(count <= grid->codes.size());
+	if (count == 0) return;
+
+	std::vector<uint8_t> buffer;
+	const uint8_t *raw = directBlock(input, count);
+	if (!raw) {
+		buffer.resize(count);
+		input->read(&buffer[0], count);
+		raw = &buffer[0];
+	}
+	decodeGrid8(raw, grid, count, emptyCode);
+	return;
+}
+
+void readGrid16le(stream::input_sptr input, TileGrid *grid,
+	unsigned int count, unsigned int emptyCode)
+{
+	assert(count <= grid->codes.size());
+	if (count == 0) return;
+
+	std::vector<uint8_t> buffer;
+	const uint8_t *raw = directBlock(input, count * 2);
+	if (!raw) {
+		buffer.resize(count * 2);
+		input->read(&buffer[0], count * 2);
+		raw = &buffer[0];
+	}
+	decodeGrid16le(raw, grid, count, emptyCode);
+	return;
+}
+
+void decodeGrid8(const uint8_t *raw, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode)
+{
+	assert(count <= grid->codes.size());
+	if (count == 0) return;
+
+	uint32_t *codes = &grid->codes[0];
+	for (unsigned int i = 0; i < count; i++) {
+		uint32_t code = raw[i];
+		codes[i] = (code == emptyCode) ? INVALID_TILECODE : code;
+	}
+	return;
+}
+
+void decodeGrid16le(const uint8_t *raw, TileGrid *grid, unsigned int count,
+	unsigned int emptyCode)
+{
+	assert(count <= grid->codes.size());
+	if (count == 0) return;
+
+	uint32_t *codes = &grid->codes[0];
+	for (unsigned int i = 0; i < count; i++) {
+		uint32_t code = raw[i * 2] | (raw[i * 2 + 1] << 8);
+		codes[i] = (code == emptyCode) ? INVALID_TILECODE : code;
+	}
+	return;
+}
+
+void decodeGridColumns16le(const uint8_t *raw, TileGrid *grid,
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+	unsigned int emptyCode)
+{
+	assert(x + width <= grid->width);
+	assert(y + height <= grid->height);
+
+	// Each block reads a few bytes from TRANSPOSE_BLOCK columns and writes a
+	// few cells to TRANSPOSE_BLOCK rows, so both fit in the cache at once.
+	for (unsigned int bx = 0; bx < width; bx += TRANSPOSE_BLOCK) {
+		unsigned int ex = std::min(bx + TRANSPOSE_BLOCK, width);
+		for (unsigned int by = 0; by < height; by += TRANSPOSE_BLOCK) {
+			unsigned int ey = std::min(by + TRANSPOSE_BLOCK, height);
+			for (unsigned int ty = by; ty < ey; ty++) {
+				uint32_t *row = &grid->codes[grid->index(x, y + ty)];
+				const uint8_t *cell = raw + (bx * height + ty) * 2;
+				for (unsigned int tx = bx; tx < ex; tx++) {
+					uint32_t code = cell[0] | (cell[1] << 8);
+					row[tx] = (code == emptyCode) ? INVALID_TILECODE : code;
+					cell += height * 2;
+				}
+			}
+		}
+	}
+	return;
+}
+
+void encodeGridColumns16le(const TileGrid& grid, uint8_t *raw,
+	unsigned int emptyCode)
+{
+	unsigned int width = grid.width, height = grid.height;
+	for (unsigned int by = 0; by < height; by += TRANSPOSE_BLOCK) {
+		unsigned int ey = std::min(by + TRANSPOSE_BLOCK, height);
+		for (unsigned int bx = 0; bx < width; bx += TRANSPOSE_BLOCK) {
+			unsigned int ex = std::min(bx + TRANSPOSE_BLOCK, width);
+			for (unsigned int ty = by; ty < ey; ty++) {
+				const uint32_t *row = &grid.codes[grid.index(0, ty)];
+				uint8_t *cell = raw + (bx * height + ty) * 2;
+				for (unsigned int tx = bx; tx < ex; tx++) {
+					uint32_t code = row[tx];
+					if (code == INVALID_TILECODE) code = emptyCode;
+					cell[0] = code & 0xFF;
+					cell[1] = (code >> 8) & 0xFF;
+					cell += height * 2;
+				}
+			}
+		}
+	}
+	return;
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,136 @@
+/**
+ * @file  map2d_item.cpp
+ * @brief Item within a layer of a 2D grid-based map.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <camoto/gamemaps/map2d.hpp>
+
+namespace camoto {
+namespace gamemaps {
+
+/// Fields only needed by items other than plain tiles.
+struct Map2D::Layer::Item::Extra
+{
+	/// Create with all fields zeroed.
+	Extra()
+		:	player(),
+			text(),
+			movement(),
+			blocking()
+	{
+	}
+
+	PlayerInfo player;     ///< Fields for Item::Player
+	TextInfo text;         ///< Fields for Item::Text
+	MovementInfo movement; ///< Fields for Item::Movement
+	BlockingInfo blocking; ///< Fields for Item::Blocking
+};
+
+const Map2D::Layer::Item::Extra Map2D::Layer::Item::emptyExtra;
+
+Map2D::Layer::Item::Item()
+	:	type(Default),
+		x(0),
+		y(0),
+		code(0),
+		generalFlags((GeneralFlags)0),
+		extra(NULL)
+{
+}
+
+Map2D::Layer::Item::Item(const Item& other)
+	:	type(other.type),
+		x(other.x),
+		y(other.y),
+		code(other.code),
+		generalFlags(other.generalFlags),
+		extra(other.extra ? new Extra(*other.extra) : NULL)
+{
+}
+
+Map2D::Layer::Item::~Item()
+{
+	delete this->extra;
+}
+
+Map2D::Layer::Item& Map2D::Layer::Item::operator=(const Item& other)
+{
+	if (this == &other) return *this;
+
+	this->type = other.type;
+	this->x = other.x;
+	this->y = other.y;
+	this->code = other.code;
+	this->generalFlags = other.generalFlags;
+	if (other.extra) {
+		this->getExtra() = *other.extra;
+	} else {
+		delete this->extra;
+		this->extra = NULL;
+	}
+	return *this;
+}
+
+Map2D::Layer::Item::PlayerInfo& Map2D::Layer::Item::player()
+{
+	return this->getExtra().player;
+}
+
+const Map2D::Layer::Item::PlayerInfo& Map2D::Layer::Item::player() const
+{
+	return this->extra ? this->extra->player : emptyExtra.player;
+}
+
+Map2D::Layer::Item::TextInfo& Map2D::Layer::Item::text()
+{
+	return this->getExtra().text;
+}
+
+const Map2D::Layer::Item::TextInfo& Map2D::Layer::Item::text() const
+{
+	return this->extra ? this->extra->text : emptyExtra.text;
+}
+
+Map2D::Layer::Item::MovementInfo& Map2D::Layer::Item::movement()
+{
+	return this->getExtra().movement;
+}
+
+const Map2D::Layer::Item::MovementInfo& Map2D::Layer::Item::movement() const
+{
+	return this->extra ? this->extra->movement : emptyExtra.movement;
+}
+
+Map2D::Layer::Item::BlockingInfo& Map2D::Layer::Item::blocking()
+{
+	return this->getExtra().blocking;
+}
+
+const Map2D::Layer::Item::BlockingInfo& Map2D::Layer::Item::blocking() const
+{
+	return this->extra ? this->extra->blocking : emptyExtra.blocking;
+}
+
+Map2D::Layer::Item::Extra& Map2D::Layer::Item::getExtra()
+{
+	if (!this->extra) this->extra = new Extra();
+	return *this->extra;
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -18,11 +18,28 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
+#include <camoto/stream.hpp>
 #include "map2d-generic.hpp"
 
+/// Value in GenericMap2D::Layer::indexHead/indexNext marking the end of a chain
+#define INDEX_END ((unsigned int)-1)
+
+/// Smallest number of buckets the item index is allowed to shrink down to
+#define INDEX_MIN_BUCKETS 4096
+
 namespace camoto {
 namespace gamemaps {
 
+TileGrid::TileGrid(unsigned int width, unsigned int height, bool hasFlags)
+	:	width(width),
+		height(height),
+		codes(width * height, INVALID_TILECODE)
+{
+	if (hasFlags) this->flags.resize(width * height, 0);
+}
+
+
 GenericMap2D::Layer::Layer(const std::string& title, int caps, unsigned int width,
 	unsigned int height, unsigned int tileWidth, unsigned int tileHeight,
 	ItemPtrVectorPtr& items, ItemPtrVectorPtr& validItems)
@@ -31,8 +48,28 @@ GenericMap2D::Layer::Layer(const std::string& title, int caps, unsigned int widt
 		width(width), height(height),
 		tileWidth(tileWidth), tileHeight(tileHeight),
 		items(items),
-		validItems(validItems)
+		validItems(validItems),
+		indexShift(0),
+		indexWidth(0),
+		indexHeight(0)
+{
+	this->maxExtent.width = this->maxExtent.height = 0;
+}
+
+GenericMap2D::Layer::Layer(const std::string& title, int caps, unsigned int width,
+	unsigned int height, unsigned int tileWidth, unsigned int tileHeight,
+	TileGridPtr& grid, ItemPtrVectorPtr& validItems)
+	:	title(title),
+		caps(caps),
+		width(width), height(height),
+		tileWidth(tileWidth), tileHeight(tileHeight),
+		grid(grid),
+		validItems(validItems),
+		indexShift(0),
+		indexWidth(0),
+		indexHeight(0)
 {
+	this->maxExtent.width = this->maxExtent.height = 0;
 }
 
 GenericMap2D::Layer::~Layer()
@@ -82,14 +119,221 @@ void GenericMap2D::Layer::setTileSize(unsigned int x, unsigned int y)
 
 	this->tileWidth = x;
 	this->tileHeight = y;
+
+	// Image sizes in tiles will be different now
+	this->extents.clear();
+	this->maxExtent.width = this->maxExtent.height = 0;
 	return;
 }
 
 Map2D::Layer::ItemPtrVectorPtr GenericMap2D::Layer::getAllItems()
 {
+	if (this->grid) {
+		// Convert the grid into items.  From now on the items are authoritative,
+		// since the caller is free to modify them.  Items already handed out by
+		// getItemAt() are kept, so the caller's pointers stay part of the layer.
+		const TileGrid& g = *this->grid;
+		ItemPtrVectorPtr gridItems(new ItemPtrVector());
+		std::map<unsigned int, ItemPtr>::const_iterator
+			cell = this->cellItems.begin();
+		for (unsigned int i = 0; i < g.codes.size(); i++) {
+			if ((cell != this->cellItems.end()) && (cell->first == i)) {
+				gridItems->push_back(cell->second);
+				cell++;
+				continue;
+			}
+			if (g.codes[i] == INVALID_TILECODE) continue;
+			gridItems->push_back(this->createGridItem(i));
+		}
+		this->items = gridItems;
+		this->grid.reset();
+		this->cellItems.clear();
+	}
 	return this->items;
 }
 
+Map2D::Layer::ItemPtr GenericMap2D::Layer::getItemAt(unsigned int x,
+	unsigned int y)
+{
+	if (this->grid) {
+		if ((x >= this->grid->width) || (y >= this->grid->height)) {
+			return ItemPtr();
+		}
+		return this->getGridItem(this->grid->index(x, y));
+	}
+
+	this->checkIndex();
+	if (
+		((x >> this->indexShift) >= this->indexWidth)
+		|| ((y >> this->indexShift) >= this->indexHeight)
+	) {
+		return ItemPtr();
+	}
+	const ItemPtrVector& all = *this->items;
+	for (unsigned int i = this->indexHead[this->indexBucket(x, y)];
+		i != INDEX_END;
+		i = this->indexNext[i]
+	) {
+		if ((all[i]->x == x) && (all[i]->y == y)) return all[i];
+	}
+	return ItemPtr();
+}
+
+Map2D::Layer::ItemPtrVectorPtr GenericMap2D::Layer::getItemsInRect(
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	ItemPtrVectorPtr found(new ItemPtrVector());
+	if ((width == 0) || (height == 0)) return found;
+
+	// Last cell inside the area, clamped in case it would wrap around
+	unsigned int x2 = x + width - 1;
+	if (x2 < x) x2 = INDEX_END;
+	unsigned int y2 = y + height - 1;
+	if (y2 < y) y2 = INDEX_END;
+
+	if (this->grid) {
+		// Visit the cells in row order, which is the order getAllItems() uses
+		const TileGrid& g = *this->grid;
+		if ((x >= g.width) || (y >= g.height)) return found;
+		x2 = std::min(x2, g.width - 1);
+		y2 = std::min(y2, g.height - 1);
+		for (unsigned int cy = y; cy <= y2; cy++) {
+			for (unsigned int cx = x; cx <= x2; cx++) {
+				ItemPtr item = this->getGridItem(g.index(cx, cy));
+				if (item) found->push_back(item);
+			}
+		}
+		return found;
+	}
+
+	this->checkIndex();
+	unsigned int bx1 = x >> this->indexShift;
+	unsigned int by1 = y >> this->indexShift;
+	if ((bx1 >= this->indexWidth) || (by1 >= this->indexHeight)) return found;
+	unsigned int bx2 = std::min(x2 >> this->indexShift, this->indexWidth - 1);
+	unsigned int by2 = std::min(y2 >> this->indexShift, this->indexHeight - 1);
+
+	const ItemPtrVector& all = *this->items;
+	std::vector<unsigned int> matches;
+	for (unsigned int by = by1; by <= by2; by++) {
+		for (unsigned int bx = bx1; bx <= bx2; bx++) {
+			for (unsigned int i = this->indexHead[by * this->indexWidth + bx];
+				i != INDEX_END;
+				i = this->indexNext[i]
+			) {
+				const Item& item = *all[i];
+				if (
+					(item.x >= x) && (item.x <= x2)
+					&& (item.y >= y) && (item.y <= y2)
+				) {
+					matches.push_back(i);
+				}
+			}
+		}
+	}
+
+	// Buckets are visited out of order, so put the items back in layer order
+	std::sort(matches.begin(), matches.end());
+	found->reserve(matches.size());
+	for (std::vector<unsigned int>::const_iterator i = matches.begin();
+		i != matches.end();
+		i++
+	) {
+		found->push_back(all[*i]);
+	}
+	return found;
+}
+
+Map2D::Layer::ItemPtrVectorPtr GenericMap2D::Layer::getItemsInRect(
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height,
+	const TilesetCollectionPtr& tileset)
+{
+	if ((width == 0) || (height == 0)) return ItemPtrVectorPtr(new ItemPtrVector());
+	this->syncGrid();
+	this->checkIndex();
+	this->updateMaxExtent(tileset);
+
+	// Widen the area up and to the left, to include items that start outside
+	// it but are large enough to reach into it.
+	unsigned int padX = std::min(x, this->maxExtent.width - 1);
+	unsigned int padY = std::min(y, this->maxExtent.height - 1);
+	unsigned int searchWidth = width + padX;
+	if (searchWidth < width) searchWidth = INDEX_END;
+	unsigned int searchHeight = height + padY;
+	if (searchHeight < height) searchHeight = INDEX_END;
+	ItemPtrVectorPtr candidates = this->getItemsInRect(x - padX, y - padY,
+		searchWidth, searchHeight);
+	if ((padX == 0) && (padY == 0)) return candidates;
+
+	ItemPtrVectorPtr found(new ItemPtrVector());
+	for (ItemPtrVector::const_iterator i = candidates->begin();
+		i != candidates->end();
+		i++
+	) {
+		const Extent& e = this->getExtent(*i, tileset);
+		if (
+			((uint64_t)(*i)->x + e.width > x)
+			&& ((uint64_t)(*i)->y + e.height > y)
+		) {
+			found->push_back(*i);
+		}
+	}
+	return found;
+}
+
+void GenericMap2D::Layer::addItem(const ItemPtr& item)
+{
+	// A grid can only hold one item per cell, so switch to a list of items
+	if (this->grid) this->getAllItems();
+	this->checkIndex();
+	this->items->push_back(item);
+	this->indexNext.push_back(INDEX_END);
+	if (!this->indexLink(this->items->size() - 1)) {
+		// Outside the current index, rebuild it next time it's needed
+		this->indexNext.clear();
+	}
+
+	this->codeAdded(item->code);
+	return;
+}
+
+void GenericMap2D::Layer::moveItem(const ItemPtr& item, unsigned int x,
+	unsigned int y)
+{
+	// A grid can't hold an item away from its cell, so switch to a list of
+	// items
+	if (this->grid) this->getAllItems();
+	this->checkIndex();
+
+	// Unlink the item from the bucket for its current location
+	unsigned int index = INDEX_END;
+	if (
+		((item->x >> this->indexShift) < this->indexWidth)
+		&& ((item->y >> this->indexShift) < this->indexHeight)
+	) {
+		unsigned int *next = &this->indexHead[this->indexBucket(item->x, item->y)];
+		while (*next != INDEX_END) {
+			if ((*this->items)[*next] == item) {
+				index = *next;
+				*next = this->indexNext[index];
+				break;
+			}
+			next = &this->indexNext[*next];
+		}
+	}
+
+	item->x = x;
+	item->y = y;
+
+	// If the item wasn't where we expected (e.g. its coordinates had been
+	// changed directly) or has moved outside the index, rebuild the index the
+	// next time it is needed.
+	if ((index == INDEX_END) || !this->indexLink(index)) {
+		this->indexNext.clear();
+	}
+	return;
+}
+
 gamegraphics::ImagePtr GenericMap2D::Layer::imageFromCode(
 	const Map2D::Layer::ItemPtr& item,
 	const TilesetCollectionPtr& tileset) const
@@ -117,10 +361,302 @@ gamegraphics::PaletteTablePtr GenericMap2D::Layer::getPalette(
 	return gamegraphics::PaletteTablePtr();
 }
 
-const Map2D::Layer::ItemPtrVectorPtr GenericMap2D::Layer::getValidItemList() const
+Map2D::Layer::ConstItemPtrVectorPtr GenericMap2D::Layer::getValidItemList()
+	const
 {
+	if (this->ownValidItems) return this->ownValidItems;
 	return this->validItems;
 }
 
+Map2D::Layer::ItemPtrVectorPtr GenericMap2D::Layer::getEditableValidItemList()
+{
+	if (!this->ownValidItems) {
+		// The list passed to the constructor may be shared with every other map
+		// of this format, so give the caller a copy they are free to change.
+		ItemPtrVectorPtr copy(new ItemPtrVector());
+		if (this->validItems) {
+			copy->reserve(this->validItems->size());
+			for (ItemPtrVector::const_iterator i = this->validItems->begin();
+				i != this->validItems->end();
+				i++
+			) {
+				copy->push_back(ItemPtr(new Item(**i)));
+			}
+		}
+		this->ownValidItems = copy;
+	}
+	return this->ownValidItems;
+}
+
+const TileGridPtr& GenericMap2D::Layer::getTileGrid()
+{
+	this->syncGrid();
+	return this->grid;
+}
+
+void GenericMap2D::Layer::getMaxExtent(const TilesetCollectionPtr& tileset,
+	unsigned int *width, unsigned int *height)
+{
+	this->syncGrid();
+	this->updateMaxExtent(tileset);
+	*width = this->maxExtent.width;
+	*height = this->maxExtent.height;
+	return;
+}
+
+void GenericMap2D::Layer::setMapTileSize(unsigned int x, unsigned int y)
+{
+	this->tileWidth = x;
+	this->tileHeight = y;
+	this->extents.clear();
+	this->maxExtent.width = this->maxExtent.height = 0;
+	return;
+}
+
+const GenericMap2D::Layer::Extent& GenericMap2D::Layer::getExtent(
+	const ItemPtr& item, const TilesetCollectionPtr& tileset)
+{
+	if (tileset != this->extentTileset) {
+		this->extents.clear();
+		this->extentTileset = tileset;
+		this->maxExtent.width = this->maxExtent.height = 0;
+	}
+
+	std::map<unsigned int, Extent>::const_iterator cached =
+		this->extents.find(item->code);
+	if (cached != this->extents.end()) return cached->second;
+
+	Extent ext;
+	ext.width = ext.height = 1;
+	if (this->tileWidth && this->tileHeight) {
+		gamegraphics::ImagePtr img;
+		ImageType imgType;
+		try {
+			// Call through the base class as our own imageFromCode() hides it
+			const Map2D::Layer *layer = this;
+			imgType = layer->imageFromCode(item, tileset, &img);
+		} catch (const std::exception&) {
+			// Couldn't load the image, so treat it as if there was none
+			imgType = Unknown;
+		}
+		if ((imgType == Supplied) && img) {
+			unsigned int width, height;
+			img->getDimensions(&width, &height);
+			ext.width = std::max(1U,
+				(width + this->tileWidth - 1) / this->tileWidth);
+			ext.height = std::max(1U,
+				(height + this->tileHeight - 1) / this->tileHeight);
+		}
+	}
+	return this->extents[item->code] = ext;
+}
+
+void GenericMap2D::Layer::updateMaxExtent(const TilesetCollectionPtr& tileset)
+{
+	if (tileset != this->extentTileset) {
+		this->extents.clear();
+		this->extentTileset = tileset;
+		this->maxExtent.width = this->maxExtent.height = 0;
+	}
+	if (this->maxExtent.width != 0) return;
+
+	// Find the largest image in the layer.  This only has to look up each
+	// distinct tile code once, so it's cheap after the first call.  The items
+	// the layer permits are included too, so an item can be changed into any
+	// of them without this having to be worked out again.
+	this->maxExtent.width = this->maxExtent.height = 1;
+	ConstItemPtrVectorPtr valid = this->getValidItemList();
+	if (valid) {
+		for (ItemPtrVector::const_iterator i = valid->begin();
+			i != valid->end();
+			i++
+		) {
+			this->growMaxExtent(this->getExtent(*i, tileset));
+		}
+	}
+	if (this->grid) {
+		// Look up the codes in the grid without creating an item for each cell
+		ItemPtr probe(new Item());
+		probe->type = Item::Default;
+		const std::vector<uint32_t>& codes = this->grid->codes;
+		for (unsigned int i = 0; i < codes.size(); i++) {
+			if (codes[i] == INVALID_TILECODE) continue;
+			if ((i > 0) && (codes[i] == codes[i - 1])) continue; // same as last
+			probe->code = codes[i];
+			this->growMaxExtent(this->getExtent(probe, tileset));
+		}
+	} else {
+		for (ItemPtrVector::const_iterator i = this->items->begin();
+			i != this->items->end();
+			i++
+		) {
+			this->growMaxExtent(this->getExtent(*i, tileset));
+		}
+	}
+	return;
+}
+
+void GenericMap2D::Layer::growMaxExtent(const Extent& e)
+{
+	if (e.width > this->maxExtent.width) this->maxExtent.width = e.width;
+	if (e.height > this->maxExtent.height) this->maxExtent.height = e.height;
+	return;
+}
+
+void GenericMap2D::Layer::codeAdded(unsigned int code)
+{
+	// Nothing to do until the largest image size has been worked out
+	if (this->maxExtent.width == 0) return;
+	std::map<unsigned int, Extent>::const_iterator e = this->extents.find(code);
+	if (e == this->extents.end()) {
+		this->maxExtent.width = this->maxExtent.height = 0;
+	} else {
+		this->growMaxExtent(e->second);
+	}
+	return;
+}
+
+Map2D::Layer::ItemPtr GenericMap2D::Layer::createGridItem(unsigned int index)
+{
+	const TileGrid& g = *this->grid;
+	Map2D::Layer::ItemPtr t;
+	if (this->arena) t = createItem(this->arena);
+	else t.reset(new Map2D::Layer::Item());
+	t->type = Map2D::Layer::Item::Default;
+	t->x = index % g.width;
+	t->y = index / g.width;
+	t->code = g.codes[index];
+	if (!g.flags.empty() && g.flags[index]) {
+		t->type |= Map2D::Layer::Item::Flags;
+		t->generalFlags = (Map2D::Layer::Item::GeneralFlags)g.flags[index];
+	}
+	return t;
+}
+
+Map2D::Layer::ItemPtr GenericMap2D::Layer::getGridItem(unsigned int index)
+{
+	std::map<unsigned int, ItemPtr>::const_iterator cell =
+		this->cellItems.find(index);
+	if (cell != this->cellItems.end()) return cell->second;
+	if (this->grid->codes[index] == INVALID_TILECODE) return ItemPtr();
+	return this->cellItems[index] = this->createGridItem(index);
+}
+
+void GenericMap2D::Layer::syncGrid()
+{
+	if (!this->grid) return;
+	TileGrid& g = *this->grid;
+	for (std::map<unsigned int, ItemPtr>::const_iterator
+		cell = this->cellItems.begin(); cell != this->cellItems.end(); cell++
+	) {
+		const Item& item = *cell->second;
+		if ((item.x != cell->first % g.width) || (item.y != cell->first / g.width)) {
+			// The item has been moved without moveItem(), so it no longer fits in
+			// the grid.
+			this->getAllItems();
+			return;
+		}
+		if (g.codes[cell->first] != item.code) {
+			g.codes[cell->first] = item.code;
+			this->codeAdded(item.code);
+		}
+		if (!g.flags.empty()) {
+			g.flags[cell->first] = (item.type & Item::Flags) ? item.generalFlags : 0;
+		}
+	}
+	return;
+}
+
+void GenericMap2D::Layer::rebuildIndex()
+{
+	const ItemPtrVector& all = *this->getAllItems();
+
+	unsigned int maxX = 0, maxY = 0;
+	for (ItemPtrVector::const_iterator i = all.begin(); i != all.end(); i++) {
+		if ((*i)->x > maxX) maxX = (*i)->x;
+		if ((*i)->y > maxY) maxY = (*i)->y;
+	}
+
+	// Grow the buckets until the index is no larger than a few entries per
+	// item.  Grid-based layers end up with one cell per bucket, while sparse
+	// layers (especially those using pixel coordinates) get larger buckets.
+	uint64_t limit = std::max<uint64_t>((uint64_t)all.size() * 4,
+		INDEX_MIN_BUCKETS);
+	this->indexShift = 0;
+	while (
+		(uint64_t)((maxX >> this->indexShift) + 1)
+			* ((maxY >> this->indexShift) + 1) > limit
+	) {
+		this->indexShift++;
+	}
+	this->indexWidth = (maxX >> this->indexShift) + 1;
+	this->indexHeight = (maxY >> this->indexShift) + 1;
+
+	// Items may have changed, so the largest image will need finding again
+	this->maxExtent.width = this->maxExtent.height = 0;
+
+	this->indexHead.assign(this->indexWidth * this->indexHeight, INDEX_END);
+	this->indexNext.assign(all.size(), INDEX_END);
+	for (unsigned int i = 0; i < all.size(); i++) this->indexLink(i);
+	return;
+}
+
+void GenericMap2D::Layer::checkIndex()
+{
+	// If items have been added or removed other than through addItem(), the
+	// chains are no longer valid.  Grid layers are looked up in the grid
+	// instead, so they never need an index.
+	if (this->grid) return;
+	if (this->indexNext.size() != this->items->size()) {
+		this->rebuildIndex();
+	}
+	return;
+}
+
+bool GenericMap2D::Layer::indexLink(unsigned int i)
+{
+	const Item& item = *(*this->items)[i];
+	if (
+		((item.x >> this->indexShift) >= this->indexWidth)
+		|| ((item.y >> this->indexShift) >= this->indexHeight)
+	) {
+		return false;
+	}
+
+	// Insert into the chain, keeping it in descending order.  When building the
+	// index or appending items this is always at the head of the chain.
+	unsigned int *next = &this->indexHead[this->indexBucket(item.x, item.y)];
+	while ((*next != INDEX_END) && (*next > i)) next = &this->indexNext[*next];
+	this->indexNext[i] = *next;
+	*next = i;
+	return true;
+}
+
+TileGridPtr getTileGrid(const Map2D::LayerPtr& layer, unsigned int width,
+	unsigned int height)
+{
+	boost::shared_ptr<GenericMap2D::Layer> genericLayer =
+		boost::dynamic_pointer_cast<GenericMap2D::Layer>(layer);
+	if (genericLayer) {
+		const TileGridPtr& grid = genericLayer->getTileGrid();
+		if (grid && (grid->width == width) && (grid->height == height)) {
+			return grid;
+		}
+	}
+
+	TileGridPtr grid(new TileGrid(width, height));
+	const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
+	for (Map2D::Layer::ItemPtrVector::const_iterator i = items->begin();
+		i != items->end();
+		i++
+	) {
+		if (((*i)->x >= width) || ((*i)->y >= height)) {
+			throw stream::error("Layer has tiles outside map boundary!");
+		}
+		grid->codes[grid->index((*i)->x, (*i)->y)] = (*i)->code;
+	}
+	return grid;
+}
+
 } // namespace gamemaps
 } // namespace camoto
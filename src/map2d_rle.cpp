@@ -0,0 +1,222 @@
+/**
+ * @file  map2d_rle.cpp
+ * @brief Run-length encoding shared by the map formats.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <algorithm>
+#include "map2d-rle.hpp"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace camoto {
+namespace gamemaps {
+
+unsigned int rleCountSame(const uint8_t *data, unsigned int len)
+{
+	assert(len > 0);
+	uint8_t value = data[0];
+	unsigned int i = 1;
+#if defined(__AVX2__)
+	__m256i value32 = _mm256_set1_epi8(value);
+	for (; i + 32 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+		uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, value32));
+		if (same != 0xFFFFFFFF) return i + __builtin_ctz(~same);
+	}
+#endif
+#if defined(__SSE2__)
+	__m128i value16 = _mm_set1_epi8(value);
+	for (; i + 16 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+		uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(block, value16));
+		if (same != 0xFFFF) return i + __builtin_ctz(~same);
+	}
+#endif
+	for (; i < len; i++) {
+		if (data[i] != value) return i;
+	}
+	return len;
+}
+
+unsigned int rleCountDiff(const uint8_t *data, unsigned int len)
+{
+	assert(len > 0);
+	unsigned int i = 0;
+	// Each block is compared against the same block shifted by one byte, so
+	// the last byte read is one past the end of the block.
+#if defined(__AVX2__)
+	for (; i + 33 <= len; i += 32) {
+		__m256i block = _mm256_loadu_si256((const __m256i *)(data + i));
+		__m256i next = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+		uint32_t same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, next));
+		if (same) return i + __builtin_ctz(same);
+	}
+#endif
+#if defined(__SSE2__)
+	for (; i + 17 <= len; i += 16) {
+		__m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+		__m128i next = _mm_loadu_si128((const __m128i *)(data + i + 1));
+		uint32_t same = _mm_movemask_epi8(_mm_cmpeq_epi8(block, next));
+		if (same) return i + __builtin_ctz(same);
+	}
+#endif
+	for (; i + 1 < len; i++) {
+		if (data[i] == data[i + 1]) return i;
+	}
+	return len - 1;
+}
+
+RLECodec::~RLECodec()
+{
+}
+
+RLECodec_CountValue::RLECodec_CountValue(unsigned int maxRun)
+	:	maxRun(maxRun)
+{
+	assert((maxRun > 0) && (maxRun <= 255));
+}
+
+void RLECodec_CountValue::encode(const uint8_t *data, unsigned int len,
+	std::vector<uint8_t> *out) const
+{
+	for (unsigned int i = 0; i < len; ) {
+		uint8_t value = data[i];
+		unsigned int count = rleCountSame(data + i, len - i);
+		i += count;
+		while (count) {
+			unsigned int amt = std::min(this->maxRun, count);
+			out->push_back(amt);
+			out->push_back(value);
+			count -= amt;
+		}
+	}
+	return;
+}
+
+unsigned int RLECodec_CountValue::decode(const uint8_t *in, unsigned int lenIn,
+	uint8_t *out, unsigned int lenOut, unsigned int *lenWritten) const
+{
+	unsigned int i = 0, o = 0;
+	while ((o < lenOut) && (i + 2 <= lenIn)) {
+		unsigned int count = std::min((unsigned int)in[i], lenOut - o);
+		memset(out + o, in[i + 1], count);
+		o += count;
+		i += 2;
+	}
+	*lenWritten = o;
+	return i;
+}
+
+RLECodec_Signed::RLECodec_Signed(unsigned int maxLiteral,
+	unsigned int maxLastLiteral, int omitTrailing)
+	:	maxLiteral(maxLiteral),
+		maxLastLiteral(maxLastLiteral),
+		omitTrailing(omitTrailing)
+{
+	assert((maxLiteral > 0) && (maxLiteral <= 0x80));
+	assert((maxLastLiteral > 0) && (maxLastLiteral <= 0x80));
+}
+
+/// Append a block of differing bytes, split into blocks of up to maxBlock.
+static void putSignedLiteral(std::vector<uint8_t> *out, const uint8_t *data,
+	unsigned int len, unsigned int maxBlock)
+{
+	while (len) {
+		unsigned int amt = std::min(maxBlock, len);
+		out->push_back(0x100 - amt);
+		out->insert(out->end(), data, data + amt);
+		data += amt;
+		len -= amt;
+	}
+	return;
+}
+
+/// Append a run of the same byte, split into runs of up to 0x7F.
+static void putSignedRun(std::vector<uint8_t> *out, uint8_t value,
+	unsigned int count)
+{
+	while (count) {
+		unsigned int amt = std::min(0x7Fu, count);
+		out->push_back(amt);
+		out->push_back(value);
+		count -= amt;
+	}
+	return;
+}
+
+void RLECodec_Signed::encode(const uint8_t *data, unsigned int len,
+	std::vector<uint8_t> *out) const
+{
+	assert(len > 0);
+	// Worst case is all differing bytes, plus a count every block
+	out->reserve(out->size() + len + len / this->maxLiteral + 2);
+
+	for (unsigned int i = 0; i < len; ) {
+		// Differing bytes, then the run that follows them
+		unsigned int lenLit = rleCountDiff(data + i, len - i);
+		unsigned int start = i + lenLit;
+		uint8_t value = data[start];
+		unsigned int count = rleCountSame(data + start, len - start);
+
+		if (start + count == len) {
+			// The last run is always written as a run, even if it is only one
+			// byte long, unless it can be left out entirely.
+			putSignedLiteral(out, data + i, lenLit,
+				(count > 1) ? this->maxLiteral : this->maxLastLiteral);
+			if (value != this->omitTrailing) putSignedRun(out, value, count);
+		} else {
+			putSignedLiteral(out, data + i, lenLit, this->maxLiteral);
+			putSignedRun(out, value, count);
+		}
+		i = start + count;
+	}
+	return;
+}
+
+unsigned int RLECodec_Signed::decode(const uint8_t *in, unsigned int lenIn,
+	uint8_t *out, unsigned int lenOut, unsigned int *lenWritten) const
+{
+	unsigned int i = 0, o = 0;
+	while ((o < lenOut) && (i < lenIn)) {
+		uint8_t code = in[i++];
+		if (code & 0x80) {
+			// Block of differing bytes, 0xFF for one byte, 0xFE for two, etc.
+			unsigned int len = std::min(0x100u - code, lenIn - i);
+			unsigned int amt = std::min(len, lenOut - o);
+			memcpy(out + o, in + i, amt);
+			o += amt;
+			i += len;
+		} else {
+			if (i >= lenIn) break;
+			unsigned int amt = std::min((unsigned int)code, lenOut - o);
+			memset(out + o, in[i++], amt);
+			o += amt;
+		}
+	}
+	*lenWritten = o;
+	return i;
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,120 @@
+/**
+ * @file  probe.cpp
+ * @brief Data read from a file for checking its format.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <camoto/gamemaps/input_mmap.hpp>
+#include <camoto/gamemaps/probe.hpp>
+
+/// Number of bytes read from the start of the file.
+/**
+ * This is large enough to hold the whole of every fixed-size map format, and
+ * the 64kB layers of the larger formats.
+ */
+#define PROBE_HEAD_LEN 131072
+
+/// Number of bytes read from the end of the file, for trailing data.
+#define PROBE_TAIL_LEN 16384
+
+namespace camoto {
+namespace gamemaps {
+
+Probe::Probe(stream::input_sptr input)
+	:	lenFile(input->size()),
+		whole(NULL),
+		offTail(0)
+{
+	input_mmap *mem = dynamic_cast<input_mmap *>(input.get());
+	if (mem) {
+		// Already in memory so there is nothing to read
+		this->whole = mem->data();
+		this->input = input;
+		return;
+	}
+
+	if (this->lenFile <= PROBE_HEAD_LEN + PROBE_TAIL_LEN) {
+		// Small enough to read the whole thing
+		this->head.resize(this->lenFile);
+	} else {
+		this->head.resize(PROBE_HEAD_LEN);
+		this->tail.resize(PROBE_TAIL_LEN);
+		this->offTail = this->lenFile - PROBE_TAIL_LEN;
+		this->input = input;
+	}
+	if (this->head.empty()) return;
+	input->seekg(0, stream::start);
+	this->head.resize(input->try_read(&this->head[0], this->head.size()));
+	if (!this->tail.empty()) {
+		input->seekg(this->offTail, stream::start);
+		this->tail.resize(input->try_read(&this->tail[0], this->tail.size()));
+	}
+}
+
+stream::len Probe::size() const
+{
+	return this->lenFile;
+}
+
+stream::len Probe::read(stream::pos offset, void *buffer, stream::len len)
+	const
+{
+	if (offset >= this->lenFile) return 0;
+	if (len > this->lenFile - offset) len = this->lenFile - offset;
+
+	if (this->whole) {
+		memcpy(buffer, this->whole + offset, len);
+		return len;
+	}
+	if (offset + len <= this->head.size()) {
+		memcpy(buffer, &this->head[offset], len);
+		return len;
+	}
+	if ((offset >= this->offTail) && (offset + len <= this->offTail
+		+ this->tail.size())
+	) {
+		memcpy(buffer, &this->tail[offset - this->offTail], len);
+		return len;
+	}
+
+	// Somewhere in the middle of a large file
+	if (!this->input) return 0;
+	boost::mutex::scoped_lock lock(this->lock);
+	try {
+		this->input->seekg(offset, stream::start);
+		return this->input->try_read((uint8_t *)buffer, len);
+	} catch (const stream::error&) {
+		return 0;
+	}
+}
+
+bool Probe::readU8(stream::pos offset, uint8_t *value) const
+{
+	return this->read(offset, value, 1) == 1;
+}
+
+bool Probe::readU16le(stream::pos offset, uint16_t *value) const
+{
+	uint8_t raw[2];
+	if (this->read(offset, raw, 2) != 2) return false;
+	*value = raw[0] | (raw[1] << 8);
+	return true;
+}
+
+} // namespace gamemaps
+} // namespace camoto
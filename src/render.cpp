@@ -0,0 +1,416 @@
+/**
+ * @file  render.cpp
+ * @brief Draw a Map2D as it would appear in the game.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <camoto/gamemaps/render.hpp>
+#include <camoto/gamemaps/util.hpp>
+#include "map2d-blit.hpp"
+#include "map2d-generic.hpp"
+
+namespace camoto {
+namespace gamemaps {
+
+using namespace camoto::gamegraphics;
+
+/// The visible part of one tile, and where to draw it in the output.
+struct DrawTile
+{
+	unsigned int x;              ///< Output column of the first visible pixel
+	unsigned int top;            ///< Output row of the first visible pixel
+	unsigned int bottom;         ///< Output row below the last visible pixel
+	unsigned int srcX;           ///< First visible column of the tile
+	unsigned int srcY;           ///< First visible row of the tile
+	unsigned int width;          ///< Number of visible columns
+	const TileAtlas::Tile *tile; ///< Image to draw
+	const TileAtlas *src;        ///< Atlas holding tile
+	BlitMode mode;               ///< How to draw transparent pixels
+};
+
+/// Horizontal bands of an image being drawn by one or more threads.
+struct BandQueue
+{
+	uint8_t *pixels;          ///< First pixel of the output
+	unsigned int stride;      ///< Bytes from one output row to the next
+	unsigned int width;       ///< Output width, in pixels
+	unsigned int height;      ///< Output height, in pixels
+	unsigned int bandHeight;  ///< Rows in each band, the last may be shorter
+	uint8_t colourOffset;     ///< Added to every tile pixel
+
+	/// Tiles that overlap each band, in the order they are drawn.
+	std::vector<std::vector<DrawTile> > bands;
+
+	boost::mutex lock;        ///< Protects the field below
+	unsigned int next;        ///< Index into bands of the next to draw
+};
+
+/// Clear one band, then draw the tiles overlapping it clipped to the band.
+static void drawBand(const BandQueue& queue, unsigned int band)
+{
+	unsigned int top = band * queue.bandHeight;
+	unsigned int bottom = std::min(top + queue.bandHeight, queue.height);
+	for (unsigned int y = top; y < bottom; y++) {
+		memset(&queue.pixels[y * queue.stride], 0, queue.width);
+	}
+
+	const std::vector<DrawTile>& tiles = queue.bands[band];
+	for (std::vector<DrawTile>::const_iterator
+		t = tiles.begin(); t != tiles.end(); t++
+	) {
+		unsigned int outY = std::max(t->top, top);
+		unsigned int endY = std::min(t->bottom, bottom);
+		blitTile(&queue.pixels[outY * queue.stride + t->x], queue.stride,
+			t->src->getPixels(*t->tile), t->src->getMask(*t->tile),
+			t->tile->width, t->srcX, t->srcY + (outY - t->top), t->width,
+			endY - outY, queue.colourOffset, t->mode);
+	}
+	return;
+}
+
+/// Clip a tile to the area being drawn and add it to the bands it overlaps.
+/**
+ * @param queue
+ *   Bands to add the tile to.
+ *
+ * @param tile
+ *   Image to draw.
+ *
+ * @param src
+ *   Atlas holding tile.
+ *
+ * @param left
+ *   Map pixel the left edge of the tile is drawn at.
+ *
+ * @param top
+ *   Map pixel the top edge of the tile is drawn at.
+ *
+ * @param x
+ *   Map pixel at the left of the area being drawn.
+ *
+ * @param y
+ *   Map pixel at the top of the area being drawn.
+ *
+ * @param mode
+ *   How to draw the tile's transparent pixels.
+ */
+static void queueTile(BandQueue *queue, const TileAtlas::Tile& tile,
+	const TileAtlas *src, unsigned int left, unsigned int top, unsigned int x,
+	unsigned int y, BlitMode mode)
+{
+	if ((left >= x + queue->width) || (top >= y + queue->height)) return;
+	if ((left + tile.width <= x) || (top + tile.height <= y)) return;
+
+	DrawTile draw;
+	draw.srcX = (left < x) ? x - left : 0;
+	draw.srcY = (top < y) ? y - top : 0;
+	draw.x = left + draw.srcX - x;
+	draw.top = top + draw.srcY - y;
+	draw.width = std::min(tile.width - draw.srcX, queue->width - draw.x);
+	draw.bottom = draw.top
+		+ std::min(tile.height - draw.srcY, queue->height - draw.top);
+	draw.tile = &tile;
+	draw.src = src;
+	draw.mode = mode;
+
+	for (unsigned int b = draw.top / queue->bandHeight;
+		b <= (draw.bottom - 1) / queue->bandHeight; b++
+	) {
+		queue->bands[b].push_back(draw);
+	}
+	return;
+}
+
+/// Draw bands from the queue until there are none left.
+static void drawBands(BandQueue *queue)
+{
+	for (;;) {
+		unsigned int band;
+		{
+			boost::mutex::scoped_lock lock(queue->lock);
+			if (queue->next >= queue->bands.size()) return;
+			band = queue->next++;
+		}
+		drawBand(*queue, band);
+	}
+}
+
+/// Wait for a group of threads when leaving a scope, however it is left.
+class JoinGuard
+{
+	public:
+		JoinGuard(boost::thread_group *threads)
+			:	threads(threads)
+		{
+		}
+
+		~JoinGuard()
+		{
+			this->threads->join_all();
+		}
+
+	protected:
+		boost::thread_group *threads; ///< Threads to wait for
+};
+
+/// Get the palette the tiles are drawn in.
+static PaletteTablePtr getTilePalette(const TilesetCollectionPtr& tileset)
+{
+	for (TilesetCollection::const_iterator
+		i = tileset->begin(); i != tileset->end(); i++
+	) {
+		if (i->second->getCaps() & Tileset::HasPalette) {
+			return i->second->getPalette();
+		}
+	}
+	PaletteTablePtr pal = createPalette_DefaultVGA();
+	// Force last colour to be transparent
+	pal->at(255).red = 255;
+	pal->at(255).green = 0;
+	pal->at(255).blue = 192;
+	pal->at(255).alpha = 0;
+	return pal;
+}
+
+/// Is there room in the palette to insert a transparent colour?
+static inline bool useMask(const PaletteTablePtr& tilePal)
+{
+	return tilePal->size() < 255;
+}
+
+Map2DRenderer::Map2DRenderer()
+{
+}
+
+Map2DRenderer::Map2DRenderer(const TileAtlasPtr& atlas)
+	:	atlas(atlas)
+{
+}
+
+void Map2DRenderer::render(const Map2DPtr& map,
+	const TilesetCollectionPtr& tileset, RenderedMap *out)
+{
+	this->render(map, tileset, out, 1);
+	return;
+}
+
+void Map2DRenderer::render(const Map2DPtr& map,
+	const TilesetCollectionPtr& tileset, RenderedMap *out, unsigned int threads)
+{
+	unsigned int globalTileWidth, globalTileHeight;
+	map->getTileSize(&globalTileWidth, &globalTileHeight);
+	map->getMapSize(&out->width, &out->height);
+	out->width *= globalTileWidth;
+	out->height *= globalTileHeight;
+	// Every pixel is cleared as it is drawn
+	out->pixels.resize(out->width * out->height);
+	out->palette = this->getPalette(tileset);
+
+	this->draw(map, tileset, true, 0, 0, out->width, out->height,
+		out->pixels.empty() ? NULL : &out->pixels[0], out->width, threads);
+	return;
+}
+
+void Map2DRenderer::renderRegion(const Map2DPtr& map,
+	const TilesetCollectionPtr& tileset, unsigned int x, unsigned int y,
+	unsigned int width, unsigned int height, uint8_t *pixels,
+	unsigned int stride)
+{
+	this->draw(map, tileset, false, x, y, width, height, pixels, stride, 1);
+	return;
+}
+
+PaletteTablePtr Map2DRenderer::getPalette(const TilesetCollectionPtr& tileset)
+	const
+{
+	PaletteTablePtr tilePal = getTilePalette(tileset);
+	PaletteTablePtr pal(new PaletteTable(*tilePal));
+	if (useMask(tilePal)) {
+		// Make first colour transparent, moving the others up by one
+		PaletteEntry transparent;
+		transparent.red = 255;
+		transparent.green = 0;
+		transparent.blue = 192;
+		transparent.alpha = 0;
+		pal->insert(pal->begin(), transparent);
+	}
+	return pal;
+}
+
+void Map2DRenderer::clearCache()
+{
+	this->cache.reset();
+	return;
+}
+
+unsigned long Map2DRenderer::getCacheSize() const
+{
+	return this->cache ? this->cache->getTileCount() : 0;
+}
+
+void Map2DRenderer::draw(const Map2DPtr& map,
+	const TilesetCollectionPtr& tileset, bool wholeMap, unsigned int x,
+	unsigned int y, unsigned int width, unsigned int height, uint8_t *pixels,
+	unsigned int stride, unsigned int threads)
+{
+	if ((width == 0) || (height == 0)) return;
+
+	bool sharedAtlas = this->atlas && (this->atlas->getTileset() == tileset);
+	if (!this->cache || (this->cache->getTileset() != tileset)) {
+		this->cache.reset(new TileAtlas(tileset));
+	}
+	bool mask = useMask(getTilePalette(tileset));
+
+	// Use several bands per thread, so threads that finish their bands early
+	// can take some of the work left over from busier parts of the map.
+	// There is no point having more threads than rows, and clamping first
+	// keeps threads * 4 from overflowing.
+	threads = std::min(threads, height);
+	unsigned int bandCount = 1;
+	if (threads > 1) bandCount = std::min(threads * 4, height);
+
+	BandQueue queue;
+	queue.pixels = pixels;
+	queue.stride = stride;
+	queue.width = width;
+	queue.height = height;
+	queue.bandHeight = std::max((height + bandCount - 1) / bandCount, 1u);
+	queue.colourOffset = mask ? 1 : 0;
+	queue.bands.resize(bandCount);
+	queue.next = 0;
+
+	// Load all the tiles on this thread, since the renderer's own atlas can
+	// only be added to by one thread at a time.
+	unsigned int layerCount = map->getLayerCount();
+	for (unsigned int layerIndex = 0; layerIndex < layerCount; layerIndex++) {
+		Map2D::LayerPtr layer = map->getLayer(layerIndex);
+
+		// Figure out the layer size (in tiles) and the tile size
+		unsigned int layerWidth, layerHeight, tileWidth, tileHeight;
+		getLayerDims(map, layer, &layerWidth, &layerHeight, &tileWidth, &tileHeight);
+
+		// The first layer hides whatever was underneath, higher layers let
+		// lower ones show through their transparent pixels.
+		BlitMode mode = BlitMasked;
+		if (layerIndex == 0) mode = mask ? BlitClear : BlitOpaque;
+
+		// Grid layers are read straight from the grid.  getAllItems() would turn
+		// the grid into items for good, and getItemsInRect() would create an
+		// item for every cell that is looked at.
+		boost::shared_ptr<GenericMap2D::Layer> genericLayer =
+			boost::dynamic_pointer_cast<GenericMap2D::Layer>(layer);
+		TileGridPtr grid;
+		if (genericLayer) grid = genericLayer->getTileGrid();
+		if (grid) {
+			// Cells that can be seen, including large images whose cell is above
+			// or to the left of the area.
+			unsigned int cellX = 0, cellY = 0;
+			unsigned int endX = grid->width, endY = grid->height;
+			if (!wholeMap) {
+				unsigned int extentWidth, extentHeight;
+				genericLayer->getMaxExtent(tileset, &extentWidth, &extentHeight);
+				cellX = x / tileWidth;
+				cellY = y / tileHeight;
+				cellX -= std::min(cellX, extentWidth - 1);
+				cellY -= std::min(cellY, extentHeight - 1);
+				endX = std::min(endX, (x + width - 1) / tileWidth + 1);
+				endY = std::min(endY, (y + height - 1) / tileHeight + 1);
+			}
+
+			// Images are looked up by code, so one item can stand in for every
+			// cell when a tile has to be loaded.
+			Map2D::Layer::ItemPtr cell(new Map2D::Layer::Item());
+			cell->type = Map2D::Layer::Item::Default;
+			for (unsigned int cy = cellY; cy < endY; cy++) {
+				for (unsigned int cx = cellX; cx < endX; cx++) {
+					unsigned int code = grid->codes[grid->index(cx, cy)];
+					if (code == INVALID_TILECODE) continue;
+					cell->x = cx;
+					cell->y = cy;
+					cell->code = code;
+					const TileAtlas *src;
+					const TileAtlas::Tile& thisTile = this->getTile(layerIndex, layer,
+						cell, sharedAtlas, &src);
+					if (thisTile.width == 0) continue; // no image
+					queueTile(&queue, thisTile, src, cx * tileWidth, cy * tileHeight,
+						x, y, mode);
+				}
+			}
+			continue;
+		}
+
+		// Only visit the items that can be seen, including large images whose
+		// cell is above or to the left of the area.
+		Map2D::Layer::ItemPtrVectorPtr items;
+		if (wholeMap) {
+			items = layer->getAllItems();
+		} else {
+			items = layer->getItemsInRect(x / tileWidth, y / tileHeight,
+				(x + width - 1) / tileWidth - x / tileWidth + 1,
+				(y + height - 1) / tileHeight - y / tileHeight + 1, tileset);
+		}
+
+		// Run through the items and add them to the bands they overlap
+		for (Map2D::Layer::ItemPtrVector::const_iterator t = items->begin();
+			t != items->end(); t++
+		) {
+			const TileAtlas *src;
+			const TileAtlas::Tile& thisTile = this->getTile(layerIndex, layer, *t,
+				sharedAtlas, &src);
+			if (thisTile.width == 0) continue; // no image
+			queueTile(&queue, thisTile, src, (*t)->x * tileWidth,
+				(*t)->y * tileHeight, x, y, mode);
+		}
+	}
+
+	// The calling thread does its share too, so only start the extra ones.
+	// The guard makes sure none are still using the queue if this throws.
+	boost::thread_group workers;
+	JoinGuard guard(&workers);
+	for (unsigned int i = 1; (i < threads) && (i < bandCount); i++) {
+		try {
+			workers.create_thread(boost::bind(drawBands, &queue));
+		} catch (const boost::thread_resource_error&) {
+			// Draw whatever the started threads don't get to on this thread
+			break;
+		}
+	}
+	drawBands(&queue);
+	return;
+}
+
+const TileAtlas::Tile& Map2DRenderer::getTile(unsigned int layerIndex,
+	const Map2D::LayerPtr& layer, const Map2D::Layer::ItemPtr& item,
+	bool sharedAtlas, const TileAtlas **src)
+{
+	if (sharedAtlas) {
+		const TileAtlas::Tile *tile = this->atlas->find(layerIndex, item->code);
+		if (tile) {
+			*src = this->atlas.get();
+			return *tile;
+		}
+	}
+	*src = this->cache.get();
+	return this->cache->add(layerIndex, layer, item);
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,130 @@
+/**
+ * @file  tile_atlas.cpp
+ * @brief Decoded tile images shared between maps and threads.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <camoto/gamemaps/tile_atlas.hpp>
+
+namespace camoto {
+namespace gamemaps {
+
+using namespace camoto::gamegraphics;
+
+TileAtlas::TileAtlas(const TilesetCollectionPtr& tileset)
+	:	tileset(tileset)
+{
+}
+
+TileAtlas::TileAtlas(const Map2DPtr& map, const TilesetCollectionPtr& tileset)
+	:	tileset(tileset)
+{
+	unsigned int layerCount = map->getLayerCount();
+	for (unsigned int layerIndex = 0; layerIndex < layerCount; layerIndex++) {
+		Map2D::LayerPtr layer = map->getLayer(layerIndex);
+		Map2D::Layer::ConstItemPtrVectorPtr valid = layer->getValidItemList();
+		if (!valid) continue;
+		for (Map2D::Layer::ItemPtrVector::const_iterator i = valid->begin();
+			i != valid->end(); i++
+		) {
+			this->add(layerIndex, layer, *i);
+		}
+	}
+}
+
+const TilesetCollectionPtr& TileAtlas::getTileset() const
+{
+	return this->tileset;
+}
+
+unsigned long TileAtlas::getTileCount() const
+{
+	return this->tiles.size();
+}
+
+const TileAtlas::Tile *TileAtlas::find(unsigned int layerIndex,
+	unsigned int code) const
+{
+	boost::unordered_map<TileKey, Tile>::const_iterator t =
+		this->tiles.find(TileKey(layerIndex, code));
+	if (t == this->tiles.end()) return NULL;
+	return &t->second;
+}
+
+const TileAtlas::Tile& TileAtlas::add(unsigned int layerIndex,
+	const Map2D::LayerPtr& layer, const Map2D::Layer::ItemPtr& item)
+{
+	TileKey key(layerIndex, item->code);
+	boost::unordered_map<TileKey, Tile>::iterator t = this->tiles.find(key);
+	if (t != this->tiles.end()) return t->second;
+
+	Tile& tile = this->tiles[key];
+	tile.width = tile.height = 0;
+	tile.pixelOffset = this->pixels.size();
+	tile.maskOffset = this->mask.size();
+
+	ImagePtr img;
+	Map2D::Layer::ImageType imgType;
+	try {
+		imgType = layer->imageFromCode(item, this->tileset, &img);
+	} catch (const std::exception& e) {
+		std::cerr << "[TileAtlas] Error loading image: " << e.what()
+			<< std::endl;
+		imgType = Map2D::Layer::Unknown;
+	}
+	// Everything other than a supplied image is drawn as nothing for now,
+	// but the digits and unknown tiles could be given their own images.
+	if ((imgType != Map2D::Layer::Supplied) || !img) return tile;
+
+	unsigned int width, height;
+	img->getDimensions(&width, &height);
+	if ((width == 0) || (height == 0)) return tile;
+	StdImageDataPtr data = img->toStandard();
+	StdImageDataPtr stdMask = img->toStandardMask();
+
+	unsigned long lenPixels = width * height;
+	this->pixels.insert(this->pixels.end(), &data[0], &data[0] + lenPixels);
+
+	// Pack the visibility bit of each pixel, starting each row on a new byte
+	unsigned int stride = (width + 7) / 8;
+	this->mask.resize(tile.maskOffset + stride * height, 0);
+	uint8_t *bits = &this->mask[tile.maskOffset];
+	const uint8_t *src = &stdMask[0];
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			if ((*src++ & Image::Mask_Visibility) == Image::Mask_Vis_Opaque) {
+				bits[x >> 3] |= 0x80 >> (x & 7);
+			}
+		}
+		bits += stride;
+	}
+
+	tile.width = width;
+	tile.height = height;
+	return tile;
+}
+
+bool TileAtlas::hitTest(const Tile& tile, unsigned int x, unsigned int y) const
+{
+	if ((x >= tile.width) || (y >= tile.height)) return false;
+	const uint8_t *row = this->getMask(tile) + y * getMaskStride(tile);
+	return row[x >> 3] & (0x80 >> (x & 7));
+}
+
+} // namespace gamemaps
+} // namespace camoto
@@ -0,0 +1,229 @@
+/**
+ * @file  test-atlas.cpp
+ * @brief Test code for decoded tile images shared between maps.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/gamemaps/render.hpp>
+#include <camoto/gamemaps/tile_atlas.hpp>
+#include "test-image.hpp"
+
+using namespace camoto;
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_atlas)
+
+/// Map size, in 8x8 tiles.
+#define MAP_SIZE 16
+
+/// Create an item with the given code at a location.
+static Map2D::Layer::ItemPtr createItem(unsigned int x, unsigned int y,
+	unsigned int code)
+{
+	Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+	item->type = Map2D::Layer::Item::Default;
+	item->x = x;
+	item->y = y;
+	item->code = code;
+	return item;
+}
+
+/// Create a map with two layers of items.
+/**
+ * The background permits codes 0 to 3 and the sprite layer codes 1 and 3,
+ * see FakeImageLayer for the image sizes.  Code 4 in the background and
+ * code 2 in the sprite layer are used without being permitted, so an atlas
+ * built from the valid item lists does not have them.
+ */
+static Map2DPtr createMap()
+{
+	Map2D::Layer::ItemPtrVectorPtr validBackground(
+		new Map2D::Layer::ItemPtrVector());
+	for (unsigned int code = 0; code < 4; code++) {
+		validBackground->push_back(createItem(0, 0, code));
+	}
+	Map2D::Layer::ItemPtrVectorPtr background(new Map2D::Layer::ItemPtrVector());
+	for (unsigned int y = 0; y < MAP_SIZE; y++) {
+		for (unsigned int x = 0; x < MAP_SIZE; x++) {
+			background->push_back(createItem(x, y, (x * 5 + y * 3) % 4));
+		}
+	}
+	background->push_back(createItem(9, 2, 4));
+
+	Map2D::Layer::ItemPtrVectorPtr validSprites(
+		new Map2D::Layer::ItemPtrVector());
+	validSprites->push_back(createItem(0, 0, 1));
+	validSprites->push_back(createItem(0, 0, 3));
+	Map2D::Layer::ItemPtrVectorPtr sprites(new Map2D::Layer::ItemPtrVector());
+	for (unsigned int i = 0; i < 6; i++) {
+		sprites->push_back(createItem(1 + i * 2, 2 + i * 2, 1 + i % 3));
+	}
+
+	Map2D::LayerPtrVector layers;
+	layers.push_back(Map2D::LayerPtr(
+		new FakeImageLayer(MAP_SIZE, MAP_SIZE, background, validBackground)));
+	layers.push_back(Map2D::LayerPtr(
+		new FakeImageLayer(MAP_SIZE, MAP_SIZE, sprites, validSprites)));
+
+	return Map2DPtr(new GenericMap2D(Map::Attributes(), Map::GraphicsFilenames(),
+		Map2D::NoCaps, 0, 0, MAP_SIZE, MAP_SIZE, 8, 8, layers,
+		Map2D::PathPtrVectorPtr()));
+}
+
+/// Check a tile holds the FakeImage for a code, pixel for pixel.
+static void checkTile(const TileAtlas& atlas, const TileAtlas::Tile& tile,
+	unsigned int code)
+{
+	unsigned int size = code * 8 - 3;
+	BOOST_REQUIRE_EQUAL(tile.width, size);
+	BOOST_REQUIRE_EQUAL(tile.height, size);
+
+	FakeImage image(size, size, code);
+	gamegraphics::StdImageDataPtr pixels = image.toStandard();
+	const uint8_t *atlasPixels = atlas.getPixels(tile);
+	for (unsigned int y = 0; y < size; y++) {
+		for (unsigned int x = 0; x < size; x++) {
+			BOOST_REQUIRE_MESSAGE(atlasPixels[y * size + x] == pixels[y * size + x],
+				"Pixel " << x << "," << y << " of code " << code << " differs");
+			BOOST_REQUIRE_MESSAGE(
+				atlas.hitTest(tile, x, y) == ((x + y + code) % 5 != 0),
+				"Mask bit " << x << "," << y << " of code " << code << " differs");
+		}
+	}
+
+	// Nothing outside the tile is opaque, including the unused bits at the
+	// end of each row of the mask.
+	BOOST_CHECK(!atlas.hitTest(tile, size, 0));
+	BOOST_CHECK(!atlas.hitTest(tile, 0, size));
+	unsigned int stride = TileAtlas::getMaskStride(tile);
+	BOOST_REQUIRE_EQUAL(stride, (size + 7) / 8);
+	const uint8_t *mask = atlas.getMask(tile);
+	for (unsigned int y = 0; y < size; y++) {
+		BOOST_CHECK_EQUAL(mask[y * stride + stride - 1] & (0xFF >> (size % 8)), 0);
+	}
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(prebuild_from_map)
+{
+	BOOST_TEST_MESSAGE("Building an atlas from a map adds every valid item");
+
+	TilesetCollectionPtr tileset(new TilesetCollection());
+	Map2DPtr map = createMap();
+	TileAtlas atlas(map, tileset);
+
+	BOOST_CHECK(atlas.getTileset() == tileset);
+	BOOST_CHECK_EQUAL(atlas.getTileCount(), 4 + 2);
+
+	// Code 0 has no image but is still known
+	const TileAtlas::Tile *blank = atlas.find(0, 0);
+	BOOST_REQUIRE(blank);
+	BOOST_CHECK_EQUAL(blank->width, 0);
+	BOOST_CHECK_EQUAL(blank->height, 0);
+
+	for (unsigned int code = 1; code < 4; code++) {
+		const TileAtlas::Tile *tile = atlas.find(0, code);
+		BOOST_REQUIRE_MESSAGE(tile, "Background code " << code << " missing");
+		checkTile(atlas, *tile, code);
+	}
+	const TileAtlas::Tile *sprite = atlas.find(1, 3);
+	BOOST_REQUIRE(sprite);
+	checkTile(atlas, *sprite, 3);
+
+	// Codes used in the map without being valid, and codes in other layers
+	BOOST_CHECK(!atlas.find(0, 4));
+	BOOST_CHECK(!atlas.find(1, 0));
+	BOOST_CHECK(!atlas.find(1, 2));
+	BOOST_CHECK(!atlas.find(2, 1));
+}
+
+BOOST_AUTO_TEST_CASE(add_and_find)
+{
+	BOOST_TEST_MESSAGE("Tiles of widths that are not whole bytes pack correctly");
+
+	TilesetCollectionPtr tileset(new TilesetCollection());
+	Map2DPtr map = createMap();
+	Map2D::LayerPtr layer = map->getLayer(0);
+	TileAtlas atlas(tileset);
+	BOOST_CHECK_EQUAL(atlas.getTileCount(), 0);
+	BOOST_CHECK(!atlas.find(0, 1));
+
+	// Widths of 5, 13, 21, 29 and 37 pixels, each packed straight after the
+	// one before, so a row that does not start on a new byte shifts the rest.
+	for (unsigned int code = 1; code <= 5; code++) {
+		const TileAtlas::Tile& tile = atlas.add(0, layer, createItem(0, 0, code));
+		BOOST_REQUIRE(atlas.find(0, code) == &tile);
+	}
+	BOOST_CHECK_EQUAL(atlas.getTileCount(), 5);
+
+	// Adding a code again returns the existing tile
+	const TileAtlas::Tile *first = atlas.find(0, 2);
+	BOOST_CHECK(&atlas.add(0, layer, createItem(3, 3, 2)) == first);
+	BOOST_CHECK_EQUAL(atlas.getTileCount(), 5);
+
+	// The same code in another layer is a separate tile
+	BOOST_CHECK(!atlas.find(1, 2));
+	BOOST_CHECK(&atlas.add(1, map->getLayer(1), createItem(0, 0, 2)) != first);
+	BOOST_CHECK_EQUAL(atlas.getTileCount(), 6);
+
+	// Check them all at the end, after the planes have grown
+	for (unsigned int code = 1; code <= 5; code++) {
+		checkTile(atlas, *atlas.find(0, code), code);
+	}
+	checkTile(atlas, *atlas.find(1, 2), 2);
+}
+
+BOOST_AUTO_TEST_CASE(renderer_matches_plain)
+{
+	BOOST_TEST_MESSAGE("Drawing from a shared atlas gives the same image");
+
+	TilesetCollectionPtr tileset(new TilesetCollection());
+	Map2DPtr map = createMap();
+
+	Map2DRenderer plain;
+	RenderedMap expected;
+	plain.render(map, tileset, &expected);
+	BOOST_REQUIRE_EQUAL(expected.width, MAP_SIZE * 8);
+	BOOST_REQUIRE_EQUAL(expected.height, MAP_SIZE * 8);
+
+	TileAtlasPtr atlas(new TileAtlas(map, tileset));
+	unsigned long atlasSize = atlas->getTileCount();
+	Map2DRenderer shared(atlas);
+	RenderedMap fromAtlas;
+	shared.render(map, tileset, &fromAtlas);
+	BOOST_CHECK(fromAtlas.pixels == expected.pixels);
+
+	// Only the two codes missing from the atlas were loaded by the renderer,
+	// and the shared atlas was left alone.
+	BOOST_CHECK_EQUAL(shared.getCacheSize(), 2);
+	BOOST_CHECK_EQUAL(atlas->getTileCount(), atlasSize);
+	BOOST_CHECK(plain.getCacheSize() > shared.getCacheSize());
+
+	RenderedMap threaded;
+	shared.render(map, tileset, &threaded, 4);
+	BOOST_CHECK(threaded.pixels == expected.pixels);
+
+	// Other tilesets do not use the atlas at all
+	TilesetCollectionPtr otherTileset(new TilesetCollection());
+	RenderedMap fromOther;
+	shared.render(map, otherTileset, &fromOther);
+	BOOST_CHECK(fromOther.pixels == expected.pixels);
+	BOOST_CHECK_EQUAL(shared.getCacheSize(), plain.getCacheSize());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
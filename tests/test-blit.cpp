@@ -0,0 +1,131 @@
+/**
+ * @file  test-blit.cpp
+ * @brief Test code for drawing tiles into a framebuffer.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <vector>
+#include <boost/test/unit_test.hpp>
+#include "map2d-blit.hpp"
+
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_blit)
+
+/// Next value from a fixed generator, so failures always happen the same way.
+static uint8_t nextByte(uint32_t *state)
+{
+	*state = *state * 1103515245 + 12345;
+	return (*state >> 16) & 0xFF;
+}
+
+/// Pixel-by-pixel version of blitTile().
+static void blitReference(uint8_t *dst, unsigned int dstStride,
+	const uint8_t *pixels, const uint8_t *mask, unsigned int tileWidth,
+	unsigned int srcX, unsigned int srcY, unsigned int width,
+	unsigned int height, uint8_t colourOffset, BlitMode mode)
+{
+	unsigned int maskStride = (tileWidth + 7) / 8;
+	for (unsigned int y = 0; y < height; y++) {
+		for (unsigned int x = 0; x < width; x++) {
+			unsigned int tX = srcX + x, tY = srcY + y;
+			bool opaque = mask[tY * maskStride + tX / 8] & (0x80 >> (tX % 8));
+			uint8_t *out = &dst[y * dstStride + x];
+			if (opaque || (mode == BlitOpaque)) {
+				*out = pixels[tY * tileWidth + tX] + colourOffset;
+			} else if (mode == BlitClear) {
+				*out = 0;
+			}
+		}
+	}
+	return;
+}
+
+/// Draw one tile both ways over the same background and compare the results.
+static void checkBlit(unsigned int tileWidth, unsigned int tileHeight,
+	unsigned int srcX, unsigned int srcY, unsigned int width,
+	unsigned int height, uint8_t colourOffset, BlitMode mode, uint32_t seed)
+{
+	uint32_t state = seed;
+	std::vector<uint8_t> pixels(tileWidth * tileHeight);
+	for (unsigned int i = 0; i < pixels.size(); i++) pixels[i] = nextByte(&state);
+
+	// Mostly mixed mask bytes, with some fully opaque and fully transparent
+	// ones so the shortcuts for those are used too.
+	std::vector<uint8_t> mask(((tileWidth + 7) / 8) * tileHeight);
+	for (unsigned int i = 0; i < mask.size(); i++) {
+		uint8_t b = nextByte(&state);
+		mask[i] = (b < 0x20) ? 0x00 : (b < 0x40) ? 0xFF : nextByte(&state);
+	}
+
+	// Leave room either side of each row so stray writes are noticed
+	unsigned int dstStride = width + 19;
+	std::vector<uint8_t> expected(dstStride * (height + 2));
+	for (unsigned int i = 0; i < expected.size(); i++) {
+		expected[i] = nextByte(&state);
+	}
+	std::vector<uint8_t> actual = expected;
+
+	unsigned int start = dstStride + 5;
+	blitReference(&expected[start], dstStride, &pixels[0], &mask[0], tileWidth,
+		srcX, srcY, width, height, colourOffset, mode);
+	blitTile(&actual[start], dstStride, &pixels[0], &mask[0], tileWidth,
+		srcX, srcY, width, height, colourOffset, mode);
+
+	BOOST_REQUIRE_MESSAGE(actual == expected, "blitTile() differs for a "
+		<< tileWidth << "x" << tileHeight << " tile drawn from " << srcX << ","
+		<< srcY << " size " << width << "x" << height << " with offset "
+		<< (int)colourOffset << " in mode " << mode);
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(matches_per_pixel)
+{
+	BOOST_TEST_MESSAGE("Drawing tiles gives the same pixels as a per-pixel copy");
+
+	// 8, 16 and 32 have their own fast paths, the rest only use the general one
+	unsigned int widths[] = {8, 16, 32, 1, 5, 12, 24, 33, 40};
+	uint8_t offsets[] = {0, 0x50, 0xF0};
+	BlitMode modes[] = {BlitMasked, BlitClear, BlitOpaque};
+	uint32_t seed = 1;
+
+	for (unsigned int w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+		unsigned int tileWidth = widths[w];
+		unsigned int tileHeight = 1 + tileWidth % 7 + 8;
+		for (unsigned int m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+			for (unsigned int o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++) {
+				// Whole tile
+				checkBlit(tileWidth, tileHeight, 0, 0, tileWidth, tileHeight,
+					offsets[o], modes[m], seed++);
+
+				// Clipped on each side, at every starting column
+				for (unsigned int srcX = 0; srcX < tileWidth; srcX++) {
+					checkBlit(tileWidth, tileHeight, srcX, 2, tileWidth - srcX,
+						tileHeight - 2, offsets[o], modes[m], seed++);
+					checkBlit(tileWidth, tileHeight, 0, 0, tileWidth - srcX,
+						tileHeight - 3, offsets[o], modes[m], seed++);
+					if (srcX + 2 < tileWidth) {
+						checkBlit(tileWidth, tileHeight, srcX, 1, tileWidth - srcX - 2,
+							1, offsets[o], modes[m], seed++);
+					}
+				}
+			}
+		}
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
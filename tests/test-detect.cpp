@@ -0,0 +1,166 @@
+/**
+ * @file  test-detect.cpp
+ * @brief Test code for the Detector and DetectCache.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <fstream>
+#include <stdexcept>
+#include <camoto/stream_string.hpp>
+#include <camoto/gamemaps/detect.hpp>
+#include <camoto/gamemaps/detect_cache.hpp>
+#include "fmt-map-ccomic.hpp"
+#include "tests.hpp"
+
+using namespace camoto;
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_detect)
+
+/// Format whose check fails with something other than a stream::error.
+class MapType_Throw: virtual public MapType_CComic
+{
+	public:
+		virtual Certainty isInstance(const Probe& probe) const
+		{
+			throw std::runtime_error("isInstance failed");
+		}
+};
+
+/// Captain Comic level that MapType_CComic is certain about.
+static const std::string mapContent = STRING_WITH_NULLS(
+	"\x03\x00" "\x05\x00"
+	"\x02\x01\x00"
+	"\x12\x11\x10"
+	"\x22\x21\x20"
+	"\x32\x31\x30"
+	"\x42\x41\x40"
+);
+
+static stream::string_sptr createMap()
+{
+	stream::string_sptr ss(new stream::string());
+	ss << mapContent;
+	return ss;
+}
+
+/// Save content to a file on disk, and into a stream for the cache to read.
+static void writeFile(const boost::filesystem::path& filename,
+	const std::string& content, const spy_string_sptr& ss)
+{
+	{
+		std::ofstream f(filename.string().c_str(), std::ios::binary);
+		f << content;
+	}
+	ss->truncate(0);
+	ss->seekp(0, stream::start);
+	ss->write(content);
+	ss->bytesRead = 0;
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(exception_reaches_caller)
+{
+	BOOST_TEST_MESSAGE("Exceptions from format checks reach the caller");
+
+	MapTypeVector types;
+	types.push_back(MapTypePtr(new MapType_CComic()));
+	types.push_back(MapTypePtr(new MapType_Throw()));
+	types.push_back(MapTypePtr(new MapType_CComic()));
+	Detector detector(types);
+	stream::string_sptr ss = createMap();
+	Probe probe(ss);
+
+	unsigned int threads[] = {1, 2, 4};
+	for (unsigned int t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+		// Checking every format must reach the one that fails
+		BOOST_CHECK_THROW(
+			detector.detect(ss, probe, std::string(), threads[t], false),
+			std::runtime_error
+		);
+
+		// Checking in turn stops at the first format, which is certain, so the
+		// failure must not be reported even if another thread got to it
+		DetectMatchVector matches;
+		BOOST_CHECK_NO_THROW(
+			matches = detector.detect(ss, probe, std::string(), threads[t], true)
+		);
+		BOOST_CHECK_EQUAL(matches.size(), 1);
+	}
+}
+
+BOOST_AUTO_TEST_CASE(cache_skips_unchanged_file)
+{
+	BOOST_TEST_MESSAGE("Cache does not read unchanged files on disk again");
+
+	TempPath dir;
+	boost::filesystem::create_directory(dir.path);
+	boost::filesystem::path filename = dir.path / "level.pt";
+	spy_string_sptr ss(new spy_string());
+	DetectCache cache(getManager(), (dir.path / "cache").string());
+
+	// Each version of the level is the same size, and is saved over the last
+	// without touching the times by hand, as a game or editor would.
+	std::string versions[3];
+	for (unsigned int v = 0; v < 3; v++) {
+		versions[v] = mapContent;
+		versions[v][4] = '\x10' + v;
+	}
+	unsigned int misses = 0;
+
+	// A file rewritten moments after it was checked, likely within the same
+	// second, must be read again.
+	for (unsigned int v = 0; v < 2; v++) {
+		writeFile(filename, versions[v], ss);
+		cache.detect(ss, filename.string());
+		BOOST_CHECK_EQUAL(cache.getMisses(), ++misses);
+		BOOST_CHECK_GE(ss->bytesRead, versions[v].length());
+	}
+
+	// Once the file is old enough its hash is saved, then used from then on
+	boost::filesystem::last_write_time(filename,
+		boost::filesystem::last_write_time(filename) - 60);
+	ss->bytesRead = 0;
+	DetectMatchVector first = cache.detect(ss, filename.string());
+	BOOST_CHECK_EQUAL(cache.getHits(), 1);
+	BOOST_CHECK_GE(ss->bytesRead, versions[1].length());
+
+	ss->bytesRead = 0;
+	DetectMatchVector second = cache.detect(ss, filename.string());
+	BOOST_CHECK_EQUAL(cache.getHits(), 2);
+#if defined(HAVE_SYS_STAT_H) && defined(HAVE_STRUCT_STAT_ST_MTIM) \
+	&& defined(HAVE_STRUCT_STAT_ST_CTIM)
+	BOOST_CHECK_EQUAL(ss->bytesRead, 0);
+#endif
+	BOOST_REQUIRE_EQUAL(first.size(), second.size());
+	for (unsigned int i = 0; i < first.size(); i++) {
+		BOOST_CHECK_EQUAL(first[i].type->getMapCode(),
+			second[i].type->getMapCode());
+	}
+
+	// Saving over the old file gives it new times, so it is read again
+	writeFile(filename, versions[2], ss);
+	cache.detect(ss, filename.string());
+	BOOST_CHECK_EQUAL(cache.getMisses(), ++misses);
+	BOOST_CHECK_GE(ss->bytesRead, versions[2].length());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
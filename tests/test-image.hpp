@@ -0,0 +1,136 @@
+/**
+ * @file  test-image.hpp
+ * @brief In-memory images for testing code that draws or measures tiles.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _CAMOTO_GAMEMAPS_TEST_IMAGE_HPP_
+#define _CAMOTO_GAMEMAPS_TEST_IMAGE_HPP_
+
+#include <camoto/gamegraphics/image.hpp>
+#include <camoto/gamemaps/map2d.hpp>
+#include "map2d-generic.hpp"
+
+/// Image of any size, with a pixel pattern worked out from a seed.
+/**
+ * Every fifth pixel along each diagonal is transparent, so both the pixel
+ * and mask data are different for each image.
+ */
+class FakeImage: virtual public camoto::gamegraphics::Image
+{
+	public:
+		FakeImage(unsigned int width, unsigned int height, unsigned int seed)
+			:	width(width),
+				height(height),
+				seed(seed)
+		{
+		}
+
+		virtual int getCaps()
+		{
+			return 0;
+		}
+
+		virtual void getDimensions(unsigned int *width, unsigned int *height)
+		{
+			*width = this->width;
+			*height = this->height;
+			return;
+		}
+
+		virtual void setDimensions(unsigned int width, unsigned int height)
+		{
+			this->width = width;
+			this->height = height;
+			return;
+		}
+
+		virtual camoto::gamegraphics::StdImageDataPtr toStandard()
+		{
+			camoto::gamegraphics::StdImageDataPtr data(
+				new uint8_t[this->width * this->height]);
+			for (unsigned int i = 0; i < this->width * this->height; i++) {
+				data[i] = 1 + (i * 7 + this->seed * 13) % 200;
+			}
+			return data;
+		}
+
+		virtual camoto::gamegraphics::StdImageDataPtr toStandardMask()
+		{
+			camoto::gamegraphics::StdImageDataPtr data(
+				new uint8_t[this->width * this->height]);
+			for (unsigned int y = 0; y < this->height; y++) {
+				for (unsigned int x = 0; x < this->width; x++) {
+					data[y * this->width + x] = ((x + y + this->seed) % 5 == 0)
+						? camoto::gamegraphics::Image::Mask_Vis_Transparent
+						: camoto::gamegraphics::Image::Mask_Vis_Opaque;
+				}
+			}
+			return data;
+		}
+
+		virtual void fromStandard(camoto::gamegraphics::StdImageDataPtr newContent,
+			camoto::gamegraphics::StdImageDataPtr newMask)
+		{
+			return;
+		}
+
+	protected:
+		unsigned int width;  ///< Image width, in pixels
+		unsigned int height; ///< Image height, in pixels
+		unsigned int seed;   ///< Value the pixel pattern is based on
+};
+
+/// Layer whose tile images come from FakeImage instead of a tileset.
+/**
+ * An item with code N uses an image (N * 8 - 3) pixels square, i.e. N tiles
+ * square once rounded up to the 8x8 tile size.  Code 0 has no image.
+ */
+class FakeImageLayer: virtual public camoto::gamemaps::GenericMap2D::Layer
+{
+	public:
+		FakeImageLayer(unsigned int width, unsigned int height,
+			camoto::gamemaps::Map2D::Layer::ItemPtrVectorPtr& items,
+			camoto::gamemaps::Map2D::Layer::ItemPtrVectorPtr& validItems)
+			:	camoto::gamemaps::GenericMap2D::Layer("Fake",
+					camoto::gamemaps::Map2D::Layer::HasOwnTileSize,
+					width, height, 8, 8, items, validItems)
+		{
+		}
+
+		FakeImageLayer(unsigned int width, unsigned int height,
+			camoto::gamemaps::TileGridPtr& grid,
+			camoto::gamemaps::Map2D::Layer::ItemPtrVectorPtr& validItems)
+			:	camoto::gamemaps::GenericMap2D::Layer("Fake",
+					camoto::gamemaps::Map2D::Layer::HasOwnTileSize,
+					width, height, 8, 8, grid, validItems)
+		{
+		}
+
+		virtual camoto::gamemaps::Map2D::Layer::ImageType imageFromCode(
+			const camoto::gamemaps::Map2D::Layer::ItemPtr& item,
+			const camoto::gamemaps::TilesetCollectionPtr& tileset,
+			camoto::gamegraphics::ImagePtr *out) const
+		{
+			if (item->code == 0) return camoto::gamemaps::Map2D::Layer::Blank;
+			unsigned int size = item->code * 8 - 3;
+			out->reset(new FakeImage(size, size, item->code));
+			return camoto::gamemaps::Map2D::Layer::Supplied;
+		}
+};
+
+#endif // _CAMOTO_GAMEMAPS_TEST_IMAGE_HPP_
@@ -0,0 +1,133 @@
+/**
+ * @file  test-layer.cpp
+ * @brief Test code for looking up items in a GenericMap2D::Layer.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include "test-image.hpp"
+
+using namespace camoto;
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_layer)
+
+/// Tile codes placed in the test layers, see FakeImageLayer for the sizes.
+static const struct {
+	unsigned int x;
+	unsigned int y;
+	unsigned int code;
+} layerContent[] = {
+	{ 5, 0, 4}, // 4x4 tiles, reaches down to y=3
+	{ 2, 2, 3}, // 3x3 tiles, reaches across to x=4 and down to y=4
+	{ 0, 6, 2}, // 2x2 tiles, stops at x=1
+	{10,10, 1}, // one tile
+};
+
+static Map2D::LayerPtr createItemLayer()
+{
+	Map2D::Layer::ItemPtrVectorPtr items(new Map2D::Layer::ItemPtrVector());
+	for (unsigned int i = 0; i < sizeof(layerContent) / sizeof(layerContent[0]); i++) {
+		Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+		item->type = Map2D::Layer::Item::Default;
+		item->x = layerContent[i].x;
+		item->y = layerContent[i].y;
+		item->code = layerContent[i].code;
+		items->push_back(item);
+	}
+	Map2D::Layer::ItemPtrVectorPtr validItems(new Map2D::Layer::ItemPtrVector());
+	return Map2D::LayerPtr(new FakeImageLayer(20, 20, items, validItems));
+}
+
+static Map2D::LayerPtr createGridLayer()
+{
+	TileGridPtr grid(new TileGrid(20, 20));
+	for (unsigned int i = 0; i < sizeof(layerContent) / sizeof(layerContent[0]); i++) {
+		grid->codes[grid->index(layerContent[i].x, layerContent[i].y)] =
+			layerContent[i].code;
+	}
+	Map2D::Layer::ItemPtrVectorPtr validItems(new Map2D::Layer::ItemPtrVector());
+	return Map2D::LayerPtr(new FakeImageLayer(20, 20, grid, validItems));
+}
+
+/// Get the codes of the items in the area, in the order they were returned.
+static std::vector<unsigned int> codesInRect(const Map2D::LayerPtr& layer,
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	TilesetCollectionPtr tilesets(new TilesetCollection());
+	Map2D::Layer::ItemPtrVectorPtr found = layer->getItemsInRect(x, y, width,
+		height, tilesets);
+	std::vector<unsigned int> codes;
+	for (Map2D::Layer::ItemPtrVector::const_iterator i = found->begin();
+		i != found->end();
+		i++
+	) {
+		codes.push_back((*i)->code);
+	}
+	return codes;
+}
+
+static void checkOverhangs(const Map2D::LayerPtr& layer)
+{
+	// Items above and to the left of the area that reach into it
+	std::vector<unsigned int> codes = codesInRect(layer, 4, 3, 2, 2);
+	BOOST_REQUIRE_EQUAL(codes.size(), 2);
+	BOOST_CHECK_EQUAL(codes[0], 4); // from above
+	BOOST_CHECK_EQUAL(codes[1], 3); // from above and to the left
+
+	// Just past the bottom-right corner of the 3x3 item
+	codes = codesInRect(layer, 5, 5, 1, 1);
+	BOOST_CHECK(codes.empty());
+
+	// Just past the right edge of the 2x2 item
+	codes = codesInRect(layer, 2, 7, 3, 1);
+	BOOST_CHECK(codes.empty());
+
+	// Bottom-right corner of the 2x2 item only
+	codes = codesInRect(layer, 1, 7, 1, 1);
+	BOOST_REQUIRE_EQUAL(codes.size(), 1);
+	BOOST_CHECK_EQUAL(codes[0], 2);
+
+	// Items starting inside the area are returned as before
+	codes = codesInRect(layer, 10, 10, 5, 5);
+	BOOST_REQUIRE_EQUAL(codes.size(), 1);
+	BOOST_CHECK_EQUAL(codes[0], 1);
+
+	// The same item is returned as getItemAt() gives
+	TilesetCollectionPtr tilesets(new TilesetCollection());
+	Map2D::Layer::ItemPtrVectorPtr found = layer->getItemsInRect(4, 4, 1, 1,
+		tilesets);
+	BOOST_REQUIRE_EQUAL(found->size(), 1);
+	BOOST_CHECK(found->at(0) == layer->getItemAt(2, 2));
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(items_overhanging_rect)
+{
+	BOOST_TEST_MESSAGE("Finding large items that start outside the area");
+
+	checkOverhangs(createItemLayer());
+}
+
+BOOST_AUTO_TEST_CASE(grid_overhanging_rect)
+{
+	BOOST_TEST_MESSAGE("Finding large grid tiles that start outside the area");
+
+	checkOverhangs(createGridLayer());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -185,6 +185,7 @@ class test_map_bash: public test_map2d
 		test_map_bash()
 		{
 			this->type = "map-bash";
+			this->sharedItems = true;
 			this->pxWidth = 16 * 16;
 			this->pxHeight = 2 * 16;
 			this->numLayers = 5;
@@ -30,6 +30,7 @@ class test_map_ccaves: public test_map2d
 		test_map_ccaves()
 		{
 			this->type = "map-ccaves";
+			this->sharedItems = true;
 			this->pxWidth = 40 * 16;
 			this->pxHeight = 17 * 16;
 			this->numLayers = 2;
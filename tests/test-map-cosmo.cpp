@@ -26,6 +26,7 @@ class test_map_cosmo: public test_map2d
 		test_map_cosmo()
 		{
 			this->type = "map-cosmo";
+			this->sharedItems = true;
 			this->pxWidth = 64 * 8;
 			this->pxHeight = 512 * 8;
 			this->numLayers = 2;
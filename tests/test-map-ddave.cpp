@@ -26,6 +26,7 @@ class test_map_ddave: public test_map2d
 		test_map_ddave()
 		{
 			this->type = "map-ddave";
+			this->sharedItems = true;
 			this->pxWidth = 100 * 16;
 			this->pxHeight = 10 * 16;
 			this->numLayers = 1;
@@ -26,9 +26,11 @@ class test_map_got: public test_map2d
 		test_map_got()
 		{
 			this->type = "map-got";
+			this->sharedItems = true;
 			this->pxWidth = 20 * 16 * 10;
 			this->pxHeight = 12 * 16 * 12;
 			this->numLayers = 5;
+			this->partialOpen = true;
 			this->mapCode[0].code = 256 + 0x03;
 			this->mapCode[1].code = 0x88;
 			this->mapCode[2].code = 0xB0;
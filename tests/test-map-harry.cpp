@@ -26,6 +26,7 @@ class test_map_harry: public test_map2d
 		test_map_harry()
 		{
 			this->type = "map-harry";
+			this->sharedItems = true;
 			this->pxWidth = 4 * 16;
 			this->pxHeight = 4 * 16;
 			this->numLayers = 3;
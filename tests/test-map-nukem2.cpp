@@ -20,12 +20,113 @@
 
 #include "test-map2d.hpp"
 
+/// Compress the extra bits the way earlier versions of the library did.
+/**
+ * This is the original encoder, kept to check that the current one still
+ * produces exactly the same data.
+ */
+static std::string oldEncodeExtra(const std::vector<int>& rawExtra)
+{
+	std::vector<int> rleExtra;
+	std::vector<int> diffCount;
+	std::vector<int>::const_iterator i = rawExtra.begin();
+	int lastByte = *i;
+	int lastByteCount = 1;
+	i++;
+	for (; i != rawExtra.end(); i++) {
+		if (lastByte == *i) {
+			while (!diffCount.empty()) {
+				std::vector<int>::iterator end;
+				int len;
+				if (diffCount.size() > 0x7F) {
+					len = 0x7F;
+					end = diffCount.begin() + 0x7F;
+				} else {
+					len = diffCount.size();
+					end = diffCount.end();
+				}
+				rleExtra.push_back(0x100 - len);
+				rleExtra.insert(rleExtra.end(), diffCount.begin(), end);
+				diffCount.erase(diffCount.begin(), end);
+			}
+			lastByteCount++;
+		} else {
+			if (lastByteCount > 1) {
+				while (lastByteCount > 0) {
+					int amt = std::min(0x7F, lastByteCount);
+					rleExtra.push_back(amt);
+					rleExtra.push_back(lastByte);
+					lastByteCount -= amt;
+				}
+			} else {
+				diffCount.push_back(lastByte);
+			}
+			lastByte = *i;
+			lastByteCount = 1;
+		}
+	}
+	while (!diffCount.empty()) {
+		std::vector<int>::iterator end;
+		int len;
+		if (diffCount.size() > 0x80) {
+			len = 0x80;
+			end = diffCount.begin() + 0x80;
+		} else {
+			len = diffCount.size();
+			end = diffCount.end();
+		}
+		rleExtra.push_back(0x100 - len);
+		rleExtra.insert(rleExtra.end(), diffCount.begin(), end);
+		diffCount.erase(diffCount.begin(), end);
+	}
+	if ((lastByte != 0x00) && (lastByteCount > 0)) {
+		while (lastByteCount > 0) {
+			int amt = std::min(0x7F, lastByteCount);
+			rleExtra.push_back(amt);
+			rleExtra.push_back(lastByte);
+			lastByteCount -= amt;
+		}
+	}
+	rleExtra.push_back(0x00);
+	rleExtra.push_back(0x00);
+
+	std::string out;
+	out += (char)(rleExtra.size() & 0xFF);
+	out += (char)(rleExtra.size() >> 8);
+	for (std::vector<int>::iterator i = rleExtra.begin(); i != rleExtra.end(); i++) {
+		out += (char)*i;
+	}
+	return out;
+}
+
+/// Build a map where every cell has both layers, with the given extra bits.
+static std::string mapWithExtra(const std::vector<int>& rawExtra)
+{
+	std::string tiles;
+	for (unsigned int i = 0; i < 65500 / 2; i++) tiles.append("\x01\x80", 2);
+	return STRING_WITH_NULLS(
+		"\x35\x00"
+		"czone1.mni  \0"
+		"drop1.mni   \0"
+		"demosong.imf\0"
+		"\x01\x02\x00\x00"
+		"\x03\x00" /* Actor ints */
+		"\x02\x00\x00\x00\x00\x00"
+		"\x40\x00" /* Map width */
+	) + tiles + oldEncodeExtra(rawExtra) + STRING_WITH_NULLS(
+		"attrfile.mni\0"
+		"tile.mni\0\0\0\0\0"
+		"maskfile.mni\0"
+	);
+}
+
 class test_map_nukem2: public test_map2d
 {
 	public:
 		test_map_nukem2()
 		{
 			this->type = "map-nukem2";
+			this->sharedItems = true;
 			this->pxWidth = 64 * 8;
 			this->pxHeight = 511 * 8;
 			this->numLayers = 3;
@@ -140,6 +241,35 @@ class test_map_nukem2: public test_map2d
 				"attrfile.mni\0"
 				"tile.mni\0\0\0\0\0"
 			));
+
+			// Extra bits must be compressed exactly as before.  The blocks of
+			// differing bytes and runs here are longer than a single code can hold.
+			std::vector<int> noisy, runs, tail;
+			unsigned int seed = 1;
+			for (unsigned int i = 0; i < 65500 / 8; i++) {
+				seed = seed * 1103515245 + 12345;
+				noisy.push_back((seed >> 16) & 0xFF);
+			}
+			while (runs.size() < 65500 / 8) {
+				seed = seed * 1103515245 + 12345;
+				unsigned int len = 1 + ((seed >> 16) % 300);
+				int value = (seed >> 8) & 0xFF;
+				for (unsigned int i = 0; (i < len) && (runs.size() < 65500 / 8); i++) {
+					runs.push_back(value);
+				}
+			}
+			// Block of exactly 0x80 differing bytes at the end
+			tail.assign(65500 / 8 - 0x80, 0x00);
+			for (int i = 0; i < 0x80; i++) tail.push_back(i + 1);
+
+			// c06: Noisy extra bits
+			this->conversion(mapWithExtra(noisy), mapWithExtra(noisy));
+
+			// c07: Extra bits in runs
+			this->conversion(mapWithExtra(runs), mapWithExtra(runs));
+
+			// c08: Extra bits ending in differing bytes
+			this->conversion(mapWithExtra(tail), mapWithExtra(tail));
 		}
 
 		virtual std::string initialstate()
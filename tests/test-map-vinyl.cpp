@@ -26,6 +26,7 @@ class test_map_vinyl: public test_map2d
 		test_map_vinyl()
 		{
 			this->type = "map-vinyl";
+			this->sharedItems = true;
 			this->pxWidth = 5 * 16;
 			this->pxHeight = 4 * 16;
 			this->numLayers = 2;
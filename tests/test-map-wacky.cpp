@@ -45,6 +45,7 @@ class test_map_wacky: public test_map2d
 		test_map_wacky()
 		{
 			this->type = "map-wacky";
+			this->sharedItems = true;
 			this->pxWidth = 64 * 32;
 			this->pxHeight = 64 * 32;
 			this->numLayers = 1;
@@ -26,6 +26,7 @@ class test_map_wordresc: public test_map2d
 		test_map_wordresc()
 		{
 			this->type = "map-wordresc";
+			this->sharedItems = true;
 			this->pxWidth = 3 * 16;
 			this->pxHeight = 5 * 16;
 			this->numLayers = 4;
@@ -207,6 +208,39 @@ class test_map_wordresc: public test_map2d
 				"\x08\x74\x01\x73"
 				"\x0a\x20"
 			));
+
+			// 01: Runs too long for one count are split as before
+			std::string longRuns = STRING_WITH_NULLS(
+				"\x10\x00" "\x11\x00"
+				"\x04\x00"
+				"\x02\x00"
+				"\x03\x00"
+				"\x02\x00" "\x04\x00"
+				"\x06\x00" "\x08\x00"
+				"\x01\x00" /* Gruzzle count */
+				"\x00\x00" "\x04\x00"
+				"\x01\x00" /* Drip count */
+				"\x02\x00" "\x04\x00" "\x44\x00"
+				"\x01\x00" /* Slime bucket count */
+				"\x01\x00" "\x04\x00"
+				"\x02\x00" /* Book count */
+				"\x02\x00" "\x04\x00"
+				"\x02\x00" "\x03\x00"
+				"\x00\x00" "\x00\x00" /* Letter 1 */
+				"\x01\x00" "\x00\x00"
+				"\x02\x00" "\x00\x00"
+				"\x00\x00" "\x01\x00"
+				"\x01\x00" "\x01\x00"
+				"\x02\x00" "\x01\x00"
+				"\x00\x00" "\x02\x00"
+				"\x01\x00" /* Anim count */
+				"\x01\x00" "\x01\x00"
+				"\x01\x00" /* FG tiles */
+				"\x02\x00" "\x02\x00"
+				"\xFF\x02\x11\x02"
+				"\xFF\x73\xFF\x73\xFF\x73\xFF\x73\x44\x73" /* attribute layer */
+			);
+			this->conversion(longRuns, longRuns);
 		}
 
 		virtual std::string initialstate()
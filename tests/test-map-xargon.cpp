@@ -51,10 +51,13 @@ class test_map_xargon: public test_map2d
 		test_map_xargon()
 		{
 			this->type = "map-xargon";
+			this->sharedItems = true;
 			this->pxWidth = 128 * 16;
 			this->pxHeight = 64 * 16;
 			this->numLayers = 2;
-			this->mapCode[0].code = 0x01;
+			this->partialOpen = true;
+			this->mapCode[0].y = 7;
+			this->mapCode[0].code = 0x08;
 			this->mapCode[1].code = 0x01;
 			this->suppResult[SuppItem::Extra1].reset(new test_suppx1_map_xargon());
 			this->skipInstDetect.push_back("map-wordresc");
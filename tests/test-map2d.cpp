@@ -18,9 +18,16 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <algorithm>
 #include <iomanip>
+#include <fstream>
+#include <iterator>
+#include <set>
 #include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
 #include <camoto/util.hpp>
+#include "map2d-generic.hpp"
 #include "test-map2d.hpp"
 
 using namespace camoto;
@@ -39,6 +46,22 @@ using namespace camoto::gamemaps;
 		} \
 	}
 
+/// Number of bytes from the first to the last that differ between a and b.
+/**
+ * @return The length of b if the lengths are different, as the whole thing
+ *   has to be rewritten.
+ */
+static stream::len changedSpan(const std::string& a, const std::string& b)
+{
+	if (a.length() != b.length()) return b.length();
+	std::string::size_type first = 0;
+	while ((first < a.length()) && (a[first] == b[first])) first++;
+	if (first == a.length()) return 0;
+	std::string::size_type last = a.length() - 1;
+	while (a[last] == b[last]) last--;
+	return last - first + 1;
+}
+
 test_map2d::test_map2d()
 	:	init(false),
 		numIsInstanceTests(0),
@@ -54,16 +77,33 @@ test_map2d::test_map2d()
 		this->mapCode[i].code = -1;
 	}
 	this->written = true;
+	this->partialOpen = false;
+	this->sharedItems = false;
 }
 
 void test_map2d::addTests()
 {
 	ADD_MAP2D_TEST(&test_map2d::test_isinstance_others);
+	ADD_MAP2D_TEST(&test_map2d::test_isinstance_truncated);
+	ADD_MAP2D_TEST(&test_map2d::test_detect);
+	ADD_MAP2D_TEST(&test_map2d::test_detect_threads);
+	ADD_MAP2D_TEST(&test_map2d::test_detect_cache);
 	ADD_MAP2D_TEST(&test_map2d::test_getsize);
 	ADD_MAP2D_TEST(&test_map2d::test_read);
 	ADD_MAP2D_TEST(&test_map2d::test_write);
+	ADD_MAP2D_TEST(&test_map2d::test_write_items);
+	ADD_MAP2D_TEST(&test_map2d::test_write_files);
+	ADD_MAP2D_TEST(&test_map2d::test_write_failure);
+	ADD_MAP2D_TEST(&test_map2d::test_write_files_failure);
+	ADD_MAP2D_TEST(&test_map2d::test_write_changes);
+	ADD_MAP2D_TEST(&test_map2d::test_getitemat);
+	ADD_MAP2D_TEST(&test_map2d::test_getitemat_grid);
+	ADD_MAP2D_TEST(&test_map2d::test_read_mmap);
+	ADD_MAP2D_TEST(&test_map2d::test_lazy_layers);
+	ADD_MAP2D_TEST(&test_map2d::test_open_region);
 	ADD_MAP2D_TEST(&test_map2d::test_codelist);
 	ADD_MAP2D_TEST(&test_map2d::test_codelist_valid);
+	ADD_MAP2D_TEST(&test_map2d::test_codelist_copy);
 	return;
 }
 
@@ -272,6 +312,139 @@ void test_map2d::test_isinstance_others()
 	return;
 }
 
+void test_map2d::test_isinstance_truncated()
+{
+	// Make sure no format throws an exception when the file is cut short
+	BOOST_TEST_MESSAGE("isInstance check for truncated " << this->type
+		<< " content");
+	ManagerPtr pManager(camoto::gamemaps::getManager());
+	std::string content = this->initialstate();
+	std::string::size_type cuts[] = {
+		0, 1, 2, 3, 5, content.length() / 2, content.length() - 1
+	};
+	for (unsigned int c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+		if (cuts[c] >= content.length()) continue;
+		stream::string_sptr ss(new stream::string());
+		ss << content.substr(0, cuts[c]);
+		Probe probe(ss);
+
+		MapTypePtr pTestType;
+		for (int i = 0; (pTestType = pManager->getMapType(i)); i++) {
+			BOOST_CHECK_NO_THROW(pTestType->isInstance(probe));
+		}
+	}
+}
+
+void test_map2d::test_detect()
+{
+	// The Detector must find exactly the formats that checking every one would
+	BOOST_TEST_MESSAGE("Detector matches isInstance for " << this->type);
+	ManagerPtr pManager(camoto::gamemaps::getManager());
+	Detector detector(pManager);
+	stream::string_sptr ss(new stream::string());
+	ss << this->initialstate();
+	Probe probe(ss);
+
+	DetectMatchVector matches = detector.detect(ss, probe, std::string());
+	std::set<std::string> detected;
+	for (DetectMatchVector::const_iterator i = matches.begin();
+		i != matches.end(); i++
+	) {
+		detected.insert(i->type->getMapCode());
+		BOOST_CHECK_EQUAL(i->certainty, i->type->isInstance(probe));
+		if (i != matches.begin()) {
+			BOOST_CHECK_MESSAGE((i - 1)->certainty >= i->certainty,
+				"Detector did not return the most certain matches first");
+		}
+	}
+
+	MapTypePtr pTestType;
+	for (int i = 0; (pTestType = pManager->getMapType(i)); i++) {
+		bool match = pTestType->isInstance(probe) != MapType::DefinitelyNo;
+		BOOST_CHECK_MESSAGE(match == (detected.count(pTestType->getMapCode()) > 0),
+			"Detector and isInstance() disagree on " << pTestType->getMapCode());
+	}
+	BOOST_CHECK_MESSAGE(detected.count(this->type),
+		"Detector did not find " << this->type);
+}
+
+void test_map2d::test_detect_threads()
+{
+	// Checking formats on several threads must give the same result as
+	// checking them one after the other
+	BOOST_TEST_MESSAGE("Detecting " << this->type << " on multiple threads");
+	ManagerPtr pManager(camoto::gamemaps::getManager());
+	Detector detector(pManager);
+	stream::string_sptr ss(new stream::string());
+	ss << this->initialstate();
+	Probe probe(ss);
+
+	for (int stop = 0; stop < 2; stop++) {
+		DetectMatchVector expected = detector.detect(ss, probe, std::string(),
+			1, stop != 0);
+		unsigned int threads[] = {2, 4, 32};
+		for (unsigned int t = 0; t < sizeof(threads) / sizeof(threads[0]); t++) {
+			DetectMatchVector matches = detector.detect(ss, probe, std::string(),
+				threads[t], stop != 0);
+			BOOST_REQUIRE_EQUAL(matches.size(), expected.size());
+			for (unsigned int i = 0; i < matches.size(); i++) {
+				BOOST_CHECK_EQUAL(matches[i].type->getMapCode(),
+					expected[i].type->getMapCode());
+				BOOST_CHECK_EQUAL(matches[i].certainty, expected[i].certainty);
+			}
+		}
+	}
+
+	DetectMatchVector expected = detector.detect(ss, probe, std::string(), 1,
+		true);
+	DetectMatchVector matches = pManager->detect(ss, std::string());
+	BOOST_REQUIRE_EQUAL(matches.size(), expected.size());
+	for (unsigned int i = 0; i < matches.size(); i++) {
+		BOOST_CHECK_EQUAL(matches[i].type->getMapCode(),
+			expected[i].type->getMapCode());
+	}
+}
+
+void test_map2d::test_detect_cache()
+{
+	BOOST_TEST_MESSAGE("Detecting " << this->type << " through the cache");
+	ManagerPtr pManager(camoto::gamemaps::getManager());
+	TempPath dir("test-detect-cache-%%%%-%%%%");
+	{
+		DetectCache cache(pManager, dir.path.string());
+		stream::string_sptr ss(new stream::string());
+		ss << this->initialstate();
+
+		DetectMatchVector expected = pManager->detect(ss, std::string());
+		DetectMatchVector first = cache.detect(ss, std::string());
+		BOOST_CHECK_EQUAL(cache.getHits(), 0);
+		BOOST_CHECK_EQUAL(cache.getMisses(), 1);
+
+		// A second cache in the same folder must see the saved result
+		DetectCache cache2(pManager, dir.path.string());
+		DetectMatchVector second = cache2.detect(ss, std::string());
+		BOOST_CHECK_EQUAL(cache2.getHits(), 1);
+		BOOST_CHECK_EQUAL(cache2.getMisses(), 0);
+
+		BOOST_REQUIRE_EQUAL(first.size(), expected.size());
+		BOOST_REQUIRE_EQUAL(second.size(), expected.size());
+		for (unsigned int i = 0; i < expected.size(); i++) {
+			BOOST_CHECK_EQUAL(first[i].type->getMapCode(),
+				expected[i].type->getMapCode());
+			BOOST_CHECK_EQUAL(second[i].type->getMapCode(),
+				expected[i].type->getMapCode());
+			BOOST_CHECK_EQUAL(second[i].certainty, expected[i].certainty);
+		}
+
+		// Changing the content must not use the old result
+		ss->seekp(0, stream::end);
+		ss->write("\x00", 1);
+		cache2.detect(ss, std::string());
+		BOOST_CHECK_EQUAL(cache2.getHits(), 1);
+		BOOST_CHECK_EQUAL(cache2.getMisses(), 1);
+	}
+}
+
 void test_map2d::test_getsize()
 {
 	BOOST_TEST_MESSAGE("Getting map size");
@@ -348,13 +521,543 @@ void test_map2d::test_write()
 		"Error writing map to a file - data is different to original");
 }
 
+void test_map2d::test_write_items()
+{
+	BOOST_TEST_MESSAGE("Write map codes after accessing layer items");
+
+	// Retrieve the items in every layer, so any layers holding their tiles in a
+	// dense grid are converted to items before the map is written.
+	for (unsigned int l = 0; l < this->numLayers; l++) {
+		this->pMap->getLayer(l)->getAllItems();
+	}
+
+	this->base->truncate(0);
+
+	// Erase all the supp items
+	for (unsigned int i = 0; i < (unsigned int)SuppItem::MaxValue; i++) {
+		SuppItem::Type s = (SuppItem::Type)i;
+		if (this->suppResult[s]) {
+			this->suppData[s]->truncate(0);
+		}
+	}
+
+	this->pMapType->write(this->pMap, this->base, this->suppData);
+
+	BOOST_CHECK_MESSAGE(
+		this->is_content_equal(this->initialstate()),
+		"Error writing map to a file - data is different to original"
+	);
+
+	CHECK_ALL_SUPP_ITEMS(initialstate,
+		"Error writing map to a file - data is different to original");
+}
+
+/// Read an entire file into a string.
+static std::string readFile(const boost::filesystem::path& filename)
+{
+	std::ifstream f(filename.string().c_str(), std::ios::binary);
+	return std::string(std::istreambuf_iterator<char>(f),
+		std::istreambuf_iterator<char>());
+}
+
+void test_map2d::test_write_files()
+{
+	BOOST_TEST_MESSAGE("Write map to files on disk");
+
+	TempPath temp;
+	const boost::filesystem::path& dir = temp.path;
+	boost::filesystem::create_directory(dir);
+
+	boost::filesystem::path filename = dir / "map";
+	SuppFilenames suppFilenames;
+	for (unsigned int i = 0; i < (unsigned int)SuppItem::MaxValue; i++) {
+		SuppItem::Type s = (SuppItem::Type)i;
+		if (this->suppResult[s]) {
+			suppFilenames[s] = (dir / camoto::suppToString(s)).string();
+		}
+	}
+
+	// Replace an existing map file, which must keep its permissions
+	{
+		std::ofstream f(filename.string().c_str(), std::ios::binary);
+		f << "original";
+	}
+	const boost::filesystem::perms mode = boost::filesystem::owner_read
+		| boost::filesystem::owner_write | boost::filesystem::group_read;
+	boost::filesystem::permissions(filename, mode);
+
+	BOOST_REQUIRE_NO_THROW(
+		this->pMapType->writeFiles(this->pMap, filename.string(), suppFilenames);
+	);
+
+	BOOST_CHECK_MESSAGE(
+		this->is_equal(this->initialstate(), readFile(filename)),
+		"Error writing map to a file on disk - data is different to original"
+	);
+	unsigned int numFiles = 1;
+	for (SuppFilenames::const_iterator i = suppFilenames.begin();
+		i != suppFilenames.end(); i++
+	) {
+		numFiles++;
+		if (!this->suppResult[i->first]->written) continue;
+		BOOST_CHECK_MESSAGE(
+			this->is_equal(this->suppResult[i->first]->initialstate(),
+				readFile(i->second)),
+			"[SuppItem::" << camoto::suppToString(i->first) << "] "
+			"Error writing map to a file on disk - data is different to original"
+		);
+	}
+
+	// Make sure no temporary files were left behind
+	unsigned int numFound = std::distance(
+		boost::filesystem::directory_iterator(dir),
+		boost::filesystem::directory_iterator());
+	BOOST_CHECK_EQUAL(numFound, numFiles);
+
+	BOOST_CHECK_EQUAL(boost::filesystem::status(filename).permissions(), mode);
+}
+
+/// Write some text to a file, replacing it if it already exists.
+static void writeFile(const boost::filesystem::path& filename,
+	const std::string& content)
+{
+	std::ofstream f(filename.string().c_str(), std::ios::binary);
+	f.write(content.data(), content.length());
+	return;
+}
+
+void test_map2d::test_write_failure()
+{
+	BOOST_TEST_MESSAGE("Failing to write map leaves streams unchanged");
+
+	// Any map that is not a Map2D is rejected by every format
+	MapPtr badMap(new Map(Map::Attributes(), Map::GraphicsFilenames()));
+
+	stream::string_sptr output(new stream::string());
+	output << "original";
+	SuppData suppData;
+	for (unsigned int i = 0; i < (unsigned int)SuppItem::MaxValue; i++) {
+		SuppItem::Type s = (SuppItem::Type)i;
+		if (this->suppResult[s]) {
+			stream::string_sptr suppSS(new stream::string());
+			suppSS << "original supp";
+			suppData[s] = suppSS;
+		}
+	}
+
+	BOOST_CHECK_THROW(
+		this->pMapType->write(badMap, output, suppData),
+		stream::error
+	);
+
+	BOOST_CHECK_EQUAL(*output->str(), "original");
+	for (SuppData::iterator i = suppData.begin(); i != suppData.end(); i++) {
+		stream::string_sptr suppSS =
+			boost::dynamic_pointer_cast<stream::string>(i->second);
+		BOOST_CHECK_MESSAGE(*suppSS->str() == "original supp",
+			"[SuppItem::" << camoto::suppToString(i->first) << "] "
+			"Supp stream was changed by a failed write");
+	}
+}
+
+void test_map2d::test_write_files_failure()
+{
+	BOOST_TEST_MESSAGE("Failing to write map files leaves originals intact");
+
+	TempPath temp;
+	const boost::filesystem::path& dir = temp.path;
+	boost::filesystem::create_directory(dir);
+
+	boost::filesystem::path filename = dir / "map";
+	writeFile(filename, "original");
+	SuppFilenames suppFilenames;
+	for (unsigned int i = 0; i < (unsigned int)SuppItem::MaxValue; i++) {
+		SuppItem::Type s = (SuppItem::Type)i;
+		if (this->suppResult[s]) {
+			suppFilenames[s] = (dir / camoto::suppToString(s)).string();
+			writeFile(suppFilenames[s], "original supp");
+		}
+	}
+	unsigned int numFiles = 1 + suppFilenames.size();
+
+	// An error while encoding the map must not touch the files
+	MapPtr badMap(new Map(Map::Attributes(), Map::GraphicsFilenames()));
+	BOOST_CHECK_THROW(
+		this->pMapType->writeFiles(badMap, filename.string(), suppFilenames),
+		stream::error
+	);
+	BOOST_CHECK_EQUAL(readFile(filename), "original");
+	BOOST_CHECK_EQUAL(
+		std::distance(boost::filesystem::directory_iterator(dir),
+			boost::filesystem::directory_iterator()),
+		numFiles);
+
+	// Make the last file impossible to replace by putting a non-empty folder
+	// in its place, so the files renamed before it must be put back.
+	boost::filesystem::path blocked = suppFilenames.empty()
+		? filename : boost::filesystem::path(suppFilenames.rbegin()->second);
+	boost::filesystem::remove(blocked);
+	boost::filesystem::create_directory(blocked);
+	writeFile(blocked / "inside", "");
+
+	BOOST_CHECK_THROW(
+		this->pMapType->writeFiles(this->pMap, filename.string(), suppFilenames),
+		stream::error
+	);
+	if (blocked != filename) {
+		BOOST_CHECK_EQUAL(readFile(filename), "original");
+	}
+	for (SuppFilenames::const_iterator i = suppFilenames.begin();
+		i != suppFilenames.end(); i++
+	) {
+		if (i->second == blocked.string()) continue;
+		BOOST_CHECK_MESSAGE(readFile(i->second) == "original supp",
+			"[SuppItem::" << camoto::suppToString(i->first) << "] "
+			"File was not put back after a failed save");
+	}
+	BOOST_CHECK(boost::filesystem::is_directory(blocked));
+
+	// No temporary or backup files must be left behind
+	BOOST_CHECK_EQUAL(
+		std::distance(boost::filesystem::directory_iterator(dir),
+			boost::filesystem::directory_iterator()),
+		numFiles);
+}
+
+void test_map2d::test_write_changes()
+{
+	BOOST_TEST_MESSAGE("Write only the changed parts of a map");
+
+	// Save into streams that keep track of what is done to them
+	spy_string_sptr spyBase(new spy_string());
+	spyBase->write(this->initialstate());
+	this->base = spyBase;
+	std::map<SuppItem::Type, spy_string_sptr> spySupps;
+	for (SuppData::iterator i = this->suppData.begin();
+		i != this->suppData.end(); i++
+	) {
+		spy_string_sptr s(new spy_string());
+		s->write(this->suppResult[i->first]->initialstate());
+		s->bytesWritten = 0;
+		spySupps[i->first] = s;
+		i->second = s;
+	}
+	spyBase->bytesWritten = 0;
+
+	// Nothing has changed yet, so the data should be left as it was
+	this->pMapType->writeChanges(this->pMap, this->base, this->suppData);
+
+	BOOST_CHECK_MESSAGE(
+		this->is_content_equal(this->initialstate()),
+		"Error writing unchanged map - data is different to original"
+	);
+
+	CHECK_ALL_SUPP_ITEMS(initialstate,
+		"Error writing unchanged map - data is different to original");
+
+	BOOST_CHECK_EQUAL(spyBase->bytesWritten, 0);
+	for (std::map<SuppItem::Type, spy_string_sptr>::iterator i = spySupps.begin();
+		i != spySupps.end(); i++
+	) {
+		BOOST_CHECK_EQUAL(i->second->bytesWritten, 0);
+	}
+
+	// Change one tile to some other permitted code
+	Map2D::LayerPtr layer = this->pMap->getLayer(0);
+	Map2D::Layer::ItemPtr item = layer->getItemAt(this->mapCode[0].x,
+		this->mapCode[0].y);
+	BOOST_REQUIRE(item);
+	Map2D::Layer::ConstItemPtrVectorPtr validItems = layer->getValidItemList();
+	for (Map2D::Layer::ItemPtrVector::const_iterator i = validItems->begin();
+		i != validItems->end(); i++
+	) {
+		if ((*i)->code != item->code) {
+			item->code = (*i)->code;
+			break;
+		}
+	}
+
+	// Write the whole map out separately to find out what to expect.  This
+	// must not affect the copy kept for writeChanges().
+	stream::string_sptr expected(new stream::string());
+	SuppData expectedSuppData;
+	for (SuppData::iterator i = this->suppData.begin();
+		i != this->suppData.end(); i++
+	) {
+		expectedSuppData[i->first].reset(new stream::string());
+	}
+	this->pMapType->write(this->pMap, expected, expectedSuppData);
+
+	// This time the change should be patched into the existing data
+	std::string before = *spyBase->str();
+	stream::len written = spyBase->bytesWritten;
+	std::map<SuppItem::Type, std::string> beforeSupps;
+	std::map<SuppItem::Type, stream::len> writtenSupps;
+	for (std::map<SuppItem::Type, spy_string_sptr>::iterator i = spySupps.begin();
+		i != spySupps.end(); i++
+	) {
+		beforeSupps[i->first] = *i->second->str();
+		writtenSupps[i->first] = i->second->bytesWritten;
+		i->second->bytesRead = 0;
+	}
+	spyBase->bytesRead = 0;
+
+	this->pMapType->writeChanges(this->pMap, this->base, this->suppData);
+
+	BOOST_CHECK_MESSAGE(
+		this->is_content_equal(*expected->str()),
+		"Error writing changes to a map - data is different to a full write"
+	);
+	for (SuppData::iterator i = expectedSuppData.begin();
+		i != expectedSuppData.end(); i++
+	) {
+		if (!this->suppResult[i->first]->written) continue;
+		stream::string_sptr s =
+			boost::dynamic_pointer_cast<stream::string>(i->second);
+		BOOST_CHECK_MESSAGE(
+			this->is_supp_equal(i->first, *s->str()),
+			"[SuppItem::" << camoto::suppToString(i->first) << "] "
+			"Error writing changes to a map - data is different to a full write"
+		);
+	}
+
+	// The copy from the last save must have been used instead of reading the
+	// streams again, and only the area that changed may have been written.
+	BOOST_CHECK_EQUAL(spyBase->bytesRead, 0);
+	BOOST_CHECK_LE(spyBase->bytesWritten - written,
+		changedSpan(before, *spyBase->str()));
+	for (std::map<SuppItem::Type, spy_string_sptr>::iterator i = spySupps.begin();
+		i != spySupps.end(); i++
+	) {
+		BOOST_CHECK_EQUAL(i->second->bytesRead, 0);
+		BOOST_CHECK_LE(i->second->bytesWritten - writtenSupps[i->first],
+			changedSpan(beforeSupps[i->first], *i->second->str()));
+	}
+}
+
+void test_map2d::test_getitemat()
+{
+	BOOST_TEST_MESSAGE("Looking up map codes by location");
+
+	for (int l = 0; l < this->numLayers; l++) {
+		Map2D::LayerPtr layer = this->pMap->getLayer(l);
+		unsigned int x = this->mapCode[l].x;
+		unsigned int y = this->mapCode[l].y;
+
+		Map2D::Layer::ItemPtr item = layer->getItemAt(x, y);
+		BOOST_REQUIRE_MESSAGE(item,
+			"Unable to find first tile in layer " << l
+			<< " (counting from layer 0) at position " << x << "," << y);
+		BOOST_REQUIRE_EQUAL(item->code, this->mapCode[l].code);
+
+		Map2D::Layer::ItemPtrVectorPtr area = layer->getItemsInRect(x, y, 1, 1);
+		BOOST_REQUIRE_MESSAGE(
+			std::find(area->begin(), area->end(), item) != area->end(),
+			"getItemsInRect() did not return tile in layer " << l);
+
+		// Without any tilesets every item is one tile in size
+		TilesetCollectionPtr noTilesets(new TilesetCollection());
+		area = layer->getItemsInRect(x, y, 1, 1, noTilesets);
+		BOOST_REQUIRE_MESSAGE(
+			std::find(area->begin(), area->end(), item) != area->end(),
+			"getItemsInRect() with tileset did not return tile in layer " << l);
+
+		// Move the item past the edge of the existing items, to make sure the
+		// index is updated.
+		unsigned int newX = x + 1000, newY = y + 1000;
+		layer->moveItem(item, newX, newY);
+		BOOST_REQUIRE_MESSAGE(layer->getItemAt(newX, newY) == item,
+			"Unable to find moved tile in layer " << l);
+		BOOST_REQUIRE_MESSAGE(layer->getItemAt(x, y) != item,
+			"Moved tile still found at old location in layer " << l);
+	}
+}
+
+void test_map2d::test_getitemat_grid()
+{
+	BOOST_TEST_MESSAGE("Looking up map codes without converting tile grids");
+
+	for (int l = 0; l < this->numLayers; l++) {
+		boost::shared_ptr<GenericMap2D::Layer> layer =
+			boost::dynamic_pointer_cast<GenericMap2D::Layer>(
+				this->pMap->getLayer(l));
+		if (!layer || !layer->getTileGrid()) continue; // not a grid layer
+		unsigned int x = this->mapCode[l].x;
+		unsigned int y = this->mapCode[l].y;
+
+		Map2D::Layer::ItemPtr item = layer->getItemAt(x, y);
+		BOOST_REQUIRE(item);
+		Map2D::Layer::ItemPtrVectorPtr area = layer->getItemsInRect(x, y, 1, 1);
+		BOOST_REQUIRE_MESSAGE(area->size() == 1 && area->at(0) == item,
+			"getItemsInRect() did not return the same item as getItemAt() in "
+			"layer " << l);
+		TilesetCollectionPtr noTilesets(new TilesetCollection());
+		layer->getItemsInRect(0, 0, 8, 8, noTilesets);
+
+		const TileGridPtr& grid = layer->getTileGrid();
+		BOOST_REQUIRE_MESSAGE(grid,
+			"Looking up items discarded the tile grid in layer " << l);
+
+		// Changes to the returned item must end up in the grid, which is what
+		// the format writers read.
+		item->code++;
+		BOOST_REQUIRE_EQUAL(layer->getTileGrid()->codes[grid->index(x, y)],
+			this->mapCode[l].code + 1);
+		item->code--;
+
+		// Moving the item means the grid can no longer hold the layer
+		layer->moveItem(item, x + 1000, y + 1000);
+		BOOST_REQUIRE_MESSAGE(!layer->getTileGrid(),
+			"Tile grid still in use after moving an item in layer " << l);
+		BOOST_REQUIRE(layer->getItemAt(x + 1000, y + 1000) == item);
+	}
+}
+
+void test_map2d::test_read_mmap()
+{
+	BOOST_TEST_MESSAGE("Reading map from a memory-mapped file");
+
+	TempPath temp;
+	const boost::filesystem::path& filename = temp.path;
+	std::string content = this->initialstate();
+	{
+		std::ofstream f(filename.string().c_str(), std::ios::binary);
+		f.write(content.data(), content.length());
+	}
+
+	input_mmap_sptr input(new input_mmap(filename.string()));
+	BOOST_REQUIRE_EQUAL(input->size(), content.length());
+
+	MapPtr map;
+	BOOST_REQUIRE_NO_THROW(
+		map = this->pMapType->open(input, this->suppData);
+	);
+	// The file stays mapped after it has been deleted
+	boost::filesystem::remove(filename);
+
+	Map2DPtr map2d = boost::dynamic_pointer_cast<Map2D>(map);
+	BOOST_REQUIRE_MESSAGE(map2d, "Could not create map class");
+	for (int l = 0; l < this->numLayers; l++) {
+		Map2D::Layer::ItemPtr item = map2d->getLayer(l)->getItemAt(
+			this->mapCode[l].x, this->mapCode[l].y);
+		BOOST_REQUIRE_MESSAGE(item,
+			"Unable to find first tile in layer " << l
+			<< " (counting from layer 0) when read from a memory-mapped file");
+		BOOST_REQUIRE_EQUAL(item->code, this->mapCode[l].code);
+	}
+}
+
+/// Get every layer in a map, for test_lazy_layers().
+static void getAllLayers(Map2DPtr map, Map2D::LayerPtrVector *out)
+{
+	unsigned int layerCount = map->getLayerCount();
+	for (unsigned int l = 0; l < layerCount; l++) {
+		out->push_back(map->getLayer(l));
+	}
+	return;
+}
+
+void test_map2d::test_lazy_layers()
+{
+	BOOST_TEST_MESSAGE("Loading layers from multiple threads at once");
+
+	stream::string_sptr input(new stream::string());
+	input->write(this->initialstate());
+
+	MapPtr map;
+	BOOST_REQUIRE_NO_THROW(
+		map = this->pMapType->open(input, this->suppData);
+	);
+	Map2DPtr map2d = boost::dynamic_pointer_cast<Map2D>(map);
+	BOOST_REQUIRE_MESSAGE(map2d, "Could not create map class");
+
+	// Layers that have not been loaded yet must not depend on the input stream
+	input->truncate(0);
+
+	const unsigned int numThreads = 4;
+	Map2D::LayerPtrVector layers[numThreads];
+	boost::thread_group threads;
+	for (unsigned int t = 0; t < numThreads; t++) {
+		threads.create_thread(boost::bind(getAllLayers, map2d, &layers[t]));
+	}
+	threads.join_all();
+
+	for (unsigned int t = 0; t < numThreads; t++) {
+		BOOST_REQUIRE_EQUAL(layers[t].size(), map2d->getLayerCount());
+		for (unsigned int l = 0; l < layers[t].size(); l++) {
+			BOOST_REQUIRE_MESSAGE(layers[t][l] == layers[0][l],
+				"Layer " << l << " was loaded more than once");
+		}
+	}
+
+	for (int l = 0; l < this->numLayers; l++) {
+		Map2D::Layer::ItemPtr item = layers[0][l]->getItemAt(
+			this->mapCode[l].x, this->mapCode[l].y);
+		BOOST_REQUIRE_MESSAGE(item,
+			"Unable to find first tile in layer " << l
+			<< " (counting from layer 0) after loading it on demand");
+		BOOST_REQUIRE_EQUAL(item->code, this->mapCode[l].code);
+	}
+}
+
+void test_map2d::test_open_region()
+{
+	BOOST_TEST_MESSAGE("Opening a small region of a map");
+
+	unsigned int mapTileWidth, mapTileHeight;
+	this->pMap->getTileSize(&mapTileWidth, &mapTileHeight);
+
+	for (int l = 0; l < this->numLayers; l++) {
+		// Convert the layer coordinates into map tiles
+		Map2D::LayerPtr layer = this->pMap->getLayer(l);
+		unsigned int layerTileWidth = mapTileWidth;
+		unsigned int layerTileHeight = mapTileHeight;
+		if (layer->getCaps() & Map2D::Layer::HasOwnTileSize) {
+			layer->getTileSize(&layerTileWidth, &layerTileHeight);
+		}
+		MapRegion region;
+		region.x = this->mapCode[l].x * layerTileWidth / mapTileWidth;
+		region.y = this->mapCode[l].y * layerTileHeight / mapTileHeight;
+		region.width = 1;
+		region.height = 1;
+
+		stream::string_sptr input(new stream::string());
+		input->write(this->initialstate());
+		MapPtr map;
+		BOOST_REQUIRE_NO_THROW(
+			map = this->pMapType->openRegion(input, this->suppData, region);
+		);
+		Map2DPtr map2d = boost::dynamic_pointer_cast<Map2D>(map);
+		BOOST_REQUIRE_MESSAGE(map2d, "Could not create map class");
+		BOOST_REQUIRE_EQUAL(map2d->getLayerCount(), this->numLayers);
+
+		Map2D::Layer::ItemPtr item = map2d->getLayer(l)->getItemAt(
+			this->mapCode[l].x, this->mapCode[l].y);
+		BOOST_REQUIRE_MESSAGE(item,
+			"Unable to find first tile in layer " << l
+			<< " (counting from layer 0) when opening only the region around it");
+		BOOST_REQUIRE_EQUAL(item->code, this->mapCode[l].code);
+
+		if (this->partialOpen) {
+			// Make sure the rest of the map was skipped
+			unsigned int numFull = 0, numRegion = 0;
+			for (int m = 0; m < this->numLayers; m++) {
+				numFull += this->pMap->getLayer(m)->getAllItems()->size();
+				numRegion += map2d->getLayer(m)->getAllItems()->size();
+			}
+			BOOST_REQUIRE_MESSAGE(numRegion < numFull,
+				"Opening a region of the map loaded the entire map");
+		}
+	}
+}
+
 void test_map2d::test_codelist()
 {
 	BOOST_TEST_MESSAGE("Checking map codes are all in allowed tile list");
 	for (unsigned int l = 0; l < this->numLayers; l++) {
 		Map2D::LayerPtr layer = this->pMap->getLayer(l);
 		const Map2D::Layer::ItemPtrVectorPtr items = layer->getAllItems();
-		const Map2D::Layer::ItemPtrVectorPtr allowed = layer->getValidItemList();
+		Map2D::Layer::ConstItemPtrVectorPtr allowed = layer->getValidItemList();
 		for (Map2D::Layer::ItemPtrVector::const_iterator
 			i = items->begin(); i != items->end(); i++
 		) {
@@ -380,7 +1083,7 @@ void test_map2d::test_codelist_valid()
 	BOOST_TEST_MESSAGE("Checking allowed tile list is set up correctly");
 	for (unsigned int l = 0; l < this->numLayers; l++) {
 		Map2D::LayerPtr layer = this->pMap->getLayer(l);
-		const Map2D::Layer::ItemPtrVectorPtr allowed = layer->getValidItemList();
+		Map2D::Layer::ConstItemPtrVectorPtr allowed = layer->getValidItemList();
 		for (Map2D::Layer::ItemPtrVector::const_iterator
 			i = allowed->begin(); i != allowed->end(); i++
 		) {
@@ -394,3 +1097,50 @@ void test_map2d::test_codelist_valid()
 		}
 	}
 }
+
+void test_map2d::test_codelist_copy()
+{
+	BOOST_TEST_MESSAGE("Checking allowed tile list is only shared until changed");
+
+	stream::string_sptr input(new stream::string());
+	input->write(this->initialstate());
+	MapPtr map;
+	BOOST_REQUIRE_NO_THROW(
+		map = this->pMapType->open(input, this->suppData);
+	);
+	Map2DPtr other = boost::dynamic_pointer_cast<Map2D>(map);
+	BOOST_REQUIRE_MESSAGE(other, "Could not create map class");
+
+	unsigned int numShared = 0;
+	for (unsigned int l = 0; l < this->numLayers; l++) {
+		Map2D::LayerPtr layer = this->pMap->getLayer(l);
+		Map2D::LayerPtr otherLayer = other->getLayer(l);
+		Map2D::Layer::ConstItemPtrVectorPtr shared = layer->getValidItemList();
+		if (!shared || shared->empty()) continue;
+
+		// Reading the list must not copy it
+		BOOST_CHECK(layer->getValidItemList() == shared);
+		if (otherLayer->getValidItemList() == shared) numShared++;
+
+		Map2D::Layer::ItemPtrVectorPtr allowed = layer->getEditableValidItemList();
+		BOOST_REQUIRE(allowed);
+		BOOST_REQUIRE(allowed != shared);
+		unsigned int count = allowed->size();
+		BOOST_REQUIRE_EQUAL(count, shared->size());
+		unsigned int firstCode = allowed->at(0)->code;
+
+		// Change the list of one map, which must not affect the other
+		allowed->at(0)->code = firstCode + 1;
+		allowed->pop_back();
+		BOOST_CHECK(layer->getValidItemList() == allowed);
+
+		Map2D::Layer::ConstItemPtrVectorPtr otherAllowed =
+			otherLayer->getValidItemList();
+		BOOST_REQUIRE_EQUAL(otherAllowed->size(), count);
+		BOOST_CHECK_EQUAL(otherAllowed->at(0)->code, firstCode);
+	}
+	if (this->sharedItems) {
+		BOOST_CHECK_MESSAGE(numShared > 0,
+			"Valid item list was copied for each map instead of being shared");
+	}
+}
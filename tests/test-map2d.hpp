@@ -56,11 +56,26 @@ class test_map2d: public test_main
 		virtual void prepareTest();
 
 		void test_isinstance_others();
+		void test_isinstance_truncated();
+		void test_detect();
+		void test_detect_threads();
+		void test_detect_cache();
 		void test_getsize();
 		void test_read();
 		void test_write();
+		void test_write_items();
+		void test_write_files();
+		void test_write_failure();
+		void test_write_files_failure();
+		void test_write_changes();
+		void test_getitemat();
+		void test_getitemat_grid();
+		void test_read_mmap();
+		void test_lazy_layers();
+		void test_open_region();
 		void test_codelist();
 		void test_codelist_valid();
+		void test_codelist_copy();
 
 	protected:
 		/// Initial state.
@@ -198,6 +213,13 @@ class test_map2d: public test_main
 		/// Set to false if this instance is of a supp item and it is not written
 		/// out when saving a map.
 		bool written;
+
+		/// Set to true if MapType::openRegion() loads less than the whole map.
+		bool partialOpen;
+
+		/// Set to true if every map of this format is given the same list of
+		/// valid items for at least one layer, instead of building its own.
+		bool sharedItems;
 };
 
 /// Add a test_map2d member function to the test suite
@@ -0,0 +1,232 @@
+/**
+ * @file  test-render.cpp
+ * @brief Test code for drawing whole maps and parts of maps.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include <camoto/gamemaps/render.hpp>
+#include "test-image.hpp"
+
+using namespace camoto;
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_render)
+
+/// Map size, in 8x8 tiles.
+#define MAP_SIZE 20
+
+/// Tile code of each cell, see FakeImageLayer for the image sizes.
+/**
+ * Most cells have a one-tile image, with some empty cells, some with no
+ * image, and a few larger images that cover their neighbours and hang off
+ * the bottom and right of the map.
+ */
+static unsigned int cellCode(unsigned int x, unsigned int y)
+{
+	if ((x == 3) && (y == 4)) return 4;
+	if ((x == 18) && (y == 17)) return 3;
+	if ((x == 0) && (y == 12)) return 2;
+	unsigned int n = (x * 7 + y * 3) % 11;
+	if (n == 0) return INVALID_TILECODE;
+	if (n == 1) return 0;
+	return 1;
+}
+
+/// Tile code the background permits but does not use, larger than any used.
+#define VALID_CODE 5
+
+/// Create a map whose background layer is a grid, or a list of items.
+/**
+ * Both versions hold the same tiles, so they draw the same image.  A second
+ * layer of items on top covers part of the background.
+ */
+static Map2DPtr createMap(bool useGrid)
+{
+	Map2D::Layer::ItemPtrVectorPtr validItems(new Map2D::Layer::ItemPtrVector());
+	Map2D::Layer::ItemPtrVectorPtr validBackground(
+		new Map2D::Layer::ItemPtrVector());
+	Map2D::Layer::ItemPtr valid(new Map2D::Layer::Item());
+	valid->type = Map2D::Layer::Item::Default;
+	valid->x = valid->y = 0;
+	valid->code = VALID_CODE;
+	validBackground->push_back(valid);
+	Map2D::LayerPtrVector layers;
+
+	if (useGrid) {
+		TileGridPtr grid(new TileGrid(MAP_SIZE, MAP_SIZE));
+		for (unsigned int y = 0; y < MAP_SIZE; y++) {
+			for (unsigned int x = 0; x < MAP_SIZE; x++) {
+				grid->codes[grid->index(x, y)] = cellCode(x, y);
+			}
+		}
+		layers.push_back(Map2D::LayerPtr(
+			new FakeImageLayer(MAP_SIZE, MAP_SIZE, grid, validBackground)));
+	} else {
+		Map2D::Layer::ItemPtrVectorPtr items(new Map2D::Layer::ItemPtrVector());
+		for (unsigned int y = 0; y < MAP_SIZE; y++) {
+			for (unsigned int x = 0; x < MAP_SIZE; x++) {
+				unsigned int code = cellCode(x, y);
+				if (code == INVALID_TILECODE) continue;
+				Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+				item->type = Map2D::Layer::Item::Default;
+				item->x = x;
+				item->y = y;
+				item->code = code;
+				items->push_back(item);
+			}
+		}
+		layers.push_back(Map2D::LayerPtr(
+			new FakeImageLayer(MAP_SIZE, MAP_SIZE, items, validBackground)));
+	}
+
+	Map2D::Layer::ItemPtrVectorPtr sprites(new Map2D::Layer::ItemPtrVector());
+	for (unsigned int i = 0; i < 6; i++) {
+		Map2D::Layer::ItemPtr item(new Map2D::Layer::Item());
+		item->type = Map2D::Layer::Item::Default;
+		item->x = 2 + i * 3;
+		item->y = 1 + i * 2;
+		item->code = 1 + i % 3;
+		sprites->push_back(item);
+	}
+	layers.push_back(Map2D::LayerPtr(
+		new FakeImageLayer(MAP_SIZE, MAP_SIZE, sprites, validItems)));
+
+	return Map2DPtr(new GenericMap2D(Map::Attributes(), Map::GraphicsFilenames(),
+		Map2D::NoCaps, 0, 0, MAP_SIZE, MAP_SIZE, 8, 8, layers,
+		Map2D::PathPtrVectorPtr()));
+}
+
+/// Get the grid behind a map layer, or a null pointer if it has none.
+static TileGridPtr layerGrid(const Map2DPtr& map, unsigned int index)
+{
+	return boost::dynamic_pointer_cast<GenericMap2D::Layer>(
+		map->getLayer(index))->getTileGrid();
+}
+
+BOOST_AUTO_TEST_CASE(grid_matches_items)
+{
+	BOOST_TEST_MESSAGE("Grid layers draw the same as items and stay as a grid");
+
+	TilesetCollectionPtr tileset(new TilesetCollection());
+	Map2DRenderer renderer;
+
+	RenderedMap fromItems;
+	renderer.render(createMap(false), tileset, &fromItems);
+
+	Map2DPtr gridMap = createMap(true);
+	BOOST_REQUIRE(layerGrid(gridMap, 0));
+	RenderedMap fromGrid;
+	renderer.render(gridMap, tileset, &fromGrid);
+
+	BOOST_REQUIRE_EQUAL(fromGrid.width, MAP_SIZE * 8);
+	BOOST_REQUIRE_EQUAL(fromGrid.height, MAP_SIZE * 8);
+	BOOST_CHECK(fromGrid.pixels == fromItems.pixels);
+
+	// Drawing must not have turned the grid into items
+	BOOST_CHECK(layerGrid(gridMap, 0));
+
+	// Same again on several threads
+	RenderedMap threaded;
+	renderer.render(gridMap, tileset, &threaded, 4);
+	BOOST_CHECK(threaded.pixels == fromItems.pixels);
+	BOOST_CHECK(layerGrid(gridMap, 0));
+
+	// More threads than rows, and enough that four bands each would overflow
+	RenderedMap manyThreads;
+	renderer.render(gridMap, tileset, &manyThreads, 0x40000001);
+	BOOST_CHECK(manyThreads.pixels == fromItems.pixels);
+}
+
+/// Draw an area of a map and check it against the same area of a whole image.
+static void checkRegion(Map2DRenderer& renderer, const Map2DPtr& map,
+	const TilesetCollectionPtr& tileset, const RenderedMap& whole,
+	unsigned int x, unsigned int y, unsigned int width, unsigned int height)
+{
+	// Fill the image with a value that is not in any tile, and leave a gap at
+	// the end of each row so writes past the area can be seen.
+	unsigned int stride = width + 3;
+	std::vector<uint8_t> pixels(stride * height, 0xFF);
+	renderer.renderRegion(map, tileset, x, y, width, height, &pixels[0], stride);
+
+	for (unsigned int py = 0; py < height; py++) {
+		for (unsigned int px = 0; px < width; px++) {
+			BOOST_REQUIRE_MESSAGE(
+				pixels[py * stride + px] == whole.pixels[(y + py) * whole.width + x + px],
+				"Pixel " << x + px << "," << y + py << " differs in area " << x << ","
+				<< y << " size " << width << "x" << height);
+		}
+		for (unsigned int px = width; px < stride; px++) {
+			BOOST_REQUIRE_EQUAL(pixels[py * stride + px], 0xFF);
+		}
+	}
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(region_matches_render)
+{
+	BOOST_TEST_MESSAGE("Drawing part of a map gives the same area as render()");
+
+	TilesetCollectionPtr tileset(new TilesetCollection());
+	for (unsigned int useGrid = 0; useGrid < 2; useGrid++) {
+		Map2DPtr map = createMap(useGrid);
+		Map2DRenderer renderer;
+		RenderedMap whole;
+		renderer.render(map, tileset, &whole);
+
+		// The palette is the one render() uses
+		gamegraphics::PaletteTablePtr pal = renderer.getPalette(tileset);
+		BOOST_REQUIRE_EQUAL(pal->size(), whole.palette->size());
+		for (unsigned int i = 0; i < pal->size(); i++) {
+			BOOST_CHECK_EQUAL((int)pal->at(i).red, (int)whole.palette->at(i).red);
+			BOOST_CHECK_EQUAL((int)pal->at(i).green, (int)whole.palette->at(i).green);
+			BOOST_CHECK_EQUAL((int)pal->at(i).blue, (int)whole.palette->at(i).blue);
+			BOOST_CHECK_EQUAL((int)pal->at(i).alpha, (int)whole.palette->at(i).alpha);
+		}
+
+		checkRegion(renderer, map, tileset, whole, 0, 0, whole.width, whole.height);
+		checkRegion(renderer, map, tileset, whole, 0, 0, 13, 9);
+		checkRegion(renderer, map, tileset, whole, 37, 45, 1, 1);
+		checkRegion(renderer, map, tileset, whole, 3 * 8 + 5, 4 * 8 + 6, 20, 17);
+		checkRegion(renderer, map, tileset, whole, 61, 3, 50, 90);
+		checkRegion(renderer, map, tileset, whole, 130, 140, 30, 20);
+		if (useGrid) BOOST_CHECK(layerGrid(map, 0));
+
+		// The layer picks up a tile being changed into a larger image, which
+		// now reaches into an empty cell further away than any image did
+		// before.  The grid has to notice a code that is not a permitted item,
+		// an item list has to have it covered already.
+		Map2D::Layer::ItemPtr item = map->getLayer(0)->getItemAt(4, 4);
+		BOOST_REQUIRE(item);
+		BOOST_REQUIRE_EQUAL(item->code, 1);
+		unsigned int emptyX, emptyY;
+		if (useGrid) {
+			item->code = VALID_CODE + 1;
+			emptyX = 4;
+			emptyY = 9;
+		} else {
+			item->code = VALID_CODE;
+			emptyX = 6;
+			emptyY = 8;
+		}
+		BOOST_REQUIRE_EQUAL(cellCode(emptyX, emptyY), INVALID_TILECODE);
+		renderer.render(map, tileset, &whole);
+		checkRegion(renderer, map, tileset, whole, emptyX * 8, emptyY * 8, 8, 8);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
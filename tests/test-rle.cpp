@@ -0,0 +1,131 @@
+/**
+ * @file  test-rle.cpp
+ * @brief Test code for the run-length encodings shared by the formats.
+ *
+ * Copyright (C) 2010-2015 Adam Nielsen <malvineous@shikadi.net>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <boost/test/unit_test.hpp>
+#include "map2d-rle.hpp"
+
+using namespace camoto::gamemaps;
+
+BOOST_AUTO_TEST_SUITE(test_rle)
+
+/// Fill a buffer with runs of random length, some of them only one byte long.
+/**
+ * A fixed generator is used so any failure happens the same way every time.
+ */
+static void fillRuns(std::vector<uint8_t> *data, unsigned int seed)
+{
+	uint32_t state = seed * 2654435761u + 1;
+	for (unsigned int i = 0; i < data->size(); ) {
+		state = state * 1103515245 + 12345;
+		uint8_t value = (state >> 16) & 0x07;
+		state = state * 1103515245 + 12345;
+		unsigned int count = ((state >> 16) % 4 == 0) ? (state >> 20) % 300 : 1;
+		for (unsigned int j = 0; (j < count) && (i < data->size()); j++) {
+			(*data)[i++] = value;
+		}
+	}
+	return;
+}
+
+/// Byte-by-byte version of rleCountSame().
+static unsigned int countSame(const uint8_t *data, unsigned int len)
+{
+	unsigned int i = 1;
+	while ((i < len) && (data[i] == data[0])) i++;
+	return i;
+}
+
+/// Byte-by-byte version of rleCountDiff().
+static unsigned int countDiff(const uint8_t *data, unsigned int len)
+{
+	unsigned int i = 0;
+	while ((i + 1 < len) && (data[i] != data[i + 1])) i++;
+	return i;
+}
+
+BOOST_AUTO_TEST_CASE(count_matches_bytewise)
+{
+	BOOST_TEST_MESSAGE("Block compares give the same counts as byte compares");
+
+	// Long enough for a few AVX2 blocks, checked at every starting alignment
+	// and every length so each block size and the tail are all hit.
+	std::vector<uint8_t> data(200);
+	for (unsigned int seed = 0; seed < 20; seed++) {
+		fillRuns(&data, seed);
+		for (unsigned int start = 0; start < 32; start++) {
+			for (unsigned int len = 1; start + len <= data.size(); len++) {
+				const uint8_t *p = &data[start];
+				BOOST_REQUIRE_EQUAL(rleCountSame(p, len), countSame(p, len));
+				BOOST_REQUIRE_EQUAL(rleCountDiff(p, len), countDiff(p, len));
+			}
+		}
+	}
+
+	// A run that ends at each position within a block
+	for (unsigned int end = 1; end < 80; end++) {
+		std::vector<uint8_t> run(100, 0x42);
+		run[end] = 0x43;
+		BOOST_REQUIRE_EQUAL(rleCountSame(&run[0], run.size()), end);
+
+		// Differing bytes that stop at the same place
+		for (unsigned int i = 0; i < run.size(); i++) run[i] = i;
+		run[end] = run[end - 1];
+		BOOST_REQUIRE_EQUAL(rleCountDiff(&run[0], run.size()), end - 1);
+	}
+}
+
+/// Encode then decode some data, and check it comes back unchanged.
+static void checkRoundTrip(const RLECodec& codec, const std::vector<uint8_t>& data,
+	int omitted)
+{
+	std::vector<uint8_t> enc;
+	codec.encode(&data[0], data.size(), &enc);
+
+	// Anything not written must be the value the reader fills in with
+	std::vector<uint8_t> dec(data.size(), (omitted < 0) ? 0xEE : omitted);
+	unsigned int lenWritten;
+	unsigned int lenUsed = codec.decode(&enc[0], enc.size(), &dec[0],
+		dec.size(), &lenWritten);
+	BOOST_REQUIRE_EQUAL(lenUsed, enc.size());
+	if (omitted < 0) BOOST_REQUIRE_EQUAL(lenWritten, data.size());
+	BOOST_REQUIRE(dec == data);
+	return;
+}
+
+BOOST_AUTO_TEST_CASE(round_trip)
+{
+	BOOST_TEST_MESSAGE("Encoded data decodes back to the original");
+
+	RLECodec_CountValue countValue(0xFF);
+	RLECodec_CountValue countValueShort(3);
+	RLECodec_Signed signedFull(0x80, 0x80, -1);
+	RLECodec_Signed signedNukem2(0x7F, 0x80, 0x00);
+
+	for (unsigned int seed = 0; seed < 50; seed++) {
+		std::vector<uint8_t> data(1 + seed * 37);
+		fillRuns(&data, seed);
+		checkRoundTrip(countValue, data, -1);
+		checkRoundTrip(countValueShort, data, -1);
+		checkRoundTrip(signedFull, data, -1);
+		checkRoundTrip(signedNukem2, data, 0x00);
+	}
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -21,12 +21,72 @@
 #ifndef _CAMOTO_GAMEMAPS_TESTS_HPP_
 #define _CAMOTO_GAMEMAPS_TESTS_HPP_
 
+#include <boost/filesystem.hpp>
 #include <boost/test/unit_test.hpp>
+#include <camoto/stream_string.hpp>
 #include <camoto/util.hpp>
 
 /// Allow a string constant to be passed around with embedded nulls
 #define STRING_WITH_NULLS(x)  std::string((x), sizeof((x)) - 1)
 
+/// Temporary file or folder that is deleted when it goes out of scope.
+/**
+ * This way nothing is left behind when a BOOST_REQUIRE fails part way
+ * through a test.
+ */
+class TempPath
+{
+	public:
+		TempPath(const char *model = "%%%%-%%%%-%%%%-%%%%")
+			:	path(boost::filesystem::temp_directory_path()
+					/ boost::filesystem::unique_path(model))
+		{
+		}
+
+		~TempPath()
+		{
+			boost::system::error_code ec;
+			boost::filesystem::remove_all(this->path, ec);
+		}
+
+		const boost::filesystem::path path; ///< Full path of the file or folder
+};
+
+/// In-memory stream that counts how much is read from and written to it.
+class spy_string: virtual public camoto::stream::string
+{
+	public:
+		spy_string()
+			:	bytesRead(0),
+				bytesWritten(0)
+		{
+		}
+
+		virtual camoto::stream::len try_read(uint8_t *buffer,
+			camoto::stream::len len)
+		{
+			camoto::stream::len r =
+				this->camoto::stream::string::try_read(buffer, len);
+			this->bytesRead += r;
+			return r;
+		}
+
+		virtual camoto::stream::len try_write(const uint8_t *buffer,
+			camoto::stream::len len)
+		{
+			camoto::stream::len w =
+				this->camoto::stream::string::try_write(buffer, len);
+			this->bytesWritten += w;
+			return w;
+		}
+
+		camoto::stream::len bytesRead;    ///< Number of bytes read so far
+		camoto::stream::len bytesWritten; ///< Number of bytes written so far
+};
+
+/// Shared pointer to a spy_string.
+typedef boost::shared_ptr<spy_string> spy_string_sptr;
+
 /// Base class for all tests
 class test_main
 {